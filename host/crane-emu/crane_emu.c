@@ -0,0 +1,384 @@
+#include "crane_emu.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <crane.h>
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <lownet.h>
+
+#include "hostbus.h"
+
+#define TAG "crane-emu"
+
+#define CRANE_PROTO 0x05
+
+#define CRANE_EMU_QUEUE   256 // more than any uint8_t capacity
+
+#define CRANE_EMU_CLOSED  0x01 // event: the client closed the connection
+
+struct crane_emu
+{
+	crane_emu_config_t config;
+	SemaphoreHandle_t lock;
+	EventGroupHandle_t events;
+	TaskHandle_t task;
+
+	enum
+		{
+			EMU_LISTEN,
+			EMU_SYN_RECEIVED,
+			EMU_CONNECTED,
+			EMU_CLOSED,
+		} state;
+	uint8_t client;       // node id of the connected client
+	uint32_t challenge;
+
+	// Receive side: the next sequence number taken, and the one a NAK
+	// was last sent for so a burst of out of order frames costs one NAK.
+	uint16_t expected;
+	uint16_t naked;
+
+	// Action queue and the action being executed
+	uint8_t queue[CRANE_EMU_QUEUE];
+	uint32_t head;
+	uint32_t count;
+	uint8_t executing;    // CRANE_NULL if idle
+	int64_t done_us;      // when the executing action completes
+
+	uint8_t light;
+	int8_t temp;
+
+	int64_t down_until;   // rebooting, deaf and silent until then
+
+	int news;             // something changed since the last STATUS
+	int64_t status_us;    // when the last STATUS was sent
+
+	crane_emu_stats_t stats;
+};
+
+static void crane_emu_send(crane_emu_t* emu, const crane_packet_t* packet)
+{
+	static const uint8_t plain_magic[2] = {0x10, 0x4e};
+	lownet_frame_t frame;
+
+	memset(&frame, 0, sizeof frame);
+	memcpy(frame.magic, plain_magic, sizeof plain_magic);
+	frame.source = emu->config.node;
+	frame.destination = emu->client;
+	frame.protocol = CRANE_PROTO;
+	frame.length = sizeof *packet;
+	memcpy(frame.payload, packet, sizeof *packet);
+	hostbus_send(&frame);
+}
+
+// Usage: crane_emu_status(EMU, FLAGS)
+// Pre:   EMU->lock is held
+// Post:  A STATUS with FLAGS, acknowledging everything taken so far,
+//        has been sent to the client
+static void crane_emu_status(crane_emu_t* emu, uint8_t flags)
+{
+	int64_t now = esp_timer_get_time();
+	int64_t left_ms = (int64_t) emu->count * emu->config.action_ms;
+	if (emu->executing != CRANE_NULL && emu->done_us > now)
+		left_ms += (emu->done_us - now) / 1000;
+
+	crane_packet_t packet;
+	memset(&packet, 0, sizeof packet);
+	packet.type = CRANE_STATUS;
+	packet.flags = flags;
+	packet.seq = emu->expected - 1;
+	packet.d.status.backlog = emu->count + (emu->executing != CRANE_NULL);
+	packet.d.status.time_left = (left_ms + 999) / 1000 > 255 ? 255 : (left_ms + 999) / 1000;
+	packet.d.status.light = emu->light;
+	packet.d.status.temp = emu->temp;
+	crane_emu_send(emu, &packet);
+
+	emu->news = 0;
+	emu->status_us = now;
+	emu->stats.statuses++;
+	if (flags & CRANE_NAK)
+		emu->stats.naks++;
+}
+
+static void crane_emu_connect(crane_emu_t* emu, uint8_t source, const crane_packet_t* packet)
+{
+	crane_packet_t reply;
+
+	if (packet->flags & CRANE_SYN)
+		{
+			// A SYN always starts over, also on a connection the client
+			// has given up on without telling us.
+			if (emu->stats.connected_us == 0)
+				emu->stats.connected_us = esp_timer_get_time();
+			emu->stats.test = (packet->flags & CRANE_TEST) != 0;
+			emu->stats.handshakes++;
+			emu->state = EMU_SYN_RECEIVED;
+			emu->client = source;
+			emu->challenge = esp_random();
+			emu->count = 0;
+			emu->executing = CRANE_NULL;
+			xEventGroupClearBits(emu->events, CRANE_EMU_CLOSED);
+
+			memset(&reply, 0, sizeof reply);
+			reply.type = CRANE_CONNECT;
+			reply.flags = CRANE_SYN | CRANE_ACK | (packet->flags & CRANE_TEST);
+			reply.d.conn.challenge = emu->challenge;
+			crane_emu_send(emu, &reply);
+		}
+	else if ((packet->flags & CRANE_ACK)
+	         && emu->state == EMU_SYN_RECEIVED
+	         && source == emu->client)
+		{
+			if (packet->d.conn.challenge != (uint32_t) ~emu->challenge)
+				{
+					ESP_LOGW(TAG, "Wrong challenge response");
+					return;
+				}
+			emu->state = EMU_CONNECTED;
+			emu->expected = 1;
+			emu->naked = 0;
+			emu->news = 1;
+			ESP_LOGI(TAG, "Connected to 0x%02x%s", source, emu->stats.test ? " (test)" : "");
+		}
+}
+
+static void crane_emu_action(crane_emu_t* emu, const crane_packet_t* packet)
+{
+	emu->stats.received++;
+
+	int16_t distance = (int16_t)(packet->seq - emu->expected);
+	if (distance < 0)
+		{
+			// Already taken; the ACK was lost, so repeat it.
+			emu->stats.duplicates++;
+			emu->news = 1;
+			return;
+		}
+	if (distance > 0)
+		{
+			emu->stats.out_of_order++;
+			if (emu->naked != emu->expected)
+				{
+					emu->naked = emu->expected;
+					crane_emu_status(emu, CRANE_NAK);
+				}
+			return;
+		}
+
+	uint8_t cmd = packet->d.action.cmd;
+	if (cmd == CRANE_STOP)
+		{
+			if (emu->stats.stopped_us == 0)
+				emu->stats.stopped_us = esp_timer_get_time();
+			emu->count = 0;
+			emu->executing = CRANE_NULL;
+			emu->stats.log[emu->stats.log_length++ % CRANE_EMU_LOG_SIZE] = cmd;
+		}
+	else if (cmd != CRANE_NULL)
+		{
+			if (emu->count == emu->config.capacity)
+				{
+					emu->stats.rejected++;
+					if (emu->naked != emu->expected)
+						{
+							emu->naked = emu->expected;
+							crane_emu_status(emu, CRANE_NAK);
+						}
+					return;
+				}
+			emu->queue[(emu->head + emu->count++) % CRANE_EMU_QUEUE] = cmd;
+		}
+
+	emu->expected++;
+	emu->stats.accepted++;
+	emu->news = 1;
+}
+
+static void crane_emu_close(crane_emu_t* emu, uint8_t source, const crane_packet_t* packet)
+{
+	crane_packet_t reply;
+
+	memset(&reply, 0, sizeof reply);
+	reply.type = CRANE_CLOSE;
+	reply.flags = CRANE_ACK;
+	reply.seq = packet->seq;
+	crane_emu_send(emu, &reply);
+
+	if (emu->state == EMU_CLOSED)
+		return;
+
+	emu->state = EMU_CLOSED;
+	emu->stats.closed_us = esp_timer_get_time();
+	xEventGroupSetBits(emu->events, CRANE_EMU_CLOSED);
+	ESP_LOGI(TAG, "Closed by 0x%02x", source);
+}
+
+static void crane_emu_receive(const lownet_frame_t* frame, void* ctx)
+{
+	crane_emu_t* emu = ctx;
+	crane_packet_t packet;
+
+	if ((frame->protocol & 0b00111111) != CRANE_PROTO || frame->length < sizeof packet)
+		return;
+	memcpy(&packet, frame->payload, sizeof packet);
+
+	xSemaphoreTake(emu->lock, portMAX_DELAY);
+	if (esp_timer_get_time() < emu->down_until)
+		{
+			emu->stats.ignored++;
+		}
+	else if (packet.type == CRANE_CONNECT)
+		crane_emu_connect(emu, frame->source, &packet);
+	else if (emu->state == EMU_CONNECTED && frame->source == emu->client)
+		{
+			if (packet.type == CRANE_ACTION)
+				crane_emu_action(emu, &packet);
+			else if (packet.type == CRANE_CLOSE)
+				crane_emu_close(emu, frame->source, &packet);
+		}
+	else if (packet.type == CRANE_CLOSE && frame->source == emu->client)
+		{
+			// Our CLOSE|ACK was lost
+			crane_emu_close(emu, frame->source, &packet);
+		}
+	else
+		{
+			emu->stats.ignored++;
+		}
+	xSemaphoreGive(emu->lock);
+	// Whatever came in may have given the crane something to do.
+	xTaskNotifyGive(emu->task);
+}
+
+// Usage: crane_emu_tick(EMU)
+// Pre:   EMU->lock is held
+// Post:  Execution has advanced to the current time and a STATUS has
+//        been sent if one is due
+// Value: The esp_timer time something is due next, INT64_MAX if nothing
+//        is until a frame comes in
+static int64_t crane_emu_tick(crane_emu_t* emu)
+{
+	int64_t now = esp_timer_get_time();
+
+	// Actions follow each other without a gap, however late we look.
+	int64_t start = now;
+	if (emu->executing != CRANE_NULL && now >= emu->done_us)
+		{
+			start = emu->done_us;
+			if (emu->executing == CRANE_LIGHT_ON || emu->executing == CRANE_LIGHT_OFF)
+				emu->light = emu->executing == CRANE_LIGHT_ON;
+			emu->stats.log[emu->stats.log_length++ % CRANE_EMU_LOG_SIZE] = emu->executing;
+			emu->executing = CRANE_NULL;
+			emu->news = 1;
+		}
+	if (emu->executing == CRANE_NULL && emu->count)
+		{
+			emu->executing = emu->queue[emu->head];
+			emu->head = (emu->head + 1) % CRANE_EMU_QUEUE;
+			emu->count--;
+			emu->done_us = start + (int64_t) emu->config.action_ms * 1000;
+		}
+
+	int64_t next = emu->executing != CRANE_NULL ? emu->done_us : INT64_MAX;
+	if (now < emu->down_until)
+		return emu->down_until < next ? emu->down_until : next;
+	if (emu->state != EMU_CONNECTED)
+		return next;
+
+	int64_t since_ms = (now - emu->status_us) / 1000;
+	if ((emu->news && since_ms >= emu->config.status_ms) || since_ms >= emu->config.idle_ms)
+		{
+			// The motors warm up while running and cool down at rest.
+			if (emu->executing != CRANE_NULL)
+				emu->temp += emu->temp < 60 && esp_random() % 4 == 0;
+			else
+				emu->temp -= emu->temp > 20 && esp_random() % 4 == 0;
+			crane_emu_status(emu, 0);
+		}
+
+	int64_t status = emu->status_us
+		+ (int64_t)(emu->news ? emu->config.status_ms : emu->config.idle_ms) * 1000;
+	return status < next ? status : next;
+}
+
+static void crane_emu_main(void* arg)
+{
+	crane_emu_t* emu = arg;
+
+	while (true)
+		{
+			xSemaphoreTake(emu->lock, portMAX_DELAY);
+			int64_t next = crane_emu_tick(emu);
+			xSemaphoreGive(emu->lock);
+
+			TickType_t wait = portMAX_DELAY;
+			if (next != INT64_MAX)
+				{
+					int64_t us = next - esp_timer_get_time();
+					wait = us > 0 ? (us + 999) / 1000 : 0;
+				}
+			if (wait)
+				ulTaskNotifyTake(pdTRUE, wait);
+		}
+}
+
+crane_emu_t* crane_emu_create(const crane_emu_config_t* config)
+{
+	crane_emu_t* emu = calloc(1, sizeof *emu);
+	if (!emu)
+		return NULL;
+
+	emu->config = *config;
+	if (emu->config.capacity == 0)
+		emu->config.capacity = CRANE_CAPACITY;
+	emu->state = EMU_LISTEN;
+	emu->executing = CRANE_NULL;
+	emu->temp = 20;
+	emu->lock = xSemaphoreCreateMutex();
+	emu->events = xEventGroupCreate();
+	if (!emu->lock || !emu->events
+	    || xTaskCreate(crane_emu_main, "crane_emu", 4096, emu, 5, &emu->task) != pdPASS
+	    || hostbus_attach(emu->config.node, crane_emu_receive, emu))
+		{
+			free(emu);
+			return NULL;
+		}
+	return emu;
+}
+
+int crane_emu_wait_closed(crane_emu_t* emu, uint32_t timeout_ms)
+{
+	EventBits_t bits = xEventGroupWaitBits(emu->events, CRANE_EMU_CLOSED, pdFALSE, pdTRUE,
+	                                       pdMS_TO_TICKS(timeout_ms));
+	return !(bits & CRANE_EMU_CLOSED);
+}
+
+void crane_emu_reboot(crane_emu_t* emu, uint32_t down_ms)
+{
+	xSemaphoreTake(emu->lock, portMAX_DELAY);
+	ESP_LOGI(TAG, "Rebooting for %u ms", down_ms);
+	emu->state = EMU_LISTEN;
+	emu->count = 0;
+	emu->executing = CRANE_NULL;
+	emu->light = 0;
+	emu->down_until = esp_timer_get_time() + (int64_t) down_ms * 1000;
+	emu->stats.reboots++;
+	xSemaphoreGive(emu->lock);
+	xTaskNotifyGive(emu->task);
+}
+
+crane_emu_stats_t crane_emu_stats(crane_emu_t* emu)
+{
+	xSemaphoreTake(emu->lock, portMAX_DELAY);
+	crane_emu_stats_t stats = emu->stats;
+	xSemaphoreGive(emu->lock);
+	return stats;
+}
@@ -0,0 +1,75 @@
+#ifndef GUARD_CRANE_EMU_H
+#define GUARD_CRANE_EMU_H
+
+/*
+ * Host emulator of the crane end of the crane protocol, attached to the
+ * in-process bus.  It answers the handshake, queues and "executes"
+ * actions with a fixed duration each, and reports STATUS at the crane's
+ * cadence: every status_ms while something changed, otherwise every
+ * idle_ms.
+ */
+
+#include <stdint.h>
+
+#define CRANE_EMU_LOG_SIZE 256
+
+typedef struct
+{
+	uint8_t node;       // node id of the emulated crane
+	uint8_t capacity;   // actions the crane queues before NAKing
+	uint32_t action_ms; // time to execute one movement or light action
+	uint32_t status_ms; // STATUS interval while there is news
+	uint32_t idle_ms;   // STATUS interval otherwise
+} crane_emu_config_t;
+
+#define CRANE_EMU_DEFAULTS { 0xEE, 8, 250, 1000, 15000 }
+
+typedef struct
+{
+	int64_t connected_us;  // esp_timer time of the SYN, 0 if none yet
+	int64_t closed_us;     // esp_timer time of the CLOSE, 0 if still open
+	uint8_t test;          // the connection was opened in TEST mode
+	int64_t stopped_us;    // esp_timer time the first STOP was taken, 0 if none
+
+	uint32_t received;     // ACTION frames received
+	uint32_t accepted;     // actions taken in order
+	uint32_t duplicates;   // retransmissions of actions already taken
+	uint32_t out_of_order; // actions ahead of the expected sequence number
+	uint32_t rejected;     // in order actions refused with a full queue
+	uint32_t naks;         // STATUS frames sent with NAK
+	uint32_t statuses;     // STATUS frames sent in total
+	uint32_t ignored;      // frames outside of a connection
+	uint32_t handshakes;   // SYNs answered
+	uint32_t reboots;
+
+	// Actions executed, in order; CRANE_NULL is not recorded
+	uint8_t log[CRANE_EMU_LOG_SIZE];
+	uint32_t log_length;
+} crane_emu_stats_t;
+
+typedef struct crane_emu crane_emu_t;
+
+// Usage: crane_emu_create(CONFIG)
+// Pre:   CONFIG != NULL, hostbus_init has been called
+// Value: A running emulator attached to the bus as CONFIG->node,
+//        NULL if it could not be started
+crane_emu_t* crane_emu_create(const crane_emu_config_t* config);
+
+// Usage: crane_emu_wait_closed(EMU, TIMEOUT_MS)
+// Pre:   EMU != NULL
+// Post:  Blocks until the client closed its connection or TIMEOUT_MS passed
+// Value: 0 if the connection was closed, non-0 on timeout
+int crane_emu_wait_closed(crane_emu_t* emu, uint32_t timeout_ms);
+
+// Usage: crane_emu_reboot(EMU, DOWN_MS)
+// Pre:   EMU != NULL
+// Post:  EMU has lost its connection and queue, and ignores everything
+//        for DOWN_MS before it accepts a new connection
+void crane_emu_reboot(crane_emu_t* emu, uint32_t down_ms);
+
+// Usage: crane_emu_stats(EMU)
+// Pre:   EMU != NULL
+// Value: A snapshot of the counters of EMU
+crane_emu_stats_t crane_emu_stats(crane_emu_t* emu);
+
+#endif
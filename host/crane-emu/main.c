@@ -0,0 +1,171 @@
+/*
+ * crane-bench: runs the unmodified crane client against the emulated
+ * crane over an in-process link with configurable impairments, and
+ * reports how long the test pattern took and what it cost on the wire.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <crane.h>
+#include <dlog.h>
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <lownet.h>
+#include <serial_io.h>
+
+#include "crane_emu.h"
+#include "hostbus.h"
+#include "lownet_host.h"
+
+// The pattern the @test script drives: o 2f b W 2d W 2u b O W
+static const uint8_t test_pattern[] = {
+	CRANE_LIGHT_ON, CRANE_FWD, CRANE_FWD, CRANE_REV,
+	CRANE_DOWN, CRANE_DOWN, CRANE_UP, CRANE_UP, CRANE_REV,
+	CRANE_LIGHT_OFF,
+};
+
+static void usage(const char* name)
+{
+	fprintf(stderr,
+	        "usage: %s [options]\n"
+	        "  -l PERMILLE  frame loss (default 0)\n"
+	        "  -r PERMILLE  frame reordering (default 0)\n"
+	        "  -d MS        one way link delay (default 5)\n"
+	        "  -j MS        link jitter (default 0)\n"
+	        "  -x MS        time the crane takes per action (default 250)\n"
+	        "  -i MS        crane STATUS interval with news (default 1000)\n"
+	        "  -c N         crane queue capacity (default 8)\n"
+	        "  -n N         run /crane bench with N actions instead of the test pattern\n"
+	        "  -a LETTER    bench action (default n, null)\n"
+	        "  -k MS        issue a STOP MS after the start and time it\n"
+	        "  -b MS        reboot the crane MS after the start\n"
+	        "  -B MS        time the crane stays down on reboot (default 2000)\n"
+	        "  -s SEED      random seed (default 1)\n"
+	        "  -t SECONDS   give up after SECONDS (default 60)\n"
+	        "  -v           log protocol traffic\n",
+	        name);
+}
+
+int main(int argc, char** argv)
+{
+	hostbus_link_t link = { .delay_ms = 5 };
+	crane_emu_config_t config = CRANE_EMU_DEFAULTS;
+	uint64_t seed = 1;
+	uint32_t timeout = 60;
+	uint32_t stop_ms = 0;
+	uint32_t bench = 0;
+	const char* action = "n";
+	uint32_t reboot_ms = 0;
+	uint32_t down_ms = 2000;
+	esp_log_level_t level = ESP_LOG_WARN;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "l:r:d:j:x:i:c:n:a:k:b:B:s:t:vh")) != -1)
+		{
+			switch (opt)
+				{
+				case 'l': link.loss = strtoul(optarg, NULL, 0); break;
+				case 'r': link.reorder = strtoul(optarg, NULL, 0); break;
+				case 'd': link.delay_ms = strtoul(optarg, NULL, 0); break;
+				case 'j': link.jitter_ms = strtoul(optarg, NULL, 0); break;
+				case 'x': config.action_ms = strtoul(optarg, NULL, 0); break;
+				case 'i': config.status_ms = strtoul(optarg, NULL, 0); break;
+				case 'c': config.capacity = strtoul(optarg, NULL, 0); break;
+				case 'n': bench = strtoul(optarg, NULL, 0); break;
+				case 'a': action = optarg; break;
+				case 'b': reboot_ms = strtoul(optarg, NULL, 0); break;
+				case 'B': down_ms = strtoul(optarg, NULL, 0); break;
+				case 'k': stop_ms = strtoul(optarg, NULL, 0); break;
+				case 's': seed = strtoull(optarg, NULL, 0); break;
+				case 't': timeout = strtoul(optarg, NULL, 0); break;
+				case 'v': level = ESP_LOG_INFO; break;
+				default:
+					usage(argv[0]);
+					return 2;
+				}
+		}
+
+	esp_log_level_set("*", level);
+	dlog_level = level;
+	esp_random_seed(seed);
+	hostbus_init(&link);
+
+	crane_emu_t* emu = crane_emu_create(&config);
+	if (!emu)
+		{
+			fprintf(stderr, "Failed to start the crane emulator\n");
+			return 1;
+		}
+
+	init_serial_service();
+	lownet_init(NULL, NULL);
+	if (crane_init() != 0)
+		return 1;
+
+	// The crane CLI tokenizes in place, so hand it a writable string.
+	char command[MSG_BUFFER_LENGTH];
+	if (bench)
+		snprintf(command, sizeof command, "bench 0x%02x %u %s", config.node, bench, action);
+	else
+		snprintf(command, sizeof command, "test 0x%02x", config.node);
+	crane_command(command);
+
+	if (reboot_ms)
+		{
+			vTaskDelay(pdMS_TO_TICKS(reboot_ms));
+			crane_emu_reboot(emu, down_ms);
+		}
+
+	int64_t stop_us = 0;
+	if (stop_ms)
+		{
+			vTaskDelay(pdMS_TO_TICKS(stop_ms));
+			snprintf(command, sizeof command, "s 0x%02x", config.node);
+			stop_us = esp_timer_get_time();
+			crane_command(command);
+		}
+
+	int timed_out = crane_emu_wait_closed(emu, timeout * 1000);
+	crane_emu_stats_t stats = crane_emu_stats(emu);
+	hostbus_stats_t bus = hostbus_stats();
+
+	double seconds = ((timed_out ? esp_timer_get_time() : stats.closed_us) - stats.connected_us) / 1e6;
+	int pattern = stats.log_length == sizeof test_pattern
+		&& memcmp(stats.log, test_pattern, sizeof test_pattern) == 0;
+
+	printf("link:        loss %u/1000 reorder %u/1000 delay %u+%u ms\n",
+	       link.loss, link.reorder, link.delay_ms, link.jitter_ms);
+	printf("crane:       %u ms per action, STATUS every %u ms, capacity %u\n",
+	       config.action_ms, config.status_ms, config.capacity);
+	printf("completion:  %s in %.3f s\n", timed_out ? "TIMEOUT" : "closed", seconds);
+	printf("actions:     %u executed, %.2f actions/s\n",
+	       stats.log_length, seconds > 0 ? stats.log_length / seconds : 0.0);
+	if (stop_ms && !bench)
+		{
+			if (stats.stopped_us)
+				printf("stop:        reached the crane after %.1f ms\n",
+				       (stats.stopped_us - stop_us) / 1e3);
+			else
+				printf("stop:        never reached the crane\n");
+		}
+	else if (!bench)
+		{
+			printf("pattern:     %s\n", pattern ? "ok" : "MISMATCH");
+		}
+	printf("received:    %u actions, %u accepted, %u duplicate, %u out of order, %u refused\n",
+	       stats.received, stats.accepted, stats.duplicates, stats.out_of_order, stats.rejected);
+	printf("status:      %u sent, %u NAK, %u frames ignored\n",
+	       stats.statuses, stats.naks, stats.ignored);
+	printf("handshakes:  %u, %u reboots\n", stats.handshakes, stats.reboots);
+	printf("frames:      %u sent, %u lost, %u reordered\n", bus.sent, bus.lost, bus.reordered);
+
+	if (bench || timed_out)
+		return timed_out;
+	return stop_ms ? !stats.stopped_us : !pattern;
+}
@@ -0,0 +1,75 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+
+/*
+ * esp_random, xorshift64* behind a lock
+ */
+
+static pthread_mutex_t host_random_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t host_random_state = 0x853c49e6748fea9bULL;
+
+void esp_random_seed(uint64_t seed)
+{
+	pthread_mutex_lock(&host_random_lock);
+	host_random_state = seed ? seed : 0x853c49e6748fea9bULL;
+	pthread_mutex_unlock(&host_random_lock);
+}
+
+uint32_t esp_random(void)
+{
+	pthread_mutex_lock(&host_random_lock);
+	uint64_t x = host_random_state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	host_random_state = x;
+	pthread_mutex_unlock(&host_random_lock);
+	return (uint32_t)((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+void esp_fill_random(void* buffer, size_t length)
+{
+	uint8_t* bytes = buffer;
+	while (length)
+		{
+			uint32_t r = esp_random();
+			size_t n = length < sizeof r ? length : sizeof r;
+			memcpy(bytes, &r, n);
+			bytes += n;
+			length -= n;
+		}
+}
+
+/*
+ * esp_log
+ */
+
+static esp_log_level_t host_log_level = ESP_LOG_INFO;
+
+void esp_log_level_set(const char* tag, esp_log_level_t level)
+{
+	if (strcmp(tag, "*") == 0)
+		host_log_level = level;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+	return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...)
+{
+	if (level > host_log_level)
+		return;
+
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
@@ -0,0 +1,40 @@
+#ifndef GUARD_HOST_ESP_LOG_H
+#define GUARD_HOST_ESP_LOG_H
+
+#include <stdint.h>
+
+typedef enum
+{
+	ESP_LOG_NONE,
+	ESP_LOG_ERROR,
+	ESP_LOG_WARN,
+	ESP_LOG_INFO,
+	ESP_LOG_DEBUG,
+	ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+// Only the global level ("*") is supported on the host.
+void esp_log_level_set(const char* tag, esp_log_level_t level);
+
+// As on the target, writes FORMAT as is if LEVEL passes the filter; the
+// ESP_LOGx macros add the level letter, time stamp and tag.
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...)
+	__attribute__((format(printf, 3, 4)));
+
+uint32_t esp_log_timestamp(void);
+
+#define ESP_LOG_LEVEL_LOCAL(level, tag, format, ...) \
+	esp_log_write((level), (tag), "%c (%lu) %s: " format "\n", "NEWIDV"[level], \
+	              (unsigned long) esp_log_timestamp(), (tag), ##__VA_ARGS__)
+
+#define ESP_LOGE(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_ERROR,   tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_WARN,    tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_INFO,    tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_DEBUG,   tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+#define ESP_EARLY_LOGE ESP_LOGE
+#define ESP_EARLY_LOGW ESP_LOGW
+#define ESP_EARLY_LOGI ESP_LOGI
+
+#endif
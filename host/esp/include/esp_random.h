@@ -0,0 +1,13 @@
+#ifndef GUARD_HOST_ESP_RANDOM_H
+#define GUARD_HOST_ESP_RANDOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Deterministic on the host: the sequence depends only on the seed.
+void esp_random_seed(uint64_t seed);
+
+uint32_t esp_random(void);
+void esp_fill_random(void* buffer, size_t length);
+
+#endif
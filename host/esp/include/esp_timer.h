@@ -0,0 +1,11 @@
+#ifndef GUARD_HOST_ESP_TIMER_H
+#define GUARD_HOST_ESP_TIMER_H
+
+#include <stdint.h>
+
+// Usage: esp_timer_get_time()
+// Value: Microseconds since the process started, on the clock of the
+//        FreeRTOS port: CLOCK_MONOTONIC, or virtual time in the simulator
+int64_t esp_timer_get_time(void);
+
+#endif
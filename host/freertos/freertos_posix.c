@@ -0,0 +1,714 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+
+#include "esp_timer.h"
+
+/*
+ * Time.  esp_timer counts microseconds of CLOCK_MONOTONIC since the
+ * first call into the port, ticks are its milliseconds.
+ */
+
+static int64_t port_now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t port_epoch_us;
+static pthread_once_t port_epoch_once = PTHREAD_ONCE_INIT;
+
+static void port_epoch_init(void)
+{
+	port_epoch_us = port_now_us();
+}
+
+int64_t esp_timer_get_time(void)
+{
+	pthread_once(&port_epoch_once, port_epoch_init);
+	return port_now_us() - port_epoch_us;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return (TickType_t)(esp_timer_get_time() / 1000);
+}
+
+// Usage: port_deadline(TS, TICKS)
+// Pre:   TS != NULL, TICKS != portMAX_DELAY
+// Post:  TS holds the CLOCK_MONOTONIC time TICKS from now
+static void port_deadline(struct timespec* ts, TickType_t ticks)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	ts->tv_sec += ticks / 1000;
+	ts->tv_nsec += (long)(ticks % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000)
+		{
+			ts->tv_sec++;
+			ts->tv_nsec -= 1000000000;
+		}
+}
+
+static void port_cond_init(pthread_cond_t* cond)
+{
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+// Usage: port_wait(COND, MUTEX, DEADLINE)
+// Pre:   MUTEX is held, DEADLINE is NULL for no timeout
+// Value: 0 if woken, ETIMEDOUT if DEADLINE passed
+static int port_wait(pthread_cond_t* cond, pthread_mutex_t* mutex, const struct timespec* deadline)
+{
+	if (!deadline)
+		return pthread_cond_wait(cond, mutex);
+	return pthread_cond_timedwait(cond, mutex, deadline);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	struct timespec ts = { ticks / 1000, (long)(ticks % 1000) * 1000000 };
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		;
+}
+
+void vTaskDelayUntil(TickType_t* previous, TickType_t increment)
+{
+	*previous += increment;
+	TickType_t now = xTaskGetTickCount();
+	if ((int32_t)(*previous - now) > 0)
+		vTaskDelay(*previous - now);
+}
+
+/*
+ * Critical sections
+ */
+
+static pthread_mutex_t port_critical = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+void vPortEnterCritical(portMUX_TYPE* mux)
+{
+	pthread_mutex_lock(&port_critical);
+}
+
+void vPortExitCritical(portMUX_TYPE* mux)
+{
+	pthread_mutex_unlock(&port_critical);
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+	return 0;
+}
+
+/*
+ * Queues and semaphores
+ */
+
+struct QueueDefinition
+{
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	uint8_t* items;
+	UBaseType_t length;
+	UBaseType_t item_size;
+	UBaseType_t head;
+	UBaseType_t count;
+};
+
+static QueueHandle_t port_queue_create(UBaseType_t length, UBaseType_t item_size, UBaseType_t count)
+{
+	QueueHandle_t queue = calloc(1, sizeof *queue);
+	if (!queue)
+		return NULL;
+	if (item_size && !(queue->items = calloc(length, item_size)))
+		{
+			free(queue);
+			return NULL;
+		}
+	pthread_mutex_init(&queue->lock, NULL);
+	port_cond_init(&queue->not_empty);
+	port_cond_init(&queue->not_full);
+	queue->length = length;
+	queue->item_size = item_size;
+	queue->count = count;
+	return queue;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+	return port_queue_create(length, item_size, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	return port_queue_create(1, 0, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	return port_queue_create(1, 0, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+	return port_queue_create(max, 0, initial);
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->not_empty);
+	pthread_cond_destroy(&queue->not_full);
+	free(queue->items);
+	free(queue);
+}
+
+static BaseType_t port_queue_send(QueueHandle_t queue, const void* item, TickType_t wait, int front, int overwrite)
+{
+	struct timespec deadline;
+	if (wait != portMAX_DELAY)
+		port_deadline(&deadline, wait);
+
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == queue->length && !overwrite)
+		{
+			if (wait == 0
+			    || port_wait(&queue->not_full, &queue->lock,
+			                 wait == portMAX_DELAY ? NULL : &deadline) == ETIMEDOUT)
+				{
+					pthread_mutex_unlock(&queue->lock);
+					return pdFALSE;
+				}
+		}
+
+	UBaseType_t slot;
+	if (overwrite && queue->count == queue->length)
+		{
+			slot = (queue->head + queue->count - 1) % queue->length;
+		}
+	else if (front)
+		{
+			queue->head = (queue->head + queue->length - 1) % queue->length;
+			slot = queue->head;
+			queue->count++;
+		}
+	else
+		{
+			slot = (queue->head + queue->count) % queue->length;
+			queue->count++;
+		}
+	if (queue->item_size)
+		memcpy(queue->items + slot * queue->item_size, item, queue->item_size);
+
+	pthread_cond_signal(&queue->not_empty);
+	pthread_mutex_unlock(&queue->lock);
+	return pdTRUE;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void* item, TickType_t wait)
+{
+	return port_queue_send(queue, item, wait, 0, 0);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t wait)
+{
+	return port_queue_send(queue, item, wait, 1, 0);
+}
+
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void* item)
+{
+	return port_queue_send(queue, item, 0, 0, 1);
+}
+
+static BaseType_t port_queue_receive(QueueHandle_t queue, void* item, TickType_t wait, int peek)
+{
+	struct timespec deadline;
+	if (wait != portMAX_DELAY)
+		port_deadline(&deadline, wait);
+
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == 0)
+		{
+			if (wait == 0
+			    || port_wait(&queue->not_empty, &queue->lock,
+			                 wait == portMAX_DELAY ? NULL : &deadline) == ETIMEDOUT)
+				{
+					pthread_mutex_unlock(&queue->lock);
+					return pdFALSE;
+				}
+		}
+
+	if (queue->item_size && item)
+		memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+	if (!peek)
+		{
+			queue->head = (queue->head + 1) % queue->length;
+			queue->count--;
+			pthread_cond_signal(&queue->not_full);
+		}
+	pthread_mutex_unlock(&queue->lock);
+	return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t wait)
+{
+	return port_queue_receive(queue, item, wait, 0);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void* item, TickType_t wait)
+{
+	return port_queue_receive(queue, item, wait, 1);
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+	pthread_mutex_lock(&queue->lock);
+	queue->head = 0;
+	queue->count = 0;
+	pthread_cond_broadcast(&queue->not_full);
+	pthread_mutex_unlock(&queue->lock);
+	return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+	pthread_mutex_lock(&queue->lock);
+	UBaseType_t count = queue->count;
+	pthread_mutex_unlock(&queue->lock);
+	return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+	pthread_mutex_lock(&queue->lock);
+	UBaseType_t spaces = queue->length - queue->count;
+	pthread_mutex_unlock(&queue->lock);
+	return spaces;
+}
+
+/*
+ * Tasks
+ */
+
+struct TaskDefinition
+{
+	pthread_t thread;
+	TaskFunction_t fn;
+	void* param;
+	char name[16];
+
+	pthread_mutex_t lock;
+	pthread_cond_t notified;
+	uint32_t value;
+	int pending;
+};
+
+static __thread TaskHandle_t port_current = NULL;
+
+static TaskHandle_t port_task_alloc(const char* name)
+{
+	TaskHandle_t task = calloc(1, sizeof *task);
+	if (!task)
+		return NULL;
+	strncpy(task->name, name ? name : "", sizeof task->name - 1);
+	pthread_mutex_init(&task->lock, NULL);
+	port_cond_init(&task->notified);
+	return task;
+}
+
+static void* port_task_main(void* arg)
+{
+	TaskHandle_t task = arg;
+	port_current = task;
+	task->fn(task->param);
+	return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack,
+                                   void* param, UBaseType_t prio, TaskHandle_t* handle,
+                                   BaseType_t core)
+{
+	TaskHandle_t task = port_task_alloc(name);
+	if (!task)
+		return pdFAIL;
+	task->fn = fn;
+	task->param = param;
+	if (handle)
+		*handle = task;
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	int error = pthread_create(&task->thread, &attr, port_task_main, task);
+	pthread_attr_destroy(&attr);
+	if (error)
+		{
+			free(task);
+			return pdFAIL;
+		}
+	pthread_setname_np(task->thread, task->name);
+	return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack,
+                       void* param, UBaseType_t prio, TaskHandle_t* handle)
+{
+	return xTaskCreatePinnedToCore(fn, name, stack, param, prio, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+	if (!task || task == port_current)
+		pthread_exit(NULL);
+	pthread_cancel(task->thread);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	// Threads not created through xTaskCreate (main) get a handle on
+	// first use so they can take part in notifications.
+	if (!port_current)
+		{
+			port_current = port_task_alloc("main");
+			port_current->thread = pthread_self();
+		}
+	return port_current;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+	BaseType_t result = pdPASS;
+
+	pthread_mutex_lock(&task->lock);
+	switch (action)
+		{
+		case eNoAction:
+			break;
+		case eSetBits:
+			task->value |= value;
+			break;
+		case eIncrement:
+			task->value++;
+			break;
+		case eSetValueWithOverwrite:
+			task->value = value;
+			break;
+		case eSetValueWithoutOverwrite:
+			if (task->pending)
+				result = pdFAIL;
+			else
+				task->value = value;
+			break;
+		}
+	task->pending = 1;
+	pthread_cond_signal(&task->notified);
+	pthread_mutex_unlock(&task->lock);
+	return result;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit,
+                           uint32_t* value, TickType_t wait)
+{
+	TaskHandle_t task = xTaskGetCurrentTaskHandle();
+	struct timespec deadline;
+	if (wait != portMAX_DELAY)
+		port_deadline(&deadline, wait);
+
+	pthread_mutex_lock(&task->lock);
+	if (!task->pending)
+		task->value &= ~clear_on_entry;
+	while (!task->pending)
+		{
+			if (wait == 0
+			    || port_wait(&task->notified, &task->lock,
+			                 wait == portMAX_DELAY ? NULL : &deadline) == ETIMEDOUT)
+				{
+					if (value)
+						*value = task->value;
+					pthread_mutex_unlock(&task->lock);
+					return pdFALSE;
+				}
+		}
+	if (value)
+		*value = task->value;
+	task->value &= ~clear_on_exit;
+	task->pending = 0;
+	pthread_mutex_unlock(&task->lock);
+	return pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t wait)
+{
+	TaskHandle_t task = xTaskGetCurrentTaskHandle();
+	struct timespec deadline;
+	if (wait != portMAX_DELAY)
+		port_deadline(&deadline, wait);
+
+	pthread_mutex_lock(&task->lock);
+	while (task->value == 0)
+		{
+			if (wait == 0
+			    || port_wait(&task->notified, &task->lock,
+			                 wait == portMAX_DELAY ? NULL : &deadline) == ETIMEDOUT)
+				break;
+		}
+	uint32_t value = task->value;
+	if (value)
+		task->value = clear_on_exit ? 0 : value - 1;
+	task->pending = 0;
+	pthread_mutex_unlock(&task->lock);
+	return value;
+}
+
+/*
+ * Event groups
+ */
+
+struct EventGroupDefinition
+{
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+	EventGroupHandle_t group = calloc(1, sizeof *group);
+	if (!group)
+		return NULL;
+	pthread_mutex_init(&group->lock, NULL);
+	port_cond_init(&group->changed);
+	return group;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+	pthread_mutex_destroy(&group->lock);
+	pthread_cond_destroy(&group->changed);
+	free(group);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+	pthread_mutex_lock(&group->lock);
+	group->bits |= bits;
+	EventBits_t result = group->bits;
+	pthread_cond_broadcast(&group->changed);
+	pthread_mutex_unlock(&group->lock);
+	return result;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+	pthread_mutex_lock(&group->lock);
+	EventBits_t result = group->bits;
+	group->bits &= ~bits;
+	pthread_mutex_unlock(&group->lock);
+	return result;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+	pthread_mutex_lock(&group->lock);
+	EventBits_t result = group->bits;
+	pthread_mutex_unlock(&group->lock);
+	return result;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+                                BaseType_t clear_on_exit, BaseType_t wait_for_all,
+                                TickType_t wait)
+{
+	struct timespec deadline;
+	if (wait != portMAX_DELAY)
+		port_deadline(&deadline, wait);
+
+	pthread_mutex_lock(&group->lock);
+	while (true)
+		{
+			EventBits_t set = group->bits & bits;
+			if (wait_for_all ? set == bits : set != 0)
+				{
+					EventBits_t result = group->bits;
+					if (clear_on_exit)
+						group->bits &= ~bits;
+					pthread_mutex_unlock(&group->lock);
+					return result;
+				}
+			if (wait == 0
+			    || port_wait(&group->changed, &group->lock,
+			                 wait == portMAX_DELAY ? NULL : &deadline) == ETIMEDOUT)
+				break;
+		}
+	EventBits_t result = group->bits;
+	pthread_mutex_unlock(&group->lock);
+	return result;
+}
+
+/*
+ * Software timers, served by one thread in expiry order
+ */
+
+struct TimerDefinition
+{
+	TimerCallbackFunction_t callback;
+	void* id;
+	TickType_t period;
+	int auto_reload;
+	int active;
+	int64_t expiry;
+	struct TimerDefinition* next;
+};
+
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	pthread_once_t once;
+	struct TimerDefinition* timers;
+} port_timers = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	PTHREAD_ONCE_INIT,
+	NULL,
+};
+
+static void* port_timer_service(void* arg)
+{
+	pthread_mutex_lock(&port_timers.lock);
+	while (true)
+		{
+			struct TimerDefinition* next = NULL;
+			for (struct TimerDefinition* t = port_timers.timers; t; t = t->next)
+				if (t->active && (!next || t->expiry < next->expiry))
+					next = t;
+
+			if (!next)
+				{
+					pthread_cond_wait(&port_timers.changed, &port_timers.lock);
+					continue;
+				}
+
+			int64_t now = xTaskGetTickCount();
+			if (next->expiry > now)
+				{
+					struct timespec deadline;
+					port_deadline(&deadline, (TickType_t)(next->expiry - now));
+					pthread_cond_timedwait(&port_timers.changed, &port_timers.lock, &deadline);
+					continue;
+				}
+
+			if (next->auto_reload)
+				next->expiry += next->period;
+			else
+				next->active = 0;
+
+			pthread_mutex_unlock(&port_timers.lock);
+			next->callback(next);
+			pthread_mutex_lock(&port_timers.lock);
+		}
+	return NULL;
+}
+
+static void port_timers_start(void)
+{
+	pthread_t thread;
+	port_cond_init(&port_timers.changed);
+	pthread_create(&thread, NULL, port_timer_service, NULL);
+	pthread_setname_np(thread, "timer_service");
+	pthread_detach(thread);
+}
+
+TimerHandle_t xTimerCreate(const char* name, TickType_t period, BaseType_t auto_reload,
+                           void* id, TimerCallbackFunction_t callback)
+{
+	pthread_once(&port_timers.once, port_timers_start);
+
+	TimerHandle_t timer = calloc(1, sizeof *timer);
+	if (!timer)
+		return NULL;
+	timer->callback = callback;
+	timer->id = id;
+	timer->period = period;
+	timer->auto_reload = auto_reload;
+
+	pthread_mutex_lock(&port_timers.lock);
+	timer->next = port_timers.timers;
+	port_timers.timers = timer;
+	pthread_mutex_unlock(&port_timers.lock);
+	return timer;
+}
+
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t wait)
+{
+	pthread_mutex_lock(&port_timers.lock);
+	for (struct TimerDefinition** t = &port_timers.timers; *t; t = &(*t)->next)
+		if (*t == timer)
+			{
+				*t = timer->next;
+				break;
+			}
+	pthread_mutex_unlock(&port_timers.lock);
+	free(timer);
+	return pdPASS;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait)
+{
+	pthread_mutex_lock(&port_timers.lock);
+	timer->active = 1;
+	timer->expiry = (int64_t) xTaskGetTickCount() + timer->period;
+	pthread_cond_signal(&port_timers.changed);
+	pthread_mutex_unlock(&port_timers.lock);
+	return pdPASS;
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t wait)
+{
+	return xTimerStart(timer, wait);
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait)
+{
+	pthread_mutex_lock(&port_timers.lock);
+	timer->active = 0;
+	pthread_mutex_unlock(&port_timers.lock);
+	return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait)
+{
+	pthread_mutex_lock(&port_timers.lock);
+	timer->period = period;
+	pthread_mutex_unlock(&port_timers.lock);
+	return xTimerStart(timer, wait);
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer)
+{
+	pthread_mutex_lock(&port_timers.lock);
+	BaseType_t active = timer->active;
+	pthread_mutex_unlock(&port_timers.lock);
+	return active;
+}
+
+void* pvTimerGetTimerID(TimerHandle_t timer)
+{
+	return timer->id;
+}
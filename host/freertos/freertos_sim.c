@@ -0,0 +1,776 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+
+#include "esp_timer.h"
+
+/*
+ * The FreeRTOS API on a virtual clock, for deterministic simulation.
+ * Tasks are threads, but only one of them runs at a time: the running
+ * task holds sim.lock and hands it on when it blocks.  Time stands still
+ * while a task runs and jumps to the earliest deadline once every task
+ * is blocked, so a run takes as long as its code does, not as long as
+ * its timeouts, and what happens in it depends on nothing but the seed.
+ *
+ * Scheduling is cooperative and in FIFO order; priorities and cores are
+ * ignored.  Code must block to let time pass: a task polling the clock
+ * in a loop never sees it move.  Only tasks and the thread that made the
+ * first call into the port may use the API.
+ */
+
+#define SIM_NEVER INT64_MAX
+
+typedef enum
+{
+	SIM_READY,
+	SIM_RUNNING,
+	SIM_BLOCKED,
+	SIM_DELETED,
+} sim_state_t;
+
+struct TaskDefinition
+{
+	pthread_t thread;
+	pthread_cond_t turn;  // signalled when the task is to run
+	TaskFunction_t fn;
+	void* param;
+	char name[16];
+
+	sim_state_t state;
+	const void* object;   // what a blocked task waits for, NULL for time only
+	int64_t deadline;     // virtual time the wait ends, SIM_NEVER for none
+	uint64_t since;       // blocking order, breaks ties between deadlines
+	int woken;            // the wait ended through OBJECT, not the deadline
+
+	struct TaskDefinition* next;       // all live tasks
+	struct TaskDefinition* next_ready;
+
+	uint32_t value;
+	int pending;
+};
+
+static struct
+{
+	pthread_mutex_t lock;
+	int64_t now;          // virtual microseconds
+	uint64_t order;
+
+	TaskHandle_t tasks;
+	TaskHandle_t current;
+	TaskHandle_t ready_head;
+	TaskHandle_t ready_tail;
+} sim = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread TaskHandle_t sim_self = NULL;
+
+static TaskHandle_t sim_task_alloc(const char* name)
+{
+	TaskHandle_t task = calloc(1, sizeof *task);
+	if (!task)
+		return NULL;
+	strncpy(task->name, name ? name : "", sizeof task->name - 1);
+	pthread_cond_init(&task->turn, NULL);
+	task->next = sim.tasks;
+	sim.tasks = task;
+	return task;
+}
+
+// Usage: sim_enter()
+// Post:  The calling thread is a task and holds sim.lock.  The first
+//        thread to call in becomes the running task.
+// Value: The calling task
+static TaskHandle_t sim_enter(void)
+{
+	if (sim_self)
+		return sim_self;
+
+	pthread_mutex_lock(&sim.lock);
+	sim_self = sim_task_alloc("main");
+	sim_self->thread = pthread_self();
+	sim_self->state = SIM_RUNNING;
+	if (sim.current)
+		{
+			fprintf(stderr, "sim: foreign thread called into the port\n");
+			abort();
+		}
+	sim.current = sim_self;
+	return sim_self;
+}
+
+static void sim_ready(TaskHandle_t task)
+{
+	task->state = SIM_READY;
+	task->next_ready = NULL;
+	if (sim.ready_tail)
+		sim.ready_tail->next_ready = task;
+	else
+		sim.ready_head = task;
+	sim.ready_tail = task;
+}
+
+static TaskHandle_t sim_pop_ready(void)
+{
+	TaskHandle_t task = sim.ready_head;
+	if (task)
+		{
+			sim.ready_head = task->next_ready;
+			if (!sim.ready_head)
+				sim.ready_tail = NULL;
+		}
+	return task;
+}
+
+// Usage: sim_dispatch(SELF)
+// Pre:   SELF is the running task and has left SIM_RUNNING
+// Post:  SELF runs again, unless it was deleted.  If no task was
+//        ready, time has advanced to the deadline that made one ready.
+static void sim_dispatch(TaskHandle_t self)
+{
+	TaskHandle_t next;
+	while (!(next = sim_pop_ready()))
+		{
+			TaskHandle_t first = NULL;
+			for (TaskHandle_t t = sim.tasks; t; t = t->next)
+				if (t->state == SIM_BLOCKED && t->deadline != SIM_NEVER
+				    && (!first || t->deadline < first->deadline
+				        || (t->deadline == first->deadline && t->since < first->since)))
+					first = t;
+			if (!first)
+				{
+					fprintf(stderr, "sim: every task is blocked for good at %.6f s\n", sim.now / 1e6);
+					exit(3);
+				}
+			if (first->deadline > sim.now)
+				sim.now = first->deadline;
+			first->woken = 0;
+			sim_ready(first);
+		}
+
+	next->state = SIM_RUNNING;
+	if (next == self)
+		return;
+	sim.current = next;
+	pthread_cond_signal(&next->turn);
+	if (self->state == SIM_DELETED)
+		return;
+	while (sim.current != self)
+		pthread_cond_wait(&self->turn, &sim.lock);
+}
+
+// Usage: sim_block(OBJECT, DEADLINE)
+// Post:  The calling task has waited for sim_wake(OBJECT) or until the
+//        virtual time DEADLINE
+// Value: non-0 if woken through OBJECT
+static int sim_block(const void* object, int64_t deadline)
+{
+	TaskHandle_t self = sim_enter();
+	self->state = SIM_BLOCKED;
+	self->object = object;
+	self->deadline = deadline;
+	self->since = sim.order++;
+	sim_dispatch(self);
+	self->object = NULL;
+	return self->woken;
+}
+
+// Post:  The tasks waiting for OBJECT are ready, in the order they blocked
+static void sim_wake(const void* object)
+{
+	while (true)
+		{
+			TaskHandle_t first = NULL;
+			for (TaskHandle_t t = sim.tasks; t; t = t->next)
+				if (t->state == SIM_BLOCKED && t->object == object && object
+				    && (!first || t->since < first->since))
+					first = t;
+			if (!first)
+				return;
+			first->woken = 1;
+			sim_ready(first);
+		}
+}
+
+static int64_t sim_deadline(TickType_t wait)
+{
+	return wait == portMAX_DELAY ? SIM_NEVER : sim.now + (int64_t) wait * 1000;
+}
+
+/*
+ * Time
+ */
+
+int64_t esp_timer_get_time(void)
+{
+	sim_enter();
+	return sim.now;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	sim_enter();
+	return (TickType_t)(sim.now / 1000);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	TaskHandle_t self = sim_enter();
+	if (ticks == 0)
+		{
+			sim_ready(self);
+			sim_dispatch(self);
+			return;
+		}
+	sim_block(NULL, sim_deadline(ticks));
+}
+
+void vTaskDelayUntil(TickType_t* previous, TickType_t increment)
+{
+	*previous += increment;
+	TickType_t now = xTaskGetTickCount();
+	if ((int32_t)(*previous - now) > 0)
+		vTaskDelay(*previous - now);
+}
+
+/*
+ * Critical sections: the running task is alone anyway
+ */
+
+void vPortEnterCritical(portMUX_TYPE* mux)
+{
+}
+
+void vPortExitCritical(portMUX_TYPE* mux)
+{
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+	return 0;
+}
+
+/*
+ * Queues and semaphores
+ */
+
+struct QueueDefinition
+{
+	uint8_t* items;
+	UBaseType_t length;
+	UBaseType_t item_size;
+	UBaseType_t head;
+	UBaseType_t count;
+};
+
+static QueueHandle_t sim_queue_create(UBaseType_t length, UBaseType_t item_size, UBaseType_t count)
+{
+	sim_enter();
+	QueueHandle_t queue = calloc(1, sizeof *queue);
+	if (!queue)
+		return NULL;
+	if (item_size && !(queue->items = calloc(length, item_size)))
+		{
+			free(queue);
+			return NULL;
+		}
+	queue->length = length;
+	queue->item_size = item_size;
+	queue->count = count;
+	return queue;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+	return sim_queue_create(length, item_size, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	return sim_queue_create(1, 0, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	return sim_queue_create(1, 0, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+	return sim_queue_create(max, 0, initial);
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+	free(queue->items);
+	free(queue);
+}
+
+static BaseType_t sim_queue_send(QueueHandle_t queue, const void* item, TickType_t wait, int front, int overwrite)
+{
+	sim_enter();
+	int64_t deadline = sim_deadline(wait);
+	while (queue->count == queue->length && !overwrite)
+		{
+			if (wait == 0 || sim.now >= deadline)
+				return pdFALSE;
+			sim_block(queue, deadline);
+		}
+
+	UBaseType_t slot;
+	if (overwrite && queue->count == queue->length)
+		{
+			slot = (queue->head + queue->count - 1) % queue->length;
+		}
+	else if (front)
+		{
+			queue->head = (queue->head + queue->length - 1) % queue->length;
+			slot = queue->head;
+			queue->count++;
+		}
+	else
+		{
+			slot = (queue->head + queue->count) % queue->length;
+			queue->count++;
+		}
+	if (queue->item_size)
+		memcpy(queue->items + slot * queue->item_size, item, queue->item_size);
+
+	sim_wake(queue);
+	return pdTRUE;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void* item, TickType_t wait)
+{
+	return sim_queue_send(queue, item, wait, 0, 0);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t wait)
+{
+	return sim_queue_send(queue, item, wait, 1, 0);
+}
+
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void* item)
+{
+	return sim_queue_send(queue, item, 0, 0, 1);
+}
+
+static BaseType_t sim_queue_receive(QueueHandle_t queue, void* item, TickType_t wait, int peek)
+{
+	sim_enter();
+	int64_t deadline = sim_deadline(wait);
+	while (queue->count == 0)
+		{
+			if (wait == 0 || sim.now >= deadline)
+				return pdFALSE;
+			sim_block(queue, deadline);
+		}
+
+	if (queue->item_size && item)
+		memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+	if (!peek)
+		{
+			queue->head = (queue->head + 1) % queue->length;
+			queue->count--;
+			sim_wake(queue);
+		}
+	return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t wait)
+{
+	return sim_queue_receive(queue, item, wait, 0);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void* item, TickType_t wait)
+{
+	return sim_queue_receive(queue, item, wait, 1);
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+	sim_enter();
+	queue->head = 0;
+	queue->count = 0;
+	sim_wake(queue);
+	return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+	return queue->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+	return queue->length - queue->count;
+}
+
+/*
+ * Tasks
+ */
+
+static void* sim_task_main(void* arg)
+{
+	TaskHandle_t task = arg;
+	sim_self = task;
+
+	pthread_mutex_lock(&sim.lock);
+	while (sim.current != task)
+		pthread_cond_wait(&task->turn, &sim.lock);
+	task->fn(task->param);
+	vTaskDelete(NULL);
+	return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack,
+                                   void* param, UBaseType_t prio, TaskHandle_t* handle,
+                                   BaseType_t core)
+{
+	sim_enter();
+	TaskHandle_t task = sim_task_alloc(name);
+	if (!task)
+		return pdFAIL;
+	task->fn = fn;
+	task->param = param;
+	task->state = SIM_BLOCKED;
+	task->deadline = SIM_NEVER;
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	int error = pthread_create(&task->thread, &attr, sim_task_main, task);
+	pthread_attr_destroy(&attr);
+	if (error)
+		{
+			task->state = SIM_DELETED;
+			return pdFAIL;
+		}
+	pthread_setname_np(task->thread, task->name);
+	if (handle)
+		*handle = task;
+	sim_ready(task);
+	return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack,
+                       void* param, UBaseType_t prio, TaskHandle_t* handle)
+{
+	return xTaskCreatePinnedToCore(fn, name, stack, param, prio, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+	TaskHandle_t self = sim_enter();
+	if (!task)
+		task = self;
+
+	if (task->state == SIM_READY)
+		{
+			TaskHandle_t* t = &sim.ready_head;
+			sim.ready_tail = NULL;
+			while (*t)
+				{
+					if (*t == task)
+						*t = task->next_ready;
+					else
+						{
+							sim.ready_tail = *t;
+							t = &(*t)->next_ready;
+						}
+				}
+		}
+	task->state = SIM_DELETED;
+	for (TaskHandle_t* t = &sim.tasks; *t; t = &(*t)->next)
+		if (*t == task)
+			{
+				*t = task->next;
+				break;
+			}
+
+	// The handle may still be notified, so it stays allocated.  A task
+	// deleted by another one never gets its turn again.
+	if (task == self)
+		{
+			sim_dispatch(self);
+			pthread_mutex_unlock(&sim.lock);
+			pthread_exit(NULL);
+		}
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	return sim_enter();
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+	sim_enter();
+	BaseType_t result = pdPASS;
+	switch (action)
+		{
+		case eNoAction:
+			break;
+		case eSetBits:
+			task->value |= value;
+			break;
+		case eIncrement:
+			task->value++;
+			break;
+		case eSetValueWithOverwrite:
+			task->value = value;
+			break;
+		case eSetValueWithoutOverwrite:
+			if (task->pending)
+				result = pdFAIL;
+			else
+				task->value = value;
+			break;
+		}
+	task->pending = 1;
+	sim_wake(task);
+	return result;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit,
+                           uint32_t* value, TickType_t wait)
+{
+	TaskHandle_t task = sim_enter();
+	int64_t deadline = sim_deadline(wait);
+
+	if (!task->pending)
+		task->value &= ~clear_on_entry;
+	while (!task->pending)
+		{
+			if (wait == 0 || sim.now >= deadline)
+				{
+					if (value)
+						*value = task->value;
+					return pdFALSE;
+				}
+			sim_block(task, deadline);
+		}
+	if (value)
+		*value = task->value;
+	task->value &= ~clear_on_exit;
+	task->pending = 0;
+	return pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t wait)
+{
+	TaskHandle_t task = sim_enter();
+	int64_t deadline = sim_deadline(wait);
+
+	while (task->value == 0)
+		{
+			if (wait == 0 || sim.now >= deadline)
+				break;
+			sim_block(task, deadline);
+		}
+	uint32_t value = task->value;
+	if (value)
+		task->value = clear_on_exit ? 0 : value - 1;
+	task->pending = 0;
+	return value;
+}
+
+/*
+ * Event groups
+ */
+
+struct EventGroupDefinition
+{
+	EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+	sim_enter();
+	return calloc(1, sizeof(struct EventGroupDefinition));
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+	free(group);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+	sim_enter();
+	group->bits |= bits;
+	sim_wake(group);
+	return group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+	EventBits_t result = group->bits;
+	group->bits &= ~bits;
+	return result;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+	return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+                                BaseType_t clear_on_exit, BaseType_t wait_for_all,
+                                TickType_t wait)
+{
+	sim_enter();
+	int64_t deadline = sim_deadline(wait);
+	while (true)
+		{
+			EventBits_t set = group->bits & bits;
+			if (wait_for_all ? set == bits : set != 0)
+				{
+					EventBits_t result = group->bits;
+					if (clear_on_exit)
+						group->bits &= ~bits;
+					return result;
+				}
+			if (wait == 0 || sim.now >= deadline)
+				break;
+			sim_block(group, deadline);
+		}
+	return group->bits;
+}
+
+/*
+ * Software timers, served by one task in expiry order
+ */
+
+struct TimerDefinition
+{
+	TimerCallbackFunction_t callback;
+	void* id;
+	TickType_t period;
+	int auto_reload;
+	int active;
+	int64_t expiry;       // virtual microseconds
+	uint64_t started;     // breaks ties between equal expiries
+	struct TimerDefinition* next;
+};
+
+static struct
+{
+	TaskHandle_t service;
+	struct TimerDefinition* timers;
+	uint64_t order;
+} sim_timers;
+
+static void sim_timer_service(void* arg)
+{
+	while (true)
+		{
+			struct TimerDefinition* next = NULL;
+			for (struct TimerDefinition* t = sim_timers.timers; t; t = t->next)
+				if (t->active && (!next || t->expiry < next->expiry
+				                  || (t->expiry == next->expiry && t->started < next->started)))
+					next = t;
+
+			if (!next)
+				{
+					sim_block(&sim_timers, SIM_NEVER);
+					continue;
+				}
+			if (next->expiry > sim.now)
+				{
+					sim_block(&sim_timers, next->expiry);
+					continue;
+				}
+
+			if (next->auto_reload)
+				{
+					next->expiry += (int64_t) next->period * 1000;
+					next->started = sim_timers.order++;
+				}
+			else
+				next->active = 0;
+			next->callback(next);
+		}
+}
+
+TimerHandle_t xTimerCreate(const char* name, TickType_t period, BaseType_t auto_reload,
+                           void* id, TimerCallbackFunction_t callback)
+{
+	sim_enter();
+	if (!sim_timers.service
+	    && xTaskCreate(sim_timer_service, "timer_service", 0, NULL, 0, &sim_timers.service) != pdPASS)
+		return NULL;
+
+	TimerHandle_t timer = calloc(1, sizeof *timer);
+	if (!timer)
+		return NULL;
+	timer->callback = callback;
+	timer->id = id;
+	timer->period = period;
+	timer->auto_reload = auto_reload;
+	timer->next = sim_timers.timers;
+	sim_timers.timers = timer;
+	return timer;
+}
+
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t wait)
+{
+	sim_enter();
+	for (struct TimerDefinition** t = &sim_timers.timers; *t; t = &(*t)->next)
+		if (*t == timer)
+			{
+				*t = timer->next;
+				break;
+			}
+	free(timer);
+	sim_wake(&sim_timers);
+	return pdPASS;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait)
+{
+	sim_enter();
+	timer->active = 1;
+	timer->expiry = sim.now + (int64_t) timer->period * 1000;
+	timer->started = sim_timers.order++;
+	sim_wake(&sim_timers);
+	return pdPASS;
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t wait)
+{
+	return xTimerStart(timer, wait);
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait)
+{
+	sim_enter();
+	timer->active = 0;
+	sim_wake(&sim_timers);
+	return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait)
+{
+	timer->period = period;
+	return xTimerStart(timer, wait);
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer)
+{
+	return timer->active;
+}
+
+void* pvTimerGetTimerID(TimerHandle_t timer)
+{
+	return timer->id;
+}
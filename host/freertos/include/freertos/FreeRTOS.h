@@ -0,0 +1,55 @@
+#ifndef GUARD_HOST_FREERTOS_H
+#define GUARD_HOST_FREERTOS_H
+
+/*
+ * Minimal FreeRTOS API on top of POSIX threads, enough to run the
+ * protocol components on a Linux host.  One tick is one millisecond.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define pdTRUE  ((BaseType_t) 1)
+#define pdFALSE ((BaseType_t) 0)
+#define pdPASS  pdTRUE
+#define pdFAIL  pdFALSE
+
+#define portMAX_DELAY      ((TickType_t) 0xffffffffUL)
+#define portTICK_PERIOD_MS ((TickType_t) 1)
+#define pdMS_TO_TICKS(ms)  ((TickType_t)(ms))
+#define pdTICKS_TO_MS(t)   ((uint32_t)(t))
+
+#define configMAX_PRIORITIES 25
+#define tskIDLE_PRIORITY     0
+#define tskNO_AFFINITY       0x7FFFFFFF
+#define portNUM_PROCESSORS   2
+
+// Critical sections map onto one process wide recursive lock.
+typedef struct
+{
+	int unused;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portMUX_INITIALIZE(mux)     ((mux)->unused = 0)
+
+void vPortEnterCritical(portMUX_TYPE* mux);
+void vPortExitCritical(portMUX_TYPE* mux);
+
+#define portENTER_CRITICAL(mux)     vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux)      vPortExitCritical(mux)
+#define portENTER_CRITICAL_ISR(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_ISR(mux)  vPortExitCritical(mux)
+#define taskENTER_CRITICAL(mux)     vPortEnterCritical(mux)
+#define taskEXIT_CRITICAL(mux)      vPortExitCritical(mux)
+#define portYIELD_FROM_ISR(x)       ((void)(x))
+
+BaseType_t xPortGetCoreID(void);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef GUARD_HOST_QUEUE_H
+#define GUARD_HOST_QUEUE_H
+
+#include "FreeRTOS.h"
+
+typedef struct QueueDefinition* QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t queue);
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void* item, TickType_t wait);
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t wait);
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void* item);
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t wait);
+BaseType_t xQueuePeek(QueueHandle_t queue, void* item, TickType_t wait);
+BaseType_t xQueueReset(QueueHandle_t queue);
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue);
+
+#define xQueueSend(q, item, wait) xQueueSendToBack((q), (item), (wait))
+#define xQueueSendFromISR(q, item, woken) \
+	((void)(woken), xQueueSendToBack((q), (item), 0))
+#define xQueueReceiveFromISR(q, item, woken) \
+	((void)(woken), xQueueReceive((q), (item), 0))
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef GUARD_HOST_SEMPHR_H
+#define GUARD_HOST_SEMPHR_H
+
+#include "queue.h"
+
+// As in FreeRTOS, semaphores are queues of zero sized items.
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial);
+
+#define xSemaphoreTake(sem, wait)  xQueueReceive((sem), NULL, (wait))
+#define xSemaphoreGive(sem)        xQueueSendToBack((sem), NULL, 0)
+#define xSemaphoreGiveFromISR(sem, woken) \
+	((void)(woken), xQueueSendToBack((sem), NULL, 0))
+#define vSemaphoreDelete(sem)      vQueueDelete(sem)
+#define uxSemaphoreGetCount(sem)   uxQueueMessagesWaiting(sem)
+
+#endif
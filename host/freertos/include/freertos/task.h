@@ -0,0 +1,43 @@
+#ifndef GUARD_HOST_TASK_H
+#define GUARD_HOST_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef struct TaskDefinition* TaskHandle_t;
+typedef void (*TaskFunction_t)(void* param);
+
+typedef enum
+{
+	eNoAction = 0,
+	eSetBits,
+	eIncrement,
+	eSetValueWithOverwrite,
+	eSetValueWithoutOverwrite,
+} eNotifyAction;
+
+// Priorities and stack sizes are accepted and ignored, every task is
+// a detached thread.
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack,
+                       void* param, UBaseType_t prio, TaskHandle_t* handle);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack,
+                                   void* param, UBaseType_t prio, TaskHandle_t* handle,
+                                   BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t* previous, TickType_t increment);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action);
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit,
+                           uint32_t* value, TickType_t wait);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t wait);
+
+#define xTaskNotifyGive(task) xTaskNotify((task), 0, eIncrement)
+#define vTaskNotifyGiveFromISR(task, woken) \
+	((void)(woken), (void) xTaskNotify((task), 0, eIncrement))
+#define xTaskNotifyFromISR(task, value, action, woken) \
+	((void)(woken), xTaskNotify((task), (value), (action)))
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef GUARD_HOST_TIMERS_H
+#define GUARD_HOST_TIMERS_H
+
+#include "FreeRTOS.h"
+
+typedef struct TimerDefinition* TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+// Callbacks run one at a time on a shared timer service thread.
+TimerHandle_t xTimerCreate(const char* name, TickType_t period, BaseType_t auto_reload,
+                           void* id, TimerCallbackFunction_t callback);
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t wait);
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait);
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer);
+
+void* pvTimerGetTimerID(TimerHandle_t timer);
+
+#endif
@@ -0,0 +1,154 @@
+/*
+ * lownet-node: the lownet core, unmodified, as a Linux process.  Every
+ * process is one node; nodes on the same multicast group hear each
+ * other, on this machine or, with -I, across a LAN.  Reads the serial
+ * commands of the boards from stdin.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chat.h>
+#include <cli.h>
+#include <dlog.h>
+#include <esp_log.h>
+#include <esp_random.h>
+#include <lownet.h>
+#include <lownet-commands.h>
+#include <lownet_mesh.h>
+#include <lownet_reliable.h>
+#include <ping.h>
+#include <pktgen.h>
+#include <serial_io.h>
+
+#ifdef LOWNET_NODE_CRYPT
+#include <crypt.h>
+#endif
+
+#include "lownet_posix.h"
+
+void help_command(char*);
+
+static const command_t commands[] = {
+	{"shout",   "/shout MSG                   Broadcast a message.", shout_command},
+	{"tell",    "/tell ID MSG or @ID MSG      Send a message to a specific node", tell_command},
+	{"ping",    "/ping ID [-c N] [-i MS] [-s SIZE]  Check if a node is online, with RTT statistics", ping_command},
+	{"pktgen",  "/pktgen ID [-r R] [-s S] [-n N | -t T]  Load test a link, /pktgen stop|status", pktgen_command},
+	{"date",    "/date                        Print the current time", date_command},
+#ifdef LOWNET_NODE_CRYPT
+	{"setkey",  "/setkey [0|1]                Set the encryption key to use.  If no key is provided encryption is disabled", crypt_setkey_command},
+	{"testenc", "/testenc [STR]               Run STR through a encrypt/decrypt cycle to verify that encryption works", crypt_test_command},
+#endif
+	{"id",      "/id                          Print your ID", id_command},
+	{"neighbors", "/neighbors                   List the nodes heard from, with signal strength and loss", neighbors_command},
+	{"mesh",    "/mesh on|off|routes|stats    Multi-hop forwarding, its routes and counters", mesh_command},
+	{"capture", "/capture [stats|snap N]      Dump the latest frames as hex pcap, or their counters", capture_command},
+	{"reliable", "/reliable stats|send ID BYTES  Reliable streams, or the throughput of one", reliable_command},
+	{"help",    "/help                        Print this help", help_command}
+};
+
+static const size_t NUM_COMMANDS = sizeof commands / sizeof(command_t);
+
+void help_command(char*)
+{
+	for (size_t i = 0; i < NUM_COMMANDS; ++i)
+		serial_write_line(commands[i].description);
+	serial_write_line("Any input not preceded by a '/' or '@' will be treated as a broadcast message.");
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr,
+	        "usage: %s -n NODE [options]\n"
+	        "  -n NODE       node id, 0x01 to 0xFE\n"
+	        "  -g GROUP      multicast group (default " LOWNET_POSIX_GROUP ")\n"
+	        "  -p PORT       UDP port (default %u)\n"
+	        "  -I ADDRESS    interface to use (default " LOWNET_POSIX_INTERFACE ")\n"
+	        "  -b KBPS       link rate sends are paced to, 0 for none (default %u)\n"
+	        "  -l LOSS       frames received dropped at random, per mille\n"
+	        "  -m            take part in the mesh\n"
+	        "  -s SEED       random seed (default: the node id)\n"
+	        "  -v            log protocol traffic\n",
+	        name, LOWNET_POSIX_PORT, LOWNET_POSIX_BITRATE);
+}
+
+int main(int argc, char** argv)
+{
+	lownet_posix_config_t config = LOWNET_POSIX_DEFAULTS;
+	uint64_t seed = 0;
+	bool mesh = false;
+	esp_log_level_t level = ESP_LOG_WARN;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:g:p:I:b:l:ms:vh")) != -1)
+		{
+			switch (opt)
+				{
+				case 'n': config.node = strtoul(optarg, NULL, 0); break;
+				case 'g': config.group = optarg; break;
+				case 'p': config.port = strtoul(optarg, NULL, 0); break;
+				case 'I': config.interface = optarg; break;
+				case 'b': config.bitrate_kbps = strtoul(optarg, NULL, 0); break;
+				case 'l': config.loss = strtoul(optarg, NULL, 0); break;
+				case 'm': mesh = true; break;
+				case 's': seed = strtoull(optarg, NULL, 0); break;
+				case 'v': level = ESP_LOG_INFO; break;
+				default:
+					usage(argv[0]);
+					return 2;
+				}
+		}
+	if (!config.node || config.node == LOWNET_BROADCAST_ADDRESS)
+		{
+			usage(argv[0]);
+			return 2;
+		}
+
+	esp_log_level_set("*", level);
+	dlog_level = level;
+	// Nodes started together must not draw the same sequence numbers.
+	esp_random_seed(seed ? seed : config.node);
+	lownet_posix_configure(&config);
+
+	init_serial_service();
+#ifdef LOWNET_NODE_CRYPT
+	lownet_init(crypt_encrypt, crypt_decrypt);
+#else
+	lownet_init(NULL, NULL);
+#endif
+	lownet_reliable_init();
+	chat_init();
+	ping_init();
+	pktgen_init();
+	if (mesh)
+		lownet_mesh_enable(true);
+
+	char msg_in[MSG_BUFFER_LENGTH];
+	while (serial_read_line(msg_in) == 0)
+		{
+			if (msg_in[0] == 0)
+				continue;
+			if (msg_in[0] == '/')
+				{
+					char* name = strtok(msg_in + 1, " ");
+					command_fun_t command = name ? find_command(name, commands, NUM_COMMANDS) : NULL;
+					if (!command)
+						{
+							printf("Invalid command: %s\n", name ? name : "");
+							continue;
+						}
+					command(strtok(NULL, "\n"));
+				}
+			else if (msg_in[0] == '@')
+				{
+					tell_command(msg_in + 1);
+				}
+			else
+				{
+					shout_command(msg_in);
+				}
+		}
+	return 0;
+}
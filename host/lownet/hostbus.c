@@ -0,0 +1,347 @@
+#include "hostbus.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#define HOSTBUS_IN_FLIGHT 1024
+#define HOSTBUS_COLLIDED 64 // frames found collided after they were scheduled
+
+typedef struct
+{
+	int64_t due;       // esp_timer time of delivery
+	uint32_t order;    // tie breaker, keeps FIFO order for equal due times
+	uint32_t id;       // the frame, shared by its copies for all receivers
+	uint8_t receiver;  // index into bus.nodes
+	lownet_frame_t frame;
+} hostbus_pending_t;
+
+static struct
+{
+	SemaphoreHandle_t lock;
+	TaskHandle_t task;
+
+	hostbus_link_t link;
+	hostbus_channel_t channel;
+	hostbus_stats_t stats;
+	hostbus_trace_fn trace;
+	void* trace_ctx;
+
+	struct
+	{
+		uint8_t from;
+		uint8_t to;
+		hostbus_link_t link;
+	} links[HOSTBUS_MAX_LINKS];
+	int num_links;
+
+	struct
+	{
+		uint8_t node;
+		hostbus_recv_fn handler;
+		void* ctx;
+	} nodes[HOSTBUS_MAX_NODES];
+	int num_nodes;
+
+	// The air: the transmission that started last, and when the air
+	// clears.  Air time is the same for all frames, so the last to start
+	// is the last to end as well.
+	int64_t air_end;
+	int64_t last_start;
+	uint32_t last_id;
+	bool last_broadcast;
+	uint32_t collided[HOSTBUS_COLLIDED];
+	int collided_next;
+
+	// Binary min-heap on (due, order)
+	hostbus_pending_t heap[HOSTBUS_IN_FLIGHT];
+	int pending;
+	uint32_t order;
+	uint32_t frames;
+} bus;
+
+static int hostbus_before(const hostbus_pending_t* a, const hostbus_pending_t* b)
+{
+	return a->due < b->due || (a->due == b->due && (int32_t)(a->order - b->order) < 0);
+}
+
+static void hostbus_swap(int i, int j)
+{
+	hostbus_pending_t t = bus.heap[i];
+	bus.heap[i] = bus.heap[j];
+	bus.heap[j] = t;
+}
+
+static void hostbus_push(const hostbus_pending_t* p)
+{
+	int i = bus.pending++;
+	bus.heap[i] = *p;
+	while (i > 0 && hostbus_before(&bus.heap[i], &bus.heap[(i - 1) / 2]))
+		{
+			hostbus_swap(i, (i - 1) / 2);
+			i = (i - 1) / 2;
+		}
+}
+
+static void hostbus_pop(hostbus_pending_t* p)
+{
+	*p = bus.heap[0];
+	bus.heap[0] = bus.heap[--bus.pending];
+	int i = 0;
+	while (true)
+		{
+			int l = 2 * i + 1, r = l + 1, m = i;
+			if (l < bus.pending && hostbus_before(&bus.heap[l], &bus.heap[m]))
+				m = l;
+			if (r < bus.pending && hostbus_before(&bus.heap[r], &bus.heap[m]))
+				m = r;
+			if (m == i)
+				break;
+			hostbus_swap(i, m);
+			i = m;
+		}
+}
+
+static void hostbus_event(hostbus_event_t event, const lownet_frame_t* frame, uint8_t receiver)
+{
+	if (bus.trace)
+		bus.trace(event, frame, receiver, bus.trace_ctx);
+}
+
+static const hostbus_link_t* hostbus_link(uint8_t from, uint8_t to)
+{
+	for (int i = 0; i < bus.num_links; ++i)
+		if (bus.links[i].from == from && bus.links[i].to == to)
+			return &bus.links[i].link;
+	return &bus.link;
+}
+
+static bool hostbus_collided(uint32_t id)
+{
+	for (int i = 0; i < HOSTBUS_COLLIDED; ++i)
+		if (bus.collided[i] == id)
+			return true;
+	return false;
+}
+
+// Usage: hostbus_air(FRAME, ID, NOW, START)
+// Pre:   bus.lock is held, the channel has air time
+// Post:  FRAME has been put on the air at *START, at NOW or later.  An
+//        earlier broadcast it collided with has been marked collided.
+// Value: true if FRAME is lost to a collision
+static bool hostbus_air(const lownet_frame_t* frame, uint32_t id, int64_t now, int64_t* start)
+{
+	int64_t air = HOSTBUS_PREAMBLE_US
+		+ (int64_t)(HOSTBUS_HEADER_BYTES + sizeof *frame) * 8 * 1000 / bus.channel.bitrate_kbps;
+	bool broadcast = frame->destination == LOWNET_BROADCAST_ADDRESS;
+	bool collision = bus.stats.sent > 1
+		&& (bus.channel.carrier_sense
+		    ? now >= bus.last_start && now - bus.last_start < HOSTBUS_SLOT_US
+		    : now < bus.air_end);
+
+	*start = now;
+	if (collision)
+		{
+			bus.stats.collisions++;
+			if (bus.last_broadcast && !hostbus_collided(bus.last_id))
+				{
+					bus.stats.collisions++;
+					bus.collided[bus.collided_next] = bus.last_id;
+					bus.collided_next = (bus.collided_next + 1) % HOSTBUS_COLLIDED;
+				}
+		}
+	// Unicast frames are acknowledged and the radio retries them, so a
+	// collision only costs them time.
+	if (collision ? !broadcast : bus.channel.carrier_sense && now < bus.air_end)
+		{
+			*start = bus.air_end + (int64_t)(esp_random() % HOSTBUS_BACKOFF_SLOTS) * HOSTBUS_SLOT_US;
+			bus.stats.deferred++;
+		}
+
+	if (*start + air > bus.air_end)
+		bus.air_end = *start + air;
+	bus.last_start = *start;
+	bus.last_id = id;
+	bus.last_broadcast = broadcast;
+	*start += air;
+	return collision && broadcast;
+}
+
+static void hostbus_main(void* arg)
+{
+	xSemaphoreTake(bus.lock, portMAX_DELAY);
+	while (true)
+		{
+			if (bus.pending == 0)
+				{
+					xSemaphoreGive(bus.lock);
+					ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+					xSemaphoreTake(bus.lock, portMAX_DELAY);
+					continue;
+				}
+
+			int64_t now = esp_timer_get_time();
+			if (bus.heap[0].due > now)
+				{
+					TickType_t wait = (bus.heap[0].due - now + 999) / 1000;
+					xSemaphoreGive(bus.lock);
+					ulTaskNotifyTake(pdTRUE, wait);
+					xSemaphoreTake(bus.lock, portMAX_DELAY);
+					continue;
+				}
+
+			hostbus_pending_t p;
+			hostbus_pop(&p);
+			uint8_t receiver = bus.nodes[p.receiver].node;
+			if (hostbus_collided(p.id))
+				{
+					hostbus_event(HOSTBUS_COLLIDED, &p.frame, receiver);
+					continue;
+				}
+			bus.stats.delivered++;
+			hostbus_event(HOSTBUS_DELIVERED, &p.frame, receiver);
+
+			// Handlers may send, so they run without the bus lock.
+			hostbus_recv_fn handler = bus.nodes[p.receiver].handler;
+			void* ctx = bus.nodes[p.receiver].ctx;
+			xSemaphoreGive(bus.lock);
+			handler(&p.frame, ctx);
+			xSemaphoreTake(bus.lock, portMAX_DELAY);
+		}
+}
+
+void hostbus_init(const hostbus_link_t* link)
+{
+	bus.link = *link;
+	bus.lock = xSemaphoreCreateMutex();
+	xTaskCreate(hostbus_main, "hostbus", 4096, NULL, 10, &bus.task);
+}
+
+int hostbus_set_link(uint8_t from, uint8_t to, const hostbus_link_t* link)
+{
+	int result = 0;
+	xSemaphoreTake(bus.lock, portMAX_DELAY);
+	if (!from && !to)
+		{
+			bus.link = *link;
+			xSemaphoreGive(bus.lock);
+			return 0;
+		}
+	int i = 0;
+	while (i < bus.num_links && (bus.links[i].from != from || bus.links[i].to != to))
+		++i;
+	if (i == HOSTBUS_MAX_LINKS)
+		{
+			result = 1;
+		}
+	else
+		{
+			bus.links[i].from = from;
+			bus.links[i].to = to;
+			bus.links[i].link = *link;
+			if (i == bus.num_links)
+				bus.num_links++;
+		}
+	xSemaphoreGive(bus.lock);
+	return result;
+}
+
+void hostbus_set_channel(const hostbus_channel_t* channel)
+{
+	xSemaphoreTake(bus.lock, portMAX_DELAY);
+	bus.channel = *channel;
+	xSemaphoreGive(bus.lock);
+}
+
+void hostbus_trace(hostbus_trace_fn trace, void* ctx)
+{
+	xSemaphoreTake(bus.lock, portMAX_DELAY);
+	bus.trace = trace;
+	bus.trace_ctx = ctx;
+	xSemaphoreGive(bus.lock);
+}
+
+int hostbus_attach(uint8_t node, hostbus_recv_fn handler, void* ctx)
+{
+	xSemaphoreTake(bus.lock, portMAX_DELAY);
+	if (bus.num_nodes == HOSTBUS_MAX_NODES)
+		{
+			xSemaphoreGive(bus.lock);
+			return 1;
+		}
+	bus.nodes[bus.num_nodes].node = node;
+	bus.nodes[bus.num_nodes].handler = handler;
+	bus.nodes[bus.num_nodes].ctx = ctx;
+	bus.num_nodes++;
+	xSemaphoreGive(bus.lock);
+	return 0;
+}
+
+void hostbus_send(const lownet_frame_t* frame)
+{
+	xSemaphoreTake(bus.lock, portMAX_DELAY);
+	bus.stats.sent++;
+	hostbus_event(HOSTBUS_SENT, frame, 0);
+
+	uint32_t id = ++bus.frames;
+	int64_t now = esp_timer_get_time();
+	int64_t arrival = now;
+	bool collided = bus.channel.bitrate_kbps && hostbus_air(frame, id, now, &arrival);
+
+	for (int i = 0; i < bus.num_nodes; ++i)
+		{
+			uint8_t node = bus.nodes[i].node;
+			if (node == frame->source)
+				continue;
+			if (frame->destination != node && frame->destination != LOWNET_BROADCAST_ADDRESS)
+				continue;
+
+			if (collided)
+				{
+					hostbus_event(HOSTBUS_COLLIDED, frame, node);
+					continue;
+				}
+
+			const hostbus_link_t* link = hostbus_link(frame->source, node);
+			if (esp_random() % 1000 < link->loss || bus.pending == HOSTBUS_IN_FLIGHT)
+				{
+					bus.stats.lost++;
+					hostbus_event(HOSTBUS_LOST, frame, node);
+					continue;
+				}
+
+			uint32_t delay = link->delay_ms;
+			if (link->jitter_ms)
+				delay += esp_random() % (link->jitter_ms + 1);
+			if (esp_random() % 1000 < link->reorder)
+				{
+					// Hold the frame back long enough for later ones to pass it.
+					delay += link->delay_ms + link->jitter_ms + 5;
+					bus.stats.reordered++;
+				}
+
+			hostbus_pending_t p;
+			p.due = arrival + (int64_t) delay * 1000;
+			p.order = bus.order++;
+			p.id = id;
+			p.receiver = i;
+			p.frame = *frame;
+			hostbus_push(&p);
+		}
+
+	xSemaphoreGive(bus.lock);
+	xTaskNotifyGive(bus.task);
+}
+
+hostbus_stats_t hostbus_stats(void)
+{
+	xSemaphoreTake(bus.lock, portMAX_DELAY);
+	hostbus_stats_t stats = bus.stats;
+	xSemaphoreGive(bus.lock);
+	return stats;
+}
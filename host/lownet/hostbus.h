@@ -0,0 +1,106 @@
+#ifndef GUARD_HOSTBUS_H
+#define GUARD_HOSTBUS_H
+
+/*
+ * In-process stand-in for the radio: nodes attach with a handler and
+ * frames are delivered to them after a configurable delay, with loss,
+ * jitter and reordering drawn from a seeded generator.  Links can be
+ * impaired one by one, and the channel can give frames air time, during
+ * which other transmissions collide with them.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <lownet.h>
+
+#define HOSTBUS_MAX_NODES 16
+#define HOSTBUS_MAX_LINKS 64 // links impaired other than the default
+
+typedef void (*hostbus_recv_fn)(const lownet_frame_t* frame, void* ctx);
+
+typedef struct
+{
+	uint32_t loss;      // per mille of frames dropped
+	uint32_t reorder;   // per mille of frames held back behind later ones
+	uint32_t delay_ms;  // one way delay
+	uint32_t jitter_ms; // uniform extra delay 0..jitter_ms
+} hostbus_link_t;
+
+typedef struct
+{
+	// Frames take HOSTBUS_PREAMBLE_US plus their bytes and the radio
+	// header at this rate on the air; 0 for no air time and collisions.
+	uint32_t bitrate_kbps;
+	// Senders wait for the air to be clear and collide only when they
+	// start within a slot of each other.  Without carrier sense every
+	// overlap is a collision.
+	bool carrier_sense;
+} hostbus_channel_t;
+
+#define HOSTBUS_PREAMBLE_US 192
+#define HOSTBUS_HEADER_BYTES 43 // 802.11 action frame and ESP-NOW headers
+#define HOSTBUS_SLOT_US 20
+#define HOSTBUS_BACKOFF_SLOTS 16
+
+typedef struct
+{
+	uint32_t sent;
+	uint32_t lost;
+	uint32_t reordered;
+	uint32_t delivered;
+	uint32_t collisions; // frames that overlapped with another on the air
+	uint32_t deferred;   // frames that waited for the air to clear
+} hostbus_stats_t;
+
+typedef enum
+{
+	HOSTBUS_SENT,      // once per frame, RECEIVER is 0
+	HOSTBUS_DELIVERED, // per receiver
+	HOSTBUS_LOST,      // per receiver, dropped by the link
+	HOSTBUS_COLLIDED,  // per receiver, destroyed on the air
+} hostbus_event_t;
+
+typedef void (*hostbus_trace_fn)(hostbus_event_t event, const lownet_frame_t* frame,
+                                 uint8_t receiver, void* ctx);
+
+// Usage: hostbus_init(LINK)
+// Pre:   LINK != NULL
+// Post:  The bus delivery task runs and applies LINK to every link not
+//        set otherwise
+void hostbus_init(const hostbus_link_t* link);
+
+// Usage: hostbus_set_link(FROM, TO, LINK)
+// Pre:   LINK != NULL, hostbus_init has been called
+// Post:  Frames from node FROM to node TO go over LINK from now on.
+//        FROM and TO 0 set the default link.
+// Value: 0 on success, non-0 if too many links are set
+int hostbus_set_link(uint8_t from, uint8_t to, const hostbus_link_t* link);
+
+// Usage: hostbus_set_channel(CHANNEL)
+// Pre:   CHANNEL != NULL, hostbus_init has been called
+// Post:  Frames sent from now on use the air as CHANNEL describes
+void hostbus_set_channel(const hostbus_channel_t* channel);
+
+// Usage: hostbus_trace(TRACE, CTX)
+// Post:  TRACE is called with CTX for every frame sent and its fate at
+//        every receiver.  It runs with the bus locked and must not call
+//        into the bus.
+void hostbus_trace(hostbus_trace_fn trace, void* ctx);
+
+// Usage: hostbus_attach(NODE, HANDLER, CTX)
+// Pre:   NODE is a node id not yet attached
+// Post:  Frames addressed to NODE or broadcast are passed to HANDLER
+//        with CTX, from the delivery task
+// Value: 0 on success, non-0 if the bus is full
+int hostbus_attach(uint8_t node, hostbus_recv_fn handler, void* ctx);
+
+// Usage: hostbus_send(FRAME)
+// Pre:   FRAME != NULL, FRAME->source is the sending node, which need
+//        not be attached
+// Post:  FRAME has been scheduled for delivery or dropped by the link model
+void hostbus_send(const lownet_frame_t* frame);
+
+hostbus_stats_t hostbus_stats(void);
+
+#endif
@@ -0,0 +1,195 @@
+#include <lownet.h>
+
+#include <string.h>
+#include <time.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "hostbus.h"
+#include "lownet_host.h"
+
+#define TAG "lownet-host"
+
+/*
+ * The lownet API of a single host node.  Frames go over the in-process
+ * bus in plaintext; keys are accepted but not applied.
+ */
+
+typedef struct
+{
+	uint8_t protocol;
+	lownet_recv_fn handler;
+	lownet_recv_ex_fn handler_ex;
+} protocol_t;
+
+static const uint8_t plain_magic[2] = {0x10, 0x4e};
+
+static struct
+{
+	uint8_t node;
+	protocol_t protocols[LOWNET_MAX_PROTOCOLS];
+	uint8_t num_protocols;
+	lownet_tap_fn tap;
+
+	lownet_time_t sync_time;
+	int64_t sync_stamp;
+} net_host = {
+	.node = LOWNET_HOST_DEFAULT_ID,
+};
+
+void lownet_host_set_id(uint8_t node)
+{
+	net_host.node = node;
+}
+
+static const protocol_t* lownet_get_protocol(uint8_t protocol)
+{
+	for (int i = 0; i < net_host.num_protocols; ++i)
+		if (net_host.protocols[i].protocol == protocol)
+			return &net_host.protocols[i];
+	return NULL;
+}
+
+static void lownet_host_receive(const lownet_frame_t* frame, void* ctx)
+{
+	if (memcmp(frame->magic, plain_magic, sizeof plain_magic) != 0)
+		return;
+
+	// The bus delivers from its own thread, there is no queue to wait in.
+	lownet_rx_info_t info = {
+		.timestamp = esp_timer_get_time(),
+		.key = LOWNET_KEY_NONE,
+	};
+	if (net_host.tap)
+		net_host.tap(frame, &info);
+
+	const protocol_t* protocol = lownet_get_protocol(frame->protocol & 0b00111111);
+	if (!protocol)
+		{
+			ESP_LOGD(TAG, "Unknown protocol %02x", frame->protocol & 0b00111111);
+			return;
+		}
+	if (protocol->handler_ex)
+		protocol->handler_ex(frame, &info);
+	else
+		protocol->handler(frame);
+}
+
+int lownet_register_protocol(uint8_t protocol, lownet_recv_fn handler)
+{
+	if (net_host.num_protocols >= LOWNET_MAX_PROTOCOLS)
+		return 1;
+
+	net_host.protocols[net_host.num_protocols].protocol = protocol;
+	net_host.protocols[net_host.num_protocols].handler = handler;
+	net_host.protocols[net_host.num_protocols].handler_ex = NULL;
+	++net_host.num_protocols;
+	return 0;
+}
+
+int lownet_register_protocol_ex(uint8_t protocol, lownet_recv_ex_fn handler)
+{
+	if (net_host.num_protocols >= LOWNET_MAX_PROTOCOLS)
+		return 1;
+
+	net_host.protocols[net_host.num_protocols].protocol = protocol;
+	net_host.protocols[net_host.num_protocols].handler = NULL;
+	net_host.protocols[net_host.num_protocols].handler_ex = handler;
+	++net_host.num_protocols;
+	return 0;
+}
+
+void lownet_register_tap(lownet_tap_fn tap)
+{
+	net_host.tap = tap;
+}
+
+void lownet_init(lownet_cipher_fn encrypt_fn, lownet_cipher_fn decrypt_fn)
+{
+	(void) encrypt_fn;
+	(void) decrypt_fn;
+
+	// Start the clock at the wall time so time stamps look familiar.
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	lownet_time_t time = {
+		.seconds = (uint32_t) now.tv_sec,
+		.parts = (uint8_t)((now.tv_nsec / 1000000) * 256 / 1000),
+	};
+	lownet_set_time(&time);
+
+	if (hostbus_attach(net_host.node, lownet_host_receive, NULL))
+		{
+			ESP_LOGE(TAG, "Bus is full");
+			return;
+		}
+	ESP_LOGI(TAG, "Initialized LowNet -- device ID: 0x%02X", net_host.node);
+}
+
+void lownet_send(const lownet_frame_t* frame)
+{
+	lownet_send_ex(frame, 0);
+}
+
+// The bus always has room.
+int lownet_send_ex(const lownet_frame_t* frame, uint32_t wait_ms)
+{
+	(void) wait_ms;
+	if (frame->length > LOWNET_PAYLOAD_SIZE)
+		return -1;
+
+	lownet_frame_t out_frame;
+	memset(&out_frame, 0, sizeof out_frame);
+	memcpy(out_frame.magic, plain_magic, sizeof plain_magic);
+	out_frame.source = net_host.node;
+	out_frame.destination = frame->destination;
+	out_frame.protocol = frame->protocol;
+	out_frame.length = frame->length;
+	memcpy(out_frame.payload, frame->payload, frame->length);
+
+	hostbus_send(&out_frame);
+	return 0;
+}
+
+lownet_time_t lownet_get_time()
+{
+	int64_t delta = ((esp_timer_get_time() / 1000) - net_host.sync_stamp)
+		+ ((((int64_t) net_host.sync_time.parts) * 1000) / 256);
+
+	lownet_time_t result;
+	result.seconds = net_host.sync_time.seconds + (uint32_t)(delta / 1000);
+	result.parts = (uint8_t)(((delta % 1000) * 256) / 1000);
+	return result;
+}
+
+void lownet_set_time(const lownet_time_t* time)
+{
+	net_host.sync_time = *time;
+	net_host.sync_stamp = esp_timer_get_time() / 1000;
+}
+
+uint8_t lownet_get_device_id()
+{
+	return net_host.node;
+}
+
+const lownet_key_t* lownet_get_key()
+{
+	return NULL;
+}
+
+void lownet_set_key(const lownet_key_t* key)
+{
+	(void) key;
+}
+
+void lownet_set_stored_key(uint8_t key_id)
+{
+	(void) key_id;
+}
+
+const char* lownet_get_signing_key()
+{
+	return lownet_public_key;
+}
@@ -0,0 +1,13 @@
+#ifndef GUARD_LOWNET_HOST_H
+#define GUARD_LOWNET_HOST_H
+
+#include <stdint.h>
+
+#define LOWNET_HOST_DEFAULT_ID 0xA0
+
+// Usage: lownet_host_set_id(NODE)
+// Pre:   lownet_init has not been called
+// Post:  The host node sends and receives as NODE
+void lownet_host_set_id(uint8_t node);
+
+#endif
@@ -0,0 +1,220 @@
+#include <lownet_port.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <device-table.h>
+#include <esp_log.h>
+#include <esp_random.h>
+#include <lownet.h>
+
+#include "lownet_posix.h"
+
+#define TAG "lownet-posix"
+
+/*
+ * Datagrams carry the link addresses in front of the frame, as the radio
+ * header does.  Every node receives every datagram and keeps those for
+ * its own address and broadcasts.
+ */
+
+#define DATAGRAM_MAX (12 + sizeof(lownet_secure_frame_t))
+
+static const uint8_t virtual_prefix[5] = {0x02, 0x4c, 0x4e, 0x00, 0x00};
+static const uint8_t broadcast_mac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+static struct
+{
+	lownet_posix_config_t config;
+	uint8_t mac[6];
+	int sock;
+	struct sockaddr_in group;
+	lownet_port_recv_fn recv;
+
+	pthread_mutex_t lock;
+	uint8_t peers[LOWNET_PORT_MAX_PEERS][6];
+	int num_peers;
+	int64_t air_free; // CLOCK_MONOTONIC microseconds our last frame is off the air
+} port = {
+	.config = LOWNET_POSIX_DEFAULTS,
+	.sock = -1,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+void lownet_posix_configure(const lownet_posix_config_t* config)
+{
+	port.config = *config;
+}
+
+// Virtual nodes need not be in the device table; their address says who
+// they are.  Ours override the table's, the network is all virtual here.
+static void port_learn(const uint8_t mac[6])
+{
+	if (memcmp(mac, virtual_prefix, sizeof virtual_prefix) != 0)
+		return;
+	uint8_t node = mac[5];
+	if (!node || node == LOWNET_BROADCAST_ADDRESS)
+		return;
+
+	lownet_identifier_t id = lownet_lookup(node);
+	if (memcmp(id.mac, mac, 6) == 0)
+		return;
+	memcpy(id.mac, mac, 6);
+	id.node = node;
+	lownet_device_add(&id);
+}
+
+static void* port_receive(void* arg)
+{
+	uint8_t datagram[DATAGRAM_MAX];
+	while (true)
+		{
+			ssize_t n = recv(port.sock, datagram, sizeof datagram, 0);
+			if (n < 12)
+				continue;
+
+			const uint8_t* dst = datagram;
+			const uint8_t* src = datagram + 6;
+			if (memcmp(src, port.mac, 6) == 0)
+				continue;
+			if (memcmp(dst, port.mac, 6) != 0 && memcmp(dst, broadcast_mac, 6) != 0)
+				continue;
+
+			port_learn(src);
+			if (port.config.loss && esp_random() % 1000 < port.config.loss)
+				continue;
+			port.recv(datagram + 12, n - 12, 0);
+		}
+	return NULL;
+}
+
+int lownet_port_init(lownet_port_recv_fn recv)
+{
+	uint8_t node = port.config.node;
+	if (!node || node == LOWNET_BROADCAST_ADDRESS)
+		{
+			ESP_LOGE(TAG, "No node id configured");
+			return 1;
+		}
+	memcpy(port.mac, virtual_prefix, sizeof virtual_prefix);
+	port.mac[5] = node;
+	port_learn(port.mac);
+	port.recv = recv;
+
+	struct in_addr interface;
+	memset(&port.group, 0, sizeof port.group);
+	port.group.sin_family = AF_INET;
+	port.group.sin_port = htons(port.config.port);
+	if (inet_pton(AF_INET, port.config.group, &port.group.sin_addr) != 1
+	    || inet_pton(AF_INET, port.config.interface, &interface) != 1)
+		{
+			ESP_LOGE(TAG, "Invalid group %s or interface %s", port.config.group, port.config.interface);
+			return 1;
+		}
+
+	port.sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (port.sock < 0)
+		{
+			ESP_LOGE(TAG, "socket: %s", strerror(errno));
+			return 1;
+		}
+
+	int one = 1;
+	struct sockaddr_in any = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port.config.port),
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+	struct ip_mreq membership = {
+		.imr_multiaddr = port.group.sin_addr,
+		.imr_interface = interface,
+	};
+	if (setsockopt(port.sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one) != 0
+	    || setsockopt(port.sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one) != 0
+	    || bind(port.sock, (struct sockaddr*) &any, sizeof any) != 0
+	    || setsockopt(port.sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof membership) != 0
+	    || setsockopt(port.sock, IPPROTO_IP, IP_MULTICAST_IF, &interface, sizeof interface) != 0
+	    || setsockopt(port.sock, IPPROTO_IP, IP_MULTICAST_LOOP, &one, sizeof one) != 0)
+		{
+			ESP_LOGE(TAG, "Joining %s:%u: %s", port.config.group, port.config.port, strerror(errno));
+			close(port.sock);
+			port.sock = -1;
+			return 1;
+		}
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, port_receive, NULL) != 0)
+		return 1;
+	pthread_detach(thread);
+
+	ESP_LOGI(TAG, "Node 0x%02X on %s:%u", node, port.config.group, port.config.port);
+	return 0;
+}
+
+void lownet_port_mac(uint8_t mac[6])
+{
+	memcpy(mac, port.mac, 6);
+}
+
+int lownet_port_add_peer(const uint8_t mac[6])
+{
+	pthread_mutex_lock(&port.lock);
+	int full = port.num_peers == LOWNET_PORT_MAX_PEERS;
+	if (!full)
+		memcpy(port.peers[port.num_peers++], mac, 6);
+	pthread_mutex_unlock(&port.lock);
+	return full;
+}
+
+void lownet_port_del_peer(const uint8_t mac[6])
+{
+	pthread_mutex_lock(&port.lock);
+	for (int i = 0; i < port.num_peers; ++i)
+		if (memcmp(port.peers[i], mac, 6) == 0)
+			{
+				memcpy(port.peers[i], port.peers[--port.num_peers], 6);
+				break;
+			}
+	pthread_mutex_unlock(&port.lock);
+}
+
+// Holds the caller back until a frame of BYTES would get its turn on the
+// air after the ones sent before it.
+static void port_pace(size_t bytes)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	int64_t now = ts.tv_sec * 1000000ll + ts.tv_nsec / 1000;
+	int64_t air = (int64_t) bytes * 8 * 1000 / port.config.bitrate_kbps;
+
+	pthread_mutex_lock(&port.lock);
+	int64_t start = port.air_free > now ? port.air_free : now;
+	port.air_free = start + air;
+	pthread_mutex_unlock(&port.lock);
+
+	if (start > now)
+		usleep(start - now);
+}
+
+int lownet_port_send(const uint8_t mac[6], const void* data, size_t length)
+{
+	uint8_t datagram[DATAGRAM_MAX];
+	if (port.sock < 0 || length > sizeof datagram - 12)
+		return 1;
+
+	memcpy(datagram, mac, 6);
+	memcpy(datagram + 6, port.mac, 6);
+	memcpy(datagram + 12, data, length);
+	if (port.config.bitrate_kbps)
+		port_pace(12 + length);
+	ssize_t sent = sendto(port.sock, datagram, 12 + length, 0,
+	                      (const struct sockaddr*) &port.group, sizeof port.group);
+	return sent != (ssize_t) (12 + length);
+}
@@ -0,0 +1,40 @@
+#ifndef GUARD_LOWNET_POSIX_H
+#define GUARD_LOWNET_POSIX_H
+
+/*
+ * UDP multicast port of the lownet core: every process running the core
+ * is one node, and all nodes joined to the same group and port hear each
+ * other.  Node NODE gets the link address 02:4c:4e:00:00:NODE.
+ */
+
+#include <stdint.h>
+
+#define LOWNET_POSIX_GROUP     "239.255.76.78"
+#define LOWNET_POSIX_PORT      7600
+#define LOWNET_POSIX_INTERFACE "127.0.0.1" // nodes on this machine only
+#define LOWNET_POSIX_BITRATE   1000        // kbit/s, the ESP-NOW default
+
+typedef struct
+{
+	uint8_t node;
+	const char* group;     // multicast group address
+	uint16_t port;
+	const char* interface; // address of the interface to use
+	// Frames leave no faster than a radio at this rate would send them,
+	// as the receivers' queues are sized for; 0 sends at once.
+	uint32_t bitrate_kbps;
+	// Frames received are dropped at random at this rate, per mille, to
+	// try protocols on a lossy link.
+	uint16_t loss;
+} lownet_posix_config_t;
+
+#define LOWNET_POSIX_DEFAULTS \
+	{ 0, LOWNET_POSIX_GROUP, LOWNET_POSIX_PORT, LOWNET_POSIX_INTERFACE, LOWNET_POSIX_BITRATE, 0 }
+
+// Usage: lownet_posix_configure(CONFIG)
+// Pre:   CONFIG != NULL, CONFIG->node is neither 0 nor the broadcast
+//        address, lownet_init has not been called yet
+// Post:  lownet_init brings the node up as CONFIG describes
+void lownet_posix_configure(const lownet_posix_config_t* config);
+
+#endif
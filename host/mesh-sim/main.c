@@ -0,0 +1,526 @@
+/*
+ * mesh-sim: runs the lownet mesh routing of many nodes in one process on
+ * a simulated topology, in simulated time, and reports how fast routes
+ * converge and how well frames get across.
+ *
+ * Links are symmetric with independent loss; unicast gets the link layer
+ * retries ESP-NOW does.  Every run is determined by its seed.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lownet.h>
+#include <lownet_mesh.h>
+
+#define MAX_NODES 200
+#define UNICAST_ATTEMPTS 4
+#define TRAFFIC_PROTOCOL 0x3E
+#define MAX_TRAFFIC 100000
+
+typedef enum
+{
+	EV_BEACON,
+	EV_RECEIVE,
+	EV_SEND,     // a forwarder's processing is done
+	EV_TRAFFIC,
+} event_type_t;
+
+typedef struct
+{
+	int64_t time;
+	uint32_t order;
+	event_type_t type;
+	uint8_t node;
+	uint8_t link;     // EV_SEND: the node to hand the frame to
+	int64_t received; // EV_SEND: when the forwarder got the frame
+	lownet_frame_t frame;
+} event_t;
+
+typedef struct __attribute__((__packed__))
+{
+	uint32_t id;
+	int64_t sent;
+} traffic_t;
+
+static struct
+{
+	// Parameters
+	int nodes;
+	uint32_t loss;       // permille per transmission
+	uint32_t delay_us;
+	uint32_t jitter_us;
+	uint32_t process_us; // time a forwarder takes
+	uint32_t interval_us;
+	int64_t warmup_us;
+	int64_t duration_us;
+	uint64_t rng;
+
+	bool link[MAX_NODES + 1][MAX_NODES + 1];
+	uint8_t distance[MAX_NODES + 1][MAX_NODES + 1]; // shortest path hops, 0 if none
+	lownet_mesh_t mesh[MAX_NODES + 1];
+	uint8_t seq[MAX_NODES + 1][256];
+
+	event_t* heap;
+	int pending;
+	int capacity;
+	uint32_t order;
+
+	// Results
+	int64_t converged;
+	uint32_t transmissions;
+	uint32_t beacon_transmissions;
+	uint32_t no_link;
+	uint32_t sent;
+	uint32_t delivered;
+	uint32_t duplicates;
+	uint32_t hops_sum;
+	uint32_t stretch_sum; // hops over shortest path, in percent
+	int64_t latency_sum;
+	int64_t latency_max;
+	bool arrived[MAX_TRAFFIC];
+} sim;
+
+static uint64_t sim_random(void)
+{
+	// splitmix64
+	uint64_t z = (sim.rng += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+static bool sim_before(const event_t* a, const event_t* b)
+{
+	return a->time < b->time || (a->time == b->time && a->order < b->order);
+}
+
+static void sim_push(event_t* e)
+{
+	if (sim.pending == sim.capacity)
+		{
+			sim.capacity = sim.capacity ? 2 * sim.capacity : 1024;
+			sim.heap = realloc(sim.heap, sim.capacity * sizeof *sim.heap);
+			if (!sim.heap)
+				{
+					perror("realloc");
+					exit(1);
+				}
+		}
+	e->order = sim.order++;
+	int i = sim.pending++;
+	sim.heap[i] = *e;
+	while (i > 0 && sim_before(&sim.heap[i], &sim.heap[(i - 1) / 2]))
+		{
+			event_t t = sim.heap[i];
+			sim.heap[i] = sim.heap[(i - 1) / 2];
+			sim.heap[(i - 1) / 2] = t;
+			i = (i - 1) / 2;
+		}
+}
+
+static void sim_pop(event_t* e)
+{
+	*e = sim.heap[0];
+	sim.heap[0] = sim.heap[--sim.pending];
+	int i = 0;
+	while (true)
+		{
+			int l = 2 * i + 1, r = l + 1, m = i;
+			if (l < sim.pending && sim_before(&sim.heap[l], &sim.heap[m]))
+				m = l;
+			if (r < sim.pending && sim_before(&sim.heap[r], &sim.heap[m]))
+				m = r;
+			if (m == i)
+				break;
+			event_t t = sim.heap[i];
+			sim.heap[i] = sim.heap[m];
+			sim.heap[m] = t;
+			i = m;
+		}
+}
+
+static int64_t sim_link_delay(void)
+{
+	int64_t delay = sim.delay_us;
+	if (sim.jitter_us)
+		delay += sim_random() % (sim.jitter_us + 1);
+	return delay;
+}
+
+static bool sim_lost(void)
+{
+	return sim_random() % 1000 < sim.loss;
+}
+
+// Puts FRAME on the air from FROM towards LINK at NOW.
+static void sim_transmit(uint8_t from, uint8_t link, const lownet_frame_t* frame, int64_t now)
+{
+	event_t e = { .type = EV_RECEIVE, .frame = *frame };
+	bool beacon = frame->protocol == LOWNET_PROTOCOL_MESH;
+
+	if (link == LOWNET_BROADCAST_ADDRESS)
+		{
+			sim.transmissions++;
+			sim.beacon_transmissions += beacon;
+			int64_t delay = sim_link_delay();
+			for (int node = 1; node <= sim.nodes; ++node)
+				{
+					if (!sim.link[from][node] || sim_lost())
+						continue;
+					e.node = node;
+					e.time = now + delay;
+					sim_push(&e);
+				}
+			return;
+		}
+
+	if (!sim.link[from][link])
+		{
+			sim.no_link++;
+			return;
+		}
+	int64_t delay = 0;
+	for (int attempt = 0; attempt < UNICAST_ATTEMPTS; ++attempt)
+		{
+			sim.transmissions++;
+			delay += sim_link_delay();
+			if (!sim_lost())
+				{
+					e.node = link;
+					e.time = now + delay;
+					sim_push(&e);
+					return;
+				}
+		}
+}
+
+static void sim_distances(void)
+{
+	for (int from = 1; from <= sim.nodes; ++from)
+		{
+			uint8_t queue[MAX_NODES];
+			int head = 0, tail = 0;
+			queue[tail++] = from;
+			while (head < tail)
+				{
+					int node = queue[head++];
+					for (int next = 1; next <= sim.nodes; ++next)
+						if (sim.link[node][next] && next != from && !sim.distance[from][next])
+							{
+								sim.distance[from][next] = sim.distance[from][node] + 1;
+								queue[tail++] = next;
+							}
+				}
+		}
+}
+
+// Value: true if every node has a route to every node it can reach
+static bool sim_converged(int64_t now)
+{
+	for (int from = 1; from <= sim.nodes; ++from)
+		for (int to = 1; to <= sim.nodes; ++to)
+			{
+				lownet_route_t route;
+				if (sim.distance[from][to]
+				    && lownet_mesh_get_route(&sim.mesh[from], to, now, &route) != 0)
+					return false;
+			}
+	return true;
+}
+
+static void sim_receive(const event_t* e)
+{
+	uint8_t node = e->node;
+	lownet_frame_t frame = e->frame;
+	lownet_rx_info_t info = { .timestamp = e->time, .key = LOWNET_KEY_NONE };
+	uint8_t next_hop;
+
+	int action = lownet_mesh_receive(&sim.mesh[node], &frame, &info, &next_hop);
+	if (action & LOWNET_MESH_FORWARD)
+		{
+			event_t send = {
+				.time = e->time + sim.process_us,
+				.type = EV_SEND,
+				.node = node,
+				.link = next_hop,
+				.received = e->time,
+				.frame = frame,
+			};
+			sim_push(&send);
+		}
+	if (!(action & LOWNET_MESH_DELIVER))
+		return;
+
+	if (frame.protocol == LOWNET_PROTOCOL_MESH)
+		{
+			lownet_mesh_beacon_receive(&sim.mesh[node], &frame, e->time);
+			return;
+		}
+	if (frame.protocol != TRAFFIC_PROTOCOL || frame.destination != node)
+		return;
+
+	traffic_t traffic;
+	memcpy(&traffic, frame.payload, sizeof traffic);
+	if (traffic.id >= MAX_TRAFFIC)
+		return;
+	if (sim.arrived[traffic.id])
+		{
+			sim.duplicates++;
+			return;
+		}
+	sim.arrived[traffic.id] = true;
+
+	int hops = LOWNET_MESH_HOPS(frame.padding[LOWNET_MESH]) + 1;
+	int64_t latency = e->time - traffic.sent;
+	sim.delivered++;
+	sim.hops_sum += hops;
+	sim.stretch_sum += 100 * hops / sim.distance[frame.source][node];
+	sim.latency_sum += latency;
+	if (latency > sim.latency_max)
+		sim.latency_max = latency;
+}
+
+static void sim_traffic(int64_t now)
+{
+	// A random pair of nodes which can reach each other.
+	uint8_t from, to;
+	do
+		{
+			from = 1 + sim_random() % sim.nodes;
+			to = 1 + sim_random() % sim.nodes;
+		}
+	while (!sim.distance[from][to]);
+
+	lownet_frame_t frame;
+	memset(&frame, 0, sizeof frame);
+	frame.source = from;
+	frame.destination = to;
+	frame.protocol = TRAFFIC_PROTOCOL;
+	frame.length = sizeof(traffic_t);
+	uint8_t* seq = &sim.seq[from][to];
+	*seq = *seq == 255 ? 1 : *seq + 1;
+	frame.padding[LOWNET_SEQ] = *seq;
+
+	traffic_t traffic = { .id = sim.sent++, .sent = now };
+	memcpy(frame.payload, &traffic, sizeof traffic);
+
+	uint8_t link = lownet_mesh_route(&sim.mesh[from], &frame, now);
+	sim_transmit(from, link, &frame, now);
+}
+
+static void sim_topology(const char* shape, double range)
+{
+	if (!strcmp(shape, "line"))
+		{
+			for (int i = 1; i < sim.nodes; ++i)
+				sim.link[i][i + 1] = sim.link[i + 1][i] = true;
+		}
+	else if (!strcmp(shape, "grid"))
+		{
+			int side = (int) ceil(sqrt(sim.nodes));
+			for (int i = 0; i < sim.nodes; ++i)
+				{
+					if ((i + 1) % side != 0 && i + 1 < sim.nodes)
+						sim.link[i + 1][i + 2] = sim.link[i + 2][i + 1] = true;
+					if (i + side < sim.nodes)
+						sim.link[i + 1][i + side + 1] = sim.link[i + side + 1][i + 1] = true;
+				}
+		}
+	else
+		{
+			double x[MAX_NODES + 1], y[MAX_NODES + 1];
+			for (int i = 1; i <= sim.nodes; ++i)
+				{
+					x[i] = (sim_random() % 10000) / 1e4;
+					y[i] = (sim_random() % 10000) / 1e4;
+				}
+			for (int i = 1; i <= sim.nodes; ++i)
+				for (int j = i + 1; j <= sim.nodes; ++j)
+					if (hypot(x[i] - x[j], y[i] - y[j]) < range)
+						sim.link[i][j] = sim.link[j][i] = true;
+		}
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr,
+	        "usage: %s [options]\n"
+	        "  -n N         nodes (default 16)\n"
+	        "  -T SHAPE     topology: line, grid or random (default grid)\n"
+	        "  -R RANGE     radio range for random, in a unit square (default 0.3)\n"
+	        "  -l PERMILLE  loss per transmission (default 0)\n"
+	        "  -d MS        link delay (default 2)\n"
+	        "  -j MS        link jitter (default 1)\n"
+	        "  -p MS        time a forwarder holds a frame (default 1)\n"
+	        "  -i MS        interval between test frames (default 50)\n"
+	        "  -w SECONDS   time before the test frames start (default 20)\n"
+	        "  -t SECONDS   simulated time (default 120)\n"
+	        "  -s SEED      random seed (default 1)\n",
+	        name);
+}
+
+int main(int argc, char** argv)
+{
+	const char* shape = "grid";
+	double range = 0.3;
+
+	sim.nodes = 16;
+	sim.delay_us = 2000;
+	sim.jitter_us = 1000;
+	sim.process_us = 1000;
+	sim.interval_us = 50000;
+	sim.warmup_us = 20000000;
+	sim.duration_us = 120000000;
+	sim.rng = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:T:R:l:d:j:p:i:w:t:s:h")) != -1)
+		{
+			switch (opt)
+				{
+				case 'n': sim.nodes = strtoul(optarg, NULL, 0); break;
+				case 'T': shape = optarg; break;
+				case 'R': range = strtod(optarg, NULL); break;
+				case 'l': sim.loss = strtoul(optarg, NULL, 0); break;
+				case 'd': sim.delay_us = strtoul(optarg, NULL, 0) * 1000; break;
+				case 'j': sim.jitter_us = strtoul(optarg, NULL, 0) * 1000; break;
+				case 'p': sim.process_us = strtoul(optarg, NULL, 0) * 1000; break;
+				case 'i': sim.interval_us = strtoul(optarg, NULL, 0) * 1000; break;
+				case 'w': sim.warmup_us = strtoll(optarg, NULL, 0) * 1000000; break;
+				case 't': sim.duration_us = strtoll(optarg, NULL, 0) * 1000000; break;
+				case 's': sim.rng = strtoull(optarg, NULL, 0); break;
+				default:
+					usage(argv[0]);
+					return 2;
+				}
+		}
+	if (sim.nodes < 2 || sim.nodes > MAX_NODES || sim.interval_us == 0)
+		{
+			usage(argv[0]);
+			return 2;
+		}
+
+	sim_topology(shape, range);
+	sim_distances();
+
+	int links = 0, pairs = 0, diameter = 0;
+	for (int i = 1; i <= sim.nodes; ++i)
+		for (int j = 1; j <= sim.nodes; ++j)
+			{
+				links += sim.link[i][j];
+				pairs += sim.distance[i][j] != 0;
+				if (sim.distance[i][j] > diameter)
+					diameter = sim.distance[i][j];
+			}
+	if (!pairs)
+		{
+			fprintf(stderr, "No two nodes are in range of each other\n");
+			return 1;
+		}
+
+	for (int node = 1; node <= sim.nodes; ++node)
+		{
+			lownet_mesh_init(&sim.mesh[node], node);
+			event_t beacon = {
+				.time = sim_random() % (LOWNET_MESH_BEACON_MS * 1000),
+				.type = EV_BEACON,
+				.node = node,
+			};
+			sim_push(&beacon);
+		}
+	event_t traffic = { .time = sim.warmup_us, .type = EV_TRAFFIC };
+	sim_push(&traffic);
+
+	sim.converged = -1;
+	while (sim.pending)
+		{
+			event_t e;
+			sim_pop(&e);
+			if (e.time > sim.duration_us)
+				break;
+
+			switch (e.type)
+				{
+				case EV_BEACON:
+					{
+						lownet_frame_t frame;
+						int start = 0;
+						do
+							{
+								start = lownet_mesh_beacon(&sim.mesh[e.node], &frame, start, e.time);
+								sim_transmit(e.node, LOWNET_BROADCAST_ADDRESS, &frame, e.time);
+							}
+						while (start);
+						if (sim.converged < 0 && sim_converged(e.time))
+							sim.converged = e.time;
+						// Beacons drift a little, as timers on separate boards do.
+						e.time += LOWNET_MESH_BEACON_MS * 1000 + sim_random() % 20000;
+						sim_push(&e);
+						break;
+					}
+				case EV_RECEIVE:
+					sim_receive(&e);
+					break;
+				case EV_SEND:
+					{
+						lownet_rx_info_t info = { .timestamp = e.received };
+						lownet_mesh_forwarded(&sim.mesh[e.node], &info, e.time);
+						sim_transmit(e.node, e.link, &e.frame, e.time);
+						break;
+					}
+				case EV_TRAFFIC:
+					if (sim.sent < MAX_TRAFFIC)
+						{
+							sim_traffic(e.time);
+							e.time += sim.interval_us;
+							sim_push(&e);
+						}
+					break;
+				}
+		}
+
+	lownet_mesh_stats_t total = {0};
+	for (int node = 1; node <= sim.nodes; ++node)
+		{
+			lownet_mesh_stats_t stats = lownet_mesh_stats(&sim.mesh[node]);
+			total.forwarded += stats.forwarded;
+			total.flooded += stats.flooded;
+			total.duplicates += stats.duplicates;
+			total.expired += stats.expired;
+			if (stats.residence_max_us > total.residence_max_us)
+				total.residence_max_us = stats.residence_max_us;
+		}
+
+	printf("topology:    %s, %d nodes, %d links, diameter %d hops\n",
+	       shape, sim.nodes, links / 2, diameter);
+	printf("link:        loss %u/1000, delay %u+%u ms, %u ms per forward\n",
+	       sim.loss, sim.delay_us / 1000, sim.jitter_us / 1000, sim.process_us / 1000);
+	if (sim.converged >= 0)
+		printf("routes:      converged after %.1f s\n", sim.converged / 1e6);
+	else
+		printf("routes:      NOT converged\n");
+	printf("delivered:   %u of %u frames (%.1f%%), %u duplicate\n",
+	       sim.delivered, sim.sent, sim.sent ? 100.0 * sim.delivered / sim.sent : 0.0,
+	       sim.duplicates);
+	if (sim.delivered)
+		{
+			printf("hops:        %.2f avg, %.0f%% of the shortest path\n",
+			       (double) sim.hops_sum / sim.delivered,
+			       (double) sim.stretch_sum / sim.delivered);
+			printf("latency:     %.2f ms avg, %.2f ms max\n",
+			       sim.latency_sum / 1e3 / sim.delivered, sim.latency_max / 1e3);
+		}
+	printf("forwarding:  %u routed, %u flooded, %u copies suppressed, %u expired\n",
+	       total.forwarded, total.flooded, total.duplicates, total.expired);
+	printf("air:         %u transmissions, %u beacons, %.2f per delivered frame\n",
+	       sim.transmissions, sim.beacon_transmissions,
+	       sim.delivered ? (double) (sim.transmissions - sim.beacon_transmissions) / sim.delivered : 0.0);
+
+	free(sim.heap);
+	return sim.converged < 0 || sim.delivered == 0;
+}
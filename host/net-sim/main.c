@@ -0,0 +1,810 @@
+/*
+ * net-sim: runs the protocol components of a node against emulated
+ * peers over the in-process bus, in virtual time.  A scenario sets up
+ * the channel, the links and the peers and schedules commands; the same
+ * scenario and seed give the same run, to the microsecond.  Metrics come
+ * from the bus trace and are printed at the end.
+ */
+
+#include <ctype.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <crane.h>
+#include <dlog.h>
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <lownet.h>
+#include <lownet_reliable.h>
+#include <ping.h>
+#include <serial_io.h>
+
+#ifdef NET_SIM_COMMAND
+#include <command.h>
+#endif
+
+#include "crane_emu.h"
+#include "hostbus.h"
+#include "lownet_host.h"
+#include "metrics.h"
+#include "reliable_emu.h"
+
+#define SIM_LINE 256
+#define SIM_MAX_ACTIONS 1024
+#define SIM_MAX_CRANES 8
+#define SIM_MAX_NOISE 64
+#define SIM_NOISE_FIRST 0x40    // node id of the first noise node
+#define SIM_NOISE_PROTOCOL 0x3E // nobody listens to it
+#define SIM_MAX_RELIABLE 4
+#define SIM_RELIABLE_PROTOCOL 0x3D // records of the reliable transport tests
+#define SIM_RELIABLE_WAIT_MS 60000 // for room in the window
+#define SIM_LINGER_US 60000000  // run time after the last action by default
+
+static const uint8_t plain_magic[2] = {0x10, 0x4e};
+
+typedef struct
+{
+	int64_t at;          // virtual microseconds
+	int line;
+	char text[SIM_LINE];
+} sim_action_t;
+
+static struct
+{
+	const char* path;
+	uint64_t seed;
+	int64_t duration;    // 0 for SIM_LINGER_US after the last action
+	uint8_t node;
+	hostbus_link_t link; // the default link
+
+	sim_action_t actions[SIM_MAX_ACTIONS];
+	int num_actions;
+
+	struct
+	{
+		uint8_t node;
+		crane_emu_t* emu;
+		int64_t expect; // actions it must have executed by the end, -1 for any
+	} cranes[SIM_MAX_CRANES];
+	int num_cranes;
+
+	// Peers of the reliable transport, and the node's end of the test
+	// streams to and from them
+	struct
+	{
+		uint8_t node;
+		reliable_emu_t* emu;
+		TaskHandle_t task; // sends the node's records
+		uint32_t next;     // number of the next record to send
+		uint32_t end;      // records queued up to this number
+		uint32_t refused;  // records lownet_reliable_send did not queue
+		int64_t record;    // number of the next record from the peer
+		uint32_t received; // records taken in order
+		uint32_t errors;   // records corrupt or out of sequence
+	} reliables[SIM_MAX_RELIABLE];
+	int num_reliables;
+
+	// Noise nodes broadcast frames of SIZE bytes at exponentially
+	// distributed intervals, RATE per second each.
+	struct
+	{
+		TaskHandle_t task;
+		int count;
+		double rate;
+		uint8_t size;
+		int64_t next[SIM_MAX_NOISE];
+	} noise;
+
+	metrics_t metrics;
+} sim = {
+	.seed = 1,
+	.node = LOWNET_HOST_DEFAULT_ID,
+	.link = { .delay_ms = 5 },
+};
+
+static void usage(const char* name)
+{
+	fprintf(stderr,
+	        "usage: %s [options] SCENARIO\n"
+	        "  -s SEED      random seed, overrides the scenario's\n"
+	        "  -d TIME      network time to run, overrides the scenario's\n"
+	        "  -v           log protocol traffic\n"
+	        "\n"
+	        "Scenario lines, '#' starts a comment.  Lines are run at start up in\n"
+	        "order, or at TIME with an \"at TIME\" prefix.  TIME is a number with a\n"
+	        "unit of us, ms, s, m or h; milliseconds without one.\n"
+	        "  seed N                       random seed (default 1)\n"
+	        "  duration TIME                network time to run (default: 60 s after\n"
+	        "                               the last action)\n"
+	        "  node ID                      id of the simulated node (default 0x%02X)\n"
+	        "  link default|ID ID [loss P] [reorder P] [delay MS] [jitter MS]\n"
+	        "                               impair all links, or both directions of one;\n"
+	        "                               loss and reordering per mille\n"
+	        "  channel KBPS [csma|aloha]    give frames air time at KBPS, collisions\n"
+	        "                               with or without carrier sense; 0 for none\n"
+	        "  crane-emu ID [action MS] [status MS] [idle MS] [capacity N] [expect N]\n"
+	        "                               an emulated crane, which must have\n"
+	        "                               executed N actions by the end\n"
+	        "  responder ID                 a node answering pings\n"
+	        "  reliable ID [rto MS]         an emulated peer of the reliable transport\n"
+	        "  reliable-send ID N           the node sends N records to the peer ID\n"
+	        "  reliable-recv ID N           the peer ID sends N records to the node\n"
+	        "  noise N RATE SIZE            N nodes broadcasting RATE frames/s of SIZE bytes\n"
+	        "  reboot ID MS                 reboot an emulated crane or peer, down for MS\n"
+	        "  frame SRC DST PROTO HEX...   inject a frame\n"
+	        "  report                       print the metrics so far\n"
+	        "  /COMMAND ARGS                a serial command of the node: /ping, /crane\n",
+	        name, LOWNET_HOST_DEFAULT_ID);
+}
+
+// Usage: sim_time(TEXT, US)
+// Value: 0 and the time TEXT gives in *US, non-0 if TEXT is no time
+static int sim_time(const char* text, int64_t* us)
+{
+	char* unit;
+	double value = strtod(text, &unit);
+	if (unit == text || value < 0)
+		return 1;
+
+	double scale;
+	if (*unit == '\0' || strcmp(unit, "ms") == 0)
+		scale = 1e3;
+	else if (strcmp(unit, "us") == 0)
+		scale = 1;
+	else if (strcmp(unit, "s") == 0)
+		scale = 1e6;
+	else if (strcmp(unit, "m") == 0)
+		scale = 60e6;
+	else if (strcmp(unit, "h") == 0)
+		scale = 3600e6;
+	else
+		return 1;
+	*us = (int64_t) llround(value * scale);
+	return 0;
+}
+
+// Usage: sim_node(TEXT, NODE)
+// Value: 0 and the node id TEXT gives in *NODE, non-0 if it is none
+static int sim_node(const char* text, uint8_t* node)
+{
+	char* end;
+	unsigned long value = text ? strtoul(text, &end, 0) : 0;
+	if (!text || *end || value == 0 || value >= LOWNET_BROADCAST_ADDRESS)
+		return 1;
+	*node = value;
+	return 0;
+}
+
+static void sim_send(lownet_frame_t* frame)
+{
+	memcpy(frame->magic, plain_magic, sizeof plain_magic);
+	hostbus_send(frame);
+}
+
+// Answers pings the way ping.c does.
+static void sim_responder_receive(const lownet_frame_t* frame, void* ctx)
+{
+	uint8_t self = (uintptr_t) ctx;
+	ping_packet_t packet;
+
+	if ((frame->protocol & 0b00111111) != LOWNET_PROTOCOL_PING
+	    || frame->length < sizeof packet
+	    || memcmp(frame->magic, plain_magic, sizeof plain_magic) != 0)
+		return;
+	memcpy(&packet, frame->payload, sizeof packet);
+	if (packet.origin == self)
+		return;
+
+	lownet_frame_t reply;
+	memset(&reply, 0, sizeof reply);
+	reply.source = self;
+	reply.destination = frame->source;
+	reply.protocol = LOWNET_PROTOCOL_PING;
+	reply.length = frame->length;
+	memcpy(reply.payload, frame->payload, frame->length);
+	packet.timestamp_back = lownet_get_time();
+	memcpy(reply.payload, &packet, sizeof packet);
+	sim_send(&reply);
+}
+
+static int64_t sim_noise_interval(void)
+{
+	double u = (esp_random() + 1.0) / 4294967296.0;
+	return (int64_t)(-log(u) / sim.noise.rate * 1e6) + 1;
+}
+
+static void sim_noise_main(void* arg)
+{
+	while (true)
+		{
+			if (sim.noise.count == 0)
+				{
+					ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+					continue;
+				}
+
+			int first = 0;
+			for (int i = 1; i < sim.noise.count; ++i)
+				if (sim.noise.next[i] < sim.noise.next[first])
+					first = i;
+			int64_t wait = sim.noise.next[first] - esp_timer_get_time();
+			if (wait > 0)
+				{
+					ulTaskNotifyTake(pdTRUE, (wait + 999) / 1000);
+					continue;
+				}
+
+			lownet_frame_t frame;
+			memset(&frame, 0, sizeof frame);
+			frame.source = SIM_NOISE_FIRST + first;
+			frame.destination = LOWNET_BROADCAST_ADDRESS;
+			frame.protocol = SIM_NOISE_PROTOCOL;
+			frame.length = sim.noise.size;
+			esp_fill_random(frame.payload, frame.length);
+			sim_send(&frame);
+			sim.noise.next[first] += sim_noise_interval();
+		}
+}
+
+// Usage: sim_link(ARGS, LINK)
+// Pre:   ARGS is the rest of a link line, after strtok
+// Post:  LINK has been changed as ARGS says
+// Value: 0 on success, non-0 on a syntax error
+static int sim_link(hostbus_link_t* link)
+{
+	char* key;
+	while ((key = strtok(NULL, " \t")))
+		{
+			char* value = strtok(NULL, " \t");
+			if (!value)
+				return 1;
+			uint32_t n = strtoul(value, NULL, 0);
+			if (strcmp(key, "loss") == 0)
+				link->loss = n;
+			else if (strcmp(key, "reorder") == 0)
+				link->reorder = n;
+			else if (strcmp(key, "delay") == 0)
+				link->delay_ms = n;
+			else if (strcmp(key, "jitter") == 0)
+				link->jitter_ms = n;
+			else
+				return 1;
+		}
+	return 0;
+}
+
+static int sim_crane_emu(void)
+{
+	crane_emu_config_t config = CRANE_EMU_DEFAULTS;
+	int64_t expect = -1;
+	if (sim_node(strtok(NULL, " \t"), &config.node) || sim.num_cranes == SIM_MAX_CRANES)
+		return 1;
+
+	char* key;
+	while ((key = strtok(NULL, " \t")))
+		{
+			char* value = strtok(NULL, " \t");
+			if (!value)
+				return 1;
+			uint32_t n = strtoul(value, NULL, 0);
+			if (strcmp(key, "action") == 0)
+				config.action_ms = n;
+			else if (strcmp(key, "status") == 0)
+				config.status_ms = n;
+			else if (strcmp(key, "idle") == 0)
+				config.idle_ms = n;
+			else if (strcmp(key, "capacity") == 0)
+				config.capacity = n;
+			else if (strcmp(key, "expect") == 0)
+				expect = n;
+			else
+				return 1;
+		}
+
+	crane_emu_t* emu = crane_emu_create(&config);
+	if (!emu)
+		return 1;
+	sim.cranes[sim.num_cranes].node = config.node;
+	sim.cranes[sim.num_cranes].emu = emu;
+	sim.cranes[sim.num_cranes].expect = expect;
+	sim.num_cranes++;
+	return 0;
+}
+
+// Takes the records of the peers' test streams.  Record 0 starts a
+// stream over, after the peer rebooted.
+static void sim_reliable_receive(const lownet_segment_t* segment)
+{
+	for (int i = 0; i < sim.num_reliables; ++i)
+		if (sim.reliables[i].node == segment->source)
+			{
+				int64_t number = reliable_emu_check(segment->data, segment->length);
+				if (number < 0 || (number != 0 && number != sim.reliables[i].record))
+					{
+						fprintf(stderr, "0x%02x: record %lld where %lld was due\n", segment->source,
+						        (long long) number, (long long) sim.reliables[i].record);
+						sim.reliables[i].errors++;
+					}
+				sim.reliables[i].record = number + 1;
+				sim.reliables[i].received++;
+			}
+}
+
+static void sim_reliable_main(void* arg)
+{
+	uint8_t record[RELIABLE_EMU_RECORD];
+	int i = (intptr_t) arg;
+
+	while (true)
+		{
+			if (sim.reliables[i].next == sim.reliables[i].end)
+				{
+					ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+					continue;
+				}
+			reliable_emu_record(sim.reliables[i].next++, record);
+			if (lownet_reliable_send(sim.reliables[i].node, SIM_RELIABLE_PROTOCOL, record,
+			                         sizeof record, pdMS_TO_TICKS(SIM_RELIABLE_WAIT_MS))
+			    != sizeof record)
+				sim.reliables[i].refused++;
+		}
+}
+
+static int sim_reliable(void)
+{
+	reliable_emu_config_t config = RELIABLE_EMU_DEFAULTS;
+	config.protocol = SIM_RELIABLE_PROTOCOL;
+	if (sim_node(strtok(NULL, " \t"), &config.node) || sim.num_reliables == SIM_MAX_RELIABLE)
+		return 1;
+
+	char* key;
+	while ((key = strtok(NULL, " \t")))
+		{
+			char* value = strtok(NULL, " \t");
+			if (!value)
+				return 1;
+			if (strcmp(key, "rto") == 0)
+				config.rto_ms = strtoul(value, NULL, 0);
+			else
+				return 1;
+		}
+
+	int i = sim.num_reliables;
+	sim.reliables[i].node = config.node;
+	sim.reliables[i].emu = reliable_emu_create(&config);
+	if (!sim.reliables[i].emu
+	    || xTaskCreate(sim_reliable_main, "reliable_test", 4096, (void*)(intptr_t) i, 5,
+	                   &sim.reliables[i].task) != pdPASS)
+		return 1;
+	sim.num_reliables++;
+	return 0;
+}
+
+// Usage: sim_reliable_find(TEXT)
+// Value: The index of the reliable peer TEXT names, -1 if it is none
+static int sim_reliable_find(const char* text)
+{
+	uint8_t node;
+	if (sim_node(text, &node))
+		return -1;
+	for (int i = 0; i < sim.num_reliables; ++i)
+		if (sim.reliables[i].node == node)
+			return i;
+	return -1;
+}
+
+static int sim_noise(void)
+{
+	char* count = strtok(NULL, " \t");
+	char* rate = strtok(NULL, " \t");
+	char* size = strtok(NULL, " \t");
+	if (!count || !rate || !size)
+		return 1;
+
+	sim.noise.count = atoi(count);
+	sim.noise.rate = atof(rate);
+	sim.noise.size = atoi(size) > LOWNET_PAYLOAD_SIZE ? LOWNET_PAYLOAD_SIZE : atoi(size);
+	if (sim.noise.count < 0 || sim.noise.count > SIM_MAX_NOISE || sim.noise.rate <= 0)
+		{
+			sim.noise.count = 0;
+			return sim.noise.rate != 0;
+		}
+
+	int64_t now = esp_timer_get_time();
+	for (int i = 0; i < sim.noise.count; ++i)
+		{
+			sim.metrics.ignore[SIM_NOISE_FIRST + i] = 1;
+			sim.noise.next[i] = now + sim_noise_interval();
+		}
+	if (!sim.noise.task
+	    && xTaskCreate(sim_noise_main, "noise", 4096, NULL, 5, &sim.noise.task) != pdPASS)
+		return 1;
+	xTaskNotifyGive(sim.noise.task);
+	return 0;
+}
+
+static int sim_frame(void)
+{
+	lownet_frame_t frame;
+	memset(&frame, 0, sizeof frame);
+
+	char* source = strtok(NULL, " \t");
+	char* destination = strtok(NULL, " \t");
+	char* protocol = strtok(NULL, " \t");
+	if (!source || !destination || !protocol)
+		return 1;
+	frame.source = strtoul(source, NULL, 0);
+	frame.destination = strtoul(destination, NULL, 0);
+	frame.protocol = strtoul(protocol, NULL, 0);
+
+	char* hex;
+	while ((hex = strtok(NULL, " \t")))
+		for (; hex[0] && hex[1]; hex += 2)
+			{
+				if (frame.length == LOWNET_PAYLOAD_SIZE || !isxdigit((unsigned char) hex[0])
+				    || !isxdigit((unsigned char) hex[1]))
+					return 1;
+				char byte[3] = { hex[0], hex[1], '\0' };
+				frame.payload[frame.length++] = strtoul(byte, NULL, 16);
+			}
+	sim_send(&frame);
+	return 0;
+}
+
+static void sim_report(void)
+{
+	hostbus_stats_t bus = hostbus_stats();
+	double seconds = esp_timer_get_time() / 1e6;
+
+	printf("time:        %.3f s\n", seconds);
+	printf("channel:     %u frames, %u copies delivered, %u lost, %u collisions, %u deferred\n",
+	       bus.sent, bus.delivered, bus.lost, bus.collisions, bus.deferred);
+	for (int i = 0; i < sim.num_cranes; ++i)
+		{
+			crane_emu_stats_t stats = crane_emu_stats(sim.cranes[i].emu);
+			printf("crane 0x%02x:  %u actions executed, %u duplicate, %u out of order, "
+			       "%u NAK, %u handshakes, %u reboots\n",
+			       sim.cranes[i].node, stats.log_length, stats.duplicates, stats.out_of_order,
+			       stats.naks, stats.handshakes, stats.reboots);
+		}
+	for (int i = 0; i < sim.num_reliables; ++i)
+		{
+			lownet_reliable_stats_t node[LOWNET_RELIABLE_PEERS];
+			lownet_reliable_stats_t* stream = NULL;
+			size_t count = lownet_reliable_peers(node, LOWNET_RELIABLE_PEERS);
+			for (size_t j = 0; j < count; ++j)
+				if (node[j].node == sim.reliables[i].node)
+					stream = &node[j];
+			if (!stream)
+				continue;
+
+			reliable_emu_stats_t stats = reliable_emu_stats(sim.reliables[i].emu);
+			printf("reliable 0x%02x: node queued %u records, %u refused: %u retransmitted, "
+			       "%u fast, %u timeouts, %u failures; peer took %u in order in %u streams, "
+			       "%u out of order, %u RST, %u errors\n",
+			       sim.reliables[i].node, sim.reliables[i].next, sim.reliables[i].refused,
+			       stream->retransmitted, stream->fast, stream->timeouts, stream->failures,
+			       stats.records, stats.streams, stats.out_of_order, stats.resets, stats.errors);
+			printf("               peer sent %u records: %u retransmitted, %u resyncs; "
+			       "node took %u in order, %u out of order, %u errors\n",
+			       stats.sent, stats.retransmitted, stats.resyncs, sim.reliables[i].received,
+			       stream->out_of_order, sim.reliables[i].errors);
+		}
+	metrics_print(&sim.metrics, stdout, seconds);
+	fflush(stdout);
+}
+
+// Usage: sim_execute(ACTION)
+// Pre:   ACTION is a scenario line without its "at TIME"
+// Post:  ACTION has been carried out
+// Value: 0 on success, non-0 on an error
+static int sim_execute(sim_action_t* action)
+{
+	char* text = action->text;
+	if (text[0] == '/')
+		{
+			char* name = strtok(text + 1, " \t");
+			char* args = strtok(NULL, "");
+			if (!name)
+				return 1;
+			if (strcmp(name, "ping") == 0)
+				ping_command(args);
+			else if (strcmp(name, "crane") == 0)
+				crane_command(args);
+			else
+				return 1;
+			return 0;
+		}
+
+	char* directive = strtok(text, " \t");
+	if (strcmp(directive, "seed") == 0 || strcmp(directive, "duration") == 0
+	    || strcmp(directive, "node") == 0)
+		{
+			// Taken before the start
+			return 0;
+		}
+	else if (strcmp(directive, "link") == 0)
+		{
+			char* from = strtok(NULL, " \t");
+			if (from && strcmp(from, "default") == 0)
+				{
+					if (sim_link(&sim.link))
+						return 1;
+					return hostbus_set_link(0, 0, &sim.link);
+				}
+
+			uint8_t a, b;
+			hostbus_link_t link = sim.link;
+			if (sim_node(from, &a) || sim_node(strtok(NULL, " \t"), &b) || sim_link(&link))
+				return 1;
+			return hostbus_set_link(a, b, &link) || hostbus_set_link(b, a, &link);
+		}
+	else if (strcmp(directive, "channel") == 0)
+		{
+			char* rate = strtok(NULL, " \t");
+			char* mode = strtok(NULL, " \t");
+			if (!rate || (mode && strcmp(mode, "csma") != 0 && strcmp(mode, "aloha") != 0))
+				return 1;
+			hostbus_channel_t channel = {
+				.bitrate_kbps = strtoul(rate, NULL, 0),
+				.carrier_sense = !mode || strcmp(mode, "csma") == 0,
+			};
+			hostbus_set_channel(&channel);
+			return 0;
+		}
+	else if (strcmp(directive, "crane-emu") == 0)
+		{
+			return sim_crane_emu();
+		}
+	else if (strcmp(directive, "responder") == 0)
+		{
+			uint8_t node;
+			if (sim_node(strtok(NULL, " \t"), &node))
+				return 1;
+			return hostbus_attach(node, sim_responder_receive, (void*)(uintptr_t) node);
+		}
+	else if (strcmp(directive, "reliable") == 0)
+		{
+			return sim_reliable();
+		}
+	else if (strcmp(directive, "reliable-send") == 0 || strcmp(directive, "reliable-recv") == 0)
+		{
+			int i = sim_reliable_find(strtok(NULL, " \t"));
+			char* count = strtok(NULL, " \t");
+			if (i < 0 || !count)
+				return 1;
+			if (strcmp(directive, "reliable-recv") == 0)
+				{
+					reliable_emu_send(sim.reliables[i].emu, sim.node, strtoul(count, NULL, 0));
+					return 0;
+				}
+			sim.reliables[i].end += strtoul(count, NULL, 0);
+			xTaskNotifyGive(sim.reliables[i].task);
+			return 0;
+		}
+	else if (strcmp(directive, "noise") == 0)
+		{
+			return sim_noise();
+		}
+	else if (strcmp(directive, "reboot") == 0)
+		{
+			uint8_t node;
+			char* down = NULL;
+			if (sim_node(strtok(NULL, " \t"), &node) || !(down = strtok(NULL, " \t")))
+				return 1;
+			for (int i = 0; i < sim.num_cranes; ++i)
+				if (sim.cranes[i].node == node)
+					{
+						crane_emu_reboot(sim.cranes[i].emu, strtoul(down, NULL, 0));
+						return 0;
+					}
+			for (int i = 0; i < sim.num_reliables; ++i)
+				if (sim.reliables[i].node == node)
+					{
+						reliable_emu_reboot(sim.reliables[i].emu, strtoul(down, NULL, 0));
+						return 0;
+					}
+			return 1;
+		}
+	else if (strcmp(directive, "frame") == 0)
+		{
+			return sim_frame();
+		}
+	else if (strcmp(directive, "report") == 0)
+		{
+			sim_report();
+			return 0;
+		}
+	return 1;
+}
+
+static int sim_compare(const void* a, const void* b)
+{
+	const sim_action_t* x = a;
+	const sim_action_t* y = b;
+	if (x->at != y->at)
+		return x->at < y->at ? -1 : 1;
+	return x->line - y->line;
+}
+
+// Usage: sim_load(PATH)
+// Post:  The lines of the scenario in PATH are in sim.actions, in the
+//        order they run; seed, duration and node have been taken
+// Value: 0 on success, non-0 on an error, which has been reported
+static int sim_load(const char* path)
+{
+	FILE* file = fopen(path, "r");
+	if (!file)
+		{
+			perror(path);
+			return 1;
+		}
+
+	char line[SIM_LINE];
+	int number = 0;
+	int error = 0;
+	while (!error && fgets(line, sizeof line, file))
+		{
+			++number;
+			line[strcspn(line, "#\r\n")] = '\0';
+			char* text = line + strspn(line, " \t");
+			size_t length = strlen(text);
+			while (length && isspace((unsigned char) text[length - 1]))
+				text[--length] = '\0';
+			if (!length)
+				continue;
+
+			int64_t at = 0;
+			if (strncmp(text, "at ", 3) == 0)
+				{
+					char* time = text + 3 + strspn(text + 3, " \t");
+					char* rest = time + strcspn(time, " \t");
+					if (*rest)
+						*rest++ = '\0';
+					text = rest + strspn(rest, " \t");
+					error = sim_time(time, &at) || !*text;
+				}
+			else if (strncmp(text, "seed ", 5) == 0)
+				sim.seed = strtoull(text + 5, NULL, 0);
+			else if (strncmp(text, "duration ", 9) == 0)
+				error = sim_time(text + 9 + strspn(text + 9, " \t"), &sim.duration);
+			else if (strncmp(text, "node ", 5) == 0)
+				error = sim_node(text + 5 + strspn(text + 5, " \t"), &sim.node);
+
+			if (error || sim.num_actions == SIM_MAX_ACTIONS)
+				{
+					fprintf(stderr, "%s:%d: %s\n", path, number,
+					        error ? "syntax error" : "too many lines");
+					error = 1;
+					break;
+				}
+			sim_action_t* action = &sim.actions[sim.num_actions++];
+			action->at = at;
+			action->line = number;
+			snprintf(action->text, sizeof action->text, "%s", text);
+		}
+	fclose(file);
+
+	qsort(sim.actions, sim.num_actions, sizeof *sim.actions, sim_compare);
+	return error;
+}
+
+static void sim_wait_until(int64_t at)
+{
+	int64_t wait = at - esp_timer_get_time();
+	if (wait > 0)
+		vTaskDelay((wait + 999) / 1000);
+}
+
+int main(int argc, char** argv)
+{
+	int64_t duration = -1;
+	uint64_t seed = 0;
+	esp_log_level_t level = ESP_LOG_WARN;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "s:d:vh")) != -1)
+		{
+			switch (opt)
+				{
+				case 's': seed = strtoull(optarg, NULL, 0); break;
+				case 'd':
+					if (sim_time(optarg, &duration))
+						{
+							usage(argv[0]);
+							return 2;
+						}
+					break;
+				case 'v': level = ESP_LOG_INFO; break;
+				default:
+					usage(argv[0]);
+					return 2;
+				}
+		}
+	if (optind != argc - 1)
+		{
+			usage(argv[0]);
+			return 2;
+		}
+	if (sim_load(argv[optind]))
+		return 2;
+	if (seed)
+		sim.seed = seed;
+	if (duration >= 0)
+		sim.duration = duration;
+	if (!sim.duration)
+		sim.duration = (sim.num_actions ? sim.actions[sim.num_actions - 1].at : 0) + SIM_LINGER_US;
+
+	struct timespec wall_start;
+	clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+	esp_log_level_set("*", level);
+	dlog_level = level;
+	esp_random_seed(sim.seed);
+	hostbus_init(&sim.link);
+	hostbus_trace(metrics_trace, &sim.metrics);
+
+	init_serial_service();
+	lownet_host_set_id(sim.node);
+	lownet_init(NULL, NULL);
+	// Network time starts at 0, for runs to be the same.
+	lownet_time_t epoch = { 0, 0 };
+	lownet_set_time(&epoch);
+	if (crane_init() != 0)
+		return 1;
+	ping_init();
+	lownet_reliable_init();
+	if (lownet_reliable_register(SIM_RELIABLE_PROTOCOL, sim_reliable_receive) != 0)
+		return 1;
+#ifdef NET_SIM_COMMAND
+	command_init();
+#endif
+
+	for (int i = 0; i < sim.num_actions; ++i)
+		{
+			sim_action_t* action = &sim.actions[i];
+			if (action->at > sim.duration)
+				break;
+			sim_wait_until(action->at);
+			char text[SIM_LINE];
+			snprintf(text, sizeof text, "%s", action->text);
+			if (sim_execute(action))
+				{
+					fprintf(stderr, "%s:%d: cannot run \"%s\"\n", argv[optind], action->line, text);
+					return 2;
+				}
+		}
+	sim_wait_until(sim.duration);
+
+	struct timespec wall_end;
+	clock_gettime(CLOCK_MONOTONIC, &wall_end);
+	double wall = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+
+	printf("--- %s, seed %llu ---\n", argv[optind], (unsigned long long) sim.seed);
+	sim_report();
+	fprintf(stderr, "simulated %.1f s in %.2f s of wall time\n", sim.duration / 1e6, wall);
+
+	// Records lost or out of order are a failure of the transport, and
+	// a crane short of its actions one of the crane client.
+	for (int i = 0; i < sim.num_cranes; ++i)
+		{
+			uint32_t executed = crane_emu_stats(sim.cranes[i].emu).log_length;
+			if (sim.cranes[i].expect >= 0 && executed != sim.cranes[i].expect)
+				{
+					fprintf(stderr, "crane 0x%02x executed %u actions, expected %lld\n",
+					        sim.cranes[i].node, executed, (long long) sim.cranes[i].expect);
+					return 1;
+				}
+		}
+	for (int i = 0; i < sim.num_reliables; ++i)
+		if (sim.reliables[i].errors || reliable_emu_stats(sim.reliables[i].emu).errors)
+			return 1;
+	return 0;
+}
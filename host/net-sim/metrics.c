@@ -0,0 +1,133 @@
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_timer.h>
+
+static uint32_t metrics_key(const lownet_frame_t* frame)
+{
+	uint32_t hash = 2166136261u;
+	const uint8_t head[] = { frame->source, frame->destination, frame->protocol, frame->length };
+	for (size_t i = 0; i < sizeof head; ++i)
+		hash = (hash ^ head[i]) * 16777619u;
+	for (size_t i = 0; i < frame->length && i < LOWNET_PAYLOAD_SIZE; ++i)
+		hash = (hash ^ frame->payload[i]) * 16777619u;
+	return hash;
+}
+
+// Pre:   PROTOCOL->delivered counts the message LATENCY belongs to
+static void metrics_latency(metrics_protocol_t* protocol, int64_t latency)
+{
+	uint32_t i = protocol->delivered - 1;
+	if (i == protocol->capacity)
+		{
+			uint32_t capacity = protocol->capacity ? 2 * protocol->capacity : 256;
+			int32_t* latencies = realloc(protocol->latencies, capacity * sizeof *latencies);
+			if (!latencies)
+				return;
+			protocol->latencies = latencies;
+			protocol->capacity = capacity;
+		}
+	if (i < protocol->capacity)
+		protocol->latencies[i] = latency > INT32_MAX ? INT32_MAX : (int32_t) latency;
+}
+
+void metrics_trace(hostbus_event_t event, const lownet_frame_t* frame,
+                   uint8_t receiver, void* ctx)
+{
+	metrics_t* metrics = ctx;
+	if (metrics->ignore[frame->source])
+		return;
+
+	metrics_protocol_t* protocol = &metrics->protocols[frame->protocol & 0b00111111];
+	int64_t now = esp_timer_get_time();
+	uint32_t key = metrics_key(frame);
+	metrics_message_t* message = &metrics->messages[key % METRICS_MESSAGES];
+
+	switch (event)
+		{
+		case HOSTBUS_SENT:
+			protocol->frames++;
+			if (message->key == key && message->first_us
+			    && now - message->last_us < (int64_t) METRICS_RETRANSMIT_MS * 1000)
+				{
+					protocol->retransmissions++;
+					message->last_us = now;
+					break;
+				}
+			protocol->messages++;
+			message->key = key;
+			message->first_us = now;
+			message->last_us = now;
+			message->delivered = 0;
+			break;
+
+		case HOSTBUS_DELIVERED:
+			if (frame->destination != receiver && frame->destination != LOWNET_BROADCAST_ADDRESS)
+				break;
+			if (message->key != key || message->delivered)
+				break;
+			message->delivered = 1;
+			protocol->delivered++;
+			protocol->bytes += frame->length;
+			metrics_latency(protocol, now - message->first_us);
+			break;
+
+		case HOSTBUS_LOST:
+			protocol->lost++;
+			break;
+
+		case HOSTBUS_COLLIDED:
+			protocol->collided++;
+			break;
+		}
+}
+
+static int metrics_compare(const void* a, const void* b)
+{
+	int32_t x = *(const int32_t*) a, y = *(const int32_t*) b;
+	return (x > y) - (x < y);
+}
+
+// Value: The P-th percentile of the N sorted LATENCIES, in milliseconds
+static double metrics_percentile(const int32_t* latencies, uint32_t n, double p)
+{
+	if (n == 0)
+		return 0.0;
+	uint32_t i = (uint32_t)(p / 100.0 * (n - 1) + 0.5);
+	return latencies[i] / 1e3;
+}
+
+void metrics_print(metrics_t* metrics, FILE* out, double seconds)
+{
+	static const char* names[METRICS_PROTOCOLS] = {
+		[0x01] = "time", [0x02] = "chat", [0x03] = "ping", [0x04] = "command",
+		[0x05] = "crane", [0x06] = "pktgen", [0x07] = "mesh",
+	};
+
+	fprintf(out, "protocol     frames  messages  retrans  delivered  goodput B/s"
+	        "     p50 ms    p90 ms    p99 ms    max ms\n");
+	for (int i = 0; i < METRICS_PROTOCOLS; ++i)
+		{
+			metrics_protocol_t* protocol = &metrics->protocols[i];
+			if (!protocol->frames)
+				continue;
+
+			uint32_t n = protocol->delivered < protocol->capacity ? protocol->delivered : protocol->capacity;
+			qsort(protocol->latencies, n, sizeof *protocol->latencies, metrics_compare);
+
+			char name[16];
+			if (names[i])
+				snprintf(name, sizeof name, "%s", names[i]);
+			else
+				snprintf(name, sizeof name, "0x%02x", i);
+			fprintf(out, "%-10s %8u  %8u  %7u  %9u  %11.1f  %9.3f %9.3f %9.3f %9.3f\n",
+			        name, protocol->frames, protocol->messages, protocol->retransmissions,
+			        protocol->delivered, seconds > 0 ? protocol->bytes / seconds : 0.0,
+			        metrics_percentile(protocol->latencies, n, 50),
+			        metrics_percentile(protocol->latencies, n, 90),
+			        metrics_percentile(protocol->latencies, n, 99),
+			        metrics_percentile(protocol->latencies, n, 100));
+		}
+}
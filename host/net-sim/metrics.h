@@ -0,0 +1,61 @@
+#ifndef GUARD_NET_SIM_METRICS_H
+#define GUARD_NET_SIM_METRICS_H
+
+/*
+ * Traffic metrics from the bus trace, per protocol.  A message is a
+ * distinct payload from a source to a destination; sending it again
+ * within METRICS_RETRANSMIT_MS of the last copy is a retransmission.
+ * Latency runs from the first copy sent to the first one delivered, so
+ * it includes the time retransmissions took.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hostbus.h"
+
+#define METRICS_PROTOCOLS 64
+#define METRICS_MESSAGES 4096 // messages tracked at a time
+#define METRICS_RETRANSMIT_MS 10000
+
+typedef struct
+{
+	uint32_t frames;          // frames sent
+	uint32_t messages;        // distinct messages sent
+	uint32_t retransmissions; // frames repeating a message
+	uint32_t delivered;       // messages that reached their destination
+	uint64_t bytes;           // payload bytes of those
+	uint32_t lost;            // copies dropped by a link
+	uint32_t collided;        // copies destroyed on the air
+
+	int32_t* latencies;       // microseconds, one per delivered message
+	uint32_t capacity;
+} metrics_protocol_t;
+
+typedef struct
+{
+	uint32_t key;             // hash of the frame header and payload
+	int64_t first_us;         // esp_timer time of the first copy sent
+	int64_t last_us;          // ... and of the latest
+	uint8_t delivered;
+} metrics_message_t;
+
+typedef struct
+{
+	metrics_protocol_t protocols[METRICS_PROTOCOLS];
+	uint8_t ignore[256];      // sources left out, the noise nodes
+	metrics_message_t messages[METRICS_MESSAGES];
+} metrics_t;
+
+// Usage: metrics_trace(EVENT, FRAME, RECEIVER, METRICS)
+// Post:  The event has been accounted in METRICS
+// Note:  A hostbus_trace_fn, register it with METRICS as the context
+void metrics_trace(hostbus_event_t event, const lownet_frame_t* frame,
+                   uint8_t receiver, void* metrics);
+
+// Usage: metrics_print(METRICS, OUT, SECONDS)
+// Post:  A table of the protocols seen over SECONDS of network time,
+//        with goodput and latency percentiles, has been written to OUT
+void metrics_print(metrics_t* metrics, FILE* out, double seconds);
+
+#endif
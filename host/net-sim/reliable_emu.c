@@ -0,0 +1,356 @@
+#include "reliable_emu.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <lownet.h>
+
+#include "hostbus.h"
+
+#define TAG "reliable-emu"
+
+#define WINDOW LOWNET_RELIABLE_WINDOW
+
+struct reliable_emu
+{
+	reliable_emu_config_t config;
+	SemaphoreHandle_t lock;
+	TaskHandle_t task;
+
+	int64_t down_until;  // rebooting, deaf and silent until then
+
+	// Receive side: segments from rcv_nxt on are buffered until they can
+	// be taken in order.
+	bool synced;
+	uint16_t rcv_syn;    // number of the first segment of the stream
+	uint16_t rcv_nxt;
+	int64_t record;      // number of the next record, -1 for any
+	struct
+	{
+		bool have;
+		uint8_t length;
+		uint8_t data[RELIABLE_EMU_RECORD];
+	} in[WINDOW];
+
+	// Send side: segments snd_una..snd_nxt - 1 are in flight, at their
+	// number modulo the window.
+	uint8_t peer;        // node the records go to
+	bool syn;            // the next new segment starts the stream
+	uint16_t snd_una;
+	uint16_t snd_nxt;
+	uint32_t next;       // number of the next record to send
+	uint32_t end;        // records queued up to this number
+	struct
+	{
+		uint32_t record;
+		uint8_t flags;
+		bool acked;
+		int64_t sent_at;
+	} out[WINDOW];
+
+	reliable_emu_stats_t stats;
+};
+
+void reliable_emu_record(uint32_t number, uint8_t* record)
+{
+	memcpy(record, &number, sizeof number);
+	for (size_t i = sizeof number; i < RELIABLE_EMU_RECORD; ++i)
+		record[i] = (number + i) % 251;
+}
+
+int64_t reliable_emu_check(const uint8_t* record, size_t length)
+{
+	uint32_t number;
+	if (length != RELIABLE_EMU_RECORD)
+		return -1;
+	memcpy(&number, record, sizeof number);
+	for (size_t i = sizeof number; i < RELIABLE_EMU_RECORD; ++i)
+		if (record[i] != (number + i) % 251)
+			return -1;
+	return number;
+}
+
+static void reliable_emu_transmit(reliable_emu_t* emu, uint8_t destination,
+                                  const lownet_reliable_header_t* header, const uint8_t* data,
+                                  uint8_t length)
+{
+	static const uint8_t plain_magic[2] = {0x10, 0x4e};
+	lownet_frame_t frame;
+
+	memset(&frame, 0, sizeof frame);
+	memcpy(frame.magic, plain_magic, sizeof plain_magic);
+	frame.source = emu->config.node;
+	frame.destination = destination;
+	frame.protocol = LOWNET_PROTOCOL_RELIABLE;
+	frame.length = sizeof *header + length;
+	memcpy(frame.payload, header, sizeof *header);
+	if (length)
+		memcpy(frame.payload + sizeof *header, data, length);
+	hostbus_send(&frame);
+}
+
+// Pre: EMU->lock is held
+static void reliable_emu_ack(reliable_emu_t* emu, uint8_t destination)
+{
+	lownet_reliable_header_t header = {
+		.flags = LOWNET_RELIABLE_ACK,
+		.ack = emu->rcv_nxt,
+	};
+	for (int i = 0; i < WINDOW - 1; ++i)
+		if (emu->in[(uint16_t) (emu->rcv_nxt + 1 + i) % WINDOW].have)
+			header.sack |= 1u << i;
+	reliable_emu_transmit(emu, destination, &header, NULL, 0);
+}
+
+// Pre: EMU->lock is held
+static void reliable_emu_segment(reliable_emu_t* emu, uint16_t seq, int64_t now)
+{
+	uint8_t record[RELIABLE_EMU_RECORD];
+	lownet_reliable_header_t header = {
+		.protocol = emu->config.protocol,
+		.flags = emu->out[seq % WINDOW].flags | LOWNET_RELIABLE_DATA,
+		.seq = seq,
+	};
+	reliable_emu_record(emu->out[seq % WINDOW].record, record);
+	emu->out[seq % WINDOW].sent_at = now;
+	reliable_emu_transmit(emu, emu->peer, &header, record, sizeof record);
+}
+
+// Pre: EMU->lock is held
+static void reliable_emu_acknowledged(reliable_emu_t* emu, uint16_t ack, uint32_t sack)
+{
+	if ((uint16_t) (ack - emu->snd_una) > (uint16_t) (emu->snd_nxt - emu->snd_una))
+		return;
+	for (uint16_t seq = ack + 1; seq != emu->snd_nxt; ++seq)
+		{
+			uint16_t beyond = seq - ack - 1;
+			if (beyond < 32 && (sack & (1u << beyond)))
+				emu->out[seq % WINDOW].acked = true;
+		}
+	for (; emu->snd_una != ack; ++emu->snd_una)
+		{
+			emu->out[emu->snd_una % WINDOW].acked = false;
+			emu->stats.acked++;
+		}
+}
+
+// Pre: EMU->lock is held
+static void reliable_emu_data(reliable_emu_t* emu, uint8_t source,
+                              const lownet_reliable_header_t* header, const uint8_t* data,
+                              uint8_t length)
+{
+	emu->stats.segments++;
+	if ((header->flags & LOWNET_RELIABLE_SYN) && (!emu->synced || header->seq != emu->rcv_syn))
+		{
+			emu->synced = true;
+			emu->rcv_syn = emu->rcv_nxt = header->seq;
+			emu->record = -1;
+			for (int i = 0; i < WINDOW; ++i)
+				emu->in[i].have = false;
+			emu->stats.streams++;
+		}
+	if (!emu->synced)
+		{
+			lownet_reliable_header_t reset = { .flags = LOWNET_RELIABLE_RST };
+			reliable_emu_transmit(emu, source, &reset, NULL, 0);
+			emu->stats.resets++;
+			return;
+		}
+
+	uint16_t offset = header->seq - emu->rcv_nxt;
+	if (offset >= WINDOW || emu->in[header->seq % WINDOW].have)
+		emu->stats.duplicates++;
+	else
+		{
+			emu->in[header->seq % WINDOW].have = true;
+			emu->in[header->seq % WINDOW].length = length;
+			memcpy(emu->in[header->seq % WINDOW].data, data, length);
+			if (offset)
+				emu->stats.out_of_order++;
+		}
+
+	while (emu->in[emu->rcv_nxt % WINDOW].have)
+		{
+			emu->in[emu->rcv_nxt % WINDOW].have = false;
+			int64_t number = reliable_emu_check(emu->in[emu->rcv_nxt % WINDOW].data,
+			                                    emu->in[emu->rcv_nxt % WINDOW].length);
+			if (number < 0 || (emu->record >= 0 && number != emu->record))
+				{
+					ESP_LOGW(TAG, "0x%02x: record %lld where %lld was due", emu->config.node,
+					         (long long) number, (long long) emu->record);
+					emu->stats.errors++;
+				}
+			emu->record = number < 0 ? -1 : number + 1;
+			emu->stats.records++;
+			emu->rcv_nxt++;
+		}
+
+	// Every segment is acknowledged at once.
+	reliable_emu_ack(emu, source);
+}
+
+static void reliable_emu_receive(const lownet_frame_t* frame, void* ctx)
+{
+	reliable_emu_t* emu = ctx;
+	lownet_reliable_header_t header;
+
+	if ((frame->protocol & 0b00111111) != LOWNET_PROTOCOL_RELIABLE
+	    || frame->destination != emu->config.node || frame->length < sizeof header)
+		return;
+	memcpy(&header, frame->payload, sizeof header);
+
+	xSemaphoreTake(emu->lock, portMAX_DELAY);
+	if (esp_timer_get_time() < emu->down_until)
+		{
+			emu->stats.ignored++;
+		}
+	else
+		{
+			// The node has no stream from us: the oldest segment in flight
+			// starts it over, and everything it held is sent again.
+			if ((header.flags & LOWNET_RELIABLE_RST) && emu->snd_una != emu->snd_nxt)
+				{
+					emu->out[emu->snd_una % WINDOW].flags |= LOWNET_RELIABLE_SYN;
+					for (uint16_t seq = emu->snd_una; seq != emu->snd_nxt; ++seq)
+						{
+							emu->out[seq % WINDOW].acked = false;
+							emu->out[seq % WINDOW].sent_at = 0;
+						}
+					emu->stats.resyncs++;
+				}
+			else if (header.flags & LOWNET_RELIABLE_RST)
+				emu->syn = true;
+			if ((header.flags & LOWNET_RELIABLE_ACK) && frame->source == emu->peer)
+				reliable_emu_acknowledged(emu, header.ack, header.sack);
+			if (header.flags & LOWNET_RELIABLE_DATA)
+				reliable_emu_data(emu, frame->source, &header, frame->payload + sizeof header,
+				                  frame->length - sizeof header);
+		}
+	xSemaphoreGive(emu->lock);
+	// Acknowledgements open the window.
+	xTaskNotifyGive(emu->task);
+}
+
+// Usage: reliable_emu_tick(EMU)
+// Pre:   EMU->lock is held
+// Post:  New records have been sent as far as the window allows, and
+//        those which timed out again
+// Value: The esp_timer time something is due next, INT64_MAX if nothing
+//        is until a frame comes in
+static int64_t reliable_emu_tick(reliable_emu_t* emu)
+{
+	int64_t now = esp_timer_get_time();
+	int64_t rto = (int64_t) emu->config.rto_ms * 1000;
+	if (now < emu->down_until)
+		return emu->down_until;
+
+	while (emu->next != emu->end && (uint16_t) (emu->snd_nxt - emu->snd_una) < WINDOW)
+		{
+			emu->out[emu->snd_nxt % WINDOW].record = emu->next++;
+			emu->out[emu->snd_nxt % WINDOW].flags = LOWNET_RELIABLE_END
+				| (emu->syn ? LOWNET_RELIABLE_SYN : 0);
+			emu->out[emu->snd_nxt % WINDOW].acked = false;
+			emu->syn = false;
+			reliable_emu_segment(emu, emu->snd_nxt++, now);
+			emu->stats.sent++;
+		}
+
+	int64_t next = INT64_MAX;
+	for (uint16_t seq = emu->snd_una; seq != emu->snd_nxt; ++seq)
+		{
+			if (emu->out[seq % WINDOW].acked)
+				continue;
+			if (now - emu->out[seq % WINDOW].sent_at >= rto)
+				{
+					reliable_emu_segment(emu, seq, now);
+					emu->stats.retransmitted++;
+				}
+			if (emu->out[seq % WINDOW].sent_at + rto < next)
+				next = emu->out[seq % WINDOW].sent_at + rto;
+		}
+	return next;
+}
+
+static void reliable_emu_main(void* arg)
+{
+	reliable_emu_t* emu = arg;
+
+	while (true)
+		{
+			xSemaphoreTake(emu->lock, portMAX_DELAY);
+			int64_t next = reliable_emu_tick(emu);
+			xSemaphoreGive(emu->lock);
+
+			TickType_t wait = portMAX_DELAY;
+			if (next != INT64_MAX)
+				{
+					int64_t us = next - esp_timer_get_time();
+					wait = us > 0 ? (us + 999) / 1000 : 0;
+				}
+			if (wait)
+				ulTaskNotifyTake(pdTRUE, wait);
+		}
+}
+
+// Pre: EMU->lock is held
+static void reliable_emu_forget(reliable_emu_t* emu)
+{
+	emu->synced = false;
+	emu->syn = true;
+	emu->snd_una = emu->snd_nxt = (uint16_t) esp_random();
+	emu->next = emu->end = 0;
+}
+
+reliable_emu_t* reliable_emu_create(const reliable_emu_config_t* config)
+{
+	reliable_emu_t* emu = calloc(1, sizeof *emu);
+	if (!emu)
+		return NULL;
+
+	emu->config = *config;
+	reliable_emu_forget(emu);
+	emu->lock = xSemaphoreCreateMutex();
+	if (!emu->lock
+	    || xTaskCreate(reliable_emu_main, "reliable_emu", 4096, emu, 5, &emu->task) != pdPASS
+	    || hostbus_attach(emu->config.node, reliable_emu_receive, emu))
+		{
+			free(emu);
+			return NULL;
+		}
+	return emu;
+}
+
+void reliable_emu_send(reliable_emu_t* emu, uint8_t node, uint32_t count)
+{
+	xSemaphoreTake(emu->lock, portMAX_DELAY);
+	emu->peer = node;
+	emu->end += count;
+	xSemaphoreGive(emu->lock);
+	xTaskNotifyGive(emu->task);
+}
+
+void reliable_emu_reboot(reliable_emu_t* emu, uint32_t down_ms)
+{
+	xSemaphoreTake(emu->lock, portMAX_DELAY);
+	ESP_LOGI(TAG, "Rebooting for %u ms", down_ms);
+	reliable_emu_forget(emu);
+	emu->down_until = esp_timer_get_time() + (int64_t) down_ms * 1000;
+	emu->stats.reboots++;
+	xSemaphoreGive(emu->lock);
+	xTaskNotifyGive(emu->task);
+}
+
+reliable_emu_stats_t reliable_emu_stats(reliable_emu_t* emu)
+{
+	xSemaphoreTake(emu->lock, portMAX_DELAY);
+	reliable_emu_stats_t stats = emu->stats;
+	xSemaphoreGive(emu->lock);
+	return stats;
+}
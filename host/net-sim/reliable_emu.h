@@ -0,0 +1,91 @@
+#ifndef GUARD_RELIABLE_EMU_H
+#define GUARD_RELIABLE_EMU_H
+
+/*
+ * Host emulator of the far end of the reliable transport, attached to the
+ * in-process bus and written from the wire format alone.  It takes a
+ * test stream of records from the node, buffering what arrives ahead of
+ * a gap and acknowledging every segment with a sack bitmap, and checks
+ * that the records come in order; it answers segments of a stream it
+ * does not know with RST.  It also sends records to the node, with a
+ * fixed retransmission timeout.
+ *
+ * A record fills a segment: its number, from 0, and a pattern which
+ * depends on it.  Within a stream the numbers follow each other; a new
+ * stream may start at any number, as a sender which gave up dropped
+ * what it had queued, and one which resynchronized repeats some.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <lownet_reliable.h>
+
+#define RELIABLE_EMU_RECORD LOWNET_RELIABLE_SEGMENT
+
+typedef struct
+{
+	uint8_t node;     // node id of the emulated peer
+	uint8_t protocol; // of the records, both ways
+	uint32_t rto_ms;  // retransmission timeout of the records it sends
+} reliable_emu_config_t;
+
+#define RELIABLE_EMU_DEFAULTS { 0x30, 0x3D, 200 }
+
+typedef struct
+{
+	// Records from the node
+	uint32_t segments;      // data segments received
+	uint32_t records;       // records taken in order
+	uint32_t out_of_order;  // segments received ahead of a gap
+	uint32_t duplicates;    // segments received again
+	uint32_t streams;       // streams the node started
+	uint32_t resets;        // RSTs sent for segments of an unknown stream
+	uint32_t errors;        // records corrupt or out of sequence
+
+	// Records to the node
+	uint32_t sent;          // records sent for the first time
+	uint32_t retransmitted; // records sent again
+	uint32_t acked;         // records acknowledged
+	uint32_t resyncs;       // RSTs received
+	uint32_t ignored;       // frames received while down
+	uint32_t reboots;
+} reliable_emu_stats_t;
+
+typedef struct reliable_emu reliable_emu_t;
+
+// Usage: reliable_emu_record(NUMBER, RECORD)
+// Pre:   RECORD has room for RELIABLE_EMU_RECORD bytes
+// Post:  RECORD holds the record NUMBER of the test stream
+void reliable_emu_record(uint32_t number, uint8_t* record);
+
+// Usage: reliable_emu_check(RECORD, LENGTH)
+// Pre:   RECORD points to LENGTH bytes
+// Value: The number of the record, -1 if it is no intact record
+int64_t reliable_emu_check(const uint8_t* record, size_t length);
+
+// Usage: reliable_emu_create(CONFIG)
+// Pre:   CONFIG != NULL, hostbus_init has been called
+// Value: A running emulator attached to the bus as CONFIG->node,
+//        NULL if it could not be started
+reliable_emu_t* reliable_emu_create(const reliable_emu_config_t* config);
+
+// Usage: reliable_emu_send(EMU, NODE, COUNT)
+// Pre:   EMU != NULL, NODE is the node under test
+// Post:  COUNT more records are queued for NODE, numbered on from the
+//        last one sent since EMU started
+void reliable_emu_send(reliable_emu_t* emu, uint8_t node, uint32_t count);
+
+// Usage: reliable_emu_reboot(EMU, DOWN_MS)
+// Pre:   EMU != NULL
+// Post:  EMU has lost its streams both ways and what it had queued, and
+//        ignores everything for DOWN_MS; records it sends afterwards are
+//        numbered from 0 again
+void reliable_emu_reboot(reliable_emu_t* emu, uint32_t down_ms);
+
+// Usage: reliable_emu_stats(EMU)
+// Pre:   EMU != NULL
+// Value: A snapshot of the counters of EMU
+reliable_emu_stats_t reliable_emu_stats(reliable_emu_t* emu);
+
+#endif
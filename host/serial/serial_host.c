@@ -0,0 +1,53 @@
+#include <serial_io.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+/*
+ * Serial service of a host node: lines go to stdout and come from stdin.
+ */
+
+static SemaphoreHandle_t serial_lock;
+
+void init_serial_service()
+{
+	serial_lock = xSemaphoreCreateMutex();
+}
+
+void serial_write_line(const char* string)
+{
+	if (string == NULL)
+		return;
+
+	if (serial_lock)
+		xSemaphoreTake(serial_lock, portMAX_DELAY);
+	printf("%s\n", string);
+	fflush(stdout);
+	if (serial_lock)
+		xSemaphoreGive(serial_lock);
+}
+
+int serial_write_line_timeout(const char* string, TickType_t timeout)
+{
+	if (string == NULL)
+		return -1;
+	serial_write_line(string);
+	return 0;
+}
+
+uint32_t serial_dropped_bytes(void)
+{
+	return 0;
+}
+
+int serial_read_line(char* buffer)
+{
+	if (buffer == NULL || !fgets(buffer, MSG_BUFFER_LENGTH, stdin))
+		return -1;
+
+	buffer[strcspn(buffer, "\r\n")] = '\0';
+	return 0;
+}
@@ -5,16 +5,20 @@
 
 // LowNet includes.
 #include <lownet.h>
+#include <lownet_reliable.h>
 
 #include <serial_io.h>
 #include <cli.h>
 #include <chat.h>
 #include <ping.h>
+#include <pktgen.h>
 #include <crypt.h>
 #include <command.h>
 #include <lownet-commands.h>
 #include <crane.h>
 
+#include "bridge.h"
+
 // Usage: help_command(NULL)
 // Pre:   None, this command takes no arguments.
 // Post:  A list of available commands has been written to the serial port.
@@ -23,12 +27,18 @@ void help_command(char*);
 const command_t commands[] = {
 	{"shout",   "/shout MSG                   Broadcast a message.", shout_command},
 	{"tell",    "/tell ID MSG or @ID MSG      Send a message to a specific node", tell_command},
-	{"ping",    "/ping ID                     Check if a node is online", ping_command},
+	{"ping",    "/ping ID [-c N] [-i MS] [-s SIZE]  Check if a node is online, with RTT statistics", ping_command},
+	{"pktgen",  "/pktgen ID [-r R] [-s S] [-n N | -t T]  Load test a link, /pktgen stop|status", pktgen_command},
 	{"date",    "/date                        Print the current time", date_command},
 	{"setkey",  "/setkey [0|1]                Set the encryption key to use.  If no key is provided encryption is disabled", crypt_setkey_command},
 	{"id",      "/id                          Print your ID", id_command},
+	{"neighbors", "/neighbors                   List the nodes heard from, with signal strength and loss", neighbors_command},
+	{"mesh",    "/mesh on|off|routes|stats    Multi-hop forwarding, its routes and counters", mesh_command},
+	{"capture", "/capture [stats|snap N]      Dump the latest frames as hex pcap, or their counters", capture_command},
+	{"reliable", "/reliable stats|send ID BYTES  Reliable streams, or the throughput of one", reliable_command},
 	{"testenc", "/testenc [STR]               Run STR through a encrypt/decrypt cycle to verify that encryption works", crypt_test_command},
 	{"crane",   "/crane COMMAND               /crane help for details", crane_command},
+	{"binary",  "/binary                      Switch the serial link to binary framing for host tools", bridge_command},
 	{"help",    "/help                        Print this help", help_command}
 };
 
@@ -67,10 +77,13 @@ void app_main(void)
 	// Initialize the LowNet services.
 	lownet_init(crypt_encrypt, crypt_decrypt);
 
+	lownet_reliable_init();
 	chat_init();
 	ping_init();
+	pktgen_init();
 	command_init();
 	crane_init();
+	bridge_init(commands, NUM_COMMANDS);
 
 	while (true) {
 		memset(msg_in, 0, MSG_BUFFER_LENGTH);
@@ -91,16 +104,16 @@ void app_main(void)
 							continue;
 						}
 					char* args = strtok(NULL, "\n");
-					command(args);
+					bridge_call(command, args);
 				}
 			else if (msg_in[0] == '@')
 				{
-					FIND_COMMAND("tell")(msg_in + 1);
+					bridge_call(FIND_COMMAND("tell"), msg_in + 1);
 				}
 			else
 				{
 					// Default, chat broadcast message.
-					FIND_COMMAND("shout")(msg_in);
+					bridge_call(FIND_COMMAND("shout"), msg_in);
 				}
 		}
 	}
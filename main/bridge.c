@@ -0,0 +1,244 @@
+#include "bridge.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <esp_log.h>
+#include <lownet.h>
+#include <serial_io.h>
+
+#define TAG "bridge"
+
+#define BRIDGE_QUEUE 8
+#define BRIDGE_PRIO  4
+
+// A request as it came off the link; handled in the bridge task so that
+// slow CLI commands do not hold up the RX task.
+typedef struct
+{
+	uint8_t type;
+	uint16_t length;
+	uint8_t body[SERIAL_FRAME_MAX];
+} bridge_request_t;
+
+static struct
+{
+	const command_t* commands;
+	size_t num_commands;
+
+	QueueHandle_t requests;
+	SemaphoreHandle_t command_lock; // one CLI command runs at a time
+
+	uint64_t mask;
+	uint8_t flags;
+
+	bridge_stats_t stats;
+} bridge;
+
+// Called from the serial RX task.
+static void bridge_receive(uint8_t type, const uint8_t* body, size_t length)
+{
+	bridge_request_t request;
+	request.type = type;
+	request.length = length;
+	memcpy(request.body, body, length);
+
+	if (xQueueSend(bridge.requests, &request, 0) != pdTRUE)
+		bridge.stats.refused++;
+}
+
+// Called from the lownet service task.
+static void bridge_tap(const lownet_frame_t* frame, const lownet_rx_info_t* info)
+{
+	bridge.stats.tapped++;
+
+	if (!(bridge.mask & (1ull << (frame->protocol & 0x3F))))
+		return;
+	if (!(bridge.flags & BRIDGE_SUB_ALL)
+	    && frame->destination != lownet_get_device_id()
+	    && frame->destination != LOWNET_BROADCAST_ADDRESS)
+		return;
+
+	uint8_t event[sizeof info->timestamp + 2 + sizeof *frame];
+	memcpy(event, &info->timestamp, sizeof info->timestamp);
+	event[8] = (uint8_t) info->rssi;
+	event[9] = info->flags;
+	memcpy(event + 10, frame, sizeof *frame);
+
+	// Never stall the network for the host; the serial layer counts drops.
+	if (serial_write_frame(BRIDGE_FRAME, event, sizeof event, 0) == 0)
+		bridge.stats.forwarded++;
+}
+
+static void bridge_reply(uint8_t type, uint8_t tag, uint8_t status, const void* data, size_t length)
+{
+	uint8_t body[SERIAL_FRAME_MAX - 1];
+	if (length > sizeof body - 2)
+		length = sizeof body - 2;
+
+	body[0] = tag;
+	body[1] = status;
+	if (length)
+		memcpy(body + 2, data, length);
+
+	// Replies matter more than events, so wait for room.
+	serial_write_frame(BRIDGE_REPLY | type, body, length + 2, pdMS_TO_TICKS(1000));
+}
+
+static uint8_t bridge_send(const uint8_t* args, size_t length)
+{
+	if (length < 3 || args[2] > LOWNET_PAYLOAD_SIZE || length != 3u + args[2])
+		return BRIDGE_EINVAL;
+
+	lownet_frame_t frame;
+	memset(&frame, 0, sizeof frame);
+	frame.destination = args[0];
+	frame.protocol = args[1];
+	frame.length = args[2];
+	memcpy(frame.payload, args + 3, frame.length);
+	lownet_send(&frame);
+
+	bridge.stats.sent++;
+	return BRIDGE_OK;
+}
+
+static uint8_t bridge_subscribe(const uint8_t* args, size_t length)
+{
+	if (length != sizeof bridge.mask + 1)
+		return BRIDGE_EINVAL;
+
+	memcpy(&bridge.mask, args, sizeof bridge.mask);
+	bridge.flags = args[sizeof bridge.mask];
+	lownet_register_tap(bridge.mask ? bridge_tap : NULL);
+	return BRIDGE_OK;
+}
+
+static uint8_t bridge_run(const uint8_t* args, size_t length)
+{
+	if (length < 1)
+		return BRIDGE_EINVAL;
+	if (args[0] >= bridge.num_commands)
+		return BRIDGE_ENOENT;
+
+	// CLI commands tokenize in place and expect NULL for no arguments.
+	char text[SERIAL_FRAME_MAX];
+	size_t n = length - 1;
+	memcpy(text, args + 1, n);
+	text[n] = '\0';
+
+	bridge_call(bridge.commands[args[0]].fun, n ? text : NULL);
+	return BRIDGE_OK;
+}
+
+static void bridge_handle(const bridge_request_t* request)
+{
+	if (request->length < 1)
+		return;
+
+	uint8_t tag = request->body[0];
+	const uint8_t* args = request->body + 1;
+	size_t length = request->length - 1;
+	bridge.stats.requests++;
+
+	switch (request->type)
+		{
+		case BRIDGE_PING:
+			bridge_reply(request->type, tag, BRIDGE_OK, args, length);
+			break;
+
+		case BRIDGE_SEND:
+			bridge_reply(request->type, tag, bridge_send(args, length), NULL, 0);
+			break;
+
+		case BRIDGE_SUBSCRIBE:
+			bridge_reply(request->type, tag, bridge_subscribe(args, length), NULL, 0);
+			break;
+
+		case BRIDGE_COMMAND:
+			bridge_reply(request->type, tag, bridge_run(args, length), NULL, 0);
+			break;
+
+		case BRIDGE_STATS:
+			{
+				bridge_stats_t stats = bridge.stats;
+				stats.dropped = serial_dropped_bytes();
+				stats.bad = serial_bad_frames();
+				bridge_reply(request->type, tag, BRIDGE_OK, &stats, sizeof stats);
+				break;
+			}
+
+		case BRIDGE_BAUD:
+			{
+				uint32_t baud;
+				if (length != sizeof baud)
+					{
+						bridge_reply(request->type, tag, BRIDGE_EINVAL, NULL, 0);
+						break;
+					}
+				memcpy(&baud, args, sizeof baud);
+				bridge_reply(request->type, tag, BRIDGE_OK, NULL, 0);
+				if (serial_set_baudrate(baud) != 0)
+					ESP_LOGE(TAG, "Failed to set baud rate %lu", (unsigned long) baud);
+				break;
+			}
+
+		case BRIDGE_TEXT:
+			bridge_reply(request->type, tag, BRIDGE_OK, NULL, 0);
+			lownet_register_tap(NULL);
+			bridge.mask = 0;
+			serial_set_binary(NULL);
+			serial_write_line("TEXT // READY");
+			break;
+
+		default:
+			bridge_reply(request->type, tag, BRIDGE_ENOENT, NULL, 0);
+			break;
+		}
+}
+
+static void bridge_main(void* arg)
+{
+	static bridge_request_t request;
+	while (true)
+		{
+			if (xQueueReceive(bridge.requests, &request, portMAX_DELAY) == pdTRUE)
+				bridge_handle(&request);
+		}
+}
+
+void bridge_init(const command_t* commands, size_t n)
+{
+	bridge.commands = commands;
+	bridge.num_commands = n;
+
+	bridge.command_lock = xSemaphoreCreateMutex();
+	bridge.requests = xQueueCreate(BRIDGE_QUEUE, sizeof(bridge_request_t));
+	if (!bridge.command_lock || !bridge.requests
+	    || xTaskCreate(bridge_main, "bridge", 4096, NULL, BRIDGE_PRIO, NULL) != pdPASS)
+		ESP_LOGE(TAG, "Failed to start the bridge");
+}
+
+void bridge_call(command_fun_t fun, char* args)
+{
+	if (bridge.command_lock)
+		xSemaphoreTake(bridge.command_lock, portMAX_DELAY);
+	fun(args);
+	if (bridge.command_lock)
+		xSemaphoreGive(bridge.command_lock);
+}
+
+void bridge_command(char*)
+{
+	if (!bridge.requests)
+		{
+			serial_write_line("Binary mode is not available.");
+			return;
+		}
+	serial_write_line("BINARY // SLIP");
+	serial_set_binary(bridge_receive);
+}
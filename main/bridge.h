@@ -0,0 +1,80 @@
+#ifndef BRIDGE_H
+#define BRIDGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <cli.h>
+
+/*
+  Binary host interface.  /binary switches the serial link to SLIP framed
+  messages (see serial_set_binary).  Every message is a type byte and a
+  body; multi-byte fields are little endian.
+
+  Requests from the host start with a tag byte that the reply echoes:
+
+    PING       tag data...               echoes data
+    SEND       tag dst proto len payload sends a lownet frame
+    SUBSCRIBE  tag mask:u64 flags        FRAME events for protocols in
+                                         mask (bit n = protocol n), of
+                                         all destinations with
+                                         BRIDGE_SUB_ALL; mask 0 stops
+    COMMAND    tag id args...            runs CLI command number id with
+                                         the text args; its output comes
+                                         as text frames before the reply
+    STATS      tag                       counters, see bridge_stats_t
+    BAUD       tag baud:u32              replies, then changes the speed
+    TEXT       tag                       replies, then back to text mode
+
+  Replies are BRIDGE_REPLY | type with body tag status data.  FRAME
+  events carry timestamp:u64 (us) rssi:i8 flags:u8 and the full
+  lownet_frame_t.
+ */
+
+#define BRIDGE_PING       0x01
+#define BRIDGE_SEND       0x02
+#define BRIDGE_SUBSCRIBE  0x03
+#define BRIDGE_COMMAND    0x04
+#define BRIDGE_STATS      0x05
+#define BRIDGE_BAUD       0x06
+#define BRIDGE_TEXT       0x07
+
+#define BRIDGE_FRAME      0x40
+#define BRIDGE_REPLY      0x80
+
+#define BRIDGE_OK         0x00
+#define BRIDGE_EINVAL     0x01 // malformed request
+#define BRIDGE_ENOENT     0x02 // unknown request type or command id
+#define BRIDGE_EFAIL      0x03 // the request was understood but failed
+
+#define BRIDGE_SUB_ALL    0x01 // FRAME events for other destinations too
+
+typedef struct __attribute__((__packed__))
+{
+	uint32_t tapped;    // valid frames seen on the air
+	uint32_t forwarded; // FRAME events queued for the host
+	uint32_t sent;      // frames sent for the host
+	uint32_t requests;  // requests handled
+	uint32_t refused;   // requests dropped because the queue was full
+	uint32_t dropped;   // serial output bytes dropped
+	uint32_t bad;       // input frames with bad framing
+} bridge_stats_t;
+
+// Usage: bridge_init(COMMANDS, N)
+// Pre:   COMMANDS is an array of N commands, numbered from 0 for
+//        BRIDGE_COMMAND, which outlives the bridge
+// Post:  The bridge task runs; the link stays in text mode until /binary
+void bridge_init(const command_t* commands, size_t n);
+
+// Usage: bridge_call(FUN, ARGS)
+// Post:  FUN has been called with ARGS.  The commands the host runs with
+//        COMMAND and those typed on the console go through here, one at a
+//        time, as CLI commands are not written to run concurrently.
+void bridge_call(command_fun_t fun, char* args);
+
+// Usage: bridge_command(NULL)
+// Pre:   bridge_init has been called
+// Post:  The serial link is in binary mode
+void bridge_command(char* args);
+
+#endif
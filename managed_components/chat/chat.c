@@ -19,7 +19,7 @@
 
 void chat_init()
 {
-	if (lownet_register_protocol(LOWNET_PROTOCOL_CHAT, chat_receive) != 0)
+	if (lownet_frag_register(LOWNET_PROTOCOL_CHAT, chat_receive) != 0)
 		{
 			ESP_LOGE(TAG, "Error registering CHAT protocol");
 		}
@@ -51,23 +51,30 @@ void tell_command(char* args)
 	chat_tell(message, d);
 }
 
-void chat_receive(const lownet_frame_t* frame) {
-	if (frame->destination != lownet_get_device_id()
-			&& frame->destination != LOWNET_BROADCAST_ADDRESS)
+void chat_receive(const lownet_message_t* message, const lownet_rx_info_t* info) {
+	if (message->destination != lownet_get_device_id()
+			&& message->destination != LOWNET_BROADCAST_ADDRESS)
 		return;
 
-	char msg[frame->length + 1];
-	memcpy(msg, &frame->payload, frame->length);
-	msg[frame->length] = '\0';
-
-	// id + max(len("shouts"), len("says")) + message (+ addre... + id) + null
-	char buffer[4 + 9 + frame->length + 16 + 4 + 1 + 1];
+	// Long messages are written over as many lines as they take.
+	char buffer[MSG_BUFFER_LENGTH];
 	int n = 0;
-	n += format_id(buffer + n, frame->source);
-	n += sprintf(buffer + n, " %s: ", (frame->destination != LOWNET_BROADCAST_ADDRESS) ? "says" : "shouts");
-	n += sprintf(buffer + n, "%s", msg);
+	n += format_id(buffer + n, message->source);
+	n += sprintf(buffer + n, " %s: ", (message->destination != LOWNET_BROADCAST_ADDRESS) ? "says" : "shouts");
 
-	serial_write_line(buffer);
+	size_t done = 0;
+	do
+		{
+			size_t chunk = sizeof buffer - 1 - n;
+			if (chunk > message->length - done)
+				chunk = message->length - done;
+			memcpy(buffer + n, message->data + done, chunk);
+			buffer[n + chunk] = '\0';
+			serial_write_line(buffer);
+			done += chunk;
+			n = 0;
+		}
+	while (done < message->length);
 }
 
 // Usage: chat_valid_message(MESSAGE)
@@ -87,7 +94,7 @@ size_t chat_valid_message(const char* message)
 				return 0;
 		}
 
-	if (i > LOWNET_PAYLOAD_SIZE)
+	if (i > LOWNET_FRAG_MAX_MESSAGE)
 		return 0;
 
 
@@ -103,11 +110,5 @@ void chat_tell(const char* message, uint8_t destination) {
 	if (!(message && (length = chat_valid_message(message))))
 		return;
 
-	lownet_frame_t frame;
-	frame.source = lownet_get_device_id();
-	frame.destination = destination;
-	frame.protocol = LOWNET_PROTOCOL_CHAT;
-	frame.length = length;
-	memcpy(&frame.payload, message, length);
-	lownet_send(&frame);
+	lownet_frag_send(destination, LOWNET_PROTOCOL_CHAT, message, length);
 }
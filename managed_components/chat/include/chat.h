@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 #include "lownet.h"
+#include "lownet_frag.h"
 
 #define LOWNET_PROTOCOL_CHAT 0x02
 
@@ -21,7 +22,10 @@ void shout_command(char* args);
 // Post:  MSG has been sent to the node identified by ID.
 void tell_command(char* args);
 
-void chat_receive(const lownet_frame_t* frame);
+// Usage: chat_receive(MESSAGE, INFO)
+// Pre:   MESSAGE is a chat message
+// Post:  MESSAGE has been written to the serial port if it is for us
+void chat_receive(const lownet_message_t* message, const lownet_rx_info_t* info);
 
 void chat_shout(const char* message);
 void chat_tell(const char* message, uint8_t destination);
@@ -1,62 +1,497 @@
 #include "crane.h"
+#include "crane_opt.h"
+#include "crane_script.h"
 
+#include <stdlib.h>
 #include <string.h>
 
+#include <dlog.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 
 #include <lownet.h>
 #include <utility.h>
 #include <serial_io.h>
 
 #include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
 #include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <freertos/timers.h>
 
 #define CRANE_PROTO 0x05
 
 #define TAG "crane"
 
-void crane_connect(uint8_t id);
-void crane_disconnect();
-int  crane_action(uint8_t action); // returns zero if ACK is received
-void crane_test(uint8_t id);
-void crane_receive(const lownet_frame_t* frame);
-void crane_send(uint8_t destination, const crane_packet_t* packet);
-
-// state of a single flow
-static struct
+#define CRANE_TASK_PRIO  5
+#define CRANE_TASK_STACK 4096
+// STOP repeats go out ahead of everything else, reception included.
+#define CRANE_STOP_PRIO  (LOWNET_SERVICE_PRIO + 1)
+#define CRANE_STOP_STACK 3072
+
+#define CRANE_RTO_MS     5000 // retransmission timeout of the oldest action
+#define CRANE_RETRIES    5    // timeouts in a row before giving up
+#define CRANE_HANDSHAKE_MS 5000 // give up on a first connection after this
+#define CRANE_RESUME_MS  30000 // give up re-establishing a lost connection after this
+#define CRANE_SYN_MS     1000 // SYN retransmission interval
+#define CRANE_DEAD_MS    5000 // default dead interval, see crane_liveness_check
+#define CRANE_IDLE_STATUS_MS 15000 // STATUS interval of a crane with no news
+#define CRANE_LIVENESS_MS 250 // period of the liveness check
+#define CRANE_CLOSE_MS   500  // wait for the crane to answer a CLOSE
+#define CRANE_CLOSE_TRIES 3
+#define CRANE_WATCH_MS   1000 // minimum interval between printed STATUS lines
+#define CRANE_HISTOGRAM  (CRANE_CAPACITY + 2) // backlog 0..CAPACITY, and above
+#define CRANE_STOP_REPEAT_MS 200 // resend interval of an unacknowledged STOP
+#define CRANE_STOP_TRIES 25      // repeats before STOP falls back to the RTO
+// Beyond the time_left a crane reports: the STATUS saying it is done may
+// be lost, and the next one come at the idle cadence.
+#define CRANE_BARRIER_SLACK_MS (CRANE_IDLE_STATUS_MS + CRANE_RTO_MS)
+
+// Window slots: one more than CRANE_WINDOW so a STOP always finds room
+#define CRANE_SLOTS      (CRANE_WINDOW + 1)
+
+// Session event bits
+#define CRANE_EV_CONNECTED 0x01 // handshake completed, cleared when the connection is lost
+#define CRANE_EV_CLOSED    0x02 // connection closed or given up for good
+#define CRANE_EV_STATUS    0x04 // a STATUS frame was processed
+#define CRANE_EV_ACK       0x08 // the cumulative ACK advanced
+#define CRANE_EV_IDLE      0x10 // nothing in flight and backlog is zero
+
+// Job flags
+#define CRANE_JOB_TEST   0x01 // handshake in TEST mode first, close when done
+#define CRANE_JOB_BENCH  0x02 // send count x action and time them instead of a program
+#define CRANE_JOB_CSV    0x04 // bench: also print every latency as CSV
+
+#define CRANE_BENCH_MAX  1000 // actions a bench may send
+
+#define XSTR(x) #x
+#define STR(x)  XSTR(x)
+
+typedef struct
 {
-	uint16_t seq;
 	uint8_t crane;
-	QueueHandle_t acks;
+	uint8_t flags;
+	uint8_t action;       // bench only
+	uint16_t count;       // bench only
+	crane_program_t program;
+} crane_job_t;
+
+// Send to ACK latencies of the actions of a bench, in order of ACK
+typedef struct
+{
+	uint32_t* latency;    // in us
+	uint32_t recorded;
+	uint32_t capacity;
+	int64_t last_ack;     // esp_timer time of the last recorded ACK
+} crane_bench_t;
+
+// state of a single flow, one per crane we are talking to
+typedef struct
+{
+	uint8_t crane;        // node id of the crane, 0 if the slot is free
 	enum
 		{
 			ST_DISCONNECTED,
 			ST_HANDSHAKE,
 			ST_CONNECTED,
 		} state;
-} state;
-// Track latest STATUS information
-static uint16_t g_last_status_seq = 0;
-static uint8_t  g_last_backlog    = 0;
+
+	uint8_t flags;        // CONNECT flags of the session, CRANE_TEST
+	uint8_t closing;      // closed by us, never resumed
+
+	SemaphoreHandle_t lock;    // guards everything below
+	EventGroupHandle_t events; // CRANE_EV_* bits
+	TimerHandle_t rto;         // retransmission timer
+
+	// Sequence space and send window.  Actions acked+1 .. seq-1 are in
+	// flight and kept in window[seq % CRANE_SLOTS] for retransmission.
+	uint16_t seq;         // sequence number of the next action
+	uint16_t acked;       // highest cumulative ACK seen on this session
+	uint8_t retries;      // consecutive timeouts of the oldest action
+	crane_packet_t window[CRANE_SLOTS];
+	int64_t sent_at[CRANE_SLOTS]; // esp_timer time of the first transmission
+	uint32_t retransmits; // actions sent again
+	uint32_t naks;        // NAKs received
+	crane_bench_t* bench; // records ACK latencies while set
+
+	// STOP express lane: a STOP is sent at once and repeated every
+	// CRANE_STOP_REPEAT_MS until the cumulative ACK covers stop_seq.
+	uint8_t stopping;     // a STOP is unacknowledged
+	uint8_t stop_tries;
+	uint16_t stop_seq;
+	int64_t stop_due;     // esp_timer time of the next repeat, 0 for none
+	uint32_t stops;       // STOPs issued, lets waiting actions see a flush
+	int64_t stop_sent;    // esp_timer time the pending STOP was first sent
+	uint32_t stop_count;  // acknowledged STOPs and their latency in us
+	uint32_t stop_last;
+	uint32_t stop_min;
+	uint32_t stop_max;
+
+	// Liveness, in esp_timer milliseconds
+	uint32_t heard;       // last frame from the crane
+	uint32_t syn_sent;    // last SYN, while in ST_HANDSHAKE
+	uint32_t deadline;    // handshake given up after this
+	uint32_t challenge;   // of the crane's SYN|ACK, to answer a repeat
+	uint32_t resumes;     // connections re-established after a loss
+
+	// latest STATUS information
+	uint16_t status_seq;
+	status_t status;
+
+	// STATUS history, the oldest sample is overwritten first
+	crane_sample_t telemetry[CRANE_TELEMETRY_SIZE];
+	uint32_t samples;     // samples recorded, next goes to samples % SIZE
+	uint32_t printed;     // stamp of the last watched STATUS line
+} crane_session_t;
+
+static struct
+{
+	crane_session_t sessions[CRANE_MAX_SESSIONS];
+	crane_session_t* current; // target of manual commands
+	SemaphoreHandle_t lock;   // guards slot allocation
+
+	TaskHandle_t task;        // runs scripts submitted through jobs
+	TaskHandle_t express;     // repeats unacknowledged STOPs
+	QueueHandle_t jobs;
+	volatile int abort;       // set to stop the running script
+	int watch;                // print STATUS lines as they arrive
+
+	int optimize;             // run scripts through crane_opt
+	uint32_t opt_in;          // actions scripts issued through the optimizer
+	uint32_t opt_out;         // and of those, sent
+
+	TimerHandle_t liveness;   // runs crane_liveness_check
+	uint32_t dead_ms;         // silence tolerated beyond the STATUS cadence
+} cranes;
+
+crane_session_t* crane_connect(uint8_t id, uint8_t flags);
+void crane_disconnect(crane_session_t* session);
+int  crane_action(crane_session_t* session, uint8_t action); // returns zero if ACK is received
+int  crane_stop(crane_session_t* session);
+void crane_test(uint8_t id);
+int  crane_submit(uint8_t id, uint8_t flags, const char* source);
+int  crane_bench(uint8_t id, uint16_t count, uint8_t action, uint8_t flags);
+void crane_task_main(void* pvTaskParam);
+void crane_rto_expired(TimerHandle_t timer);
+void crane_express_main(void* pvTaskParam);
+void crane_liveness_check(TimerHandle_t timer);
+void crane_receive(const lownet_frame_t* frame, const lownet_rx_info_t* info);
+void crane_send(uint8_t destination, const crane_packet_t* packet);
+
+// Usage: crane_session_find(ID)
+// Pre:   None
+// Value: The session bound to crane ID, or NULL if there is none
+static crane_session_t* crane_session_find(uint8_t id)
+{
+	if (id == 0)
+		return NULL;
+
+	for (int i = 0; i < CRANE_MAX_SESSIONS; ++i)
+		if (cranes.sessions[i].crane == id)
+			return &cranes.sessions[i];
+	return NULL;
+}
+
+static uint32_t crane_now_ms(void)
+{
+	return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+// Usage: crane_in_flight(SESSION)
+// Pre:   SESSION != NULL, SESSION->lock is held
+// Value: The number of actions sent but not yet acknowledged
+static uint16_t crane_in_flight(const crane_session_t* session)
+{
+	if (session->state != ST_CONNECTED)
+		return 0;
+	return (uint16_t)(session->seq - 1 - session->acked);
+}
+
+// Usage: crane_express_arm(SESSION)
+// Pre:   SESSION != NULL, SESSION->lock is held
+// Post:  The express task repeats the window of SESSION in
+//        CRANE_STOP_REPEAT_MS, and then every CRANE_STOP_REPEAT_MS
+//        until SESSION->stop_due is cleared
+static void crane_express_arm(crane_session_t* session)
+{
+	session->stop_due = esp_timer_get_time() + CRANE_STOP_REPEAT_MS * 1000ll;
+	xTaskNotifyGive(cranes.express);
+}
+
+// Usage: crane_session_reset(SESSION)
+// Pre:   SESSION != NULL
+// Post:  SESSION is disconnected and its sequence space cleared,
+//        the slot stays bound to the same crane.
+static void crane_session_reset(crane_session_t* session)
+{
+	xSemaphoreTake(session->lock, portMAX_DELAY);
+	xTimerStop(session->rto, 0);
+	session->stop_due = 0;
+	session->state = ST_DISCONNECTED;
+	session->seq = 0;
+	session->acked = 0;
+	session->retries = 0;
+	session->stopping = 0;
+	session->stop_count = 0;
+	session->closing = 0;
+	session->resumes = 0;
+	session->retransmits = 0;
+	session->naks = 0;
+	session->status_seq = 0;
+	session->samples = 0;
+	session->printed = 0;
+	memset(&session->status, 0, sizeof session->status);
+	memset(session->window, 0, sizeof session->window);
+	xEventGroupClearBits(session->events, 0xFF);
+	xSemaphoreGive(session->lock);
+}
+
+// Usage: crane_session_open(ID)
+// Pre:   ID is a crane node id
+// Value: The session bound to ID, allocating a free slot if needed.
+//        NULL if the table is full.
+static crane_session_t* crane_session_open(uint8_t id)
+{
+	xSemaphoreTake(cranes.lock, portMAX_DELAY);
+	crane_session_t* session = crane_session_find(id);
+	if (!session)
+		{
+			for (int i = 0; i < CRANE_MAX_SESSIONS; ++i)
+				if (cranes.sessions[i].crane == 0)
+					{
+						session = &cranes.sessions[i];
+						crane_session_reset(session);
+						session->crane = id;
+						break;
+					}
+		}
+	xSemaphoreGive(cranes.lock);
+	return session;
+}
+
+// Usage: crane_session_free(SESSION)
+// Pre:   SESSION != NULL
+// Post:  SESSION has been reset and its slot released
+static void crane_session_free(crane_session_t* session)
+{
+	xSemaphoreTake(cranes.lock, portMAX_DELAY);
+	crane_session_reset(session);
+	session->crane = 0;
+	if (cranes.current == session)
+		cranes.current = NULL;
+	xEventGroupSetBits(session->events, CRANE_EV_CLOSED);
+	xSemaphoreGive(cranes.lock);
+}
 
 int crane_init(void)
 {
-	if (lownet_register_protocol(CRANE_PROTO, crane_receive) != 0)
+	if (lownet_register_protocol_ex(CRANE_PROTO, crane_receive) != 0)
 		{
 			ESP_LOGE(TAG, "Failed to register crane protocol");
 			return 1;
 		}
 
-	state.seq = 0;
-	state.crane = 0;
-	state.state = ST_DISCONNECTED;
-	state.acks = xQueueCreate(8, sizeof(uint16_t));
-	// status tracking
-        g_last_status_seq = 0;
-        g_last_backlog    = 0;
+	cranes.lock = xSemaphoreCreateMutex();
+	cranes.current = NULL;
+	for (int i = 0; i < CRANE_MAX_SESSIONS; ++i)
+		{
+			crane_session_t* session = &cranes.sessions[i];
+			memset(session, 0, sizeof *session);
+			session->state = ST_DISCONNECTED;
+			session->lock = xSemaphoreCreateMutex();
+			session->events = xEventGroupCreate();
+			session->rto = xTimerCreate("crane_rto",
+			                            pdMS_TO_TICKS(CRANE_RTO_MS),
+			                            pdFALSE,
+			                            session,
+			                            crane_rto_expired);
+			if (!session->lock || !session->events || !session->rto)
+				{
+					ESP_LOGE(TAG, "Failed to allocate crane session");
+					return 1;
+				}
+		}
+
+	if (xTaskCreate(crane_express_main,
+	                "crane_stop",
+	                CRANE_STOP_STACK,
+	                NULL,
+	                CRANE_STOP_PRIO,
+	                &cranes.express) != pdPASS)
+		{
+			ESP_LOGE(TAG, "Failed to start crane STOP task");
+			return 1;
+		}
+
+	cranes.dead_ms = CRANE_DEAD_MS;
+	cranes.liveness = xTimerCreate("crane_live",
+	                               pdMS_TO_TICKS(CRANE_LIVENESS_MS),
+	                               pdTRUE,
+	                               NULL,
+	                               crane_liveness_check);
+	if (!cranes.liveness || xTimerStart(cranes.liveness, 0) != pdPASS)
+		{
+			ESP_LOGE(TAG, "Failed to start crane liveness timer");
+			return 1;
+		}
+
+	cranes.jobs = xQueueCreate(2, sizeof(crane_job_t));
+	if (!cranes.jobs
+	    || xTaskCreate(crane_task_main,
+	                   "crane_task",
+	                   CRANE_TASK_STACK,
+	                   NULL,
+	                   CRANE_TASK_PRIO,
+	                   &cranes.task) != pdPASS)
+		{
+			ESP_LOGE(TAG, "Failed to start crane task");
+			return 1;
+		}
 	return 0;
 }
 
+// Usage: crane_letter_action(C)
+// Pre:   None
+// Value: The crane action for the manual mode letter C, -1 if C is
+//        not one
+static int crane_letter_action(char c)
+{
+	switch (c)
+		{
+		case 'f': return CRANE_FWD;       // forward
+		case 'b': return CRANE_REV;       // backward
+		case 'u': return CRANE_UP;        // up
+		case 'd': return CRANE_DOWN;      // down
+		case 'o': return CRANE_LIGHT_ON;  // light on
+		case 'O': return CRANE_LIGHT_OFF; // capital O -> light off
+		case 's': return CRANE_STOP;      // stop
+		default:  return -1;
+		}
+}
+
+// Usage: crane_command_target(ID)
+// Pre:   ID is NULL or a node id string
+// Value: The session for ID if given, otherwise the current session.
+//        NULL (with a diagnostic written) if there is no such session.
+static crane_session_t* crane_command_target(const char* id)
+{
+	crane_session_t* session = id ? crane_session_find(hex_to_dec(id + 2)) : cranes.current;
+	if (!session)
+		serial_write_line(id ? "No session with that crane" : "No crane selected");
+	return session;
+}
+
+static void crane_list(void)
+{
+	static const char* names[] = { "disconnected", "handshake", "connected" };
+	char buffer[MSG_BUFFER_LENGTH];
+
+	for (int i = 0; i < CRANE_MAX_SESSIONS; ++i)
+		{
+			const crane_session_t* session = &cranes.sessions[i];
+			if (session->crane == 0)
+				continue;
+			snprintf(buffer, sizeof buffer,
+			         "%c0x%02x %-12s seq: %u in flight: %u backlog: %u heard: %lus ago resumed: %lu",
+			         session == cranes.current ? '*' : ' ',
+			         session->crane,
+			         names[session->state],
+			         session->seq,
+			         crane_in_flight(session),
+			         session->status.backlog,
+			         (unsigned long)(crane_now_ms() - session->heard) / 1000,
+			         (unsigned long) session->resumes);
+			serial_write_line(buffer);
+		}
+}
+
+// Usage: crane_telemetry(SESSION, COUNT)
+// Pre:   SESSION != NULL
+// Post:  The last COUNT (at most CRANE_TELEMETRY_SIZE) STATUS samples
+//        of SESSION have been written to the serial port, oldest first
+static void crane_telemetry(crane_session_t* session, uint32_t count)
+{
+	crane_sample_t samples[CRANE_TELEMETRY_SIZE];
+	char buffer[MSG_BUFFER_LENGTH];
+
+	xSemaphoreTake(session->lock, portMAX_DELAY);
+	uint32_t total = session->samples;
+	if (count > total)
+		count = total;
+	if (count > CRANE_TELEMETRY_SIZE)
+		count = CRANE_TELEMETRY_SIZE;
+	for (uint32_t i = 0; i < count; ++i)
+		samples[i] = session->telemetry[(total - count + i) % CRANE_TELEMETRY_SIZE];
+	xSemaphoreGive(session->lock);
+
+	serial_write_line("time(ms)   seq   backlog time light temp");
+	for (uint32_t i = 0; i < count; ++i)
+		{
+			snprintf(buffer, sizeof buffer, "%-10lu %-5u %-7u %-4u %-5s %d",
+			         (unsigned long) samples[i].stamp,
+			         samples[i].seq,
+			         samples[i].status.backlog,
+			         samples[i].status.time_left,
+			         samples[i].status.light ? "on" : "off",
+			         samples[i].status.temp);
+			serial_write_line(buffer);
+		}
+}
+
+// Usage: crane_stats(SESSION)
+// Pre:   SESSION != NULL
+// Post:  Temperature and backlog statistics over the recorded STATUS
+//        samples of SESSION have been written to the serial port
+static void crane_stats(crane_session_t* session)
+{
+	uint32_t histogram[CRANE_HISTOGRAM] = {0};
+	int min = INT8_MAX, max = INT8_MIN;
+	int32_t sum = 0;
+	char buffer[MSG_BUFFER_LENGTH];
+
+	xSemaphoreTake(session->lock, portMAX_DELAY);
+	uint32_t total = session->samples;
+	uint32_t count = total < CRANE_TELEMETRY_SIZE ? total : CRANE_TELEMETRY_SIZE;
+	for (uint32_t i = 0; i < count; ++i)
+		{
+			const status_t* status = &session->telemetry[i].status;
+			min = status->temp < min ? status->temp : min;
+			max = status->temp > max ? status->temp : max;
+			sum += status->temp;
+			histogram[status->backlog < CRANE_HISTOGRAM - 1 ? status->backlog : CRANE_HISTOGRAM - 1]++;
+		}
+	uint32_t stop_count = session->stop_count;
+	uint32_t stop_last = session->stop_last;
+	uint32_t stop_min = session->stop_min;
+	uint32_t stop_max = session->stop_max;
+	xSemaphoreGive(session->lock);
+
+	if (count == 0)
+		{
+			serial_write_line("No STATUS samples");
+			return;
+		}
+
+	snprintf(buffer, sizeof buffer, "samples: %lu of %lu  temp min/avg/max: %d/%ld/%d",
+	         (unsigned long) count, (unsigned long) total, min, (long)(sum / (int32_t) count), max);
+	serial_write_line(buffer);
+
+	if (stop_count)
+		{
+			snprintf(buffer, sizeof buffer, "stop: %lu acked, latency last/min/max: %lu/%lu/%lu ms",
+			         (unsigned long) stop_count, (unsigned long) stop_last / 1000,
+			         (unsigned long) stop_min / 1000, (unsigned long) stop_max / 1000);
+			serial_write_line(buffer);
+		}
+
+	size_t n = snprintf(buffer, sizeof buffer, "backlog:");
+	for (int i = 0; i < CRANE_HISTOGRAM && n < sizeof buffer; ++i)
+		n += snprintf(buffer + n, sizeof buffer - n, " %d%s:%lu",
+		              i, i == CRANE_HISTOGRAM - 1 ? "+" : "", (unsigned long) histogram[i]);
+	serial_write_line(buffer);
+}
+
 void crane_command(char* args)
 {
 	if (!args)
@@ -75,10 +510,21 @@ void crane_command(char* args)
 
 	if (strcmp(command, "help") == 0)
 		{
-			serial_write_line("open ID    Connect to a crane at ID");
-			serial_write_line("close      Close an existing connection");
+			serial_write_line("open ID    Connect to a crane at ID and select it");
+			serial_write_line("close [ID] Close the connection to ID or the selected crane");
+			serial_write_line("use ID     Select the crane manual commands are sent to");
+			serial_write_line("list       List crane sessions");
 			serial_write_line("test ID    Connect to ID in test mode and execute test pattern");
-			serial_write_line("CMD        Implementation defined commands to trigger crane actions");
+			serial_write_line("run [ID] SCRIPT|@NAME  Run a script on ID or the selected crane");
+			serial_write_line("scripts    List builtin scripts");
+			serial_write_line("abort      Stop the running script");
+			serial_write_line("telemetry [N] [ID]  Print the last N STATUS samples");
+			serial_write_line("stats [ID] Summarise the recorded STATUS samples");
+			serial_write_line("watch on|off  Print STATUS as it arrives, at most once a second");
+			serial_write_line("dead [MS]  Show or set how long a silent crane is tolerated");
+			serial_write_line("opt [on|off]  Coalesce script actions, show frames saved");
+			serial_write_line("bench ID N [ACTION] [csv]  Time N actions (default n, null) in test mode");
+			serial_write_line("CMD [ID]   Implementation defined commands to trigger crane actions");
 		}
 	else if (strcmp(command, "open") == 0)
 		{
@@ -89,11 +535,31 @@ void crane_command(char* args)
 					return;
 				}
 			uint8_t dest = hex_to_dec(id + 2);
-			crane_connect(dest);
+			crane_session_t* session = crane_connect(dest, 0);
+			if (session)
+				cranes.current = session;
 		}
 	else if (strcmp(command, "close") == 0)
 		{
-			crane_disconnect();
+			crane_session_t* session = crane_command_target(strtok_r(NULL, " ", &saveptr));
+			if (session)
+				crane_disconnect(session);
+		}
+	else if (strcmp(command, "use") == 0)
+		{
+			char* id = strtok_r(NULL, " ", &saveptr);
+			if (!id)
+				{
+					serial_write_line("Missing argument ID");
+					return;
+				}
+			crane_session_t* session = crane_command_target(id);
+			if (session)
+				cranes.current = session;
+		}
+	else if (strcmp(command, "list") == 0)
+		{
+			crane_list();
 		}
 	else if (strcmp(command, "test") == 0)
 		{
@@ -106,269 +572,789 @@ void crane_command(char* args)
 			uint8_t dest = hex_to_dec(id + 2);
 			crane_test(dest);
 		}
+	else if (strcmp(command, "run") == 0)
+		{
+			char* script = strtok_r(NULL, "", &saveptr);
+			char* id = NULL;
+			if (script && strncmp(script, "0x", 2) == 0)
+				{
+					id = strtok_r(script, " ", &script);
+				}
+			if (!script || !*script)
+				{
+					serial_write_line("Missing argument SCRIPT");
+					return;
+				}
+			crane_session_t* session = crane_command_target(id);
+			if (session)
+				crane_submit(session->crane, 0, script);
+		}
+	else if (strcmp(command, "scripts") == 0)
+		{
+			char buffer[MSG_BUFFER_LENGTH];
+			for (size_t i = 0; i < crane_num_scripts; ++i)
+				{
+					snprintf(buffer, sizeof buffer, "@%-8s %s",
+					         crane_scripts[i].name, crane_scripts[i].source);
+					serial_write_line(buffer);
+				}
+		}
+	else if (strcmp(command, "abort") == 0)
+		{
+			cranes.abort = 1;
+		}
+	else if (strcmp(command, "telemetry") == 0)
+		{
+			uint32_t count = 10;
+			char* id = NULL;
+			char* arg;
+			while ((arg = strtok_r(NULL, " ", &saveptr)))
+				{
+					if (strncmp(arg, "0x", 2) == 0)
+						id = arg;
+					else
+						count = strtoul(arg, NULL, 10);
+				}
+			crane_session_t* session = crane_command_target(id);
+			if (session)
+				crane_telemetry(session, count);
+		}
+	else if (strcmp(command, "stats") == 0)
+		{
+			crane_session_t* session = crane_command_target(strtok_r(NULL, " ", &saveptr));
+			if (session)
+				crane_stats(session);
+		}
+	else if (strcmp(command, "dead") == 0)
+		{
+			char* arg = strtok_r(NULL, " ", &saveptr);
+			if (arg)
+				cranes.dead_ms = strtoul(arg, NULL, 10);
+			char buffer[MSG_BUFFER_LENGTH];
+			snprintf(buffer, sizeof buffer, "dead interval: %lu ms (%lu ms when idle)",
+			         (unsigned long) cranes.dead_ms,
+			         (unsigned long)(cranes.dead_ms + CRANE_IDLE_STATUS_MS));
+			serial_write_line(buffer);
+		}
+	else if (strcmp(command, "bench") == 0)
+		{
+			char* id = strtok_r(NULL, " ", &saveptr);
+			char* count = strtok_r(NULL, " ", &saveptr);
+			if (!id || !count)
+				{
+					serial_write_line("Missing argument ID or N");
+					return;
+				}
+			int action = CRANE_NULL;
+			uint8_t flags = 0;
+			char* arg;
+			while ((arg = strtok_r(NULL, " ", &saveptr)))
+				{
+					if (strcmp(arg, "csv") == 0)
+						flags |= CRANE_JOB_CSV;
+					else if (strcmp(arg, "n") != 0 && (action = crane_letter_action(arg[0])) < 0)
+						{
+							serial_write_line("Invalid ACTION");
+							return;
+						}
+				}
+			unsigned long n = strtoul(count, NULL, 10);
+			if (n == 0 || n > CRANE_BENCH_MAX)
+				{
+					serial_write_line("N must be 1.." STR(CRANE_BENCH_MAX));
+					return;
+				}
+			crane_bench(hex_to_dec(id + 2), n, action, flags);
+		}
+	else if (strcmp(command, "opt") == 0)
+		{
+			char* arg = strtok_r(NULL, " ", &saveptr);
+			if (arg)
+				cranes.optimize = strcmp(arg, "on") == 0;
+			char buffer[MSG_BUFFER_LENGTH];
+			snprintf(buffer, sizeof buffer, "optimizer %s: %lu actions, %lu sent, %lu frames saved",
+			         cranes.optimize ? "on" : "off",
+			         (unsigned long) cranes.opt_in,
+			         (unsigned long) cranes.opt_out,
+			         (unsigned long)(cranes.opt_in - cranes.opt_out));
+			serial_write_line(buffer);
+		}
+	else if (strcmp(command, "watch") == 0)
+		{
+			char* arg = strtok_r(NULL, " ", &saveptr);
+			cranes.watch = arg && strcmp(arg, "on") == 0;
+		}
 	else
 		{
-			uint8_t action;
-			switch (command[0])
-                        {
-                        case 'f':  // forward
-	                        action = CRANE_FWD;
-	                        break;
-                        case 'b':  // backward
-	                        action = CRANE_REV;
-	                        break;
-                        case 'u':  // up
-	                        action = CRANE_UP;
-	                        break;
-                        case 'd':  // down
-	                        action = CRANE_DOWN;
-	                        break;
-                        case 'o':  // light on
-	                        action = CRANE_LIGHT_ON;
-	                        break;
-                        case 'O':  // capital O -> light off
-	                        action = CRANE_LIGHT_OFF;
-	                        break;
-                        case 's':  // stop
-	                        action = CRANE_STOP;
-	                        break;
-                        default:
-	                        ESP_LOGI(TAG, "Invalid crane command");
-	                        return;
-                        }
-                        crane_action(action);
+			int action = crane_letter_action(command[0]);
+			if (action < 0)
+				{
+					ESP_LOGI(TAG, "Invalid crane command");
+					return;
+				}
+			if (action == CRANE_STOP)
+				{
+					// A STOP also flushes scripts and queued jobs
+					cranes.abort = 1;
+					xQueueReset(cranes.jobs);
+				}
+			crane_session_t* session = crane_command_target(strtok_r(NULL, " ", &saveptr));
+			if (session)
+				crane_action(session, action);
+		}
+}
+
+// Usage: crane_resend_window(SESSION)
+// Pre:   SESSION != NULL, SESSION->lock is held
+// Post:  Every action in flight has been sent again, oldest first
+static void crane_resend_window(crane_session_t* session)
+{
+	for (uint16_t seq = session->acked + 1; seq != session->seq; ++seq)
+		{
+			crane_send(session->crane, &session->window[seq % CRANE_SLOTS]);
+			session->retransmits++;
+		}
+}
+
+// Usage: crane_session_handshake(SESSION, BUDGET)
+// Pre:   SESSION != NULL, SESSION->lock is held
+// Post:  A SYN has been sent and SESSION is in ST_HANDSHAKE.  The
+//        liveness check repeats the SYN every CRANE_SYN_MS and gives up
+//        after BUDGET ms.  Actions in flight are kept for replay.
+static void crane_session_handshake(crane_session_t* session, uint32_t budget)
+{
+	crane_packet_t packet;
+	memset(&packet, 0, sizeof(packet));
+	packet.type = CRANE_CONNECT;
+	packet.flags = CRANE_SYN | session->flags;
+	packet.seq = 0;                 // handshake always uses seq = 0
+	packet.d.conn.challenge = 0;    // initial challenge = 0
+
+	xTimerStop(session->rto, 0);
+	session->stop_due = 0;
+	xEventGroupClearBits(session->events,
+	                     CRANE_EV_CONNECTED | CRANE_EV_CLOSED | CRANE_EV_IDLE);
+	session->state = ST_HANDSHAKE;
+	session->syn_sent = crane_now_ms();
+	session->deadline = session->syn_sent + budget;
+
+	crane_send(session->crane, &packet);
+}
 
+// Usage: crane_session_lost(SESSION, WHY)
+// Pre:   SESSION != NULL, SESSION->lock is held
+// Post:  SESSION is re-establishing its connection if it has actions
+//        to replay or was still in use, otherwise it is disconnected
+//        and the next action on it reconnects
+static void crane_session_lost(crane_session_t* session, const char* why)
+{
+	uint16_t pending = session->seq ? (uint16_t)(session->seq - 1 - session->acked) : 0;
+
+	ESP_LOGW(TAG, "Crane 0x%02x %s, %s", session->crane, why,
+	         pending || session->status.backlog ? "reconnecting" : "disconnected");
+	if (pending || session->status.backlog)
+		{
+			crane_session_handshake(session, CRANE_RESUME_MS);
+		}
+	else
+		{
+			// Nothing to resume for, so the session is over: waiters see
+			// CLOSED as for a session given up after a failed resume.
+			xTimerStop(session->rto, 0);
+			session->stop_due = 0;
+			xEventGroupClearBits(session->events, CRANE_EV_CONNECTED | CRANE_EV_IDLE);
+			xEventGroupSetBits(session->events, CRANE_EV_CLOSED);
+			session->state = ST_DISCONNECTED;
 		}
 }
 
-void crane_recv_connect(const crane_packet_t* packet)
+void crane_recv_connect(crane_session_t* session, const crane_packet_t* packet)
 {
-    ESP_LOGI(TAG, "Received CONNECT packet");
+	DLOGI(TAG, "Received CONNECT packet from 0x%02x, flags %02x", session->crane, packet->flags);
 
-    if (state.state != ST_HANDSHAKE)
-        return;
+	// Expect SYN|ACK
+	if ((packet->flags & (CRANE_SYN | CRANE_ACK)) != (CRANE_SYN | CRANE_ACK))
+		{
+			ESP_LOGW(TAG, "Invalid handshake flags, expected SYN|ACK");
+			return;
+		}
 
-    ESP_LOGI(TAG, "packet flags: %02x", packet->flags);
+	xSemaphoreTake(session->lock, portMAX_DELAY);
+	session->heard = crane_now_ms();
 
-    // Expect SYN|ACK
-    if ((packet->flags & (CRANE_SYN | CRANE_ACK)) != (CRANE_SYN | CRANE_ACK))
-    {
-        ESP_LOGW(TAG, "Invalid handshake flags, expected SYN|ACK");
-        return;
-    }
+	// A repeated SYN|ACK means our final ACK was lost, answer it again.
+	int repeat = session->state == ST_CONNECTED
+		&& packet->d.conn.challenge == session->challenge;
+	if (session->state != ST_HANDSHAKE && !repeat)
+		{
+			xSemaphoreGive(session->lock);
+			return;
+		}
 
-        // Prepare final ACK packet
-    crane_packet_t outpkt;
-    memset(&outpkt, 0, sizeof(outpkt));
-    outpkt.type  = CRANE_CONNECT;
-    outpkt.seq   = 0;     // handshake always uses seq = 0
+	// Prepare final ACK packet
+	crane_packet_t outpkt;
+	memset(&outpkt, 0, sizeof(outpkt));
+	outpkt.type  = CRANE_CONNECT;
+	outpkt.seq   = 0;     // handshake always uses seq = 0
 
-    // Always ACK — and if crane used TEST, we must keep TEST in final ACK
-    outpkt.flags = CRANE_ACK;
-    if (packet->flags & CRANE_TEST) {
-        outpkt.flags |= CRANE_TEST;
-    }
+	// Always ACK — and if crane used TEST, we must keep TEST in final ACK
+	outpkt.flags = CRANE_ACK;
+	if (packet->flags & CRANE_TEST)
+		outpkt.flags |= CRANE_TEST;
 
-    outpkt.d.conn.challenge = ~packet->d.conn.challenge;
+	outpkt.d.conn.challenge = ~packet->d.conn.challenge;
 
-    crane_send(state.crane, &outpkt);
+	crane_send(session->crane, &outpkt);
+	if (repeat)
+		{
+			xSemaphoreGive(session->lock);
+			return;
+		}
 
-    // After successful handshake, first ACTION must use seq = 1
-    state.seq = 1;
-    state.state = ST_CONNECTED;
+	// After successful handshake, first ACTION must use seq = 1.  Actions
+	// not acknowledged on a previous connection are renumbered from 1 and
+	// replayed; the crane may have executed some whose ACK was lost.
+	uint16_t pending = session->seq ? (uint16_t)(session->seq - 1 - session->acked) : 0;
+	crane_packet_t replay[CRANE_SLOTS];
+	int64_t replay_sent[CRANE_SLOTS];
+	for (uint16_t i = 0; i < pending; ++i)
+		{
+			replay[i] = session->window[(uint16_t)(session->acked + 1 + i) % CRANE_SLOTS];
+			replay_sent[i] = session->sent_at[(uint16_t)(session->acked + 1 + i) % CRANE_SLOTS];
+		}
+	if (session->stopping)
+		session->stop_seq -= session->acked;
+	for (uint16_t i = 0; i < pending; ++i)
+		{
+			replay[i].seq = i + 1;
+			session->window[(i + 1) % CRANE_SLOTS] = replay[i];
+			session->sent_at[(i + 1) % CRANE_SLOTS] = replay_sent[i];
+		}
 
+	if (session->seq)
+		session->resumes++;
+	session->seq = pending + 1;
+	session->acked = 0;
+	session->retries = 0;
+	session->challenge = packet->d.conn.challenge;
+	session->status.backlog = 0;
+	session->state = ST_CONNECTED;
+
+	EventBits_t bits = CRANE_EV_CONNECTED;
+	if (pending)
+		{
+			ESP_LOGI(TAG, "Replaying %d actions to 0x%02x", pending, session->crane);
+			crane_resend_window(session);
+			xTimerReset(session->rto, 0);
+			if (session->stopping)
+				crane_express_arm(session);
+		}
+	else
+		{
+			bits |= CRANE_EV_IDLE;
+		}
+	xEventGroupSetBits(session->events, bits);
+	xSemaphoreGive(session->lock);
 
-    ESP_LOGI(TAG, "Connection established with crane 0x%02x", state.crane);
+	ESP_LOGI(TAG, "Connection established with crane 0x%02x", session->crane);
 }
 
 
-void crane_recv_close(const crane_packet_t* packet)
+void crane_recv_close(crane_session_t* session, const crane_packet_t* packet)
 {
-	ESP_LOGI(TAG, "Closing connection");
-	state.seq = 0;
-	state.state = ST_DISCONNECTED;
-	state.crane = 0;
+	xSemaphoreTake(session->lock, portMAX_DELAY);
+	session->heard = crane_now_ms();
+	if (session->closing || session->state == ST_DISCONNECTED)
+		{
+			xSemaphoreGive(session->lock);
+			ESP_LOGI(TAG, "Closing connection with crane 0x%02x", session->crane);
+			crane_session_free(session);
+			return;
+		}
+
+	// Closed by the crane, e.g. after it restarted
+	crane_session_lost(session, "closed the connection");
+	xSemaphoreGive(session->lock);
 }
 
-void crane_recv_status(const crane_packet_t* packet)
+void crane_recv_status(crane_session_t* session, const crane_packet_t* packet, int64_t received)
 {
-    char buffer[200];
+	EventBits_t bits = CRANE_EV_STATUS;
 
-    if (packet->flags & CRANE_NAK)
-    {
-        ESP_LOGI(TAG, "Received status packet with NAK -- not in use yet");
-        return;
-    }
-    else
-    {
-        // Only treat as ACK if seq looks valid (non-zero, not 0xFFFF)
-        if (packet->seq != 0 && packet->seq != 0xFFFF) {
-            xQueueSend(state.acks, &packet->seq, 0);
-        }
-    }
+	xSemaphoreTake(session->lock, portMAX_DELAY);
+	session->heard = crane_now_ms();
 
-    // --- NEW: track last status info ---
-    g_last_status_seq = packet->seq;
-    g_last_backlog    = packet->d.status.backlog;
-    // -----------------------------------
+	// The seq field carries the cumulative ACK.  Zero and 0xFFFF are
+	// sent before any action was received and acknowledge nothing.
+	uint16_t ack = packet->seq;
+	if (session->state == ST_CONNECTED && ack != 0 && ack != 0xFFFF)
+		{
+			uint16_t advance = ack - session->acked;
+			if (advance > 0 && advance <= crane_in_flight(session))
+				{
+					if (session->bench)
+						{
+							crane_bench_t* bench = session->bench;
+							for (uint16_t seq = session->acked + 1; seq != (uint16_t)(ack + 1); ++seq)
+								if (bench->recorded < bench->capacity)
+									bench->latency[bench->recorded++] = received - session->sent_at[seq % CRANE_SLOTS];
+							bench->last_ack = received;
+						}
+					session->acked = ack;
+					session->retries = 0;
+					bits |= CRANE_EV_ACK;
+					if (crane_in_flight(session))
+						xTimerReset(session->rto, 0);
+					else
+						xTimerStop(session->rto, 0);
+
+					if (session->stopping && (int16_t)(ack - session->stop_seq) >= 0)
+						{
+							uint32_t latency = received - session->stop_sent;
+							session->stopping = 0;
+							session->stop_due = 0;
+							session->stop_last = latency;
+							if (session->stop_count == 0 || latency < session->stop_min)
+								session->stop_min = latency;
+							if (latency > session->stop_max)
+								session->stop_max = latency;
+							session->stop_count++;
+							ESP_LOGI(TAG, "Crane 0x%02x stopped after %lu ms",
+							         session->crane, (unsigned long) latency / 1000);
+						}
+				}
+			else if (advance > crane_in_flight(session) && advance < 0x8000)
+				{
+					ESP_LOGE(TAG, "Unexpected ACK seq (%d >= %d)", ack, session->seq);
+				}
+		}
 
-    snprintf(buffer, sizeof buffer,
-             "backlog: %d\n"
-             "time: %d\n"
-             "light: %s\n",
-             packet->d.status.backlog,
-             packet->d.status.time_left,
-             packet->d.status.light ? "on" : "off");
-    serial_write_line(buffer);
+	// A NAK means the crane dropped what followed the acknowledged
+	// sequence number: go back and resend the rest of the window.
+	if (packet->flags & CRANE_NAK)
+		{
+			DLOGW(TAG, "NAK from 0x%02x after seq %d", session->crane, ack);
+			session->naks++;
+			crane_resend_window(session);
+		}
+
+	// track last status info
+	session->status_seq = packet->seq;
+	session->status = packet->d.status;
+
+	crane_sample_t* sample = &session->telemetry[session->samples++ % CRANE_TELEMETRY_SIZE];
+	sample->stamp = received / 1000;
+	sample->seq = packet->seq;
+	sample->status = packet->d.status;
+
+	int print = cranes.watch && sample->stamp - session->printed >= CRANE_WATCH_MS;
+	if (print)
+		session->printed = sample->stamp;
+
+	if (session->state == ST_CONNECTED
+	    && crane_in_flight(session) == 0
+	    && session->status.backlog == 0)
+		bits |= CRANE_EV_IDLE;
+	else
+		xEventGroupClearBits(session->events, CRANE_EV_IDLE);
+	xEventGroupSetBits(session->events, bits);
+
+	xSemaphoreGive(session->lock);
+
+	if (print)
+		{
+			char buffer[MSG_BUFFER_LENGTH];
+			snprintf(buffer, sizeof buffer,
+			         "crane 0x%02x backlog: %d time: %d light: %s temp: %d",
+			         session->crane,
+			         packet->d.status.backlog,
+			         packet->d.status.time_left,
+			         packet->d.status.light ? "on" : "off",
+			         packet->d.status.temp);
+			serial_write_line(buffer);
+		}
 }
 
 
-void crane_receive(const lownet_frame_t* frame)
+void crane_receive(const lownet_frame_t* frame, const lownet_rx_info_t* info)
 {
+	if (frame->length < sizeof(crane_packet_t))
+		return;
+
+	// Demultiplex by source; frames from cranes we have no session with
+	// are not ours to handle.
+	crane_session_t* session = crane_session_find(frame->source);
+	if (!session)
+		{
+			DLOGD(TAG, "Dropping frame from 0x%02x, no session", frame->source);
+			return;
+		}
+
 	crane_packet_t packet;
 	memcpy(&packet, frame->payload, sizeof packet);
-	ESP_LOGI(TAG, "Received packet frame from %02x, type: %d", frame->source, packet.type);
+	DLOGI(TAG, "Received packet frame from %02x, type: %d", frame->source, packet.type);
 	switch (packet.type)
 		{
 		case CRANE_CONNECT:
-			crane_recv_connect(&packet);
+			crane_recv_connect(session, &packet);
 			break;
 		case CRANE_STATUS:
-			crane_recv_status(&packet);
+			crane_recv_status(session, &packet, info->timestamp);
 			break;
 		case CRANE_ACTION:
 			break;
 		case CRANE_CLOSE:
-			crane_recv_close(&packet);
+			crane_recv_close(session, &packet);
 		}
 }
 
 /*
  * This function starts the connection establishment
  * procedure by sending a SYN packet to the given node.
+ * Returns the session, or NULL if it could not be started.
  */
-void crane_connect(uint8_t id)
+crane_session_t* crane_connect(uint8_t id, uint8_t flags)
 {
-    if (state.state != ST_DISCONNECTED)
-        return;
+	if (id == 0 || id == LOWNET_BROADCAST_ADDRESS)
+		{
+			serial_write_line("Invalid crane id");
+			return NULL;
+		}
 
-    crane_packet_t packet;
-    memset(&packet, 0, sizeof(packet));
-    packet.type = CRANE_CONNECT;
-    packet.flags = CRANE_SYN;
-    packet.seq = 0;                 // handshake always uses seq = 0
-    packet.d.conn.challenge = 0;    // initial challenge = 0
+	crane_session_t* session = crane_session_open(id);
+	if (!session)
+		{
+			serial_write_line("Too many crane sessions");
+			return NULL;
+		}
+	if (session->state != ST_DISCONNECTED)
+		return session;
 
-    state.crane = id;
-    state.state = ST_HANDSHAKE;
-    state.seq = 0;                  // reset sequence counter for new connection
+	crane_session_reset(session);   // fresh sequence space for the new connection
 
-    crane_send(id, &packet);
+	xSemaphoreTake(session->lock, portMAX_DELAY);
+	session->flags = flags;
+	crane_session_handshake(session, CRANE_HANDSHAKE_MS);
+	xSemaphoreGive(session->lock);
+	return session;
 }
 
-void crane_disconnect(void)
+void crane_disconnect(crane_session_t* session)
 {
 	crane_packet_t packet;
 
-	// ------------------------------------------------
-	// Milestone I, Task 3: construct a CLOSE packet and
-	// send it to the (right) crane!
-	{
-		memset(&packet, 0, sizeof(packet));
-                packet.type  = CRANE_CLOSE;
-                packet.flags = 0;          // no flags
-                packet.seq   = state.seq;  // next sequence
-                packet.d.close = 0;        // reserved must be zero
+	memset(&packet, 0, sizeof(packet));
+	packet.type  = CRANE_CLOSE;
+	packet.flags = 0;            // no flags
+	xSemaphoreTake(session->lock, portMAX_DELAY);
+	packet.seq   = session->seq; // next sequence
+	xTimerStop(session->rto, 0);
+	session->stop_due = 0;
+	session->closing = 1;
+	session->state = ST_DISCONNECTED;
+	xEventGroupSetBits(session->events, CRANE_EV_CLOSED);
+	xSemaphoreGive(session->lock);
+	packet.d.close = 0;          // reserved must be zero
+
+	// Repeat the CLOSE until the crane answers, which releases the
+	// slot, or give up and release it ourselves.
+	uint8_t id = session->crane;
+	for (int i = 0; i < CRANE_CLOSE_TRIES && session->crane == id; ++i)
+		{
+			crane_send(id, &packet);
+			ESP_LOGI(TAG, "Sent CLOSE packet to crane 0x%02x", id);
+			for (int t = 0; t < CRANE_CLOSE_MS / CRANE_LIVENESS_MS && session->crane == id; ++t)
+				vTaskDelay(pdMS_TO_TICKS(CRANE_LIVENESS_MS));
+		}
+	if (session->crane == id)
+		crane_session_free(session);
+}
 
-                crane_send(state.crane, &packet);
-                ESP_LOGI(TAG, "Sent CLOSE packet to crane 0x%02x", state.crane);
 
-                // wait a bit for possible ACK before resetting
-                vTaskDelay(pdMS_TO_TICKS(500));  
-                state.state = ST_DISCONNECTED;
-                state.seq = 0;
-	}
-	// ------------------------------------------------
-	// Then we update our state
-	state.state = ST_DISCONNECTED;
-	state.seq = 0;
-}
+/*
+ *	Retransmission timer: the oldest action has not been acknowledged
+ *	in time.  Runs in the timer service task and must not block.
+ */
+void crane_rto_expired(TimerHandle_t timer)
+{
+	crane_session_t* session = pvTimerGetTimerID(timer);
 
+	xSemaphoreTake(session->lock, portMAX_DELAY);
+	if (session->state == ST_CONNECTED && crane_in_flight(session))
+		{
+			if (++session->retries < CRANE_RETRIES)
+				{
+					DLOGW(TAG, "No ACK, retransmitting %d actions (try %d)",
+					      crane_in_flight(session), session->retries);
+					crane_resend_window(session);
+					xTimerReset(session->rto, 0);
+				}
+			else
+				{
+					crane_session_lost(session, "acknowledges nothing");
+				}
+		}
+	xSemaphoreGive(session->lock);
+}
 
 /*
- *	Subroutine for crane_action: read ACKs from crane, blocks for some time
+ *	Liveness: a crane reports STATUS every second while it has news and
+ *	every CRANE_IDLE_STATUS_MS otherwise.  A crane that reported a
+ *	backlog, or left two retransmissions unanswered, owes us a STATUS
+ *	every second and is dead after dead_ms of silence; any other crane
+ *	after CRANE_IDLE_STATUS_MS + dead_ms.  A dead crane's session is
+ *	re-established.  Also retransmits SYNs of handshakes in progress.
+ *	Runs in the timer service task and must not block.
  */
-uint16_t read_acks(void)
+void crane_liveness_check(TimerHandle_t timer)
 {
-	uint16_t seq, x;
+	uint32_t now = crane_now_ms();
 
-	// Wait for an ack up to 5 seconds
-	if ( xQueueReceive(state.acks, &seq, 5000/portTICK_PERIOD_MS) != pdTRUE )
-		seq = 0;
-	// read any other acks if in the queue
-	while ( xQueueReceive(state.acks, &x, 0) == pdTRUE )
-		seq = seq >= x ? seq : x;
-	return seq;
+	for (int i = 0; i < CRANE_MAX_SESSIONS; ++i)
+		{
+			crane_session_t* session = &cranes.sessions[i];
+			if (session->crane == 0)
+				continue;
+
+			xSemaphoreTake(session->lock, portMAX_DELAY);
+			if (session->state == ST_CONNECTED)
+				{
+					int busy = session->status.backlog || session->retries >= 2;
+					uint32_t dead = cranes.dead_ms + (busy ? 0 : CRANE_IDLE_STATUS_MS);
+					if (now - session->heard > dead)
+						crane_session_lost(session, "went silent");
+				}
+			else if (session->state == ST_HANDSHAKE
+			         && now - session->syn_sent >= CRANE_SYN_MS)
+				{
+					if ((int32_t)(now - session->deadline) >= 0)
+						{
+							ESP_LOGW(TAG, "No answer from crane 0x%02x, giving up", session->crane);
+							session->state = ST_DISCONNECTED;
+							xEventGroupSetBits(session->events, CRANE_EV_CLOSED);
+						}
+					else
+						{
+							crane_packet_t packet;
+							memset(&packet, 0, sizeof packet);
+							packet.type = CRANE_CONNECT;
+							packet.flags = CRANE_SYN | session->flags;
+							session->syn_sent = now;
+							crane_send(session->crane, &packet);
+						}
+				}
+			xSemaphoreGive(session->lock);
+		}
 }
 
 /*
- *	This can block for a while if no immediate ACK
+ *	STOP express lane: a task of its own, above the lownet service
+ *	task, repeats the tail of the window up to and including the STOP
+ *	until the crane acknowledges it, so that neither the timer service
+ *	task nor a burst of frames holds the repeats back.
  */
-int crane_action(uint8_t action)
+void crane_express_main(void* pvTaskParam)
 {
-    if (state.state != ST_CONNECTED) {
-        ESP_LOGW(TAG, "Cannot send action, not connected");
-        return -1;
-    }
+	while (true)
+		{
+			int64_t now = esp_timer_get_time();
+			int64_t next = INT64_MAX;
+			for (int i = 0; i < CRANE_MAX_SESSIONS; ++i)
+				{
+					crane_session_t* session = &cranes.sessions[i];
+					xSemaphoreTake(session->lock, portMAX_DELAY);
+					if (session->stop_due && now >= session->stop_due)
+						{
+							if (session->state != ST_CONNECTED || !session->stopping)
+								{
+									session->stop_due = 0;
+								}
+							else if (++session->stop_tries < CRANE_STOP_TRIES)
+								{
+									crane_resend_window(session);
+									session->stop_due = now + CRANE_STOP_REPEAT_MS * 1000ll;
+								}
+							else
+								{
+									// Leave it to the retransmission timer, which
+									// closes the session if the crane stays silent.
+									ESP_LOGW(TAG, "STOP to 0x%02x not acknowledged", session->crane);
+									session->stopping = 0;
+									session->stop_due = 0;
+								}
+						}
+					if (session->stop_due && session->stop_due < next)
+						next = session->stop_due;
+					xSemaphoreGive(session->lock);
+				}
 
-    if (state.crane == 0x00) {
-        ESP_LOGE(TAG, "state.crane is 0x00 — refusing to send");
-        state.state = ST_DISCONNECTED;
-        return -1;
-    }
+			TickType_t wait = portMAX_DELAY;
+			if (next != INT64_MAX)
+				wait = next > now ? pdMS_TO_TICKS((next - now + 999) / 1000) : 0;
+			if (wait)
+				ulTaskNotifyTake(pdTRUE, wait);
+		}
+}
 
-    crane_packet_t packet;
-    memset(&packet, 0, sizeof(packet));
-    packet.type = CRANE_ACTION;
-    packet.seq  = state.seq;               // use current seq
-    packet.d.action.cmd = action;
-    memset(packet.d.action.reserved, 0, sizeof(packet.d.action.reserved));
-    
-    ESP_LOGI(TAG, "Sending ACTION cmd=%d seq=%d", action, packet.seq);
+/*
+ *	Send a STOP ahead of anything waiting for room in the window.
+ *	Actions still in flight are turned into CRANE_NULL so that their
+ *	retransmissions cannot move the crane, the STOP takes the spare
+ *	window slot and is sent together with them until acknowledged.
+ *	Returns zero once the STOP has been sent.
+ */
+int crane_stop(crane_session_t* session)
+{
+	xSemaphoreTake(session->lock, portMAX_DELAY);
+	if (session->state != ST_CONNECTED)
+		{
+			xSemaphoreGive(session->lock);
+			ESP_LOGW(TAG, "Cannot send STOP, not connected");
+			return -1;
+		}
 
-    crane_send(state.crane, &packet);
+	session->stops++;
+	if (!session->stopping)
+		{
+			// A STOP whose repeats ran out may still be in flight, in the
+			// spare slot: it is repeated again instead of a new one.
+			uint16_t pending = session->seq;
+			for (uint16_t seq = session->acked + 1; seq != session->seq; ++seq)
+				if (session->window[seq % CRANE_SLOTS].d.action.cmd == CRANE_STOP)
+					pending = seq;
+				else
+					session->window[seq % CRANE_SLOTS].d.action.cmd = CRANE_NULL;
+
+			if (pending == session->seq)
+				{
+					if (crane_in_flight(session) >= CRANE_SLOTS)
+						{
+							xSemaphoreGive(session->lock);
+							ESP_LOGE(TAG, "Cannot send STOP, window full");
+							return -1;
+						}
+					if (crane_in_flight(session) == 0)
+						{
+							session->retries = 0;
+							xTimerReset(session->rto, 0);
+						}
+
+					crane_packet_t* packet = &session->window[session->seq % CRANE_SLOTS];
+					memset(packet, 0, sizeof *packet);
+					packet->type = CRANE_ACTION;
+					packet->seq  = session->seq++;
+					packet->d.action.cmd = CRANE_STOP;
+					session->sent_at[packet->seq % CRANE_SLOTS] = esp_timer_get_time();
+					session->stop_sent = esp_timer_get_time();
+				}
+			session->stopping = 1;
+			session->stop_seq = pending;
+		}
+	session->stop_tries = 0;
 
-    for (int attempt = 0; attempt < 5; ++attempt)
-    {
-        uint16_t ack = read_acks();  // wait up to 5s
+	DLOGI(TAG, "Sending STOP seq=%d to 0x%02x", session->stop_seq, session->crane);
+	crane_resend_window(session);
+	crane_express_arm(session);
+	xEventGroupClearBits(session->events, CRANE_EV_IDLE);
+	xSemaphoreGive(session->lock);
+	return 0;
+}
 
-        if (ack == 0) {
-            ESP_LOGW(TAG, "No ACK, retransmitting (try %d)", attempt + 1);
-            crane_send(state.crane, &packet);
-            continue;
-        }
+/*
+ *	Queue an action into the send window.  Blocks only while the
+ *	window is full, i.e. while the number of actions in flight has
+ *	reached the room left in the crane's backlog.  Returns zero once
+ *	the action has been sent, non-zero if the session went away or a
+ *	STOP flushed the action while it was waiting.
+ */
+int crane_action(crane_session_t* session, uint8_t action)
+{
+	if (action == CRANE_STOP)
+		return crane_stop(session);
 
-        if (ack == 0xFFFF) {
-            ESP_LOGW(TAG, "Spurious ACK seq 0xFFFF, ignoring");
-            continue;   // don't retransmit just because of this
-        }
+	xSemaphoreTake(session->lock, portMAX_DELAY);
+	uint32_t stops = session->stops;
+	while (true)
+		{
+			if (session->closing || session->crane == 0)
+				{
+					xSemaphoreGive(session->lock);
+					ESP_LOGW(TAG, "Cannot send action, not connected");
+					return -1;
+				}
+			if (session->state != ST_CONNECTED)
+				{
+					// Reconnect on demand, or wait for the reconnection
+					// in progress; the action goes out once connected.
+					if (session->state == ST_DISCONNECTED)
+						crane_session_handshake(session, CRANE_HANDSHAKE_MS);
+					xSemaphoreGive(session->lock);
+
+					EventBits_t bits = xEventGroupWaitBits(session->events,
+					                                       CRANE_EV_CONNECTED | CRANE_EV_CLOSED,
+					                                       pdFALSE,
+					                                       pdFALSE,
+					                                       portMAX_DELAY);
+					if (!(bits & CRANE_EV_CONNECTED))
+						{
+							ESP_LOGW(TAG, "Cannot send action, crane 0x%02x unreachable", session->crane);
+							return -1;
+						}
+					xSemaphoreTake(session->lock, portMAX_DELAY);
+					continue;
+				}
+			if (session->stops != stops)
+				{
+					xSemaphoreGive(session->lock);
+					DLOGI(TAG, "Action %d flushed by STOP", action);
+					return -1;
+				}
 
-        if (ack > state.seq) {
-            ESP_LOGE(TAG, "Unexpected ACK seq (%d > %d)", ack, state.seq);
-            crane_disconnect();
-            return -2;
-        }
+			uint16_t in_flight = crane_in_flight(session);
+			uint8_t backlog = session->status.backlog;
+			uint16_t room = backlog < CRANE_CAPACITY ? CRANE_CAPACITY - backlog : 0;
+			if (room > CRANE_WINDOW)
+				room = CRANE_WINDOW;
 
-        if (ack == state.seq) {
-            state.seq++;   // next command will use next seq
-            ESP_LOGI(TAG, "ACK received for seq %d", ack);
-            return 0;
-        }
-    }
+			// Always allow one action in flight so a stale backlog
+			// can never stall the session.
+			if (in_flight < room || in_flight == 0)
+				{
+					crane_packet_t* packet = &session->window[session->seq % CRANE_SLOTS];
+					memset(packet, 0, sizeof *packet);
+					packet->type = CRANE_ACTION;
+					packet->seq  = session->seq++;
+					packet->d.action.cmd = action;
+
+					DLOGI(TAG, "Sending ACTION cmd=%d seq=%d to 0x%02x",
+					      action, packet->seq, session->crane);
+					session->sent_at[packet->seq % CRANE_SLOTS] = esp_timer_get_time();
+					crane_send(session->crane, packet);
+
+					if (in_flight == 0)
+						{
+							session->retries = 0;
+							xTimerReset(session->rto, 0);
+						}
+					xEventGroupClearBits(session->events, CRANE_EV_IDLE);
+					xSemaphoreGive(session->lock);
+					return 0;
+				}
 
-    ESP_LOGI(TAG, "Received no ack from node=0x%02x", state.crane);
-    crane_disconnect();
-    return -1;
+			// Window full: wait for the next STATUS, which either
+			// advances the ACK or reports a shorter backlog.
+			xEventGroupClearBits(session->events, CRANE_EV_STATUS);
+			xSemaphoreGive(session->lock);
+
+			// The liveness check ends the wait if the crane goes
+			// silent, by reconnecting or closing the session.
+			xEventGroupWaitBits(session->events,
+			                    CRANE_EV_STATUS | CRANE_EV_CLOSED,
+			                    pdFALSE,
+			                    pdFALSE,
+			                    pdMS_TO_TICKS(CRANE_LIVENESS_MS));
+			xSemaphoreTake(session->lock, portMAX_DELAY);
+		}
 }
 
 
@@ -382,100 +1368,336 @@ int crane_action(uint8_t action)
 // 2. run the test pattern according to the specs
 // 3. close the connection
 //
-// Hint: you can work it all out here slowly, or be a wizard
-//       and launch a separate task for this!
-//
 
-static void crane_wait_until_idle(void)
+// Usage: crane_barrier_budget(SESSION)
+// Pre:   SESSION != NULL
+// Post:  CRANE_EV_STATUS and CRANE_EV_ACK are clear
+// Value: The ticks SESSION may take to become idle, going by the
+//        time_left of its latest STATUS, or portMAX_DELAY while actions
+//        are in flight
+static TickType_t crane_barrier_budget(crane_session_t* session)
 {
-    // Wait up to ~10 seconds for backlog to become 0
-    for (int i = 0; i < 100; ++i)  // 100 * 100 ms = 10 seconds
-    {
-        if (g_last_backlog == 0) {
-            return;
-        }
-        vTaskDelay(pdMS_TO_TICKS(100));
-    }
+	xSemaphoreTake(session->lock, portMAX_DELAY);
+	TickType_t budget = crane_in_flight(session)
+		? portMAX_DELAY
+		: pdMS_TO_TICKS(session->status.time_left * 1000u + CRANE_BARRIER_SLACK_MS);
+	xEventGroupClearBits(session->events, CRANE_EV_STATUS | CRANE_EV_ACK);
+	xSemaphoreGive(session->lock);
+	return budget;
+}
 
-    ESP_LOGW(TAG, "Timeout waiting for backlog to drain (backlog=%d)", g_last_backlog);
+// Usage: crane_wait_until_idle(SESSION)
+// Pre:   SESSION != NULL
+// Post:  All actions sent on SESSION have been acknowledged and the
+//        crane reported an empty backlog, or the session was given up,
+//        or the crane took longer than the time_left it reported once
+//        everything was acknowledged
+// Value: 0 if SESSION is idle, non-0 otherwise
+static int crane_wait_until_idle(crane_session_t* session)
+{
+	// The time_left of a STATUS covers only what the crane holds, so the
+	// time runs once nothing is in flight, and every STATUS or ACK brings
+	// a new estimate which starts it over.  Loss and silence are the
+	// business of the retransmission timer and the liveness check: they
+	// either reconnect, after which the replayed actions drain, or close
+	// the session, so the time does not run while the session is down
+	// either.  The wait wakes up every CRANE_LIVENESS_MS to look.
+	TickType_t start = xTaskGetTickCount();
+	TickType_t budget = crane_barrier_budget(session);
+	while (true)
+		{
+			TickType_t waited = xTaskGetTickCount() - start;
+			TickType_t wait = waited < budget ? budget - waited : 0;
+			if (wait > pdMS_TO_TICKS(CRANE_LIVENESS_MS))
+				wait = pdMS_TO_TICKS(CRANE_LIVENESS_MS);
+			EventBits_t bits = xEventGroupWaitBits(session->events,
+			                                       CRANE_EV_IDLE | CRANE_EV_CLOSED
+			                                       | CRANE_EV_STATUS | CRANE_EV_ACK,
+			                                       pdFALSE,
+			                                       pdFALSE,
+			                                       wait);
+			if (bits & (CRANE_EV_IDLE | CRANE_EV_CLOSED))
+				return (bits & CRANE_EV_IDLE) && !(bits & CRANE_EV_CLOSED) ? 0 : -1;
+
+			if ((bits & (CRANE_EV_STATUS | CRANE_EV_ACK)) || !(bits & CRANE_EV_CONNECTED)
+			    || budget == portMAX_DELAY)
+				{
+					start = xTaskGetTickCount();
+					budget = crane_barrier_budget(session);
+				}
+			else if (xTaskGetTickCount() - start >= budget)
+				{
+					ESP_LOGW(TAG, "Crane 0x%02x not idle within the time it reported",
+					         session->crane);
+					return -1;
+				}
+		}
 }
 
 
-void crane_test(uint8_t id)
+static int crane_script_action(void* ctx, uint8_t action)
 {
-    ESP_LOGI(TAG, "Starting automated crane test with 0x%02x", id);
-
-    // Start from a clean state
-    state.crane = id;
-    state.state = ST_DISCONNECTED;
-    state.seq   = 0;
+	if (cranes.abort)
+		return 1;
+	return crane_action((crane_session_t*) ctx, action);
+}
 
-    // 1. Connect with TEST flag
-    crane_packet_t packet;
-    memset(&packet, 0, sizeof(packet));
-    packet.type  = CRANE_CONNECT;
-    packet.flags = CRANE_SYN | CRANE_TEST;
-    packet.seq   = 0;                 // handshake seq = 0
-    packet.d.conn.challenge = 0;
+static int crane_script_wait(void* ctx)
+{
+	if (cranes.abort)
+		return 1;
+	return crane_wait_until_idle((crane_session_t*) ctx);
+}
 
-    state.crane = id;
-    state.state = ST_HANDSHAKE;
-    state.seq   = 0;                  // handshake uses seq 0
+static int crane_script_pause(void* ctx, uint32_t ms)
+{
+	if (cranes.abort)
+		return 1;
+	vTaskDelay(pdMS_TO_TICKS(ms));
+	return 0;
+}
 
-    crane_send(id, &packet);
+static const crane_script_ops_t crane_script_ops = {
+	.action = crane_script_action,
+	.wait = crane_script_wait,
+	.pause = crane_script_pause,
+};
+
+// Usage: crane_submit(ID, FLAGS, SOURCE)
+// Pre:   SOURCE != NULL, is a script or @NAME of a builtin script
+// Post:  SOURCE has been compiled and queued to run on crane ID
+// Value: 0 if the job was queued, non-0 otherwise
+int crane_submit(uint8_t id, uint8_t flags, const char* source)
+{
+	char buffer[MSG_BUFFER_LENGTH];
+	crane_job_t job;
 
-    // Wait up to ~3 seconds for handshake to complete
-    for (int i = 0; i < 30 && state.state != ST_CONNECTED; ++i) {
-        vTaskDelay(pdMS_TO_TICKS(100));
-    }
+	if (source[0] == '@')
+		{
+			const crane_script_t* script = crane_script_find(source + 1);
+			if (!script)
+				{
+					serial_write_line("Unknown script");
+					return 1;
+				}
+			source = script->source;
+		}
 
-    if (state.state != ST_CONNECTED)
-    {
-        ESP_LOGW(TAG, "Handshake failed");
-        return;
-    }
+	int error = crane_script_compile(source, &job.program);
+	if (error)
+		{
+			snprintf(buffer, sizeof buffer, "Script error at offset %d", error - 1);
+			serial_write_line(buffer);
+			return 1;
+		}
 
-    // At this point crane_recv_connect() has set state.seq = 1
+	job.crane = id;
+	job.flags = flags;
+	if (xQueueSend(cranes.jobs, &job, 0) != pdTRUE)
+		{
+			serial_write_line("Crane task busy");
+			return 1;
+		}
+	return 0;
+}
 
-    // 2. Run the test sequence
+// Usage: crane_bench(ID, COUNT, ACTION, FLAGS)
+// Pre:   0 < COUNT <= CRANE_BENCH_MAX
+// Post:  A bench of COUNT x ACTION against crane ID has been queued,
+//        FLAGS may hold CRANE_JOB_CSV
+// Value: 0 if the job was queued, non-0 otherwise
+int crane_bench(uint8_t id, uint16_t count, uint8_t action, uint8_t flags)
+{
+	crane_job_t job;
+
+	memset(&job, 0, sizeof job);
+	job.crane = id;
+	job.flags = CRANE_JOB_TEST | CRANE_JOB_BENCH | flags;
+	job.action = action;
+	job.count = count;
+	if (xQueueSend(cranes.jobs, &job, 0) != pdTRUE)
+		{
+			serial_write_line("Crane task busy");
+			return 1;
+		}
+	return 0;
+}
 
-    // 2. Switch on the light
-    crane_action(CRANE_LIGHT_ON);
+static int crane_compare_u32(const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*) a, y = *(const uint32_t*) b;
+	return (x > y) - (x < y);
+}
 
-    // 3. Drive crane forward for two steps
-    crane_action(CRANE_FWD);
-    crane_action(CRANE_FWD);
+// Usage: crane_bench_run(SESSION, JOB)
+// Pre:   SESSION is connected, JOB is a bench job for it
+// Post:  JOB->count actions have been sent and acknowledged, or the
+//        session was lost, and the results written to the serial port
+static void crane_bench_run(crane_session_t* session, const crane_job_t* job)
+{
+	char buffer[MSG_BUFFER_LENGTH];
+	crane_bench_t bench = {
+		.latency = malloc(job->count * sizeof(uint32_t)),
+		.capacity = job->count,
+	};
+	if (!bench.latency)
+		{
+			serial_write_line("Out of memory for bench");
+			return;
+		}
 
-    // 4. Drive crane backward for one step
-    crane_action(CRANE_REV);
+	xSemaphoreTake(session->lock, portMAX_DELAY);
+	uint32_t retransmits = session->retransmits;
+	uint32_t naks = session->naks;
+	session->bench = &bench;
+	xSemaphoreGive(session->lock);
+
+	int64_t start = esp_timer_get_time();
+	uint16_t sent = 0;
+	while (sent < job->count && !cranes.abort && crane_action(session, job->action) == 0)
+		sent++;
+	crane_wait_until_idle(session);
+
+	xSemaphoreTake(session->lock, portMAX_DELAY);
+	session->bench = NULL;
+	retransmits = session->retransmits - retransmits;
+	naks = session->naks - naks;
+	xSemaphoreGive(session->lock);
+
+	double seconds = (bench.last_ack - start) / 1e6;
+	snprintf(buffer, sizeof buffer, "bench 0x%02x: %u of %u actions acked in %.3f s, %.2f actions/s",
+	         job->crane, (unsigned) bench.recorded, (unsigned) job->count,
+	         bench.recorded ? seconds : 0.0,
+	         bench.recorded && seconds > 0 ? bench.recorded / seconds : 0.0);
+	serial_write_line(buffer);
+
+	if (bench.recorded)
+		{
+			if (job->flags & CRANE_JOB_CSV)
+				{
+					serial_write_line("ack,latency_us");
+					for (uint32_t i = 0; i < bench.recorded; ++i)
+						{
+							snprintf(buffer, sizeof buffer, "%lu,%lu",
+							         (unsigned long) i + 1, (unsigned long) bench.latency[i]);
+							serial_write_line(buffer);
+						}
+				}
 
-    // 5. Pause until all commands have executed
-    crane_wait_until_idle();
+			qsort(bench.latency, bench.recorded, sizeof(uint32_t), crane_compare_u32);
+			uint32_t last = bench.recorded - 1;
+			snprintf(buffer, sizeof buffer, "latency ms p50/p95/p99/max: %.1f/%.1f/%.1f/%.1f",
+			         bench.latency[last * 50 / 100] / 1e3,
+			         bench.latency[last * 95 / 100] / 1e3,
+			         bench.latency[last * 99 / 100] / 1e3,
+			         bench.latency[last] / 1e3);
+			serial_write_line(buffer);
+		}
 
-    // 6. Lower the hook for two steps
-    crane_action(CRANE_DOWN);
-    crane_action(CRANE_DOWN);
+	snprintf(buffer, sizeof buffer, "retransmissions: %lu  NAKs: %lu",
+	         (unsigned long) retransmits, (unsigned long) naks);
+	serial_write_line(buffer);
+	free(bench.latency);
+}
 
-    // 7. Pause until all commands have executed
-    crane_wait_until_idle();
+// Usage: crane_job_run(JOB)
+// Pre:   JOB != NULL
+// Post:  The program of JOB has run against its crane, with a TEST
+//        mode connection around it if requested
+static void crane_job_run(const crane_job_t* job)
+{
+	crane_session_t* session;
 
-    // 8. Lift the hook back up for two steps
-    crane_action(CRANE_UP);
-    crane_action(CRANE_UP);
+	cranes.abort = 0;
+	if (job->flags & CRANE_JOB_TEST)
+		{
+			// Start from a clean state.  A session still open is closed
+			// first: the crane would otherwise hold on to it until its
+			// own timeout and could refuse the new one as busy.
+			session = crane_session_find(job->crane);
+			if (session && session->state != ST_DISCONNECTED)
+				crane_disconnect(session);
+			else if (session)
+				crane_session_reset(session);
+
+			// Connect with TEST flag
+			session = crane_connect(job->crane, CRANE_TEST);
+			if (!session)
+				return;
+
+			// Wait for the handshake to complete; the liveness check
+			// repeats the SYN and gives up after CRANE_HANDSHAKE_MS.
+			xEventGroupWaitBits(session->events,
+			                    CRANE_EV_CONNECTED | CRANE_EV_CLOSED,
+			                    pdFALSE,
+			                    pdFALSE,
+			                    portMAX_DELAY);
+
+			if (session->state != ST_CONNECTED)
+				{
+					ESP_LOGW(TAG, "Handshake failed");
+					crane_session_free(session);
+					return;
+				}
+		}
+	else
+		{
+			session = crane_session_find(job->crane);
+			if (!session || session->state != ST_CONNECTED)
+				{
+					ESP_LOGW(TAG, "Not connected to crane 0x%02x", job->crane);
+					return;
+				}
+		}
 
-    // 9. Drive crane backwards for one step
-    crane_action(CRANE_REV);
+	// The test pattern must reach the crane as written, so TEST jobs
+	// are never optimized.
+	int result = 0;
+	if (job->flags & CRANE_JOB_BENCH)
+		{
+			crane_bench_run(session, job);
+		}
+	else if (cranes.optimize && !(job->flags & CRANE_JOB_TEST))
+		{
+			crane_opt_t opt;
+			crane_opt_init(&opt, &crane_script_ops, session);
+			result = crane_script_run(&job->program, &crane_opt_ops, &opt);
+			if (!result)
+				result = crane_opt_flush(&opt);
+			cranes.opt_in += opt.in;
+			cranes.opt_out += opt.out;
+			ESP_LOGI(TAG, "Optimizer sent %lu of %lu actions",
+			         (unsigned long) opt.out, (unsigned long) opt.in);
+		}
+	else
+		{
+			result = crane_script_run(&job->program, &crane_script_ops, session);
+		}
+	if (result)
+		ESP_LOGW(TAG, "Script on crane 0x%02x stopped (%d)", job->crane, result);
 
-    // 10. Switch off the light
-    crane_action(CRANE_LIGHT_OFF);
+	if ((job->flags & CRANE_JOB_TEST) && session->state == ST_CONNECTED)
+		crane_disconnect(session);
+}
 
-    // Optionally wait for everything to be flushed
-    crane_wait_until_idle();
+void crane_task_main(void* pvTaskParam)
+{
+	while (true)
+		{
+			crane_job_t job;
+			if (xQueueReceive(cranes.jobs, &job, portMAX_DELAY) != pdTRUE)
+				continue;
 
-    // 11. Disconnect
-    crane_disconnect();
+			ESP_LOGI(TAG, "Running script on crane 0x%02x", job.crane);
+			crane_job_run(&job);
+			ESP_LOGI(TAG, "Script on crane 0x%02x completed", job.crane);
+		}
+}
 
-    ESP_LOGI(TAG, "Test sequence completed");
+void crane_test(uint8_t id)
+{
+	ESP_LOGI(TAG, "Starting automated crane test with 0x%02x", id);
+	crane_submit(id, CRANE_JOB_TEST, "@test");
 }
 
 
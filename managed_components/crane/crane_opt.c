@@ -0,0 +1,111 @@
+#include "crane_opt.h"
+
+#include "crane.h"
+
+// Usage: opt_opposite(A)
+// Pre:   None
+// Value: The move undoing move A, CRANE_NULL if A is not a move
+static uint8_t opt_opposite(uint8_t a)
+{
+	switch (a)
+		{
+		case CRANE_FWD:  return CRANE_REV;
+		case CRANE_REV:  return CRANE_FWD;
+		case CRANE_UP:   return CRANE_DOWN;
+		case CRANE_DOWN: return CRANE_UP;
+		default:         return CRANE_NULL;
+		}
+}
+
+static int opt_is_light(uint8_t a)
+{
+	return a == CRANE_LIGHT_ON || a == CRANE_LIGHT_OFF;
+}
+
+void crane_opt_init(crane_opt_t* opt, const crane_script_ops_t* next, void* next_ctx)
+{
+	opt->next = next;
+	opt->next_ctx = next_ctx;
+	opt->length = 0;
+	opt->in = 0;
+	opt->out = 0;
+}
+
+int crane_opt_flush(crane_opt_t* opt)
+{
+	/*
+	 * Loop invariant:
+	 * batch[0..i) has been passed on, batch[i..length) has not
+	 */
+	for (uint8_t i = 0; i < opt->length; ++i)
+		{
+			opt->out++;
+			int result = opt->next->action(opt->next_ctx, opt->batch[i]);
+			if (result)
+				{
+					opt->length = 0;
+					return result;
+				}
+		}
+	opt->length = 0;
+	return 0;
+}
+
+static int opt_action(void* ctx, uint8_t action)
+{
+	crane_opt_t* opt = ctx;
+	opt->in++;
+
+	if (action == CRANE_STOP)
+		{
+			int result = crane_opt_flush(opt);
+			if (result)
+				return result;
+			opt->out++;
+			return opt->next->action(opt->next_ctx, action);
+		}
+
+	if (opt->length > 0)
+		{
+			uint8_t* last = &opt->batch[opt->length - 1];
+			if (*last != CRANE_NULL && opt_opposite(*last) == action)
+				{
+					opt->length--;
+					return 0;
+				}
+			if (opt_is_light(*last) && opt_is_light(action))
+				{
+					*last = action;
+					return 0;
+				}
+		}
+
+	if (opt->length == CRANE_OPT_BATCH)
+		{
+			int result = crane_opt_flush(opt);
+			if (result)
+				return result;
+		}
+	opt->batch[opt->length++] = action;
+	return 0;
+}
+
+static int opt_wait(void* ctx)
+{
+	crane_opt_t* opt = ctx;
+	int result = crane_opt_flush(opt);
+	return result ? result : opt->next->wait(opt->next_ctx);
+}
+
+static int opt_pause(void* ctx, uint32_t ms)
+{
+	crane_opt_t* opt = ctx;
+	int result = crane_opt_flush(opt);
+	return result ? result : opt->next->pause(opt->next_ctx, ms);
+}
+
+const crane_script_ops_t crane_opt_ops = {
+	.action = opt_action,
+	.wait = opt_wait,
+	.pause = opt_pause,
+};
@@ -0,0 +1,226 @@
+#include "crane_script.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#include "crane.h"
+
+const crane_script_t crane_scripts[] = {
+	// Milestone III test pattern
+	{"test",  "o 2f b W 2d W 2u b O W"},
+	{"sweep", "o 4f W 4b W O"},
+	{"blink", "5(o p500 O p500)"},
+};
+
+const size_t crane_num_scripts = sizeof crane_scripts / sizeof crane_scripts[0];
+
+const crane_script_t* crane_script_find(const char* name)
+{
+	for (size_t i = 0; i < crane_num_scripts; ++i)
+		if (strcmp(crane_scripts[i].name, name) == 0)
+			return &crane_scripts[i];
+	return NULL;
+}
+
+// Usage: script_action(C)
+// Pre:   None
+// Value: The crane action for the manual mode letter C, -1 if C is
+//        not an action
+static int script_action(char c)
+{
+	switch (c)
+		{
+		case 'f': return CRANE_FWD;
+		case 'b': return CRANE_REV;
+		case 'u': return CRANE_UP;
+		case 'd': return CRANE_DOWN;
+		case 'o': return CRANE_LIGHT_ON;
+		case 'O': return CRANE_LIGHT_OFF;
+		case 's': return CRANE_STOP;
+		case 'n': return CRANE_NULL;
+		default:  return -1;
+		}
+}
+
+// Usage: script_emit(PROGRAM, OP, ARG)
+// Pre:   PROGRAM != NULL
+// Post:  OP ARG has been appended to PROGRAM if there was room
+//        for it and the final END instruction
+// Value: 0 on success, non-0 if PROGRAM is full
+static int script_emit(crane_program_t* program, uint8_t op, uint8_t arg)
+{
+	if (program->length >= CRANE_SCRIPT_MAX_INSNS - 1)
+		return 1;
+	program->code[program->length].op = op;
+	program->code[program->length].arg = arg;
+	program->length++;
+	return 0;
+}
+
+// Usage: script_number(P, VALUE)
+// Pre:   P != NULL, *P points at a decimal digit
+// Post:  *P has been advanced past the digits, VALUE holds their value
+//        saturated at UINT32_MAX / 10
+static void script_number(const char** p, uint32_t* value)
+{
+	*value = 0;
+	while (isdigit((unsigned char) **p))
+		{
+			uint32_t digit = **p - '0';
+			if (*value <= (UINT32_MAX / 10 - digit) / 10)
+				*value = *value * 10 + digit;
+			else
+				*value = UINT32_MAX / 10;
+			(*p)++;
+		}
+}
+
+int crane_script_compile(const char* source, crane_program_t* program)
+{
+	const char* p = source;
+	int depth = 0;
+
+	memset(program, 0, sizeof *program);
+
+	while (*p)
+		{
+			if (isspace((unsigned char) *p))
+				{
+					p++;
+					continue;
+				}
+
+			const char* start = p;
+			uint32_t count = 1;
+			int counted = isdigit((unsigned char) *p);
+			if (counted)
+				{
+					script_number(&p, &count);
+					if (count == 0 || count > UINT8_MAX)
+						return 1 + (start - source);
+				}
+
+			if (*p == '(')
+				{
+					if (depth == CRANE_SCRIPT_MAX_DEPTH
+					    || script_emit(program, CRANE_OP_LOOP, count))
+						return 1 + (start - source);
+					depth++;
+					p++;
+					continue;
+				}
+			if (*p == ')')
+				{
+					if (counted || depth == 0
+					    || script_emit(program, CRANE_OP_NEXT, 0))
+						return 1 + (start - source);
+					depth--;
+					p++;
+					continue;
+				}
+
+			if (counted && script_emit(program, CRANE_OP_LOOP, count))
+				return 1 + (start - source);
+
+			int action = script_action(*p);
+			if (action >= 0)
+				{
+					if (script_emit(program, CRANE_OP_ACTION, action))
+						return 1 + (start - source);
+					p++;
+				}
+			else if (*p == 'W')
+				{
+					if (script_emit(program, CRANE_OP_WAIT, 0))
+						return 1 + (start - source);
+					p++;
+				}
+			else if (*p == 'p' && isdigit((unsigned char) p[1]))
+				{
+					uint32_t ms;
+					p++;
+					script_number(&p, &ms);
+					// Round to the 10 ms resolution, long pauses take
+					// several instructions.
+					uint32_t units = (ms + 5) / 10;
+					do
+						{
+							uint8_t n = units > UINT8_MAX ? UINT8_MAX : units;
+							if (script_emit(program, CRANE_OP_PAUSE, n))
+								return 1 + (start - source);
+							units -= n;
+						}
+					while (units);
+				}
+			else
+				{
+					return 1 + (start - source);
+				}
+
+			// An item ends at whitespace, a group boundary or the end
+			if (*p && !isspace((unsigned char) *p) && *p != ')' && *p != '(')
+				return 1 + (start - source);
+
+			if (counted && script_emit(program, CRANE_OP_NEXT, 0))
+				return 1 + (start - source);
+		}
+
+	if (depth != 0)
+		return 1 + (p - source);
+
+	program->code[program->length].op = CRANE_OP_END;
+	program->code[program->length].arg = 0;
+	program->length++;
+	return 0;
+}
+
+int crane_script_run(const crane_program_t* program, const crane_script_ops_t* ops, void* ctx)
+{
+	// A repeated item inside the innermost group adds one level
+	struct
+	{
+		uint8_t start;
+		uint8_t left;
+	} loops[CRANE_SCRIPT_MAX_DEPTH + 1];
+	int sp = 0;
+	int result = 0;
+
+	for (int pc = 0; pc < program->length; ++pc)
+		{
+			const crane_insn_t* insn = &program->code[pc];
+			switch (insn->op)
+				{
+				case CRANE_OP_END:
+					return 0;
+				case CRANE_OP_ACTION:
+					result = ops->action(ctx, insn->arg);
+					break;
+				case CRANE_OP_WAIT:
+					result = ops->wait(ctx);
+					break;
+				case CRANE_OP_PAUSE:
+					result = ops->pause(ctx, (uint32_t) insn->arg * 10);
+					break;
+				case CRANE_OP_LOOP:
+					if (sp == CRANE_SCRIPT_MAX_DEPTH + 1)
+						return -1;
+					loops[sp].start = pc;
+					loops[sp].left = insn->arg;
+					sp++;
+					break;
+				case CRANE_OP_NEXT:
+					if (sp == 0)
+						return -1;
+					if (--loops[sp - 1].left > 0)
+						pc = loops[sp - 1].start;
+					else
+						sp--;
+					break;
+				default:
+					return -1;
+				}
+			if (result)
+				return result;
+		}
+	return 0;
+}
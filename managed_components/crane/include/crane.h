@@ -1,9 +1,17 @@
 /*****************************************************************
  *  For CLI:
  *  -------
- *  /crane open [#] | close  : open/close connection
- *  /crane u|d|f|b|o|O       : manual mode
+ *  /crane open [#] | close [#] : open/close connection
+ *  /crane use # | list      : select crane / list sessions
+ *  /crane u|d|f|b|o|O|s [#] : manual mode, s = STOP (express)
  *  /crane test [node id]    : run test pattern
+ *  /crane run [#] SCRIPT|@NAME : run a script (see crane_script.h)
+ *  /crane scripts | abort   : list builtin scripts / stop script
+ *  /crane telemetry [N] | stats : recorded STATUS samples
+ *  /crane watch on|off      : print STATUS as it arrives
+ *  /crane dead [MS]         : silence tolerated before reconnecting
+ *  /crane opt [on|off]      : coalesce script actions (see crane_opt.h)
+ *  /crane bench # N [ACTION] [csv] : time N actions, default null
  *
  *  Status:   every sec if new data
  *  - otherwise every 15 seconds
@@ -14,6 +22,24 @@
 
 #include <stdint.h>
 
+/*
+ * Number of cranes a node can hold sessions with at the same time
+ */
+#define  CRANE_MAX_SESSIONS 4
+
+/*
+ * Flow control: at most CRANE_WINDOW actions in flight per session, and
+ * never more than the room left in the crane's queue of CRANE_CAPACITY
+ * actions as reported by the backlog field of STATUS
+ */
+#define  CRANE_WINDOW       8
+#define  CRANE_CAPACITY     8
+
+/*
+ * STATUS samples kept per session
+ */
+#define  CRANE_TELEMETRY_SIZE 64
+
 /*
  * Packet types
  */
@@ -91,6 +117,16 @@ typedef struct __attribute__((__packed__))
 } d;
 } crane_packet_t;
 
+/*
+ *  A STATUS sample as recorded by the client
+ */
+typedef struct
+{
+	uint32_t stamp;    // milliseconds since boot when received
+	uint16_t seq;      // cumulative ACK carried by the STATUS
+	status_t status;
+} crane_sample_t;
+
 /*******************************************************************************************/
 
 int crane_init(void);
@@ -0,0 +1,51 @@
+/*****************************************************************
+ *  Crane action optimizer
+ *  ----------------------
+ *  An optional stage between a script and the crane sender.  Actions
+ *  are held in a pending batch which is reduced as it grows:
+ *
+ *    - a move followed by its opposite cancels (f b, u d, ...),
+ *      repeatedly, so "f u d b" sends nothing
+ *    - adjacent light actions collapse into the last one, "o O" is "O"
+ *
+ *  The batch is sent when a barrier is reached: a wait, a pause, a
+ *  STOP (sent after the batch, never ahead of it), a full batch or the
+ *  end of the script.  Nothing is moved across a barrier.
+ *****************************************************************/
+
+#ifndef CRANE_OPT_H
+#define CRANE_OPT_H
+
+#include <stdint.h>
+
+#include "crane_script.h"
+
+#define CRANE_OPT_BATCH 16
+
+typedef struct
+{
+	const crane_script_ops_t* next; // where the reduced stream goes
+	void* next_ctx;
+
+	uint8_t batch[CRANE_OPT_BATCH];
+	uint8_t length;
+
+	uint32_t in;   // actions received
+	uint32_t out;  // actions passed on
+} crane_opt_t;
+
+// Hooks to run a script through an optimizer; ctx is a crane_opt_t*
+extern const crane_script_ops_t crane_opt_ops;
+
+// Usage: crane_opt_init(OPT, NEXT, NEXT_CTX)
+// Pre:   OPT != NULL, NEXT != NULL
+// Post:  OPT is an empty optimizer passing its output to NEXT with NEXT_CTX
+void crane_opt_init(crane_opt_t* opt, const crane_script_ops_t* next, void* next_ctx);
+
+// Usage: crane_opt_flush(OPT)
+// Pre:   OPT != NULL
+// Post:  The pending batch of OPT has been passed on and emptied
+// Value: 0 on success, the non-zero result of NEXT otherwise
+int crane_opt_flush(crane_opt_t* opt);
+
+#endif
@@ -0,0 +1,85 @@
+/*****************************************************************
+ *  Crane action scripts
+ *  --------------------
+ *  A script is a whitespace separated list of items:
+ *
+ *    f b u d o O s   actions, same letters as manual mode
+ *    n               null action, processed immediately by the crane
+ *    W               wait until the crane backlog is empty
+ *    pMS             pause for MS milliseconds (10 ms resolution)
+ *    N<item>         repeat an item N times, e.g. 2f
+ *    N( ... )        repeat a group N times, e.g. 3(f b)
+ *
+ *  The test pattern is "o 2f b W 2d W 2u b O W".
+ *****************************************************************/
+
+#ifndef CRANE_SCRIPT_H
+#define CRANE_SCRIPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CRANE_SCRIPT_MAX_INSNS 64
+#define CRANE_SCRIPT_MAX_DEPTH 4
+
+/*
+ * Opcodes, every instruction is two bytes: opcode + argument
+ */
+#define CRANE_OP_END     0x00   // end of program
+#define CRANE_OP_ACTION  0x01   // arg: CRANE_* action
+#define CRANE_OP_WAIT    0x02   // wait for backlog to drain
+#define CRANE_OP_PAUSE   0x03   // arg: pause in units of 10 ms
+#define CRANE_OP_LOOP    0x04   // arg: repeat count of the block up to NEXT
+#define CRANE_OP_NEXT    0x05   // end of a LOOP block
+
+typedef struct __attribute__((__packed__))
+{
+	uint8_t op;
+	uint8_t arg;
+} crane_insn_t;
+
+typedef struct
+{
+	crane_insn_t code[CRANE_SCRIPT_MAX_INSNS];
+	uint8_t length;
+} crane_program_t;
+
+// Hooks the interpreter drives; each returns zero to continue and
+// non-zero to abort the program.
+typedef struct
+{
+	int (*action)(void* ctx, uint8_t action);
+	int (*wait)(void* ctx);
+	int (*pause)(void* ctx, uint32_t ms);
+} crane_script_ops_t;
+
+typedef struct
+{
+	const char* name;
+	const char* source;
+} crane_script_t;
+
+extern const crane_script_t crane_scripts[];
+extern const size_t crane_num_scripts;
+
+// Usage: crane_script_compile(SOURCE, PROGRAM)
+// Pre:   SOURCE != NULL, PROGRAM != NULL
+// Post:  PROGRAM holds the bytecode for SOURCE if it compiled
+// Value: 0 on success, otherwise 1 + the offset in SOURCE where
+//        compilation failed
+int crane_script_compile(const char* source, crane_program_t* program);
+
+// Usage: crane_script_run(PROGRAM, OPS, CTX)
+// Pre:   PROGRAM was produced by crane_script_compile, OPS != NULL
+// Post:  The instructions of PROGRAM have been executed through OPS,
+//        each hook receiving CTX
+// Value: 0 if the program ran to the end, the non-zero hook result
+//        that aborted it otherwise
+int crane_script_run(const crane_program_t* program, const crane_script_ops_t* ops, void* ctx);
+
+// Usage: crane_script_find(NAME)
+// Pre:   NAME != NULL
+// Value: The builtin script called NAME, NULL if there is none
+const crane_script_t* crane_script_find(const char* name);
+
+#endif
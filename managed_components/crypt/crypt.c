@@ -5,7 +5,7 @@
 #include <string.h>
 
 #include <esp_log.h>
-#include <aes/esp_aes.h>
+#include <mbedtls/aes.h>
 
 #include <serial_io.h>
 #include <lownet.h>
@@ -17,17 +17,17 @@ void crypt_decrypt(const lownet_secure_frame_t* cipher, lownet_secure_frame_t* p
 	memcpy(plain, cipher, LOWNET_UNENCRYPTED_SIZE + LOWNET_IVT_SIZE);
 
 	const uint8_t* aes_key = lownet_get_key()->bytes;
-	esp_aes_context ctx;
-	esp_aes_init(&ctx);
-	esp_aes_setkey(&ctx, aes_key, 256);
-	esp_aes_crypt_cbc(&ctx,
-												ESP_AES_DECRYPT,
+	mbedtls_aes_context ctx;
+	mbedtls_aes_init(&ctx);
+	mbedtls_aes_setkey_dec(&ctx, aes_key, 256);
+	mbedtls_aes_crypt_cbc(&ctx,
+												MBEDTLS_AES_DECRYPT,
 												LOWNET_ENCRYPTED_SIZE,
 												iv,
 												(const unsigned char*) &cipher->protocol,
 												(unsigned char*) &plain->protocol
 												);
-	esp_aes_free(&ctx);
+	mbedtls_aes_free(&ctx);
 }
 
 void crypt_encrypt(const lownet_secure_frame_t* plain, lownet_secure_frame_t* cipher)
@@ -37,19 +37,19 @@ void crypt_encrypt(const lownet_secure_frame_t* plain, lownet_secure_frame_t* ci
 
 	memcpy(cipher, plain, LOWNET_UNENCRYPTED_SIZE + LOWNET_IVT_SIZE);
 	const uint8_t* aes_key = lownet_get_key()->bytes;
-	esp_aes_context ctx;
+	mbedtls_aes_context ctx;
 
-	esp_aes_init(&ctx);
-	esp_aes_setkey(&ctx, aes_key, 256);
-	esp_aes_crypt_cbc(
+	mbedtls_aes_init(&ctx);
+	mbedtls_aes_setkey_enc(&ctx, aes_key, 256);
+	mbedtls_aes_crypt_cbc(
 		&ctx,
-		ESP_AES_ENCRYPT,
+		MBEDTLS_AES_ENCRYPT,
 		LOWNET_ENCRYPTED_SIZE,
 		iv,
 		(const unsigned char*) &plain->protocol,
 		(unsigned char*) &cipher->protocol
 	);
-	esp_aes_free(&ctx);
+	mbedtls_aes_free(&ctx);
 }
 
 // Usage: crypt_command(KEY)
@@ -1,6 +1,10 @@
 #include "device-table.h"
 
 #include <stddef.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 static const lownet_identifier_t device_table[] =
 {
@@ -73,30 +77,213 @@ static const lownet_identifier_t device_table[] =
 	{{0xFF,0xFF,0xFF,0xFF,0xFF,0xFF}, 0xFF}
 };
 
+/*
+ * Runtime view of the table: the static entries above plus whatever was
+ * added since boot.  Lookups go through a direct node id index and an
+ * open addressing MAC hash, built on first use, so they do not depend on
+ * the size of the table.  Index slots hold entry + 1, so 0 is empty; MAC
+ * slots of replaced addresses become tombstones until the hash is
+ * rebuilt, and entries left without a node are used again.  Updates
+ * change entries in place, so lookups copy them out under the lock too.
+ */
+#define DEVICE_TABLE_BUCKETS 512  // power of two, at least 2 * DEVICE_TABLE_MAX
+#define DEVICE_TABLE_EMPTY   0
+#define DEVICE_TABLE_DELETED 0xFFFF
+#define DEVICE_TABLE_REHASH  (DEVICE_TABLE_BUCKETS / 4) // tombstones before a rebuild
+
+static lownet_identifier_t entries[DEVICE_TABLE_MAX];
+static uint16_t num_entries;
+static uint16_t by_id[256];
+static uint16_t by_mac[DEVICE_TABLE_BUCKETS];
+static uint16_t tombstones;
+static volatile int initialized;
+
+static portMUX_TYPE table_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t mac_hash(const uint8_t* mac) {
+	// FNV-1a, vendor bytes included so that different vendors' NICs with
+	// the same low bytes do not collide.
+	uint32_t h = 2166136261u;
+	for (int i = 0; i < 6; ++i) {
+		h = (h ^ mac[i]) * 16777619u;
+	}
+	return h;
+}
+
+// Value: The by_mac slot holding MAC, or -1 if MAC is not in the table.
+static int mac_slot(const uint8_t* mac) {
+	uint32_t h = mac_hash(mac);
+	for (int probe = 0; probe < DEVICE_TABLE_BUCKETS; ++probe) {
+		int slot = (h + probe) & (DEVICE_TABLE_BUCKETS - 1);
+		uint16_t index = by_mac[slot];
+		if (index == DEVICE_TABLE_EMPTY) {
+			return -1;
+		}
+		if (index != DEVICE_TABLE_DELETED && memcmp(entries[index - 1].mac, mac, 6) == 0) {
+			return slot;
+		}
+	}
+	return -1;
+}
+
+// Pre: table_lock is held, MAC is not in the table.
+static void mac_insert(const uint8_t* mac, uint16_t index) {
+	uint32_t h = mac_hash(mac);
+	for (int probe = 0; probe < DEVICE_TABLE_BUCKETS; ++probe) {
+		int slot = (h + probe) & (DEVICE_TABLE_BUCKETS - 1);
+		if (by_mac[slot] == DEVICE_TABLE_EMPTY || by_mac[slot] == DEVICE_TABLE_DELETED) {
+			by_mac[slot] = index;
+			return;
+		}
+	}
+}
+
+// Pre:  table_lock is held.
+// Post: by_mac holds every entry with a node, and no tombstones.
+static void mac_rehash(void) {
+	memset(by_mac, 0, sizeof by_mac);
+	for (uint16_t index = 2; index <= num_entries; ++index) {
+		if (entries[index - 1].node) {
+			mac_insert(entries[index - 1].mac, index);
+		}
+	}
+	tombstones = 0;
+}
+
+// Pre: table_lock is held.
+// Value: The index of an entry to fill, 0 if the table is full.
+static uint16_t entry_claim(void) {
+	// Entry 1 is the dead identifier, which has node 0 too.
+	for (uint16_t index = 2; index <= num_entries; ++index) {
+		if (!entries[index - 1].node) {
+			return index;
+		}
+	}
+	return num_entries < DEVICE_TABLE_MAX ? num_entries + 1 : 0;
+}
+
+// Pre: table_lock is held.
+static int table_put(const uint8_t* mac, uint8_t node, int replace) {
+	uint16_t by_node = by_id[node];
+	int slot = mac_slot(mac);
+	uint16_t by_addr = slot >= 0 ? by_mac[slot] : 0;
+
+	if (by_node && by_node == by_addr) {
+		return 0; // Already known as is.
+	}
+	if (!replace && (by_node || by_addr)) {
+		return -1;
+	}
+
+	if (by_addr && !by_node) {
+		// A known MAC under a new node id: rename the entry.
+		by_id[entries[by_addr - 1].node] = DEVICE_TABLE_EMPTY;
+		entries[by_addr - 1].node = node;
+		by_id[node] = by_addr;
+		return 0;
+	}
+
+	if (by_addr) {
+		// Both are known, separately.  The MAC's entry loses its MAC and
+		// its node, which keeps its slot of entries unused.
+		by_mac[slot] = DEVICE_TABLE_DELETED;
+		tombstones++;
+		by_id[entries[by_addr - 1].node] = DEVICE_TABLE_EMPTY;
+		memset(&entries[by_addr - 1], 0, sizeof(lownet_identifier_t));
+	}
+
+	uint16_t index = by_node;
+	if (index) {
+		// A known node id under a new MAC: move the entry.
+		int old_slot = mac_slot(entries[index - 1].mac);
+		if (old_slot >= 0) {
+			by_mac[old_slot] = DEVICE_TABLE_DELETED;
+			tombstones++;
+		}
+	} else {
+		index = entry_claim();
+		if (!index) {
+			return -1;
+		}
+	}
+
+	memcpy(entries[index - 1].mac, mac, 6);
+	entries[index - 1].node = node;
+	if (index > num_entries) {
+		num_entries = index;
+	}
+	if (tombstones >= DEVICE_TABLE_REHASH) {
+		mac_rehash();
+	} else {
+		mac_insert(mac, index);
+	}
+	by_id[node] = index;
+	return 0;
+}
+
+static void table_init(void) {
+	taskENTER_CRITICAL(&table_lock);
+	if (!initialized) {
+		// Entry 1 is the dead identifier, returned for misses.
+		size_t size = sizeof(device_table) / sizeof(device_table[0]);
+		entries[0] = device_table[0];
+		num_entries = 1;
+		for (size_t i = 1; i < size; ++i) {
+			table_put(device_table[i].mac, device_table[i].node, 0);
+		}
+		initialized = 1;
+	}
+	taskEXIT_CRITICAL(&table_lock);
+}
+
 // Lookup identifier by node id.
 lownet_identifier_t lownet_lookup(uint8_t id) {
-	size_t size = sizeof(device_table) / sizeof(device_table[0]);
-	for (int i = 0; i < size; ++i) {
-		if (device_table[i].node == id) {
-			return device_table[i];
-		}
+	if (!initialized) {
+		table_init();
 	}
-	return device_table[0];
+	taskENTER_CRITICAL(&table_lock);
+	uint16_t index = id ? by_id[id] : 0;
+	lownet_identifier_t result = index ? entries[index - 1] : entries[0];
+	taskEXIT_CRITICAL(&table_lock);
+	return result;
 }
 
 // Lookup identifier by mac address.
 lownet_identifier_t lownet_lookup_mac(const uint8_t* mac) {
-	size_t size = sizeof(device_table) / sizeof(device_table[0]);
-	for (int i = 0; i < size; ++i) {
-		int match = 1;
-		for (int j = 0; j < 6; ++j) {
-			if (device_table[i].mac[j] != mac[j]) {
-				match = 0;
-			}
-		}
-		if (match) {
-			return device_table[i];
-		}
+	if (!initialized) {
+		table_init();
+	}
+	taskENTER_CRITICAL(&table_lock);
+	int slot = mac_slot(mac);
+	lownet_identifier_t result = slot >= 0 ? entries[by_mac[slot] - 1] : entries[0];
+	taskEXIT_CRITICAL(&table_lock);
+	return result;
+}
+
+// Adds or rebinds the identifier ID.
+int lownet_device_add(const lownet_identifier_t* id) {
+	if (id == NULL || id->node == 0) {
+		return -1;
+	}
+	if (!initialized) {
+		table_init();
+	}
+	taskENTER_CRITICAL(&table_lock);
+	int result = table_put(id->mac, id->node, 1);
+	taskEXIT_CRITICAL(&table_lock);
+	return result;
+}
+
+// Number of identifiers in the table, the dead identifier excluded.
+size_t lownet_device_count(void) {
+	if (!initialized) {
+		table_init();
+	}
+	taskENTER_CRITICAL(&table_lock);
+	size_t count = num_entries - 1;
+	for (uint16_t index = 2; index <= num_entries; ++index) {
+		count -= !entries[index - 1].node;
 	}
-	return device_table[0];
+	taskEXIT_CRITICAL(&table_lock);
+	return count;
 }
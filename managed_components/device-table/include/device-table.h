@@ -1,14 +1,30 @@
 #ifndef DEVICE_TABLE_H
 #define DEVICE_TABLE_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+// Identifiers the table holds, static and runtime entries together
+#define DEVICE_TABLE_MAX 256
+
 typedef struct {
 	uint8_t mac[6];
 	uint8_t node;
 } lownet_identifier_t;
 
+// Lookups take constant time.  A miss returns the dead identifier, node 0.
 lownet_identifier_t lownet_lookup(uint8_t id);
 lownet_identifier_t lownet_lookup_mac(const uint8_t* mac);
 
+// Usage: lownet_device_add(ID)
+// Pre:   ID != NULL, ID->node != 0
+// Post:  ID->node resolves to ID->mac and back; earlier bindings of
+//        either are replaced
+// Value: 0 on success, -1 if the table is full
+int lownet_device_add(const lownet_identifier_t* id);
+
+// Usage: lownet_device_count()
+// Value: Number of identifiers in the table
+size_t lownet_device_count(void);
+
 #endif
@@ -14,4 +14,30 @@ void id_command(char* args);
 // Post:  The network time has been written to the serial port.
 void date_command(char* args);
 
+// Usage: neighbors_command(NULL)
+// Pre:   None, this command takes no arguments.
+// Post:  The nodes heard from, with signal strength and loss, have been
+//        written to the serial port.
+void neighbors_command(char* args);
+
+// Usage: mesh_command(ARGS)
+// Pre:   ARGS is "on", "off", "routes" or "stats"
+// Post:  Multi-hop forwarding has been switched on or off, or the routes
+//        or forwarding counters have been written to the serial port.
+void mesh_command(char* args);
+
+// Usage: capture_command(ARGS)
+// Pre:   ARGS is NULL, "dump", "stats" or "snap BYTES"
+// Post:  The frame capture ring has been written to the serial port as a
+//        hex encoded pcap file between BEGIN PCAP and END PCAP lines, or
+//        its counters have been written, or its snapshot length set.
+void capture_command(char* args);
+
+// Usage: reliable_command(ARGS)
+// Pre:   ARGS is "stats" or "send ID BYTES"
+// Post:  The reliable streams have been written to the serial port, or
+//        BYTES bytes have been sent reliably to ID, to be discarded, and
+//        the throughput written.
+void reliable_command(char* args);
+
 #endif
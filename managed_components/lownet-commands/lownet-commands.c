@@ -1,8 +1,15 @@
 #include "lownet-commands.h"
 
 #include <stdio.h>
+#include <string.h>
+
+#include <esp_timer.h>
 
 #include <lownet.h>
+#include <lownet_capture.h>
+#include <lownet_mesh.h>
+#include <lownet_neighbor.h>
+#include <lownet_reliable.h>
 #include <lownet_util.h>
 #include <serial_io.h>
 
@@ -29,3 +36,264 @@ void date_command(char*)
 	sprintf(buffer + n, " since the course started");
 	serial_write_line(buffer);
 }
+
+void neighbors_command(char*)
+{
+	lownet_neighbor_t neighbors[LOWNET_NEIGHBORS];
+	size_t n = lownet_neighbors(neighbors, LOWNET_NEIGHBORS);
+	if (!n)
+		{
+			serial_write_line("No neighbors heard yet.");
+			return;
+		}
+
+	char buffer[80];
+	serial_write_line("node  last seen  rssi  last  frames    lost  loss");
+	int64_t now = esp_timer_get_time();
+	for (size_t i = 0; i < n; ++i)
+		{
+			const lownet_neighbor_t* nb = &neighbors[i];
+			snprintf(buffer, sizeof buffer, "0x%02x %8.1fs %5d %5d %7lu %7lu %4u.%u%%",
+			         nb->node,
+			         (now - nb->last_seen) / 1e6,
+			         nb->rssi,
+			         nb->rssi_last,
+			         (unsigned long) nb->frames,
+			         (unsigned long) nb->lost,
+			         nb->loss / 10, nb->loss % 10);
+			serial_write_line(buffer);
+		}
+}
+
+static void mesh_routes(void)
+{
+	char buffer[64];
+	int64_t now = esp_timer_get_time();
+	lownet_mesh_t* mesh = lownet_get_mesh();
+	int count = 0;
+
+	serial_write_line("node  via   hops  latency");
+	for (int node = 1; node < LOWNET_BROADCAST_ADDRESS; ++node)
+		{
+			lownet_route_t route;
+			if (lownet_mesh_get_route(mesh, node, now, &route) != 0)
+				continue;
+			snprintf(buffer, sizeof buffer, "0x%02x  0x%02x  %4u  %5.1f ms",
+			         node, route.next_hop, route.hops, route.latency_us / 1e3);
+			serial_write_line(buffer);
+			count++;
+		}
+	if (!count)
+		serial_write_line("No routes.");
+}
+
+static void mesh_stats(void)
+{
+	char buffer[96];
+	lownet_mesh_stats_t stats = lownet_mesh_stats(lownet_get_mesh());
+
+	snprintf(buffer, sizeof buffer, "Mesh %s, %lu beacons heard",
+	         lownet_mesh_enabled() ? "on" : "off", (unsigned long) stats.beacons);
+	serial_write_line(buffer);
+	snprintf(buffer, sizeof buffer, "originated %lu, delivered %lu, avg %.1f hops, max %u",
+	         (unsigned long) stats.originated, (unsigned long) stats.delivered,
+	         stats.delivered ? (double) stats.hops_sum / stats.delivered : 0.0,
+	         stats.hops_max);
+	serial_write_line(buffer);
+	snprintf(buffer, sizeof buffer, "forwarded %lu, flooded %lu, duplicates %lu, expired %lu",
+	         (unsigned long) stats.forwarded, (unsigned long) stats.flooded,
+	         (unsigned long) stats.duplicates, (unsigned long) stats.expired);
+	serial_write_line(buffer);
+	snprintf(buffer, sizeof buffer, "residence avg %.2f ms, max %.2f ms",
+	         stats.residence_avg_us / 1e3, stats.residence_max_us / 1e3);
+	serial_write_line(buffer);
+}
+
+void mesh_command(char* args)
+{
+	if (args && !strcmp(args, "on"))
+		lownet_mesh_enable(true);
+	else if (args && !strcmp(args, "off"))
+		lownet_mesh_enable(false);
+	else if (args && !strcmp(args, "routes"))
+		mesh_routes();
+	else if (args && !strcmp(args, "stats"))
+		mesh_stats();
+	else
+		serial_write_line("Usage: /mesh on|off|routes|stats");
+}
+
+#define CAPTURE_LINE_BYTES 32 // bytes per hex line of the pcap dump
+
+typedef struct
+{
+	char line[2 * CAPTURE_LINE_BYTES + 1];
+	size_t used; // hex digits in line
+} capture_dump_t;
+
+static void capture_flush(capture_dump_t* dump)
+{
+	if (!dump->used)
+		return;
+	dump->line[dump->used] = '\0';
+	// The dump is useless with holes, so wait for the serial port.
+	serial_write_line_timeout(dump->line, portMAX_DELAY);
+	dump->used = 0;
+}
+
+static void capture_write(const void* data, size_t length, void* ctx)
+{
+	static const char digits[] = "0123456789abcdef";
+	capture_dump_t* dump = ctx;
+	const uint8_t* bytes = data;
+	for (size_t i = 0; i < length; ++i)
+		{
+			dump->line[dump->used++] = digits[bytes[i] >> 4];
+			dump->line[dump->used++] = digits[bytes[i] & 0x0F];
+			if (dump->used == 2 * CAPTURE_LINE_BYTES)
+				capture_flush(dump);
+		}
+}
+
+static void capture_stats(void)
+{
+	char buffer[96];
+	lownet_capture_stats_t stats = lownet_capture_stats();
+
+	snprintf(buffer, sizeof buffer, "%lu frames captured, %u bytes of each, last %d kept",
+	         (unsigned long) stats.captured, stats.snaplen, LOWNET_CAPTURE_FRAMES);
+	serial_write_line(buffer);
+	serial_write_line("fate            in      out");
+	for (int reason = 0; reason < LOWNET_DROP_REASONS; ++reason)
+		{
+			if (!stats.in[reason] && !stats.out[reason])
+				continue;
+			snprintf(buffer, sizeof buffer, "%-8s %9lu %8lu",
+			         lownet_drop_name(reason),
+			         (unsigned long) stats.in[reason],
+			         (unsigned long) stats.out[reason]);
+			serial_write_line(buffer);
+		}
+}
+
+void capture_command(char* args)
+{
+	unsigned snaplen;
+	if (!args || !strcmp(args, "dump"))
+		{
+			capture_dump_t dump = { .used = 0 };
+			serial_write_line_timeout("-----BEGIN PCAP-----", portMAX_DELAY);
+			lownet_capture_pcap(capture_write, &dump);
+			capture_flush(&dump);
+			serial_write_line_timeout("-----END PCAP-----", portMAX_DELAY);
+		}
+	else if (!strcmp(args, "stats"))
+		capture_stats();
+	else if (sscanf(args, "snap %u", &snaplen) == 1)
+		lownet_capture_set_snaplen(snaplen);
+	else
+		serial_write_line("Usage: /capture [dump|stats|snap BYTES]");
+}
+
+#define RELIABLE_SEND_TIMEOUT pdMS_TO_TICKS(10000) // for room in the window, or the last ACK
+
+static void reliable_stats(void)
+{
+	lownet_reliable_stats_t streams[LOWNET_RELIABLE_PEERS];
+	size_t n = lownet_reliable_peers(streams, LOWNET_RELIABLE_PEERS);
+	if (!n)
+		{
+			serial_write_line("No reliable streams.");
+			return;
+		}
+
+	char buffer[MSG_BUFFER_LENGTH];
+	for (size_t i = 0; i < n; ++i)
+		{
+			const lownet_reliable_stats_t* s = &streams[i];
+			snprintf(buffer, sizeof buffer, "0x%02x  srtt %.1f ms, rttvar %.1f ms, rto %.1f ms, %u in flight",
+			         s->node, s->srtt_us / 1e3, s->rttvar_us / 1e3, s->rto_us / 1e3, s->in_flight);
+			serial_write_line(buffer);
+			snprintf(buffer, sizeof buffer, "      sent %lu, retransmitted %lu (%lu fast), %lu timeouts, %lu failures",
+			         (unsigned long) s->sent, (unsigned long) s->retransmitted,
+			         (unsigned long) s->fast, (unsigned long) s->timeouts,
+			         (unsigned long) s->failures);
+			serial_write_line(buffer);
+			snprintf(buffer, sizeof buffer, "      delivered %lu, out of order %lu, duplicates %lu, discarded %lu bytes",
+			         (unsigned long) s->delivered, (unsigned long) s->out_of_order,
+			         (unsigned long) s->duplicates, (unsigned long) s->discarded);
+			serial_write_line(buffer);
+		}
+}
+
+static const lownet_reliable_stats_t* reliable_find(const lownet_reliable_stats_t* streams, size_t n,
+                                                    uint8_t node)
+{
+	for (size_t i = 0; i < n; ++i)
+		if (streams[i].node == node)
+			return &streams[i];
+	return NULL;
+}
+
+static void reliable_send(uint8_t node, size_t bytes)
+{
+	static uint8_t data[4 * LOWNET_RELIABLE_SEGMENT];
+	lownet_reliable_stats_t streams[LOWNET_RELIABLE_PEERS];
+	const lownet_reliable_stats_t* stream;
+	uint32_t retransmitted = 0;
+	uint32_t fast = 0;
+
+	size_t n = lownet_reliable_peers(streams, LOWNET_RELIABLE_PEERS);
+	if ((stream = reliable_find(streams, n, node)))
+		{
+			retransmitted = stream->retransmitted;
+			fast = stream->fast;
+		}
+
+	int64_t start = esp_timer_get_time();
+	size_t sent = 0;
+	while (sent < bytes)
+		{
+			size_t chunk = bytes - sent < sizeof data ? bytes - sent : sizeof data;
+			size_t queued = lownet_reliable_send(node, LOWNET_RELIABLE_DISCARD, data, chunk,
+			                                     RELIABLE_SEND_TIMEOUT);
+			sent += queued;
+			if (queued < chunk)
+				break;
+		}
+	int failed = sent < bytes || lownet_reliable_flush(node, RELIABLE_SEND_TIMEOUT);
+	int64_t elapsed = esp_timer_get_time() - start;
+
+	n = lownet_reliable_peers(streams, LOWNET_RELIABLE_PEERS);
+	if ((stream = reliable_find(streams, n, node)))
+		{
+			retransmitted = stream->retransmitted - retransmitted;
+			fast = stream->fast - fast;
+		}
+
+	char buffer[96];
+	if (failed)
+		{
+			snprintf(buffer, sizeof buffer, "Sending to 0x%02x failed, %u of %u bytes queued",
+			         node, (unsigned) sent, (unsigned) bytes);
+			serial_write_line(buffer);
+			return;
+		}
+	snprintf(buffer, sizeof buffer, "%u bytes to 0x%02x in %.1f ms, %.1f kbit/s, %lu retransmitted (%lu fast)",
+	         (unsigned) bytes, node, elapsed / 1e3, elapsed ? bytes * 8e3 / elapsed : 0.0,
+	         (unsigned long) retransmitted, (unsigned long) fast);
+	serial_write_line(buffer);
+}
+
+void reliable_command(char* args)
+{
+	int node;
+	unsigned long bytes;
+	if (args && !strcmp(args, "stats"))
+		reliable_stats();
+	else if (args && sscanf(args, "send %i %lu", &node, &bytes) == 2
+	         && node > 0 && node < LOWNET_BROADCAST_ADDRESS && node != lownet_get_device_id())
+		reliable_send(node, bytes);
+	else
+		serial_write_line("Usage: /reliable stats|send ID BYTES");
+}
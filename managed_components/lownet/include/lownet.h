@@ -49,6 +49,10 @@ typedef struct __attribute__((__packed__))
 	uint32_t crc;
 } lownet_secure_frame_t;
 
+// padding[LOWNET_SEQ] numbers the frames from a source to a destination,
+// counting 1..255 and wrapping to 1.  0 means the frame is not numbered.
+#define LOWNET_SEQ 1
+
 static_assert(sizeof(lownet_frame_t) == LOWNET_FRAME_SIZE, "lownet_frame_t size is incorrect");
 static_assert(sizeof(lownet_secure_frame_t) == 228, "lownet_secure_frame_t size is incorrect");
 static_assert(offsetof(lownet_secure_frame_t, payload) ==
@@ -80,6 +84,37 @@ typedef void (*lownet_recv_fn)(const lownet_frame_t* frame);
 // Value: 0 if PROTO was successfully registered, non-0 otherwise
 int lownet_register_protocol(uint8_t protocol, lownet_recv_fn handler);
 
+// Reception details of an inbound frame.
+#define LOWNET_RX_ENCRYPTED 0x01 // the frame arrived encrypted
+
+#define LOWNET_KEY_NONE 0xFF // no key, or one not from the keystore
+
+typedef struct
+{
+	int64_t timestamp; // esp_timer time of reception, microseconds
+	int8_t rssi;       // signal strength, dBm
+	uint8_t flags;     // LOWNET_RX_* flags
+	uint8_t key;       // keystore slot of the key which decrypted the frame
+	uint32_t queued;   // time from reception to dispatch, microseconds
+} lownet_rx_info_t;
+
+typedef void (*lownet_recv_ex_fn)(const lownet_frame_t* frame, const lownet_rx_info_t* info);
+
+// Usage: lownet_register_protocol_ex(PROTO, HANDLER)
+// Pre:   PROTO is a protocol identifier which has not been registered
+//        HANDLER is the frame handler for PROTO
+// Post:  HANDLER is given the reception details along with each frame
+// Value: 0 if PROTO was successfully registered, non-0 otherwise
+int lownet_register_protocol_ex(uint8_t protocol, lownet_recv_ex_fn handler);
+
+typedef void (*lownet_tap_fn)(const lownet_frame_t* frame, const lownet_rx_info_t* info);
+
+// Usage: lownet_register_tap(TAP)
+// Pre:   TAP does not block; it runs in the lownet service task
+// Post:  TAP sees every valid inbound frame, whatever its destination and
+//        protocol, before dispatch.  TAP == NULL removes the tap.
+void lownet_register_tap(lownet_tap_fn tap);
+
 // Lownet key structure.  Bytes member MUST point to a usable contiguous
 // region of memory of AT LEAST 'size' bytes.
 typedef struct {
@@ -97,6 +132,17 @@ void lownet_init(
 
 void lownet_send(const lownet_frame_t* frame);
 
+#define LOWNET_SEND_BUSY 2 // the link stayed out of transmit buffers
+
+// Usage: lownet_send_ex(FRAME, WAIT_MS)
+// Pre:   WAIT_MS is 0 in timer callbacks and other contexts which must
+//        not block
+// Post:  FRAME has been sent as by lownet_send; while the link was out of
+//        transmit buffers the caller waited up to WAIT_MS for one
+// Value: 0 if the link took the frame, LOWNET_SEND_BUSY if it stayed out
+//        of buffers, another non-0 value otherwise
+int lownet_send_ex(const lownet_frame_t* frame, uint32_t wait_ms);
+
 lownet_time_t lownet_get_time();
 void lownet_set_time(const lownet_time_t* time);
 
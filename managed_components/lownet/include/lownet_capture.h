@@ -0,0 +1,110 @@
+#ifndef LOWNET_CAPTURE_H
+#define LOWNET_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lownet.h"
+
+/*
+ * Frame capture.  The core records every frame it sends and every frame
+ * it receives, whatever becomes of it, in a ring of the latest
+ * LOWNET_CAPTURE_FRAMES frames.  A record is the frame header and the
+ * start of the payload, up to the snapshot length, so capturing costs a
+ * copy of at most LOWNET_CAPTURE_SNAPLEN bytes and stays on under load.
+ * Encrypted frames are recorded in the clear, marked as secure.
+ *
+ * The ring is exported as a pcap file with link type
+ * LOWNET_CAPTURE_LINKTYPE.  Every packet starts with a
+ * lownet_capture_header_t, followed by the frame as far as captured.
+ */
+
+#ifndef LOWNET_CAPTURE_FRAMES
+#define LOWNET_CAPTURE_FRAMES 128
+#endif
+
+// Bytes kept of a frame at most; the snapshot length can be lowered at
+// run time.  The header and 56 bytes of payload by default.
+#ifndef LOWNET_CAPTURE_SNAPLEN
+#define LOWNET_CAPTURE_SNAPLEN 64
+#endif
+
+static_assert(LOWNET_CAPTURE_SNAPLEN >= LOWNET_HEAD_SIZE
+              && LOWNET_CAPTURE_SNAPLEN <= LOWNET_FRAME_SIZE,
+              "LOWNET_CAPTURE_SNAPLEN must hold the header and at most a frame");
+
+#define LOWNET_CAPTURE_LINKTYPE 147 // LINKTYPE_USER0
+
+#define LOWNET_CAPTURE_IN  0
+#define LOWNET_CAPTURE_OUT 1
+
+#define LOWNET_CAPTURE_SECURE 0x01 // encrypted on the air
+
+// What became of a frame.  Inbound frames which reach their protocol,
+// or are forwarded, and outbound frames handed to the link are
+// LOWNET_DROP_NONE.
+typedef enum
+{
+	LOWNET_DROP_NONE = 0,
+	LOWNET_DROP_QUEUE,    // inbound or decryption queue full
+	LOWNET_DROP_LENGTH,   // wrong size for a frame, or for the key in use
+	LOWNET_DROP_MAGIC,    // bad magic, for secure frames a key mismatch
+	LOWNET_DROP_CRC,      // checksum mismatch
+	LOWNET_DROP_SOURCE,   // broadcast source address
+	LOWNET_DROP_MESH,     // mesh duplicate, or for others and not forwarded
+	LOWNET_DROP_ADDRESS,  // for another node
+	LOWNET_DROP_PROTOCOL, // no handler for the protocol
+	LOWNET_DROP_SEND,     // the link refused the frame
+	LOWNET_DROP_REASONS
+} lownet_drop_t;
+
+// The pseudo header in front of every packet of the pcap export.
+typedef struct __attribute__((__packed__))
+{
+	uint8_t direction; // LOWNET_CAPTURE_IN or LOWNET_CAPTURE_OUT
+	uint8_t reason;    // lownet_drop_t
+	uint8_t flags;     // LOWNET_CAPTURE_* flags
+	int8_t rssi;       // dBm, 0 for outbound frames
+} lownet_capture_header_t;
+
+typedef struct
+{
+	uint32_t captured;                     // frames recorded since boot
+	uint32_t in[LOWNET_DROP_REASONS];      // inbound frames by fate
+	uint32_t out[LOWNET_DROP_REASONS];     // outbound frames by fate
+	uint16_t snaplen;
+} lownet_capture_stats_t;
+
+// Usage: lownet_capture(HEADER, DATA, LENGTH, TIMESTAMP)
+// Pre:   DATA points to LENGTH bytes, a frame or what arrived as one;
+//        HEADER describes it.  Callable from any task and from the
+//        receive callback of the port.
+// Post:  The oldest record of the ring has been replaced with DATA, cut
+//        to the snapshot length, stamped with TIMESTAMP, esp_timer time
+void lownet_capture(lownet_capture_header_t header, const void* data, size_t length,
+                    int64_t timestamp);
+
+// Usage: lownet_capture_set_snaplen(SNAPLEN)
+// Post:  Frames are recorded up to SNAPLEN bytes from now on, clamped to
+//        LOWNET_HEAD_SIZE..LOWNET_CAPTURE_SNAPLEN
+void lownet_capture_set_snaplen(size_t snaplen);
+
+// Usage: lownet_capture_stats()
+// Value: A snapshot of the capture counters
+lownet_capture_stats_t lownet_capture_stats(void);
+
+typedef void (*lownet_capture_write_fn)(const void* data, size_t length, void* ctx);
+
+// Usage: lownet_capture_pcap(WRITE, CTX)
+// Pre:   WRITE does not capture frames itself
+// Post:  The ring has been written, oldest frame first, as a pcap file
+//        through calls of WRITE with CTX.  Timestamps are network time
+//        if it is known, time since boot otherwise.  Frames captured
+//        meanwhile are left out, as are those they overwrite.
+void lownet_capture_pcap(lownet_capture_write_fn write, void* ctx);
+
+// Usage: lownet_drop_name(REASON)
+// Value: A short name for REASON
+const char* lownet_drop_name(lownet_drop_t reason);
+
+#endif
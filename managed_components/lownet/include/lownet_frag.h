@@ -0,0 +1,96 @@
+#ifndef LOWNET_FRAG_H
+#define LOWNET_FRAG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lownet.h"
+
+/*
+ * Messages larger than a frame.  A message which does not fit into one
+ * frame goes out as numbered fragments of LOWNET_PROTOCOL_FRAG, sent back
+ * to back, which the receiver reassembles per source and message number
+ * and hands to the protocol of the message.  Messages which fit go out
+ * as a plain frame of their protocol, as they always did.
+ *
+ * Reassembly takes memory from a fixed arena.  A message which does not
+ * fit, or whose fragments stop arriving for LOWNET_FRAG_TIMEOUT_MS, is
+ * dropped; a lost fragment loses the whole message, so anything which
+ * must arrive needs acknowledgements on top.
+ */
+
+#define LOWNET_PROTOCOL_FRAG 0x08
+
+typedef struct __attribute__((__packed__))
+{
+	uint8_t protocol; // protocol of the whole message
+	uint16_t message; // numbers the messages of a sender
+	uint8_t index;    // of this fragment, from 0
+	uint8_t count;    // fragments of the message
+} lownet_frag_header_t;
+
+#define LOWNET_FRAG_DATA (LOWNET_PAYLOAD_SIZE - sizeof(lownet_frag_header_t))
+
+#ifndef LOWNET_FRAG_MAX_MESSAGE
+#define LOWNET_FRAG_MAX_MESSAGE 8192
+#endif
+
+// Reassembly memory, of which one source may hold at most half.  Room
+// is taken for whole fragments, so a message takes up to a fragment more
+// than its length.
+#ifndef LOWNET_FRAG_ARENA
+#define LOWNET_FRAG_ARENA (2 * (LOWNET_FRAG_MAX_MESSAGE + LOWNET_FRAG_DATA))
+#endif
+
+#define LOWNET_FRAG_SLOTS 8          // messages reassembled at the same time
+#define LOWNET_FRAG_TIMEOUT_MS 1000  // allowed between fragments of a message
+
+static_assert(LOWNET_FRAG_MAX_MESSAGE <= 255 * LOWNET_FRAG_DATA,
+              "LOWNET_FRAG_MAX_MESSAGE takes more than 255 fragments");
+static_assert(LOWNET_FRAG_ARENA / 2 >= LOWNET_FRAG_MAX_MESSAGE + LOWNET_FRAG_DATA,
+              "LOWNET_FRAG_ARENA cannot hold a message of the largest size");
+
+// A message as handed to its protocol.  DATA is valid until the handler
+// returns, and the handler may change it, for instance to send it back.
+typedef struct
+{
+	uint8_t source;
+	uint8_t destination;
+	uint8_t protocol;
+	uint16_t length;
+	uint8_t* data;
+} lownet_message_t;
+
+typedef void (*lownet_message_fn)(const lownet_message_t* message, const lownet_rx_info_t* info);
+
+typedef struct
+{
+	uint32_t sent;        // messages sent in fragments
+	uint32_t fragments;   // fragments sent
+	uint32_t reassembled; // messages put back together
+	uint32_t timeouts;    // messages dropped for missing fragments
+	uint32_t no_memory;   // fragments dropped for want of a slot or arena space
+	uint32_t duplicates;  // fragments received twice
+	uint32_t malformed;   // fragments which made no sense
+} lownet_frag_stats_t;
+
+// Usage: lownet_frag_register(PROTO, HANDLER)
+// Pre:   PROTO is a protocol identifier which has not been registered
+// Post:  HANDLER is given the messages of PROTO, whether they came in a
+//        frame or in fragments, from the lownet service task
+// Value: 0 if PROTO was successfully registered, non-0 otherwise
+int lownet_frag_register(uint8_t protocol, lownet_message_fn handler);
+
+// Usage: lownet_frag_send(DESTINATION, PROTO, DATA, LENGTH)
+// Pre:   DATA points to LENGTH bytes, the caller is not a timer callback
+//        (fragments wait for the link to free transmit buffers)
+// Post:  DATA has been sent to DESTINATION as a message of PROTO, in
+//        fragments if it does not fit into a frame
+// Value: 0 on success, non-0 if LENGTH exceeds LOWNET_FRAG_MAX_MESSAGE
+int lownet_frag_send(uint8_t destination, uint8_t protocol, const void* data, size_t length);
+
+// Usage: lownet_frag_stats()
+// Value: A snapshot of the fragmentation counters
+lownet_frag_stats_t lownet_frag_stats(void);
+
+#endif
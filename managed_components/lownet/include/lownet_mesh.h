@@ -0,0 +1,154 @@
+#ifndef LOWNET_MESH_H
+#define LOWNET_MESH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <freertos/FreeRTOS.h>
+
+#include "lownet.h"
+
+/*
+ * Multi-hop forwarding.  Nodes broadcast a beacon with their routes every
+ * LOWNET_MESH_BEACON_MS and keep a distance-vector table of the next hop
+ * towards every node heard of.  Frames for nodes out of radio range go
+ * to the next hop; without a route they are flooded, every node
+ * rebroadcasting each frame at most once.
+ *
+ * The routing logic is platform free: time is passed in and the caller
+ * does the sending, so the same code runs on the boards and in the host
+ * topology simulator.
+ */
+
+#define LOWNET_PROTOCOL_MESH 0x07
+
+// padding[LOWNET_MESH] of a forwarded frame: hops taken in the high
+// nibble, hops left in the low one.  0 is a single hop frame, never
+// forwarded.
+#define LOWNET_MESH 0
+#define LOWNET_MESH_TTL 15
+#define LOWNET_MESH_HOPS(b) ((b) >> 4)
+#define LOWNET_MESH_LEFT(b) ((b) & 0x0F)
+
+#define LOWNET_MESH_BEACON_MS 2000
+#define LOWNET_MESH_EXPIRY_MS (3 * LOWNET_MESH_BEACON_MS + 500)
+#define LOWNET_MESH_UNREACHABLE 16 // hop count taken as infinite
+
+// Frames remembered for duplicate suppression, and for how long.
+#define LOWNET_MESH_SEEN 64
+#define LOWNET_MESH_SEEN_MS 3000
+
+typedef struct
+{
+	uint8_t next_hop;    // 0 if there is no route
+	uint8_t hops;
+	uint32_t latency_us; // time spent in forwarders along the route
+	int64_t updated;     // esp_timer time of the latest advertisement
+} lownet_route_t;
+
+typedef struct
+{
+	uint32_t originated; // frames we sent into the mesh
+	uint32_t delivered;  // mesh frames for us
+	uint32_t forwarded;  // frames sent on along a route
+	uint32_t flooded;    // frames rebroadcast for want of a route
+	uint32_t duplicates; // copies suppressed
+	uint32_t expired;    // frames dropped with no hops left
+	uint32_t beacons;    // beacons received
+	uint32_t hops_sum;   // hops taken by the delivered frames
+	uint8_t hops_max;
+	uint32_t residence_avg_us; // smoothed time frames stay with us
+	uint32_t residence_max_us;
+} lownet_mesh_stats_t;
+
+typedef struct
+{
+	portMUX_TYPE lock;
+	uint8_t self;
+	lownet_route_t routes[256];
+
+	struct
+	{
+		uint32_t key;
+		int64_t time;
+	} seen[LOWNET_MESH_SEEN];
+	uint8_t seen_next;
+
+	lownet_mesh_stats_t stats;
+} lownet_mesh_t;
+
+typedef enum
+{
+	LOWNET_MESH_DROP = 0,
+	LOWNET_MESH_DELIVER = 1, // hand the frame to its protocol
+	LOWNET_MESH_FORWARD = 2, // send the updated frame on to *NEXT_HOP
+} lownet_mesh_action_t;
+
+// Usage: lownet_mesh_init(MESH, SELF)
+// Pre:   MESH != NULL, SELF is the node id of this node
+// Post:  MESH has no routes and has seen no frames
+void lownet_mesh_init(lownet_mesh_t* mesh, uint8_t self);
+
+// Usage: lownet_mesh_route(MESH, FRAME, NOW)
+// Pre:   FRAME is an outbound frame from this node, NOW the esp_timer time
+// Post:  FRAME carries a mesh header if it needs more than one hop
+// Value: The node to hand FRAME to, LOWNET_BROADCAST_ADDRESS to flood it
+uint8_t lownet_mesh_route(lownet_mesh_t* mesh, lownet_frame_t* frame, int64_t now);
+
+// Usage: lownet_mesh_receive(MESH, FRAME, INFO, NEXT_HOP)
+// Pre:   FRAME is a valid inbound frame and INFO its reception details
+// Post:  A route to the sender of a single hop frame has been learned.
+//        If FRAME is to be forwarded its header has been advanced, its
+//        CRC has to be recomputed, and *NEXT_HOP holds the node to send
+//        it to.
+// Value: A combination of LOWNET_MESH_DELIVER and LOWNET_MESH_FORWARD,
+//        LOWNET_MESH_DROP for duplicates and frames for others which go
+//        no further.  Single hop frames are always delivered.
+int lownet_mesh_receive(lownet_mesh_t* mesh, lownet_frame_t* frame,
+                        const lownet_rx_info_t* info, uint8_t* next_hop);
+
+// Usage: lownet_mesh_forwarded(MESH, INFO, NOW)
+// Post:  The time since INFO's reception is accounted as the residence
+//        time of a forwarded frame
+void lownet_mesh_forwarded(lownet_mesh_t* mesh, const lownet_rx_info_t* info, int64_t now);
+
+// Usage: lownet_mesh_beacon(MESH, FRAME, START, NOW)
+// Pre:   START is 0 for the first beacon frame of a round, the value of
+//        the previous call for the following ones
+// Post:  FRAME is a broadcast beacon advertising as many of our routes,
+//        from START on, as fit into a frame.  Expired routes have been
+//        dropped from MESH.
+// Value: 0 if FRAME holds the last of the routes, the START of the next
+//        beacon frame otherwise
+int lownet_mesh_beacon(lownet_mesh_t* mesh, lownet_frame_t* frame, int start, int64_t now);
+
+// Usage: lownet_mesh_beacon_receive(MESH, FRAME, NOW)
+// Pre:   FRAME is a LOWNET_PROTOCOL_MESH frame
+// Post:  The routes of MESH account for the routes FRAME advertises
+void lownet_mesh_beacon_receive(lownet_mesh_t* mesh, const lownet_frame_t* frame, int64_t now);
+
+// Usage: lownet_mesh_get_route(MESH, NODE, NOW, OUT)
+// Value: 0 and the route in OUT if NODE is reachable, non-0 otherwise
+int lownet_mesh_get_route(lownet_mesh_t* mesh, uint8_t node, int64_t now, lownet_route_t* out);
+
+// Usage: lownet_mesh_stats(MESH)
+// Value: A snapshot of the counters of MESH
+lownet_mesh_stats_t lownet_mesh_stats(lownet_mesh_t* mesh);
+
+// Usage: lownet_mesh_enable(ON)
+// Pre:   lownet_init has been called
+// Post:  This node forwards frames and beacons its routes if ON, and
+//        sends as a single hop network does otherwise
+void lownet_mesh_enable(bool on);
+
+// Usage: lownet_mesh_enabled()
+// Value: true if this node takes part in the mesh
+bool lownet_mesh_enabled(void);
+
+// Usage: lownet_get_mesh()
+// Value: The mesh state of this node, for lownet_mesh_get_route and
+//        lownet_mesh_stats
+lownet_mesh_t* lownet_get_mesh(void);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef LOWNET_NEIGHBOR_H
+#define LOWNET_NEIGHBOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lownet.h"
+
+// Nodes heard from, least recently heard evicted first.
+#define LOWNET_NEIGHBORS 32
+
+// What reception has told us about the link from one node.  Everything is
+// measured passively on the frames the node sends anyway.
+typedef struct
+{
+	uint8_t node;
+	int64_t first_seen; // esp_timer time of the first frame, microseconds
+	int64_t last_seen;  // esp_timer time of the latest frame, microseconds
+	int8_t rssi;        // smoothed signal strength, dBm
+	int8_t rssi_last;   // signal strength of the latest frame, dBm
+	uint32_t frames;    // valid frames received
+	uint32_t lost;      // frames missing from the sequence numbers
+	uint16_t loss;      // lost out of every 1000 frames sent to us, 0 if unknown
+} lownet_neighbor_t;
+
+// Usage: lownet_neighbor_update(FRAME, INFO)
+// Pre:   FRAME and INFO describe a valid inbound frame
+// Post:  The neighbor entry of FRAME->source accounts for FRAME
+void lownet_neighbor_update(const lownet_frame_t* frame, const lownet_rx_info_t* info);
+
+// Usage: lownet_neighbor_get(NODE, OUT)
+// Pre:   OUT != NULL
+// Post:  OUT holds what is known of the link from NODE
+// Value: 0 if NODE has been heard from, non-0 otherwise
+int lownet_neighbor_get(uint8_t node, lownet_neighbor_t* out);
+
+// Usage: lownet_neighbors(OUT, MAX)
+// Pre:   OUT has room for MAX entries
+// Post:  OUT holds up to MAX neighbors, most recently heard first
+// Value: The number of entries written to OUT
+size_t lownet_neighbors(lownet_neighbor_t* out, size_t max);
+
+// Usage: lownet_neighbor_timeout(NODE, BASE_MS)
+// Pre:   None
+// Value: BASE_MS stretched for the measured loss towards NODE: the time to
+//        wait before assuming a frame exchange with NODE failed.  BASE_MS
+//        for unknown and clean links, up to 4 * BASE_MS for lossy ones.
+uint32_t lownet_neighbor_timeout(uint8_t node, uint32_t base_ms);
+
+#endif
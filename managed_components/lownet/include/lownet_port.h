@@ -0,0 +1,52 @@
+#ifndef LOWNET_PORT_H
+#define LOWNET_PORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The link layer under the lownet core.  lownet_port_esp.c puts it on
+ * ESP-NOW; host builds bring their own, e.g. UDP multicast.  Everything
+ * else the core needs, FreeRTOS, esp_timer and esp_random, the host
+ * shims provide.
+ */
+
+// Unicast peers the port can hold besides the broadcast address.
+#define LOWNET_PORT_MAX_PEERS 19
+
+// Called for every frame received, from the port's receive context,
+// which must not be blocked.  RSSI is in dBm, 0 if unknown.
+typedef void (*lownet_port_recv_fn)(const uint8_t* data, int length, int8_t rssi);
+
+// Usage: lownet_port_init(RECV)
+// Pre:   RECV != NULL, called once
+// Post:  The link is up and hands received frames to RECV
+// Value: 0 on success, non-0 otherwise
+int lownet_port_init(lownet_port_recv_fn recv);
+
+// Usage: lownet_port_mac(MAC)
+// Post:  MAC holds the link address of this node
+void lownet_port_mac(uint8_t mac[6]);
+
+// Usage: lownet_port_add_peer(MAC)
+// Pre:   Fewer than LOWNET_PORT_MAX_PEERS unicast peers have been added
+// Post:  Frames can be sent to MAC
+// Value: 0 on success, non-0 otherwise
+int lownet_port_add_peer(const uint8_t mac[6]);
+
+// Usage: lownet_port_del_peer(MAC)
+// Post:  MAC is no longer a peer
+void lownet_port_del_peer(const uint8_t mac[6]);
+
+// Returned by lownet_port_send when the link has no transmit buffer free
+// for the moment.  Ports do not wait for one, since frames are sent from
+// timer callbacks too; the frame may be sent again later.
+#define LOWNET_PORT_BUSY 2
+
+// Usage: lownet_port_send(MAC, DATA, LENGTH)
+// Pre:   MAC is the broadcast address or a peer
+// Value: 0 if the frame was handed to the link, LOWNET_PORT_BUSY if the
+//        link was out of buffers, another non-0 value otherwise
+int lownet_port_send(const uint8_t mac[6], const void* data, size_t length);
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef LOWNET_RELIABLE_H
+#define LOWNET_RELIABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <freertos/FreeRTOS.h>
+
+#include "lownet.h"
+
+/*
+ * Reliable delivery.  Protocols hand data for a node to this layer, which
+ * splits it into numbered segments of LOWNET_PROTOCOL_RELIABLE and keeps
+ * up to LOWNET_RELIABLE_WINDOW of them in flight.  The receiver buffers
+ * segments which arrive ahead of a gap and acknowledges cumulatively,
+ * with a bitmap of the segments it holds beyond the gap, so the sender
+ * repeats only what was lost: at once when later segments got through,
+ * after a retransmission timeout adapted to the measured round trip time
+ * of the node otherwise.  Segments are handed to the protocol in order,
+ * from the lownet service task.
+ *
+ * Every node keeps one stream to each node it talks to, shared by the
+ * protocols using this layer.  A stream starts with a segment flagged
+ * LOWNET_RELIABLE_SYN, so a node which restarts starts over at its
+ * peers; a node which gets segments of a stream it does not know answers
+ * LOWNET_RELIABLE_RST, and the sender starts over from its oldest segment
+ * in flight.  A node which stops acknowledging is given up on after
+ * LOWNET_RELIABLE_TRIES transmissions of a segment, and what was queued
+ * for it is dropped.
+ */
+
+#define LOWNET_PROTOCOL_RELIABLE 0x09
+
+typedef struct __attribute__((__packed__))
+{
+	uint8_t protocol; // protocol of the data
+	uint8_t flags;    // LOWNET_RELIABLE_* flags
+	uint16_t seq;     // of this segment, with LOWNET_RELIABLE_DATA
+	uint16_t ack;     // next segment expected, with LOWNET_RELIABLE_ACK
+	uint32_t sack;    // bit i: segment ack + 1 + i has been received
+} lownet_reliable_header_t;
+
+#define LOWNET_RELIABLE_DATA 0x01 // the frame carries a segment
+#define LOWNET_RELIABLE_ACK  0x02 // ack and sack are valid
+#define LOWNET_RELIABLE_SYN  0x04 // the segment starts the stream
+#define LOWNET_RELIABLE_END  0x08 // the last segment of a send
+#define LOWNET_RELIABLE_RST  0x10 // the sender has no stream from the receiver
+
+#define LOWNET_RELIABLE_SEGMENT (LOWNET_PAYLOAD_SIZE - sizeof(lownet_reliable_header_t))
+
+// Data for this protocol is counted and dropped, for throughput tests.
+#define LOWNET_RELIABLE_DISCARD 0x00
+
+#ifndef LOWNET_RELIABLE_WINDOW
+#define LOWNET_RELIABLE_WINDOW 16   // segments in flight to a node
+#endif
+#define LOWNET_RELIABLE_PEERS 4     // nodes with a stream, least recently used idle one evicted
+#define LOWNET_RELIABLE_TRIES 8     // transmissions of a segment before giving up
+#define LOWNET_RELIABLE_DUPTHRESH 3 // later segments acknowledged before repeating one
+
+// Retransmission timeout bounds, and the timeout until the round trip
+// time has been measured.
+#define LOWNET_RELIABLE_RTO_MIN_MS 30
+#define LOWNET_RELIABLE_RTO_MAX_MS 8000
+#define LOWNET_RELIABLE_RTO_INIT_MS 1000
+
+// Period of the task which retransmits and sends delayed acknowledgements,
+// while anything is in flight
+#define LOWNET_RELIABLE_TICK_MS 10
+
+// Segments are numbered modulo 2^16 and kept at their number modulo the
+// window, so the window divides 2^16; both ends must use the same one.
+static_assert(LOWNET_RELIABLE_WINDOW >= 2 && LOWNET_RELIABLE_WINDOW <= 32
+              && (LOWNET_RELIABLE_WINDOW & (LOWNET_RELIABLE_WINDOW - 1)) == 0,
+              "LOWNET_RELIABLE_WINDOW must be a power of two which fits the sack bitmap");
+
+// A segment as handed to its protocol
+typedef struct
+{
+	uint8_t source;
+	uint8_t protocol;
+	uint8_t length;
+	const uint8_t* data;
+	bool end; // the last segment of a lownet_reliable_send
+} lownet_segment_t;
+
+typedef void (*lownet_reliable_fn)(const lownet_segment_t* segment);
+
+typedef struct
+{
+	uint8_t node;
+	uint32_t srtt_us;       // smoothed round trip time, 0 until measured
+	uint32_t rttvar_us;
+	uint32_t rto_us;        // current retransmission timeout
+	uint8_t in_flight;      // segments sent and not yet acknowledged
+	uint32_t sent;          // segments sent for the first time
+	uint32_t retransmitted; // segments sent again
+	uint32_t fast;          // of them, because later segments were acknowledged
+	uint32_t timeouts;      // retransmission timeouts
+	uint32_t failures;      // times the node was given up on
+	uint32_t delivered;     // segments handed over in order
+	uint32_t out_of_order;  // segments received ahead of a gap
+	uint32_t duplicates;    // segments received again
+	uint32_t discarded;     // bytes received for LOWNET_RELIABLE_DISCARD
+} lownet_reliable_stats_t;
+
+// Usage: lownet_reliable_init()
+// Pre:   lownet_init has been called
+// Post:  LOWNET_PROTOCOL_RELIABLE is registered and the task which
+//        retransmits runs
+void lownet_reliable_init(void);
+
+// Usage: lownet_reliable_register(PROTO, HANDLER)
+// Pre:   PROTO has not been registered with this layer, and is not
+//        LOWNET_RELIABLE_DISCARD
+// Post:  HANDLER is given the segments of PROTO in order
+// Value: 0 if PROTO was successfully registered, non-0 otherwise
+int lownet_reliable_register(uint8_t protocol, lownet_reliable_fn handler);
+
+// Usage: lownet_reliable_send(NODE, PROTO, DATA, LENGTH, TIMEOUT)
+// Pre:   NODE is neither 0 nor the broadcast address, DATA points to
+//        LENGTH bytes, the caller is not the lownet service task
+// Post:  The first bytes of DATA, in segments, have been queued for
+//        reliable delivery to NODE as PROTO; the caller has waited up to
+//        TIMEOUT ticks for room in the window
+// Value: The number of bytes queued, LENGTH unless the time ran out, the
+//        node was given up on or no stream could be set up for it
+size_t lownet_reliable_send(uint8_t node, uint8_t protocol, const void* data, size_t length,
+                            TickType_t timeout);
+
+// Usage: lownet_reliable_flush(NODE, TIMEOUT)
+// Pre:   The caller is not the lownet service task
+// Post:  The caller has waited up to TIMEOUT ticks for NODE to
+//        acknowledge everything queued for it
+// Value: 0 if it did, non-0 otherwise
+int lownet_reliable_flush(uint8_t node, TickType_t timeout);
+
+// Usage: lownet_reliable_peers(OUT, MAX)
+// Pre:   OUT has room for MAX entries
+// Post:  OUT holds the state of up to MAX streams
+// Value: The number of entries written to OUT
+size_t lownet_reliable_peers(lownet_reliable_stats_t* out, size_t max);
+
+#endif
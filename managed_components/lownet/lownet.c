@@ -1,7 +1,13 @@
 #define INCLUDE_vTaskDelete 1
 
 #include "lownet.h"
+#include "lownet_capture.h"
+#include "lownet_mesh.h"
+#include "lownet_neighbor.h"
+#include "lownet_port.h"
 
+#include <assert.h>
+#include <stdbool.h>
 #include <string.h>
 
 #include <freertos/FreeRTOS.h>
@@ -9,17 +15,14 @@
 #include <freertos/queue.h>
 #include <freertos/semphr.h>
 #include <freertos/task.h>
+#include <freertos/timers.h>
 
-#include <nvs_flash.h>
 #include <esp_log.h>
-#include <esp_mac.h>
-#include <esp_netif.h>
-#include <esp_now.h>
 #include <esp_random.h>
 #include <esp_timer.h>
-#include <esp_wifi.h>
 
 #include <device-table.h>
+#include <dlog.h>
 
 #define TAG "lownet-core"
 
@@ -28,11 +31,34 @@
 
 #define TIMEOUT_STARTUP ((TickType_t)(5000 / portTICK_PERIOD_MS))
 
+// Unicast link peers kept registered, least recently used evicted
+// first.  The broadcast peer is registered separately.
+#define LOWNET_PEERS 16
+static_assert(LOWNET_PEERS <= LOWNET_PORT_MAX_PEERS, "Too many lownet peers");
+
 typedef struct {
 	uint8_t protocol;
-	lownet_recv_fn handler;
+	lownet_recv_fn handler;       // exactly one of handler and handler_ex
+	lownet_recv_ex_fn handler_ex; // is set
 } protocol_t;
 
+typedef struct {
+	uint8_t node;     // 0 if the slot is free
+	uint8_t mac[6];
+	uint32_t used;    // net_system.peer_clock at the last send
+} peer_t;
+
+// Inbound queue entries carry the reception details along with the frame.
+typedef struct {
+	lownet_frame_t frame;
+	lownet_rx_info_t info;
+} inbound_t;
+
+typedef struct {
+	lownet_secure_frame_t frame;
+	lownet_rx_info_t info;
+} inbound_secure_t;
+
 static uint8_t aes_key_bytes[LOWNET_KEY_SIZE_AES];
 
 struct {
@@ -56,6 +82,25 @@ struct {
 	int64_t sync_stamp;
 	protocol_t protocols[LOWNET_MAX_PROTOCOLS];
 	uint8_t num_protocols;
+	lownet_tap_fn tap;
+
+	// Unicast peers, guarded by peer_lock.
+	SemaphoreHandle_t peer_lock;
+	peer_t peers[LOWNET_PEERS];
+	uint32_t peer_clock;
+
+	// Latest sequence number sent to each destination, guarded by
+	// tx_seq_lock: every task sends.
+	portMUX_TYPE tx_seq_lock;
+	uint8_t tx_seq[256];
+
+	// Keystore slot the active AES key came from.
+	uint8_t key_slot;
+
+	// Multi-hop forwarding, off unless enabled.
+	lownet_mesh_t mesh;
+	bool mesh_enabled;
+	TimerHandle_t mesh_beacon;
 } net_system;
 
 const uint8_t plain_magic[2] = {0x10, 0x4e};
@@ -64,11 +109,11 @@ const uint8_t cipher_magic[2] = {0x20, 0x4e};
 uint8_t net_initialized = 0;
 
 // Forward declarations.
-lownet_recv_fn lownet_get_handler(uint8_t protocol);
+const protocol_t* lownet_get_protocol(uint8_t protocol);
 void lownet_service_main(void* pvTaskParam);
 void decrypt_service_main(void* pvTaskParam);
 void lownet_service_kill();
-void lownet_inbound_handler(const esp_now_recv_info_t * info, const uint8_t* data, int len);
+void lownet_inbound_handler(const uint8_t* data, int len, int8_t rssi);
 
 void lownet_sync_time(const lownet_frame_t* time_frame);
 uint32_t lownet_crc(const lownet_frame_t* frame);
@@ -80,35 +125,24 @@ void lownet_init(lownet_cipher_fn encrypt_fn, lownet_cipher_fn decrypt_fn) {
 	} else {
 		net_initialized = 1;
 		memset(&net_system, 0, sizeof(net_system));
+		portMUX_INITIALIZE(&net_system.tx_seq_lock);
+		net_system.key_slot = LOWNET_KEY_NONE;
 		net_system.aes_key.bytes = (uint8_t*)&aes_key_bytes;
 	}
 
-	net_system.decrypt_queue = xQueueCreate(16, sizeof(lownet_secure_frame_t));
+	net_system.decrypt_queue = xQueueCreate(16, sizeof(inbound_secure_t));
 	if (!net_system.decrypt_queue)
 		{
 			ESP_EARLY_LOGE(TAG, "Error creating lownet decrypt queue");
 			return;
 		}
 
-	ESP_ERROR_CHECK(nvs_flash_init());        // initialize NVS
-	ESP_ERROR_CHECK(esp_netif_init());
-	ESP_ERROR_CHECK(esp_event_loop_create_default());
-	wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-	ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-	ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
-	ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-	ESP_ERROR_CHECK(esp_wifi_start());
-
-	if (esp_now_init() != ESP_OK) {
-		ESP_LOGE(TAG, "Error initializing ESP-NOW");
-		return;
-	}
-
 	net_system.encrypt = encrypt_fn;
 	net_system.decrypt = decrypt_fn;
 
 	net_system.events = xEventGroupCreate();
-	if (!net_system.events) {
+	net_system.peer_lock = xSemaphoreCreateMutex();
+	if (!net_system.events || !net_system.peer_lock) {
 		ESP_LOGE(TAG, "Error creating lownet event group");
 		return;
 	}
@@ -171,9 +205,91 @@ void lownet_init(lownet_cipher_fn encrypt_fn, lownet_cipher_fn decrypt_fn) {
 }
 
 
-// Delegation method for encrypting and sending a lownet frame.  Presume only
-//	lownet internal usage, so relaxed precondition check.
-void lownet_encrypt_send(const lownet_frame_t* frame) {
+// Stores the link address to send a frame for DESTINATION to in MAC:
+// the node's own MAC, registered as a peer, when the device table knows
+// it, and the broadcast MAC otherwise.  Returns true for unicast.
+// Frames are sent from timer callbacks too, so this never waits for the
+// peer list: while another sender updates it, the frame is broadcast.
+static bool lownet_peer_mac(uint8_t destination, uint8_t mac[6]) {
+	memcpy(mac, net_system.broadcast.mac, 6);
+	if (destination == net_system.broadcast.node) {
+		return false;
+	}
+	lownet_identifier_t id = lownet_lookup(destination);
+	if (!id.node) {
+		return false;
+	}
+	if (xSemaphoreTake(net_system.peer_lock, 0) != pdTRUE) {
+		DLOGD(TAG, "Peer list busy, broadcasting to 0x%02x", id.node);
+		return false;
+	}
+	memcpy(mac, id.mac, 6);
+
+	peer_t* victim = &net_system.peers[0];
+	for (int i = 0; i < LOWNET_PEERS; ++i) {
+		peer_t* peer = &net_system.peers[i];
+		if (peer->node == id.node && memcmp(peer->mac, id.mac, 6) == 0) {
+			peer->used = ++net_system.peer_clock;
+			xSemaphoreGive(net_system.peer_lock);
+			return true;
+		}
+		if (!peer->node || (victim->node && peer->used < victim->used)) {
+			victim = peer;
+		}
+	}
+
+	if (victim->node) {
+		DLOGD(TAG, "Evicting peer 0x%02x", victim->node);
+		lownet_port_del_peer(victim->mac);
+		victim->node = 0;
+	}
+
+	if (lownet_port_add_peer(id.mac) != 0) {
+		xSemaphoreGive(net_system.peer_lock);
+		DLOGW(TAG, "Cannot add peer 0x%02x, broadcasting", id.node);
+		memcpy(mac, net_system.broadcast.mac, 6);
+		return false;
+	}
+
+	victim->node = id.node;
+	memcpy(victim->mac, id.mac, 6);
+	victim->used = ++net_system.peer_clock;
+	xSemaphoreGive(net_system.peer_lock);
+	return true;
+}
+
+// Hands a frame for DESTINATION to the link.  Unicast gets link layer
+// acknowledgements and retries; if it cannot be sent the frame is
+// broadcast instead.  While the link is out of buffers, waits for one a
+// tick at a time, up to WAIT_MS.  Returns 0 if the link took the frame,
+// LOWNET_SEND_BUSY if it stayed out of buffers.
+static int lownet_transmit(uint8_t destination, const void* data, size_t length, uint32_t wait_ms) {
+	uint8_t mac[6];
+	bool unicast = lownet_peer_mac(destination, mac);
+	TickType_t start = xTaskGetTickCount();
+	int result;
+	while ((result = lownet_port_send(mac, data, length)) == LOWNET_PORT_BUSY
+	       && xTaskGetTickCount() - start < pdMS_TO_TICKS(wait_ms)) {
+		vTaskDelay(1);
+	}
+	if (result == 0) {
+		return 0;
+	}
+	if (result == LOWNET_PORT_BUSY) {
+		return LOWNET_SEND_BUSY;
+	}
+	if (unicast
+	    && lownet_port_send(net_system.broadcast.mac, data, length) == 0) {
+		return 0;
+	}
+	DLOGE(TAG, "LowNet Frame send error");
+	return -1;
+}
+
+// Delegation method for encrypting and sending a lownet frame to the
+//	node LINK.  Presume only lownet internal usage, so relaxed precondition
+//	check.  Returns as lownet_transmit.
+int lownet_encrypt_send(const lownet_frame_t* frame, uint8_t link, uint32_t wait_ms) {
 	lownet_secure_frame_t plain;
 	lownet_secure_frame_t cipher;
 
@@ -197,18 +313,54 @@ void lownet_encrypt_send(const lownet_frame_t* frame) {
 	// Encrypt with user-defined enc function.
 	net_system.encrypt(&plain, &cipher);
 
-	if (esp_now_send(net_system.broadcast.mac, (const uint8_t*)&cipher, sizeof(cipher)) != ESP_OK) {
-		ESP_LOGE(TAG, "LowNet Frame send error");
+	return lownet_transmit(link, &cipher, sizeof(cipher), wait_ms);
+}
+
+// Applies the CRC to a complete frame and sends it to the node LINK,
+// encrypted if an AES key is active.  Returns as lownet_transmit.
+static int lownet_emit(lownet_frame_t* frame, uint8_t link, uint32_t wait_ms) {
+	// Generate and apply the lownet CRC to the frame.
+	frame->crc = lownet_crc(frame);
+
+	lownet_capture_header_t header = {
+		.direction = LOWNET_CAPTURE_OUT,
+	};
+	int result;
+	if (lownet_get_key() != NULL) {
+		// We have an AES key -- use it to encrypt the frame.
+		header.flags = LOWNET_CAPTURE_SECURE;
+		result = lownet_encrypt_send(frame, link, wait_ms);
+	} else {
+		// No key is active -- send the frame as-is, plaintext.
+		result = lownet_transmit(link, frame, sizeof(*frame), wait_ms);
 	}
+	header.reason = result == 0 ? LOWNET_DROP_NONE : LOWNET_DROP_SEND;
+	lownet_capture(header, frame, sizeof(*frame), esp_timer_get_time());
+	return result;
+}
+
+// Records the fate of an inbound frame.
+static void lownet_capture_inbound(const inbound_t* inbound, lownet_drop_t reason) {
+	lownet_capture_header_t header = {
+		.direction = LOWNET_CAPTURE_IN,
+		.reason = reason,
+		.flags = (inbound->info.flags & LOWNET_RX_ENCRYPTED) ? LOWNET_CAPTURE_SECURE : 0,
+		.rssi = inbound->info.rssi,
+	};
+	lownet_capture(header, &inbound->frame, sizeof(inbound->frame), inbound->info.timestamp);
 }
 
 
 // Public interface; standard send.  Delegate to encrypt-and-send method if AES encryption
 // key is defined.
 void lownet_send(const lownet_frame_t* frame) {
+	lownet_send_ex(frame, 0);
+}
+
+int lownet_send_ex(const lownet_frame_t* frame, uint32_t wait_ms) {
 	// Discard packet instead of sending if specified payload length
 	// is impossible.
-	if (frame->length > LOWNET_PAYLOAD_SIZE) { return; }
+	if (frame->length > LOWNET_PAYLOAD_SIZE) { return -1; }
 
 	lownet_frame_t out_frame;
 	memset(&out_frame, 0, sizeof(out_frame));
@@ -218,6 +370,11 @@ void lownet_send(const lownet_frame_t* frame) {
 	out_frame.destination = frame->destination;
 	out_frame.protocol = frame->protocol;
 	out_frame.length = frame->length;
+	portENTER_CRITICAL(&net_system.tx_seq_lock);
+	uint8_t* seq = &net_system.tx_seq[frame->destination];
+	*seq = *seq == 255 ? 1 : *seq + 1;
+	out_frame.padding[LOWNET_SEQ] = *seq;
+	portEXIT_CRITICAL(&net_system.tx_seq_lock);
 	memcpy(out_frame.payload, frame->payload, frame->length);
 	for (int i = frame->length; i < LOWNET_PAYLOAD_SIZE; ++i) {
 		// Fill any unused payload with noise.  Improves packet entropy
@@ -225,18 +382,14 @@ void lownet_send(const lownet_frame_t* frame) {
 		out_frame.payload[i] |= (uint8_t)(esp_random() & 0x000000FF);
 	}
 
-	// Generate and apply the lownet CRC to the frame.
-	out_frame.crc = lownet_crc(&out_frame);
-
-	if (lownet_get_key() != NULL) {
-		// We have an AES key -- use it to encrypt the frame.
-		lownet_encrypt_send(&out_frame);
-	} else {
-		// No key is active -- send the frame as-is, plaintext.
-		if (esp_now_send(net_system.broadcast.mac, (const uint8_t*)&out_frame, sizeof(out_frame)) != ESP_OK) {
-			ESP_LOGE(TAG, "LowNet Frame send error");
-		}
+	// Frames for nodes out of range go through the mesh.  Beacons only
+	// ever travel one hop.
+	uint8_t link = out_frame.destination;
+	if (net_system.mesh_enabled && out_frame.protocol != LOWNET_PROTOCOL_MESH) {
+		link = lownet_mesh_route(&net_system.mesh, &out_frame, esp_timer_get_time());
 	}
+
+	return lownet_emit(&out_frame, link, wait_ms);
 }
 
 // Formats and returns a lownet time structure based on synced network time.
@@ -289,6 +442,7 @@ void lownet_set_key(const lownet_key_t* key) {
 	if (key == NULL) {
 		// Disable AES.
 		net_system.aes_key.size = 0;
+		net_system.key_slot = LOWNET_KEY_NONE;
 		return;
 	}
 	if (key->size != LOWNET_KEY_SIZE_AES) {
@@ -296,6 +450,7 @@ void lownet_set_key(const lownet_key_t* key) {
 		return;
 	}
 	net_system.aes_key.size = LOWNET_KEY_SIZE_AES;
+	net_system.key_slot = LOWNET_KEY_NONE;
 	memcpy(net_system.aes_key.bytes, key->bytes, net_system.aes_key.size);
 }
 
@@ -304,6 +459,9 @@ void lownet_set_key(const lownet_key_t* key) {
 void lownet_set_stored_key(uint8_t key_id) {
 	lownet_key_t stored_key = lownet_keystore_read(key_id);
 	lownet_set_key(&stored_key);
+	if (lownet_get_key()) {
+		net_system.key_slot = key_id;
+	}
 }
 
 
@@ -316,19 +474,24 @@ void decrypt_service_main(void* pvTaskParam)
 {
 	while (true)
 		{
-			lownet_secure_frame_t cipher;
+			inbound_secure_t cipher;
 			lownet_secure_frame_t plain;
 			memset(&cipher, 0, sizeof cipher);
 
 			if (xQueueReceive(net_system.decrypt_queue , &cipher, UINT32_MAX) != pdTRUE)
 				continue;
 
-			net_system.decrypt(&cipher, &plain);
-			lownet_frame_t frame;
-			memcpy(&frame, &plain, LOWNET_UNENCRYPTED_SIZE);
-			memcpy(&frame.magic, plain_magic, sizeof plain_magic);
-			memcpy(&frame.protocol, &plain.protocol, LOWNET_ENCRYPTED_SIZE);
-			xQueueSend(net_system.inbound, &frame, 0);
+			uint8_t key = net_system.key_slot;
+			net_system.decrypt(&cipher.frame, &plain);
+			inbound_t inbound;
+			memcpy(&inbound.frame, &plain, LOWNET_UNENCRYPTED_SIZE);
+			memcpy(&inbound.frame.magic, plain_magic, sizeof plain_magic);
+			memcpy(&inbound.frame.protocol, &plain.protocol, LOWNET_ENCRYPTED_SIZE);
+			inbound.info = cipher.info;
+			inbound.info.flags |= LOWNET_RX_ENCRYPTED;
+			inbound.info.key = key;
+			if (xQueueSend(net_system.inbound, &inbound, 0) != pdTRUE)
+				lownet_capture_inbound(&inbound, LOWNET_DROP_QUEUE);
 		}
 }
 
@@ -339,16 +502,23 @@ void decrypt_service_main(void* pvTaskParam)
 // but these lines should never execute.
 void lownet_service_main(void* pvTaskParam) {
 	// Create an inbound packet queue.
-	net_system.inbound = xQueueCreate(16, sizeof(lownet_frame_t));
+	net_system.inbound = xQueueCreate(16, sizeof(inbound_t));
 	if (!net_system.inbound) {
 		ESP_EARLY_LOGE(TAG, "Error creating lownet inbound packet queue");
 		lownet_service_kill();
 		return;
 	}
 
+	// Bring up the link.
+	if (lownet_port_init(lownet_inbound_handler) != 0) {
+		ESP_EARLY_LOGE(TAG, "Failed to start the link");
+		lownet_service_kill();
+		return;
+	}
+
 	// Figure out our device identity, and the broadcast identity.
 	uint8_t local_mac[6];
-	esp_read_mac(local_mac, ESP_MAC_WIFI_STA);
+	lownet_port_mac(local_mac);
 
 	net_system.identity = lownet_lookup_mac(local_mac);
 	net_system.broadcast = lownet_lookup(0xFF);
@@ -358,21 +528,7 @@ void lownet_service_main(void* pvTaskParam) {
 		lownet_service_kill();
 		return;
 	}
-
-	// Register the broadcast address.
-	esp_now_peer_info_t peer_info = {};
-	memcpy(peer_info.peer_addr, net_system.broadcast.mac, 6);
-	peer_info.channel = 0;
-	peer_info.ifidx = ESP_IF_WIFI_STA;
-	peer_info.encrypt = false;
-	if (esp_now_add_peer(&peer_info) != ESP_OK) {
-		ESP_EARLY_LOGE(TAG, "Failed to add broadcast peer address");
-		lownet_service_kill();
-		return;
-	}
-
-	// Register our inbound network callback.
-	esp_now_register_recv_cb(lownet_inbound_handler);
+	lownet_mesh_init(&net_system.mesh, net_system.identity.node);
 
 	// Initialization done.  Set the ready bit and then hang  around
 	// dispatching frames as they arrive.
@@ -383,44 +539,86 @@ void lownet_service_main(void* pvTaskParam) {
 
 
 	while (1) {
-		lownet_frame_t  frame;
-		memset(&frame, 0, sizeof(frame));
+		inbound_t inbound;
+		lownet_frame_t* frame = &inbound.frame;
+		memset(&inbound, 0, sizeof(inbound));
 
 		// Blocking call to receive from inbound queue.  Task will be blocked until
 		// queue has data for us.
-		if (xQueueReceive(net_system.inbound, &frame, UINT32_MAX) == pdTRUE) {
+		if (xQueueReceive(net_system.inbound, &inbound, UINT32_MAX) == pdTRUE) {
 
-			if (memcmp(&frame.magic, plain_magic, 2) != 0)
+			if (memcmp(&frame->magic, plain_magic, 2) != 0)
 				{
-					ESP_LOGD(TAG, "Invalid magic bytes");
+					DLOGD(TAG, "Invalid magic bytes");
+					lownet_capture_inbound(&inbound, LOWNET_DROP_MAGIC);
 					continue;
 				}
 
 			// Check whether the network frame checksum matches computed checksum.
-			if (lownet_crc(&frame) != frame.crc)
+			if (lownet_crc(frame) != frame->crc)
 				{
-					ESP_LOGD(TAG, "CRC error");
+					DLOGD(TAG, "CRC error from 0x%02x", frame->source);
+					lownet_capture_inbound(&inbound, LOWNET_DROP_CRC);
 					continue;
 				}
 
 			// Not strictly to spec but a useful safety valve; if frame has, as a source
 			// address, the broadcast address, discard it -- something has gone wrong.
-			if (frame.source == 0xFF) { continue; }
+			if (frame->source == 0xFF) {
+				lownet_capture_inbound(&inbound, LOWNET_DROP_SOURCE);
+				continue;
+			}
+
+			inbound.info.queued = (uint32_t)(esp_timer_get_time() - inbound.info.timestamp);
+
+			// Forwarded frames tell nothing about the link to their source.
+			if (LOWNET_MESH_HOPS(frame->padding[LOWNET_MESH]) == 0) {
+				lownet_neighbor_update(frame, &inbound.info);
+			}
+
+			lownet_tap_fn tap = net_system.tap;
+			if (tap) {
+				tap(frame, &inbound.info);
+			}
+
+			if (net_system.mesh_enabled) {
+				uint8_t next_hop;
+				int action = lownet_mesh_receive(&net_system.mesh, frame, &inbound.info, &next_hop);
+				if (action & LOWNET_MESH_FORWARD) {
+					lownet_frame_t forward = *frame;
+					lownet_emit(&forward, next_hop, 0);
+					lownet_mesh_forwarded(&net_system.mesh, &inbound.info, esp_timer_get_time());
+				}
+				if (!(action & LOWNET_MESH_DELIVER)) {
+					lownet_capture_inbound(&inbound, (action & LOWNET_MESH_FORWARD)
+					                                     ? LOWNET_DROP_NONE
+					                                     : LOWNET_DROP_MESH);
+					continue;
+				}
+			}
 
 			// Check whether packet destination is us or broadcast.
-			if (frame.destination != net_system.identity.node && frame.destination != net_system.broadcast.node)
+			if (frame->destination != net_system.identity.node && frame->destination != net_system.broadcast.node)
 				{
+					lownet_capture_inbound(&inbound, LOWNET_DROP_ADDRESS);
 					continue;
 				}
 
-			lownet_recv_fn handler = lownet_get_handler(frame.protocol & 0b00111111);
-			if (!handler)
+			const protocol_t* protocol = lownet_get_protocol(frame->protocol & 0b00111111);
+			if (!protocol)
 				{
-					ESP_LOGD(TAG, "Unknown protocol %02x", frame.protocol & 0b00111111);
+					DLOGD(TAG, "Unknown protocol %02x", frame->protocol & 0b00111111);
+					lownet_capture_inbound(&inbound, LOWNET_DROP_PROTOCOL);
 					continue;
 				}
 
-			handler(&frame);
+			lownet_capture_inbound(&inbound, LOWNET_DROP_NONE);
+
+			if (protocol->handler_ex) {
+				protocol->handler_ex(frame, &inbound.info);
+			} else {
+				protocol->handler(frame);
+			}
 		}
 	}
 }
@@ -437,18 +635,46 @@ void lownet_service_kill() {
 	return; // Should never execute, when this function is called from lownet service.
 }
 
-// Inbound frame callback is executed from the context of the ESPNOW task!
-// It is of great importance that this callback function not block, and
-// return quickly to avoid locking up the wifi driver.
-void lownet_inbound_handler(const esp_now_recv_info_t * info, const uint8_t* data, int len) {
+// Inbound frame callback is executed from the receive context of the port,
+// on the boards the ESPNOW task!  It is of great importance that this
+// callback function not block, and return quickly to avoid locking up the
+// wifi driver.
+void lownet_inbound_handler(const uint8_t* data, int len, int8_t rssi) {
+	lownet_rx_info_t rx_info = {
+		.timestamp = esp_timer_get_time(),
+		.rssi = rssi,
+		.flags = 0,
+		.key = LOWNET_KEY_NONE,
+	};
+
+	lownet_capture_header_t header = {
+		.direction = LOWNET_CAPTURE_IN,
+		.rssi = rssi,
+	};
+
 	if (len == sizeof(lownet_frame_t) && net_system.aes_key.size == 0) {
+		inbound_t inbound;
+		memcpy(&inbound.frame, data, sizeof(lownet_frame_t));
+		inbound.info = rx_info;
 		// Non-blocking queue send; if queue is full then packet is dropped.
-		if (xQueueSend(net_system.inbound, data, 0) != pdTRUE) {
+		if (xQueueSend(net_system.inbound, &inbound, 0) != pdTRUE) {
 			// Error queueing data, likely errQUEUE_FULL.
 			// Packet is dropped.
+			lownet_capture_inbound(&inbound, LOWNET_DROP_QUEUE);
 		}
 	} else if (len == sizeof(lownet_secure_frame_t) && net_system.aes_key.size != 0) {
-		xQueueSend(net_system.decrypt_queue, data, 0);
+		inbound_secure_t inbound;
+		memcpy(&inbound.frame, data, sizeof(lownet_secure_frame_t));
+		inbound.info = rx_info;
+		if (xQueueSend(net_system.decrypt_queue, &inbound, 0) != pdTRUE) {
+			// Only the addresses are in the clear.
+			header.reason = LOWNET_DROP_QUEUE;
+			header.flags = LOWNET_CAPTURE_SECURE;
+			lownet_capture(header, data, LOWNET_UNENCRYPTED_SIZE, rx_info.timestamp);
+		}
+	} else {
+		header.reason = LOWNET_DROP_LENGTH;
+		lownet_capture(header, data, len, rx_info.timestamp);
 	}
 }
 
@@ -501,16 +727,42 @@ int lownet_register_protocol(uint8_t protocol, lownet_recv_fn handler)
 
 	net_system.protocols[net_system.num_protocols].protocol = protocol;
 	net_system.protocols[net_system.num_protocols].handler = handler;
+	net_system.protocols[net_system.num_protocols].handler_ex = NULL;
+
+	++net_system.num_protocols;
+	return 0;
+}
+
+// Usage: lownet_register_protocol_ex(PROTO, HANDLER)
+// Pre:   PROTO is a protocol identifier which has not been registered
+//        HANDLER is the frame handler for PROTO
+// Value: 0 if PROTO was successfully registered, non-0 otherwise
+// Post:  As lownet_register_protocol, with HANDLER as the handler_ex
+int lownet_register_protocol_ex(uint8_t protocol, lownet_recv_ex_fn handler)
+{
+	if (net_system.num_protocols >= LOWNET_MAX_PROTOCOLS)
+		return 1;
+
+	net_system.protocols[net_system.num_protocols].protocol = protocol;
+	net_system.protocols[net_system.num_protocols].handler = NULL;
+	net_system.protocols[net_system.num_protocols].handler_ex = handler;
 
 	++net_system.num_protocols;
 	return 0;
 }
 
-// Usage: lownet_get_handler(PROTO)
-// Pre:   PROTO is a protocol identifier which has previously been
-//        registered with lownet_register_protocol
-// Value: The frame handler for PROTO
-lownet_recv_fn lownet_get_handler(uint8_t protocol)
+// Usage: lownet_register_tap(TAP)
+// Pre:   TAP does not block
+// Post:  net_system.tap is TAP
+void lownet_register_tap(lownet_tap_fn tap)
+{
+	net_system.tap = tap;
+}
+
+// Usage: lownet_get_protocol(PROTO)
+// Pre:   None
+// Value: The registration of PROTO, NULL if PROTO has not been registered
+const protocol_t* lownet_get_protocol(uint8_t protocol)
 {
 	/*
 	 * Loop invariant:
@@ -519,7 +771,66 @@ lownet_recv_fn lownet_get_handler(uint8_t protocol)
 	 */
 	for (int i = 0; i < net_system.num_protocols; ++i)
 		if (net_system.protocols[i].protocol == protocol)
-			return net_system.protocols[i].handler;
+			return &net_system.protocols[i];
 
 	return NULL;
 }
+
+static void lownet_mesh_beacon_handler(const lownet_frame_t* frame, const lownet_rx_info_t* info)
+{
+	if (net_system.mesh_enabled)
+		lownet_mesh_beacon_receive(&net_system.mesh, frame, info->timestamp);
+}
+
+// Runs in the timer service task.
+static void lownet_mesh_beacon_send(TimerHandle_t timer)
+{
+	lownet_frame_t beacon;
+	int start = 0;
+	do {
+		start = lownet_mesh_beacon(&net_system.mesh, &beacon, start, esp_timer_get_time());
+		lownet_send(&beacon);
+	} while (start);
+}
+
+// Usage: lownet_mesh_enable(ON)
+// Pre:   lownet_init has been called
+// Post:  The beacon timer runs if ON, net_system.mesh_enabled is ON
+void lownet_mesh_enable(bool on)
+{
+	if (!net_system.mesh_beacon)
+		{
+			net_system.mesh_beacon = xTimerCreate("mesh_beacon",
+			                                      pdMS_TO_TICKS(LOWNET_MESH_BEACON_MS),
+			                                      pdTRUE,
+			                                      NULL,
+			                                      lownet_mesh_beacon_send);
+			if (!net_system.mesh_beacon
+			    || lownet_register_protocol_ex(LOWNET_PROTOCOL_MESH, lownet_mesh_beacon_handler) != 0)
+				{
+					ESP_LOGE(TAG, "Failed to set up the mesh");
+					return;
+				}
+		}
+
+	net_system.mesh_enabled = on;
+	if (on)
+		{
+			xTimerStart(net_system.mesh_beacon, portMAX_DELAY);
+			lownet_mesh_beacon_send(net_system.mesh_beacon);
+		}
+	else
+		{
+			xTimerStop(net_system.mesh_beacon, portMAX_DELAY);
+		}
+}
+
+bool lownet_mesh_enabled(void)
+{
+	return net_system.mesh_enabled;
+}
+
+lownet_mesh_t* lownet_get_mesh(void)
+{
+	return &net_system.mesh;
+}
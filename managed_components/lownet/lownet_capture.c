@@ -0,0 +1,167 @@
+#include "lownet_capture.h"
+
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+
+#include <esp_timer.h>
+
+#define PCAP_MAGIC 0xa1b2c3d4 // microsecond timestamps
+
+typedef struct __attribute__((__packed__))
+{
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+} pcap_file_header_t;
+
+typedef struct __attribute__((__packed__))
+{
+	uint32_t ts_sec;
+	uint32_t ts_usec;
+	uint32_t incl_len;
+	uint32_t orig_len;
+} pcap_record_header_t;
+
+typedef struct
+{
+	uint32_t seq;      // number of the frame since boot, 0 for an empty slot
+	int64_t timestamp;
+	lownet_capture_header_t header;
+	uint8_t length;    // bytes of data kept
+	uint16_t original; // bytes the frame had
+	uint8_t data[LOWNET_CAPTURE_SNAPLEN];
+} record_t;
+
+static struct
+{
+	portMUX_TYPE lock;
+	uint32_t seq;
+	uint16_t snaplen;
+	record_t ring[LOWNET_CAPTURE_FRAMES];
+	lownet_capture_stats_t stats;
+} capture = {
+	.lock = portMUX_INITIALIZER_UNLOCKED,
+	.snaplen = LOWNET_CAPTURE_SNAPLEN,
+};
+
+static const char* const drop_names[LOWNET_DROP_REASONS] = {
+	[LOWNET_DROP_NONE] = "none",
+	[LOWNET_DROP_QUEUE] = "queue",
+	[LOWNET_DROP_LENGTH] = "length",
+	[LOWNET_DROP_MAGIC] = "magic",
+	[LOWNET_DROP_CRC] = "crc",
+	[LOWNET_DROP_SOURCE] = "source",
+	[LOWNET_DROP_MESH] = "mesh",
+	[LOWNET_DROP_ADDRESS] = "address",
+	[LOWNET_DROP_PROTOCOL] = "protocol",
+	[LOWNET_DROP_SEND] = "send",
+};
+
+void lownet_capture(lownet_capture_header_t header, const void* data, size_t length,
+                    int64_t timestamp)
+{
+	if (header.reason >= LOWNET_DROP_REASONS)
+		header.reason = LOWNET_DROP_NONE;
+
+	portENTER_CRITICAL(&capture.lock);
+	uint32_t seq = ++capture.seq;
+	record_t* record = &capture.ring[seq % LOWNET_CAPTURE_FRAMES];
+	record->seq = seq;
+	record->timestamp = timestamp;
+	record->header = header;
+	record->original = length;
+	record->length = length < capture.snaplen ? length : capture.snaplen;
+	memcpy(record->data, data, record->length);
+
+	capture.stats.captured++;
+	if (header.direction == LOWNET_CAPTURE_OUT)
+		capture.stats.out[header.reason]++;
+	else
+		capture.stats.in[header.reason]++;
+	portEXIT_CRITICAL(&capture.lock);
+}
+
+void lownet_capture_set_snaplen(size_t snaplen)
+{
+	if (snaplen < LOWNET_HEAD_SIZE)
+		snaplen = LOWNET_HEAD_SIZE;
+	if (snaplen > LOWNET_CAPTURE_SNAPLEN)
+		snaplen = LOWNET_CAPTURE_SNAPLEN;
+
+	portENTER_CRITICAL(&capture.lock);
+	capture.snaplen = snaplen;
+	portEXIT_CRITICAL(&capture.lock);
+}
+
+lownet_capture_stats_t lownet_capture_stats(void)
+{
+	portENTER_CRITICAL(&capture.lock);
+	lownet_capture_stats_t stats = capture.stats;
+	stats.snaplen = capture.snaplen;
+	portEXIT_CRITICAL(&capture.lock);
+	return stats;
+}
+
+// Value: Microseconds to add to esp_timer time for network time, 0 if
+//        network time is not known
+static int64_t network_offset(void)
+{
+	lownet_time_t now = lownet_get_time();
+	if (!now.seconds)
+		return 0;
+	int64_t us = (int64_t) now.seconds * 1000000
+	             + (int64_t) now.parts * 1000000 / LOWNET_TIME_RESOLUTION;
+	return us - esp_timer_get_time();
+}
+
+void lownet_capture_pcap(lownet_capture_write_fn write, void* ctx)
+{
+	const pcap_file_header_t file = {
+		.magic = PCAP_MAGIC,
+		.version_major = 2,
+		.version_minor = 4,
+		.snaplen = sizeof(lownet_capture_header_t) + LOWNET_CAPTURE_SNAPLEN,
+		.linktype = LOWNET_CAPTURE_LINKTYPE,
+	};
+	write(&file, sizeof file, ctx);
+
+	int64_t offset = network_offset();
+
+	portENTER_CRITICAL(&capture.lock);
+	uint32_t last = capture.seq;
+	portEXIT_CRITICAL(&capture.lock);
+	uint32_t first = last > LOWNET_CAPTURE_FRAMES ? last - LOWNET_CAPTURE_FRAMES + 1 : 1;
+
+	// Records are copied out one at a time so that capture goes on; those
+	// overwritten before their turn are skipped.
+	for (uint32_t seq = first; seq && seq <= last; ++seq)
+		{
+			record_t record;
+			portENTER_CRITICAL(&capture.lock);
+			record = capture.ring[seq % LOWNET_CAPTURE_FRAMES];
+			portEXIT_CRITICAL(&capture.lock);
+			if (record.seq != seq)
+				continue;
+
+			int64_t time = record.timestamp + offset;
+			pcap_record_header_t head = {
+				.ts_sec = (uint32_t) (time / 1000000),
+				.ts_usec = (uint32_t) (time % 1000000),
+				.incl_len = sizeof record.header + record.length,
+				.orig_len = sizeof record.header + record.original,
+			};
+			write(&head, sizeof head, ctx);
+			write(&record.header, sizeof record.header, ctx);
+			write(record.data, record.length, ctx);
+		}
+}
+
+const char* lownet_drop_name(lownet_drop_t reason)
+{
+	return reason < LOWNET_DROP_REASONS ? drop_names[reason] : "?";
+}
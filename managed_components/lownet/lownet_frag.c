@@ -0,0 +1,325 @@
+#include "lownet_frag.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+
+#include <esp_random.h>
+
+#define FRAG_MAX_COUNT ((LOWNET_FRAG_MAX_MESSAGE + LOWNET_FRAG_DATA - 1) / LOWNET_FRAG_DATA)
+#define FRAG_SOURCE_SHARE (LOWNET_FRAG_ARENA / 2)
+
+// Trains of fragments run ahead of the air; a fragment waits this long
+// for the link to free a transmit buffer.
+#define FRAG_SEND_WAIT_MS 20
+
+typedef struct
+{
+	uint8_t protocol;
+	lownet_message_fn handler;
+} handler_t;
+
+typedef struct
+{
+	bool used;
+	uint8_t source;
+	uint8_t destination;
+	uint8_t protocol;
+	uint16_t message;
+	uint8_t count;
+	uint8_t received;
+	uint8_t last;      // bytes in the last fragment, once it is in
+	uint32_t offset;   // of the message in the arena
+	uint32_t size;     // bytes taken from the arena
+	uint32_t have[8];  // fragments received, a bit per index
+	int64_t updated;   // esp_timer time of the latest fragment
+} reassembly_t;
+
+// The handlers and the reassembly state belong to the lownet service
+// task; the lock guards the message numbers and the counters.
+static struct
+{
+	portMUX_TYPE lock;
+	bool registered;   // LOWNET_PROTOCOL_FRAG with the core
+	bool numbered;     // next_message has been seeded
+	uint16_t next_message;
+
+	handler_t handlers[LOWNET_MAX_PROTOCOLS];
+	uint8_t num_handlers;
+
+	reassembly_t slots[LOWNET_FRAG_SLOTS];
+	uint8_t arena[LOWNET_FRAG_ARENA];
+
+	lownet_frag_stats_t stats;
+} frag = {
+	.lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+static lownet_message_fn frag_handler(uint8_t protocol)
+{
+	for (int i = 0; i < frag.num_handlers; ++i)
+		if (frag.handlers[i].protocol == (protocol & 0x3F))
+			return frag.handlers[i].handler;
+	return NULL;
+}
+
+static void frag_count(uint32_t* counter, uint32_t n)
+{
+	portENTER_CRITICAL(&frag.lock);
+	*counter += n;
+	portEXIT_CRITICAL(&frag.lock);
+}
+
+// Messages which fit into a frame.
+static void frag_frame(const lownet_frame_t* frame, const lownet_rx_info_t* info)
+{
+	lownet_message_fn handler = frag_handler(frame->protocol);
+	if (!handler)
+		return;
+	if (frame->length > LOWNET_PAYLOAD_SIZE)
+		{
+			frag_count(&frag.stats.malformed, 1);
+			return;
+		}
+
+	uint8_t data[LOWNET_PAYLOAD_SIZE];
+	memcpy(data, frame->payload, frame->length);
+	lownet_message_t message = {
+		.source = frame->source,
+		.destination = frame->destination,
+		.protocol = frame->protocol,
+		.length = frame->length,
+		.data = data,
+	};
+	handler(&message, info);
+}
+
+// Drops the reassemblies which have not progressed for the timeout.
+static void frag_expire(int64_t now)
+{
+	for (int i = 0; i < LOWNET_FRAG_SLOTS; ++i)
+		{
+			reassembly_t* slot = &frag.slots[i];
+			if (slot->used && now - slot->updated > LOWNET_FRAG_TIMEOUT_MS * 1000ll)
+				{
+					slot->used = false;
+					frag_count(&frag.stats.timeouts, 1);
+				}
+		}
+}
+
+static reassembly_t* frag_find(uint8_t source, uint16_t message)
+{
+	for (int i = 0; i < LOWNET_FRAG_SLOTS; ++i)
+		{
+			reassembly_t* slot = &frag.slots[i];
+			if (slot->used && slot->source == source && slot->message == message)
+				return slot;
+		}
+	return NULL;
+}
+
+// Value: true if SIZE bytes at OFFSET of the arena are taken
+static bool frag_taken(uint32_t offset, uint32_t size)
+{
+	for (int i = 0; i < LOWNET_FRAG_SLOTS; ++i)
+		{
+			const reassembly_t* slot = &frag.slots[i];
+			if (slot->used && offset < slot->offset + slot->size && slot->offset < offset + size)
+				return true;
+		}
+	return false;
+}
+
+// Value: A free slot with SIZE bytes of the arena for SOURCE, at the
+//        lowest offset they fit, NULL if there is no slot or no room
+static reassembly_t* frag_claim(uint8_t source, uint32_t size)
+{
+	reassembly_t* claimed = NULL;
+	uint32_t held = 0;
+	for (int i = 0; i < LOWNET_FRAG_SLOTS; ++i)
+		{
+			reassembly_t* slot = &frag.slots[i];
+			if (!slot->used)
+				claimed = claimed ? claimed : slot;
+			else if (slot->source == source)
+				held += slot->size;
+		}
+	if (!claimed || held + size > FRAG_SOURCE_SHARE)
+		return NULL;
+
+	// Space starts at 0 or right after another message.
+	uint32_t offset = frag_taken(0, size) ? UINT32_MAX : 0;
+	for (int i = 0; i < LOWNET_FRAG_SLOTS && offset; ++i)
+		{
+			const reassembly_t* slot = &frag.slots[i];
+			uint32_t start = slot->offset + slot->size;
+			if (slot->used && start < offset && start + size <= LOWNET_FRAG_ARENA
+			    && !frag_taken(start, size))
+				offset = start;
+		}
+	if (offset == UINT32_MAX)
+		return NULL;
+
+	memset(claimed, 0, sizeof *claimed);
+	claimed->offset = offset;
+	claimed->size = size;
+	return claimed;
+}
+
+static void frag_receive(const lownet_frame_t* frame, const lownet_rx_info_t* info)
+{
+	lownet_frag_header_t header;
+	if (frame->length <= sizeof header || frame->length > LOWNET_PAYLOAD_SIZE)
+		{
+			frag_count(&frag.stats.malformed, 1);
+			return;
+		}
+	memcpy(&header, frame->payload, sizeof header);
+	uint8_t length = frame->length - sizeof header;
+
+	// All fragments but the last are full.
+	if (header.index >= header.count || header.count > FRAG_MAX_COUNT
+	    || (header.index + 1 < header.count && length != LOWNET_FRAG_DATA))
+		{
+			frag_count(&frag.stats.malformed, 1);
+			return;
+		}
+
+	lownet_message_fn handler = frag_handler(header.protocol);
+	if (!handler)
+		return;
+
+	frag_expire(info->timestamp);
+
+	// A sender which restarted may reuse the number of a message we still
+	// hold pieces of.
+	reassembly_t* slot = frag_find(frame->source, header.message);
+	if (slot && (slot->count != header.count || slot->protocol != header.protocol
+	             || slot->destination != frame->destination))
+		{
+			slot->used = false;
+			slot = NULL;
+		}
+
+	if (!slot)
+		{
+			slot = frag_claim(frame->source, header.count * LOWNET_FRAG_DATA);
+			if (!slot)
+				{
+					frag_count(&frag.stats.no_memory, 1);
+					return;
+				}
+			slot->used = true;
+			slot->source = frame->source;
+			slot->destination = frame->destination;
+			slot->protocol = header.protocol;
+			slot->message = header.message;
+			slot->count = header.count;
+		}
+
+	uint32_t bit = 1u << (header.index % 32);
+	if (slot->have[header.index / 32] & bit)
+		{
+			frag_count(&frag.stats.duplicates, 1);
+			return;
+		}
+	slot->have[header.index / 32] |= bit;
+	slot->received++;
+	slot->updated = info->timestamp;
+	memcpy(frag.arena + slot->offset + header.index * LOWNET_FRAG_DATA,
+	       frame->payload + sizeof header, length);
+	if (header.index + 1 == header.count)
+		slot->last = length;
+
+	if (slot->received < slot->count)
+		return;
+
+	lownet_message_t message = {
+		.source = slot->source,
+		.destination = slot->destination,
+		.protocol = slot->protocol,
+		.length = (slot->count - 1) * LOWNET_FRAG_DATA + slot->last,
+		.data = frag.arena + slot->offset,
+	};
+	frag_count(&frag.stats.reassembled, 1);
+	handler(&message, info);
+	slot->used = false;
+}
+
+int lownet_frag_register(uint8_t protocol, lownet_message_fn handler)
+{
+	if (frag.num_handlers >= LOWNET_MAX_PROTOCOLS)
+		return 1;
+	if (!frag.registered)
+		{
+			if (lownet_register_protocol_ex(LOWNET_PROTOCOL_FRAG, frag_receive) != 0)
+				return 1;
+			frag.registered = true;
+		}
+	if (lownet_register_protocol_ex(protocol, frag_frame) != 0)
+		return 1;
+
+	frag.handlers[frag.num_handlers].protocol = protocol;
+	frag.handlers[frag.num_handlers].handler = handler;
+	++frag.num_handlers;
+	return 0;
+}
+
+int lownet_frag_send(uint8_t destination, uint8_t protocol, const void* data, size_t length)
+{
+	if (length > LOWNET_FRAG_MAX_MESSAGE)
+		return 1;
+
+	lownet_frame_t frame;
+	frame.destination = destination;
+	if (length <= LOWNET_PAYLOAD_SIZE)
+		{
+			frame.protocol = protocol;
+			frame.length = length;
+			memcpy(frame.payload, data, length);
+			lownet_send(&frame);
+			return 0;
+		}
+
+	lownet_frag_header_t header = {
+		.protocol = protocol,
+		.count = (length + LOWNET_FRAG_DATA - 1) / LOWNET_FRAG_DATA,
+	};
+
+	// Numbers start at random so that a restarted node does not complete
+	// messages of its previous life at the receivers.
+	portENTER_CRITICAL(&frag.lock);
+	if (!frag.numbered)
+		{
+			frag.next_message = (uint16_t) esp_random();
+			frag.numbered = true;
+		}
+	header.message = frag.next_message++;
+	frag.stats.sent++;
+	frag.stats.fragments += header.count;
+	portEXIT_CRITICAL(&frag.lock);
+
+	const uint8_t* bytes = data;
+	frame.protocol = LOWNET_PROTOCOL_FRAG;
+	for (int i = 0; i < header.count; ++i)
+		{
+			size_t offset = i * LOWNET_FRAG_DATA;
+			size_t n = length - offset < LOWNET_FRAG_DATA ? length - offset : LOWNET_FRAG_DATA;
+			header.index = i;
+			memcpy(frame.payload, &header, sizeof header);
+			memcpy(frame.payload + sizeof header, bytes + offset, n);
+			frame.length = sizeof header + n;
+			lownet_send_ex(&frame, FRAG_SEND_WAIT_MS);
+		}
+	return 0;
+}
+
+lownet_frag_stats_t lownet_frag_stats(void)
+{
+	portENTER_CRITICAL(&frag.lock);
+	lownet_frag_stats_t stats = frag.stats;
+	portEXIT_CRITICAL(&frag.lock);
+	return stats;
+}
@@ -0,0 +1,296 @@
+#include "lownet_mesh.h"
+
+#include <string.h>
+
+// Weight of a new residence time sample in the smoothed value: 1/8.
+#define RESIDENCE_SHIFT 3
+
+// Advertised latencies are in units of 100 microseconds.
+#define LATENCY_UNIT 100
+
+typedef struct __attribute__((__packed__))
+{
+	uint8_t node;
+	uint8_t hops;
+	uint8_t next_hop;  // lets the neighbor the route goes through ignore it
+	uint16_t latency;  // LATENCY_UNIT
+} beacon_entry_t;
+
+typedef struct __attribute__((__packed__))
+{
+	uint8_t count;
+	uint8_t reserved;
+	uint16_t residence; // LATENCY_UNIT, the time frames stay with the sender
+	beacon_entry_t entries[];
+} beacon_t;
+
+#define BEACON_ENTRIES ((LOWNET_PAYLOAD_SIZE - sizeof(beacon_t)) / sizeof(beacon_entry_t))
+
+static uint16_t to_units(uint32_t us)
+{
+	uint32_t units = us / LATENCY_UNIT;
+	return units > 0xFFFF ? 0xFFFF : units;
+}
+
+// Identifies a frame independent of the hop it was received from: the
+// mesh header is the only thing forwarders change.
+static uint32_t frame_key(const lownet_frame_t* frame)
+{
+	uint32_t hash = 2166136261u;
+	const uint8_t head[] = {
+		frame->source, frame->destination, frame->protocol, frame->length,
+		frame->padding[LOWNET_SEQ],
+	};
+	for (size_t i = 0; i < sizeof head; ++i)
+		hash = (hash ^ head[i]) * 16777619u;
+	for (size_t i = 0; i < frame->length && i < LOWNET_PAYLOAD_SIZE; ++i)
+		hash = (hash ^ frame->payload[i]) * 16777619u;
+	return hash;
+}
+
+// Pre:   mesh->lock is held
+// Post:  KEY has been recorded as seen at NOW
+// Value: true if KEY had been seen within LOWNET_MESH_SEEN_MS
+static bool mesh_seen(lownet_mesh_t* mesh, uint32_t key, int64_t now)
+{
+	int64_t horizon = now - (int64_t) LOWNET_MESH_SEEN_MS * 1000;
+	for (int i = 0; i < LOWNET_MESH_SEEN; ++i)
+		if (mesh->seen[i].key == key && mesh->seen[i].time > horizon)
+			return true;
+
+	mesh->seen[mesh->seen_next].key = key;
+	mesh->seen[mesh->seen_next].time = now;
+	mesh->seen_next = (mesh->seen_next + 1) % LOWNET_MESH_SEEN;
+	return false;
+}
+
+// Pre:   mesh->lock is held
+// Value: The route to NODE, NULL if there is none or it expired
+static lownet_route_t* mesh_find(lownet_mesh_t* mesh, uint8_t node, int64_t now)
+{
+	lownet_route_t* route = &mesh->routes[node];
+	if (!route->next_hop)
+		return NULL;
+	if (route->hops >= LOWNET_MESH_UNREACHABLE
+	    || now - route->updated > (int64_t) LOWNET_MESH_EXPIRY_MS * 1000)
+		{
+			route->next_hop = 0;
+			return NULL;
+		}
+	return route;
+}
+
+// Pre:   mesh->lock is held
+static void mesh_direct(lownet_mesh_t* mesh, uint8_t node, int64_t now)
+{
+	if (node == mesh->self || node == LOWNET_BROADCAST_ADDRESS || !node)
+		return;
+	lownet_route_t* route = &mesh->routes[node];
+	route->next_hop = node;
+	route->hops = 1;
+	route->latency_us = 0;
+	route->updated = now;
+}
+
+void lownet_mesh_init(lownet_mesh_t* mesh, uint8_t self)
+{
+	memset(mesh, 0, sizeof *mesh);
+	portMUX_INITIALIZE(&mesh->lock);
+	mesh->self = self;
+}
+
+uint8_t lownet_mesh_route(lownet_mesh_t* mesh, lownet_frame_t* frame, int64_t now)
+{
+	uint32_t key = frame_key(frame);
+	uint8_t next_hop = LOWNET_BROADCAST_ADDRESS;
+
+	portENTER_CRITICAL(&mesh->lock);
+	if (frame->destination != LOWNET_BROADCAST_ADDRESS)
+		{
+			lownet_route_t* route = mesh_find(mesh, frame->destination, now);
+			if (route && route->hops == 1)
+				{
+					// A neighbor: a plain frame, which nodes outside the mesh
+					// understand as well.
+					portEXIT_CRITICAL(&mesh->lock);
+					return frame->destination;
+				}
+			if (route)
+				next_hop = route->next_hop;
+		}
+
+	frame->padding[LOWNET_MESH] = LOWNET_MESH_TTL;
+	mesh->stats.originated++;
+	// Copies coming back to us are duplicates.
+	mesh_seen(mesh, key, now);
+	portEXIT_CRITICAL(&mesh->lock);
+	return next_hop;
+}
+
+int lownet_mesh_receive(lownet_mesh_t* mesh, lownet_frame_t* frame,
+                        const lownet_rx_info_t* info, uint8_t* next_hop)
+{
+	uint8_t header = frame->padding[LOWNET_MESH];
+	int64_t now = info->timestamp;
+
+	if (!header)
+		{
+			portENTER_CRITICAL(&mesh->lock);
+			mesh_direct(mesh, frame->source, now);
+			portEXIT_CRITICAL(&mesh->lock);
+			return LOWNET_MESH_DELIVER;
+		}
+
+	if (frame->source == mesh->self)
+		return LOWNET_MESH_DROP;
+
+	uint32_t key = frame_key(frame);
+	int action = LOWNET_MESH_DROP;
+
+	portENTER_CRITICAL(&mesh->lock);
+	if (LOWNET_MESH_HOPS(header) == 0)
+		mesh_direct(mesh, frame->source, now);
+
+	if (mesh_seen(mesh, key, now))
+		{
+			mesh->stats.duplicates++;
+			portEXIT_CRITICAL(&mesh->lock);
+			return LOWNET_MESH_DROP;
+		}
+
+	if (frame->destination == mesh->self || frame->destination == LOWNET_BROADCAST_ADDRESS)
+		{
+			uint8_t hops = LOWNET_MESH_HOPS(header) + 1;
+			action |= LOWNET_MESH_DELIVER;
+			mesh->stats.delivered++;
+			mesh->stats.hops_sum += hops;
+			if (hops > mesh->stats.hops_max)
+				mesh->stats.hops_max = hops;
+		}
+
+	if (frame->destination != mesh->self)
+		{
+			if (LOWNET_MESH_LEFT(header) <= 1 || LOWNET_MESH_HOPS(header) >= 0x0F)
+				{
+					mesh->stats.expired++;
+				}
+			else
+				{
+					lownet_route_t* route = NULL;
+					if (frame->destination != LOWNET_BROADCAST_ADDRESS)
+						route = mesh_find(mesh, frame->destination, now);
+
+					*next_hop = route ? route->next_hop : LOWNET_BROADCAST_ADDRESS;
+					if (route)
+						mesh->stats.forwarded++;
+					else
+						mesh->stats.flooded++;
+
+					frame->padding[LOWNET_MESH] =
+						((LOWNET_MESH_HOPS(header) + 1) << 4) | (LOWNET_MESH_LEFT(header) - 1);
+					action |= LOWNET_MESH_FORWARD;
+				}
+		}
+	portEXIT_CRITICAL(&mesh->lock);
+	return action;
+}
+
+void lownet_mesh_forwarded(lownet_mesh_t* mesh, const lownet_rx_info_t* info, int64_t now)
+{
+	uint32_t residence = now > info->timestamp ? (uint32_t) (now - info->timestamp) : 0;
+
+	portENTER_CRITICAL(&mesh->lock);
+	lownet_mesh_stats_t* stats = &mesh->stats;
+	if (stats->residence_avg_us == 0)
+		stats->residence_avg_us = residence;
+	else
+		stats->residence_avg_us += ((int32_t) residence - (int32_t) stats->residence_avg_us) >> RESIDENCE_SHIFT;
+	if (residence > stats->residence_max_us)
+		stats->residence_max_us = residence;
+	portEXIT_CRITICAL(&mesh->lock);
+}
+
+int lownet_mesh_beacon(lownet_mesh_t* mesh, lownet_frame_t* frame, int start, int64_t now)
+{
+	memset(frame, 0, sizeof *frame);
+	frame->source = mesh->self;
+	frame->destination = LOWNET_BROADCAST_ADDRESS;
+	frame->protocol = LOWNET_PROTOCOL_MESH;
+
+	beacon_t* beacon = (beacon_t*) frame->payload;
+	int node = start > 0 ? start : 1;
+
+	portENTER_CRITICAL(&mesh->lock);
+	beacon->residence = to_units(mesh->stats.residence_avg_us);
+	for (; node < LOWNET_BROADCAST_ADDRESS && beacon->count < BEACON_ENTRIES; ++node)
+		{
+			lownet_route_t* route = mesh_find(mesh, node, now);
+			if (!route)
+				continue;
+			beacon_entry_t* entry = &beacon->entries[beacon->count++];
+			entry->node = node;
+			entry->hops = route->hops;
+			entry->next_hop = route->next_hop;
+			entry->latency = to_units(route->latency_us);
+		}
+	portEXIT_CRITICAL(&mesh->lock);
+
+	frame->length = sizeof(beacon_t) + beacon->count * sizeof(beacon_entry_t);
+	return node < LOWNET_BROADCAST_ADDRESS ? node : 0;
+}
+
+void lownet_mesh_beacon_receive(lownet_mesh_t* mesh, const lownet_frame_t* frame, int64_t now)
+{
+	const beacon_t* beacon = (const beacon_t*) frame->payload;
+	if (frame->length < sizeof(beacon_t)
+	    || frame->length < sizeof(beacon_t) + beacon->count * sizeof(beacon_entry_t)
+	    || LOWNET_MESH_HOPS(frame->padding[LOWNET_MESH]) != 0)
+		return;
+
+	uint8_t from = frame->source;
+	uint32_t residence = (uint32_t) beacon->residence * LATENCY_UNIT;
+
+	portENTER_CRITICAL(&mesh->lock);
+	mesh->stats.beacons++;
+	mesh_direct(mesh, from, now);
+	for (int i = 0; i < beacon->count; ++i)
+		{
+			const beacon_entry_t* entry = &beacon->entries[i];
+			// Split horizon: a route through us is no route for us.
+			if (entry->node == mesh->self || entry->next_hop == mesh->self
+			    || !entry->node || entry->node == LOWNET_BROADCAST_ADDRESS)
+				continue;
+
+			uint8_t hops = entry->hops + 1;
+			lownet_route_t* route = mesh_find(mesh, entry->node, now);
+			if (route && route->next_hop != from && route->hops <= hops)
+				continue;
+			if (!route && hops >= LOWNET_MESH_UNREACHABLE)
+				continue;
+
+			route = &mesh->routes[entry->node];
+			route->next_hop = from;
+			route->hops = hops;
+			route->latency_us = (uint32_t) entry->latency * LATENCY_UNIT + residence;
+			route->updated = now;
+		}
+	portEXIT_CRITICAL(&mesh->lock);
+}
+
+int lownet_mesh_get_route(lownet_mesh_t* mesh, uint8_t node, int64_t now, lownet_route_t* out)
+{
+	portENTER_CRITICAL(&mesh->lock);
+	lownet_route_t* route = mesh_find(mesh, node, now);
+	if (route)
+		*out = *route;
+	portEXIT_CRITICAL(&mesh->lock);
+	return route == NULL;
+}
+
+lownet_mesh_stats_t lownet_mesh_stats(lownet_mesh_t* mesh)
+{
+	portENTER_CRITICAL(&mesh->lock);
+	lownet_mesh_stats_t stats = mesh->stats;
+	portEXIT_CRITICAL(&mesh->lock);
+	return stats;
+}
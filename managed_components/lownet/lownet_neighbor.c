@@ -0,0 +1,159 @@
+#include "lownet_neighbor.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+
+// Weight of a new RSSI sample in the smoothed value, as a shift: 1/8.
+#define RSSI_SHIFT 3
+
+// A jump forward of more than this in the sequence numbers is taken to be
+// a restart of the sender rather than loss.
+#define SEQ_WINDOW 128
+
+typedef struct
+{
+	lownet_neighbor_t stats;
+	int32_t rssi_avg;  // smoothed RSSI, 1/16 dBm
+	uint32_t numbered; // frames which carried a sequence number
+	uint8_t seq[2];    // latest sequence number seen, unicast and broadcast
+} neighbor_t;
+
+static struct
+{
+	portMUX_TYPE lock;
+	neighbor_t table[LOWNET_NEIGHBORS];
+} neighbors = {
+	.lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+// Pre:   neighbors.lock is held
+// Value: The entry of NODE, NULL if NODE has not been heard from
+static neighbor_t* neighbor_find(uint8_t node)
+{
+	for (int i = 0; i < LOWNET_NEIGHBORS; ++i)
+		if (neighbors.table[i].stats.node == node)
+			return &neighbors.table[i];
+	return NULL;
+}
+
+// Pre:   neighbors.lock is held
+// Value: A free entry, or the one heard from least recently, cleared
+static neighbor_t* neighbor_claim(void)
+{
+	neighbor_t* victim = &neighbors.table[0];
+	for (int i = 0; i < LOWNET_NEIGHBORS; ++i)
+		{
+			neighbor_t* n = &neighbors.table[i];
+			if (!n->stats.node)
+				{
+					victim = n;
+					break;
+				}
+			if (n->stats.last_seen < victim->stats.last_seen)
+				victim = n;
+		}
+	memset(victim, 0, sizeof *victim);
+	return victim;
+}
+
+// Pre:   neighbors.lock is held
+// Value: A copy of the statistics of N with the loss rate filled in
+static lownet_neighbor_t neighbor_snapshot(const neighbor_t* n)
+{
+	lownet_neighbor_t out = n->stats;
+	out.rssi = (int8_t) (n->rssi_avg / 16);
+	uint32_t expected = n->numbered + n->stats.lost;
+	out.loss = expected ? (uint16_t) ((uint64_t) n->stats.lost * 1000 / expected) : 0;
+	return out;
+}
+
+void lownet_neighbor_update(const lownet_frame_t* frame, const lownet_rx_info_t* info)
+{
+	if (!frame->source || frame->source == LOWNET_BROADCAST_ADDRESS)
+		return;
+
+	portENTER_CRITICAL(&neighbors.lock);
+	neighbor_t* n = neighbor_find(frame->source);
+	if (!n)
+		{
+			n = neighbor_claim();
+			n->stats.node = frame->source;
+			n->stats.first_seen = info->timestamp;
+			n->rssi_avg = info->rssi * 16;
+		}
+
+	n->stats.last_seen = info->timestamp;
+	n->stats.rssi_last = info->rssi;
+	n->stats.frames++;
+	n->rssi_avg += (info->rssi * 16 - n->rssi_avg) >> RSSI_SHIFT;
+
+	// Senders number their frames per destination, in 1..255, so the
+	// unicast and broadcast streams we hear are each gapless unless
+	// something got lost.  0 is an unnumbered frame.  Unicast to other
+	// nodes is overheard in streams of its own and says nothing of ours.
+	uint8_t seq = frame->padding[LOWNET_SEQ];
+	bool ours = frame->destination == lownet_get_device_id()
+		|| frame->destination == LOWNET_BROADCAST_ADDRESS;
+	if (seq && ours)
+		{
+			uint8_t* last = &n->seq[frame->destination == LOWNET_BROADCAST_ADDRESS];
+			int gap = *last ? (seq - *last + 255) % 255 : 1;
+			if (gap != 0)	// not a duplicate
+				{
+					n->numbered++;
+					if (gap < SEQ_WINDOW)
+						n->stats.lost += gap - 1;
+					*last = seq;
+				}
+		}
+	portEXIT_CRITICAL(&neighbors.lock);
+}
+
+int lownet_neighbor_get(uint8_t node, lownet_neighbor_t* out)
+{
+	if (!node)
+		return 1;
+
+	portENTER_CRITICAL(&neighbors.lock);
+	neighbor_t* n = neighbor_find(node);
+	if (n)
+		*out = neighbor_snapshot(n);
+	portEXIT_CRITICAL(&neighbors.lock);
+	return n == NULL;
+}
+
+size_t lownet_neighbors(lownet_neighbor_t* out, size_t max)
+{
+	size_t count = 0;
+	portENTER_CRITICAL(&neighbors.lock);
+	for (int i = 0; i < LOWNET_NEIGHBORS; ++i)
+		{
+			if (!neighbors.table[i].stats.node)
+				continue;
+
+			// Insertion sort on last_seen, most recent first; dropping off
+			// the end what does not fit.
+			lownet_neighbor_t n = neighbor_snapshot(&neighbors.table[i]);
+			size_t j = count < max ? count++ : max;
+			while (j > 0 && out[j - 1].last_seen < n.last_seen)
+				{
+					if (j < max)
+						out[j] = out[j - 1];
+					--j;
+				}
+			if (j < max)
+				out[j] = n;
+		}
+	portEXIT_CRITICAL(&neighbors.lock);
+	return count;
+}
+
+uint32_t lownet_neighbor_timeout(uint8_t node, uint32_t base_ms)
+{
+	lownet_neighbor_t n;
+	if (lownet_neighbor_get(node, &n) != 0)
+		return base_ms;
+	return base_ms + (uint32_t) ((uint64_t) base_ms * 3 * n.loss / 1000);
+}
@@ -0,0 +1,77 @@
+#include "lownet_port.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <nvs_flash.h>
+#include <esp_log.h>
+#include <esp_mac.h>
+#include <esp_netif.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+
+#define TAG "lownet-port"
+
+static_assert(LOWNET_PORT_MAX_PEERS < ESP_NOW_MAX_TOTAL_PEER_NUM, "Too many lownet peers");
+
+static lownet_port_recv_fn port_recv;
+
+// Executed from the context of the wifi task!  It is of great importance
+// that this not block.
+static void lownet_port_inbound(const esp_now_recv_info_t* info, const uint8_t* data, int len) {
+	port_recv(data, len, info->rx_ctrl ? info->rx_ctrl->rssi : 0);
+}
+
+int lownet_port_init(lownet_port_recv_fn recv) {
+	port_recv = recv;
+
+	ESP_ERROR_CHECK(nvs_flash_init());        // initialize NVS
+	ESP_ERROR_CHECK(esp_netif_init());
+	ESP_ERROR_CHECK(esp_event_loop_create_default());
+	wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+	ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+	ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+	ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+	ESP_ERROR_CHECK(esp_wifi_start());
+
+	if (esp_now_init() != ESP_OK) {
+		ESP_LOGE(TAG, "Error initializing ESP-NOW");
+		return 1;
+	}
+
+	// Register the broadcast address.
+	static const uint8_t broadcast[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+	if (lownet_port_add_peer(broadcast) != 0) {
+		ESP_LOGE(TAG, "Failed to add broadcast peer address");
+		return 1;
+	}
+
+	// Register our inbound network callback.
+	esp_now_register_recv_cb(lownet_port_inbound);
+	return 0;
+}
+
+void lownet_port_mac(uint8_t mac[6]) {
+	esp_read_mac(mac, ESP_MAC_WIFI_STA);
+}
+
+int lownet_port_add_peer(const uint8_t mac[6]) {
+	esp_now_peer_info_t peer_info = {};
+	memcpy(peer_info.peer_addr, mac, 6);
+	peer_info.channel = 0;
+	peer_info.ifidx = ESP_IF_WIFI_STA;
+	peer_info.encrypt = false;
+	return esp_now_add_peer(&peer_info) != ESP_OK;
+}
+
+void lownet_port_del_peer(const uint8_t mac[6]) {
+	esp_now_del_peer(mac);
+}
+
+int lownet_port_send(const uint8_t mac[6], const void* data, size_t length) {
+	esp_err_t err = esp_now_send(mac, data, length);
+	if (err == ESP_ERR_ESPNOW_NO_MEM) {
+		return LOWNET_PORT_BUSY;
+	}
+	return err != ESP_OK;
+}
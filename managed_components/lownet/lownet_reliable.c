@@ -0,0 +1,654 @@
+#include "lownet_reliable.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+
+#define TAG "lownet-reliable"
+
+#define RELIABLE_TASK_PRIO  (LOWNET_SERVICE_PRIO - 1)
+#define RELIABLE_TASK_STACK 4096
+
+#define WINDOW LOWNET_RELIABLE_WINDOW
+#define SEGMENT LOWNET_RELIABLE_SEGMENT
+
+#define RTO_MIN_US (LOWNET_RELIABLE_RTO_MIN_MS * 1000ll)
+#define RTO_MAX_US (LOWNET_RELIABLE_RTO_MAX_MS * 1000ll)
+#define TICK_US (LOWNET_RELIABLE_TICK_MS * 1000ll)
+
+// Segments received in order before they are acknowledged.
+#define ACK_EVERY 2
+
+static_assert(LOWNET_RELIABLE_PEERS <= 24, "A stream takes a bit of the event group");
+
+typedef struct
+{
+	uint8_t protocol;
+	uint8_t flags;
+	uint8_t length;
+	uint8_t tries;   // transmissions so far
+	bool acked;      // selectively, ahead of a gap
+	int64_t sent_at; // esp_timer time of the latest transmission
+	uint8_t data[SEGMENT];
+} outbound_t;
+
+typedef struct
+{
+	bool have;
+	uint8_t protocol;
+	uint8_t flags;
+	uint8_t length;
+	uint8_t data[SEGMENT];
+} inbound_t;
+
+typedef struct
+{
+	uint8_t node;    // 0 while the slot is unused
+	uint32_t epoch;  // changes when what was queued is dropped
+	int64_t active;  // esp_timer time of the latest traffic, for eviction
+
+	// Sending: segments snd_una..snd_nxt - 1 are in flight, at their
+	// number modulo the window.
+	bool syn;        // the next new segment starts the stream
+	uint16_t snd_una;
+	uint16_t snd_nxt;
+	int64_t srtt;    // microseconds, 0 until measured
+	int64_t rttvar;
+	int64_t rto;
+	outbound_t out[WINDOW];
+
+	// Receiving: segments from rcv_nxt on are buffered until they can be
+	// handed over in order.
+	bool synced;     // a stream from the node has started
+	uint16_t rcv_syn; // number of its first segment
+	uint16_t rcv_nxt;
+	uint8_t unacked; // segments handed over and not acknowledged yet
+	bool ack_due;    // an acknowledgement goes out with the next tick
+	inbound_t in[WINDOW];
+
+	lownet_reliable_stats_t stats;
+} peer_t;
+
+typedef struct
+{
+	uint8_t protocol;
+	lownet_reliable_fn handler;
+} handler_t;
+
+// The streams belong to the lock; they are allocated on first use and
+// kept.  The handlers are registered before traffic starts.
+static struct
+{
+	SemaphoreHandle_t lock;
+	EventGroupHandle_t events; // bit i: stream i made progress
+	TaskHandle_t task;         // retransmits and sends delayed acknowledgements
+	bool armed;                // the task ticks
+
+	peer_t* peers[LOWNET_RELIABLE_PEERS];
+
+	handler_t handlers[LOWNET_MAX_PROTOCOLS];
+	uint8_t num_handlers;
+} reliable;
+
+static lownet_reliable_fn reliable_handler(uint8_t protocol)
+{
+	for (int i = 0; i < reliable.num_handlers; ++i)
+		if (reliable.handlers[i].protocol == protocol)
+			return reliable.handlers[i].handler;
+	return NULL;
+}
+
+static int reliable_index(const peer_t* peer)
+{
+	for (int i = 0; i < LOWNET_RELIABLE_PEERS; ++i)
+		if (reliable.peers[i] == peer)
+			return i;
+	return 0;
+}
+
+static void reliable_progress(const peer_t* peer)
+{
+	xEventGroupSetBits(reliable.events, 1u << reliable_index(peer));
+}
+
+// Pre: the lock is held
+static void reliable_arm(void)
+{
+	if (!reliable.armed)
+		{
+			reliable.armed = true;
+			xTaskNotifyGive(reliable.task);
+		}
+}
+
+// Starts a new stream to the node, dropping what was in flight.
+static void reliable_restart(peer_t* peer)
+{
+	peer->epoch++;
+	peer->syn = true;
+	peer->snd_una = peer->snd_nxt = (uint16_t) esp_random();
+	for (int i = 0; i < WINDOW; ++i)
+		peer->out[i].tries = 0;
+	reliable_progress(peer);
+}
+
+// Value: The stream of NODE, set up if CLAIM and there is none; NULL if
+//        there is none and no slot is free or idle
+static peer_t* reliable_peer(uint8_t node, bool claim)
+{
+	int unused = -1;
+	int idle = -1;
+	for (int i = 0; i < LOWNET_RELIABLE_PEERS; ++i)
+		{
+			const peer_t* peer = reliable.peers[i];
+			if (peer && peer->node == node)
+				return reliable.peers[i];
+			if (!peer || !peer->node)
+				unused = unused < 0 ? i : unused;
+			else if (peer->snd_una == peer->snd_nxt
+			         && (idle < 0 || peer->active < reliable.peers[idle]->active))
+				idle = i;
+		}
+	int index = unused >= 0 ? unused : idle;
+	if (!claim || index < 0)
+		return NULL;
+
+	peer_t* peer = reliable.peers[index];
+	if (!peer)
+		{
+			peer = calloc(1, sizeof *peer);
+			if (!peer)
+				return NULL;
+			reliable.peers[index] = peer;
+		}
+	uint32_t epoch = peer->epoch;
+	memset(peer, 0, sizeof *peer);
+	peer->epoch = epoch;
+	peer->node = node;
+	peer->active = esp_timer_get_time();
+	peer->rto = LOWNET_RELIABLE_RTO_INIT_MS * 1000ll;
+	peer->stats.node = node;
+	reliable_restart(peer);
+	return peer;
+}
+
+static uint32_t reliable_sack(const peer_t* peer)
+{
+	uint32_t sack = 0;
+	for (int i = 0; i < WINDOW - 1; ++i)
+		if (peer->in[(uint16_t) (peer->rcv_nxt + 1 + i) % WINDOW].have)
+			sack |= 1u << i;
+	return sack;
+}
+
+// Sends the segment SEQ, or only an acknowledgement if OUT is NULL.
+static void reliable_transmit(peer_t* peer, outbound_t* out, uint16_t seq)
+{
+	lownet_reliable_header_t header = {0};
+	lownet_frame_t frame;
+	frame.destination = peer->node;
+	frame.protocol = LOWNET_PROTOCOL_RELIABLE;
+	frame.length = sizeof header;
+	if (out)
+		{
+			header.protocol = out->protocol;
+			header.flags = out->flags | LOWNET_RELIABLE_DATA;
+			header.seq = seq;
+			memcpy(frame.payload + sizeof header, out->data, out->length);
+			frame.length += out->length;
+		}
+	if (peer->synced)
+		{
+			header.flags |= LOWNET_RELIABLE_ACK;
+			header.ack = peer->rcv_nxt;
+			header.sack = reliable_sack(peer);
+			peer->unacked = 0;
+			peer->ack_due = false;
+		}
+	memcpy(frame.payload, &header, sizeof header);
+	lownet_send(&frame);
+}
+
+static void reliable_send_segment(peer_t* peer, uint16_t seq, int64_t now)
+{
+	outbound_t* out = &peer->out[seq % WINDOW];
+	if (out->tries++)
+		peer->stats.retransmitted++;
+	else
+		peer->stats.sent++;
+	out->sent_at = now;
+	reliable_transmit(peer, out, seq);
+	reliable_arm();
+}
+
+static void reliable_rtt(peer_t* peer, int64_t rtt)
+{
+	if (!peer->srtt)
+		{
+			peer->srtt = rtt;
+			peer->rttvar = rtt / 2;
+		}
+	else
+		{
+			int64_t delta = peer->srtt > rtt ? peer->srtt - rtt : rtt - peer->srtt;
+			peer->rttvar += (delta - peer->rttvar) / 4;
+			peer->srtt += (rtt - peer->srtt) / 8;
+		}
+	int64_t rto = peer->srtt + (4 * peer->rttvar > TICK_US ? 4 * peer->rttvar : TICK_US);
+	peer->rto = rto < RTO_MIN_US ? RTO_MIN_US : rto > RTO_MAX_US ? RTO_MAX_US : rto;
+}
+
+static void reliable_acknowledged(peer_t* peer, uint16_t ack, uint32_t sack, int64_t now)
+{
+	uint16_t flight = peer->snd_nxt - peer->snd_una;
+	if ((uint16_t) (ack - peer->snd_una) > flight)
+		return;
+
+	// Karn: only segments sent once time the round trip.  The latest of
+	// them waited least for a delayed acknowledgement.
+	int64_t rtt = -1;
+	for (uint16_t seq = peer->snd_una; seq != peer->snd_nxt; ++seq)
+		{
+			outbound_t* out = &peer->out[seq % WINDOW];
+			uint16_t beyond = seq - ack - 1;
+			bool acked = (uint16_t) (seq - peer->snd_una) < (uint16_t) (ack - peer->snd_una)
+				|| (beyond < 32 && (sack & (1u << beyond)));
+			if (!acked || out->acked)
+				continue;
+			out->acked = true;
+			if (out->tries == 1 && (rtt < 0 || now - out->sent_at < rtt))
+				rtt = now - out->sent_at;
+		}
+	if (rtt >= 0)
+		reliable_rtt(peer, rtt);
+
+	bool progress = ack != peer->snd_una;
+	while (peer->snd_una != ack)
+		{
+			peer->out[peer->snd_una % WINDOW].tries = 0;
+			peer->snd_una++;
+		}
+
+	// A segment is taken for lost once enough segments sent after it have
+	// been acknowledged.
+	for (uint16_t seq = peer->snd_una; seq != peer->snd_nxt; ++seq)
+		{
+			outbound_t* out = &peer->out[seq % WINDOW];
+			if (out->acked)
+				continue;
+			int later = 0;
+			for (uint16_t other = seq + 1; other != peer->snd_nxt; ++other)
+				{
+					const outbound_t* o = &peer->out[other % WINDOW];
+					if (o->acked && o->sent_at > out->sent_at)
+						++later;
+				}
+			if (later >= LOWNET_RELIABLE_DUPTHRESH && out->tries < LOWNET_RELIABLE_TRIES)
+				{
+					peer->stats.fast++;
+					reliable_send_segment(peer, seq, now);
+				}
+		}
+
+	if (progress)
+		reliable_progress(peer);
+}
+
+// The node has no stream from us, having restarted or dropped ours: the
+// oldest segment in flight starts it over, and what the node held beyond
+// it is sent again.
+static void reliable_resync(peer_t* peer, int64_t now)
+{
+	if (peer->snd_una == peer->snd_nxt)
+		{
+			peer->syn = true;
+			return;
+		}
+	outbound_t* first = &peer->out[peer->snd_una % WINDOW];
+	if (first->flags & LOWNET_RELIABLE_SYN)
+		return;
+	first->flags |= LOWNET_RELIABLE_SYN;
+	for (uint16_t seq = peer->snd_una; seq != peer->snd_nxt; ++seq)
+		peer->out[seq % WINDOW].acked = false;
+	if (first->tries < LOWNET_RELIABLE_TRIES)
+		reliable_send_segment(peer, peer->snd_una, now);
+}
+
+// Tells NODE we have no stream from it.
+static void reliable_reset(uint8_t node)
+{
+	lownet_reliable_header_t header = {
+		.flags = LOWNET_RELIABLE_RST,
+	};
+	lownet_frame_t frame;
+	frame.destination = node;
+	frame.protocol = LOWNET_PROTOCOL_RELIABLE;
+	frame.length = sizeof header;
+	memcpy(frame.payload, &header, sizeof header);
+	lownet_send(&frame);
+}
+
+// Pre: the lock is held
+// Post: the segments which can be are handed over, in order, with the
+//       lock released during each handler
+static void reliable_deliver(peer_t* peer)
+{
+	uint8_t data[SEGMENT];
+	uint32_t epoch = peer->epoch;
+	while (peer->node && peer->in[peer->rcv_nxt % WINDOW].have)
+		{
+			inbound_t* in = &peer->in[peer->rcv_nxt % WINDOW];
+			in->have = false;
+			peer->rcv_nxt++;
+			peer->unacked++;
+			peer->stats.delivered++;
+
+			lownet_segment_t segment = {
+				.source = peer->node,
+				.protocol = in->protocol,
+				.length = in->length,
+				.data = data,
+				.end = in->flags & LOWNET_RELIABLE_END,
+			};
+			if (in->protocol == LOWNET_RELIABLE_DISCARD)
+				{
+					peer->stats.discarded += in->length;
+					continue;
+				}
+			lownet_reliable_fn handler = reliable_handler(in->protocol);
+			if (!handler)
+				continue;
+			memcpy(data, in->data, in->length);
+
+			xSemaphoreGive(reliable.lock);
+			handler(&segment);
+			xSemaphoreTake(reliable.lock, portMAX_DELAY);
+			if (peer->epoch != epoch)
+				break;
+		}
+}
+
+static void reliable_receive(const lownet_frame_t* frame, const lownet_rx_info_t* info)
+{
+	lownet_reliable_header_t header;
+	if (frame->length < sizeof header || frame->destination != lownet_get_device_id())
+		return;
+	memcpy(&header, frame->payload, sizeof header);
+	uint8_t length = frame->length - sizeof header;
+	bool data = header.flags & LOWNET_RELIABLE_DATA;
+	bool syn = data && (header.flags & LOWNET_RELIABLE_SYN);
+
+	xSemaphoreTake(reliable.lock, portMAX_DELAY);
+	peer_t* peer = reliable_peer(frame->source, syn);
+	if (!peer)
+		{
+			xSemaphoreGive(reliable.lock);
+			if (data)
+				reliable_reset(frame->source);
+			return;
+		}
+	peer->active = info->timestamp;
+
+	if (header.flags & LOWNET_RELIABLE_RST)
+		reliable_resync(peer, info->timestamp);
+	if (header.flags & LOWNET_RELIABLE_ACK)
+		reliable_acknowledged(peer, header.ack, header.sack, info->timestamp);
+
+	if (!data)
+		{
+			xSemaphoreGive(reliable.lock);
+			return;
+		}
+
+	// A first segment we have not seen starts the stream over, the sender
+	// having restarted or given up on us.
+	if (syn && (!peer->synced || header.seq != peer->rcv_syn))
+		{
+			peer->synced = true;
+			peer->rcv_syn = peer->rcv_nxt = header.seq;
+			peer->unacked = 0;
+			for (int i = 0; i < WINDOW; ++i)
+				peer->in[i].have = false;
+		}
+	if (!peer->synced)
+		{
+			xSemaphoreGive(reliable.lock);
+			reliable_reset(frame->source);
+			return;
+		}
+
+	bool ack_now = false;
+	uint16_t offset = header.seq - peer->rcv_nxt;
+	inbound_t* in = &peer->in[header.seq % WINDOW];
+	if (offset >= WINDOW || in->have)
+		{
+			// Old, or our acknowledgement was lost; beyond the window the
+			// sender has not heard from us for a while.
+			if (offset >= 0x8000 || offset < WINDOW)
+				peer->stats.duplicates++;
+			ack_now = true;
+		}
+	else
+		{
+			in->have = true;
+			in->protocol = header.protocol;
+			in->flags = header.flags;
+			in->length = length;
+			memcpy(in->data, frame->payload + sizeof header, length);
+			if (offset)
+				{
+					peer->stats.out_of_order++;
+					ack_now = true;
+				}
+		}
+
+	reliable_deliver(peer);
+
+	// Gaps are reported at once, so that the sender repeats the missing
+	// segments; segments in order are acknowledged in pairs.
+	if (peer->node == frame->source)
+		{
+			if (ack_now || peer->unacked >= ACK_EVERY)
+				reliable_transmit(peer, NULL, 0);
+			else if (peer->unacked)
+				{
+					peer->ack_due = true;
+					reliable_arm();
+				}
+		}
+	xSemaphoreGive(reliable.lock);
+}
+
+// Retransmits what timed out and sends the delayed acknowledgements.
+// Value: false if nothing is left in flight, and ticks can stop
+static bool reliable_tick(void)
+{
+	bool busy = false;
+	int64_t now = esp_timer_get_time();
+
+	xSemaphoreTake(reliable.lock, portMAX_DELAY);
+	for (int i = 0; i < LOWNET_RELIABLE_PEERS; ++i)
+		{
+			peer_t* peer = reliable.peers[i];
+			if (!peer || !peer->node)
+				continue;
+
+			bool expired = false;
+			for (uint16_t seq = peer->snd_una; seq != peer->snd_nxt; ++seq)
+				{
+					outbound_t* out = &peer->out[seq % WINDOW];
+					if (out->acked || now - out->sent_at < peer->rto)
+						continue;
+					if (out->tries >= LOWNET_RELIABLE_TRIES)
+						{
+							ESP_LOGW(TAG, "Giving up on 0x%02X", peer->node);
+							peer->stats.failures++;
+							reliable_restart(peer);
+							expired = false;
+							break;
+						}
+					expired = true;
+					reliable_send_segment(peer, seq, now);
+				}
+			if (expired)
+				{
+					peer->stats.timeouts++;
+					peer->rto = 2 * peer->rto > RTO_MAX_US ? RTO_MAX_US : 2 * peer->rto;
+				}
+
+			if (peer->ack_due)
+				reliable_transmit(peer, NULL, 0);
+			busy |= peer->snd_una != peer->snd_nxt;
+		}
+	reliable.armed = busy;
+	xSemaphoreGive(reliable.lock);
+	return busy;
+}
+
+// Ticks while anything is in flight or an acknowledgement is due, sleeps
+// until armed otherwise.  A task of its own, as the ticks wait for the
+// lock and for the link.
+static void reliable_main(void*)
+{
+	while (true)
+		{
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			do
+				vTaskDelay(pdMS_TO_TICKS(LOWNET_RELIABLE_TICK_MS));
+			while (reliable_tick());
+		}
+}
+
+void lownet_reliable_init(void)
+{
+	reliable.lock = xSemaphoreCreateMutex();
+	reliable.events = xEventGroupCreate();
+	if (!reliable.lock || !reliable.events
+	    || xTaskCreate(reliable_main,
+	                   "reliable",
+	                   RELIABLE_TASK_STACK,
+	                   NULL,
+	                   RELIABLE_TASK_PRIO,
+	                   &reliable.task) != pdPASS
+	    || lownet_register_protocol_ex(LOWNET_PROTOCOL_RELIABLE, reliable_receive) != 0)
+		{
+			ESP_LOGE(TAG, "Error registering reliable protocol");
+		}
+}
+
+int lownet_reliable_register(uint8_t protocol, lownet_reliable_fn handler)
+{
+	if (protocol == LOWNET_RELIABLE_DISCARD || reliable_handler(protocol)
+	    || reliable.num_handlers >= LOWNET_MAX_PROTOCOLS)
+		return 1;
+	reliable.handlers[reliable.num_handlers].protocol = protocol;
+	reliable.handlers[reliable.num_handlers].handler = handler;
+	++reliable.num_handlers;
+	return 0;
+}
+
+// Pre: the lock is held, and was taken at START
+// Post: the caller has waited for progress on PEER until TIMEOUT ticks
+//       after START at most, with the lock released meanwhile
+// Value: false if the time is up
+static bool reliable_wait(peer_t* peer, TickType_t start, TickType_t timeout)
+{
+	TickType_t elapsed = xTaskGetTickCount() - start;
+	if (elapsed >= timeout)
+		return false;
+	EventBits_t bit = 1u << reliable_index(peer);
+	xEventGroupClearBits(reliable.events, bit);
+	xSemaphoreGive(reliable.lock);
+	xEventGroupWaitBits(reliable.events, bit, pdFALSE, pdFALSE, timeout - elapsed);
+	xSemaphoreTake(reliable.lock, portMAX_DELAY);
+	return true;
+}
+
+size_t lownet_reliable_send(uint8_t node, uint8_t protocol, const void* data, size_t length,
+                            TickType_t timeout)
+{
+	if (node == 0 || node == LOWNET_BROADCAST_ADDRESS)
+		return 0;
+
+	const uint8_t* bytes = data;
+	size_t queued = 0;
+	TickType_t start = xTaskGetTickCount();
+	xSemaphoreTake(reliable.lock, portMAX_DELAY);
+	peer_t* peer = reliable_peer(node, true);
+	uint32_t epoch = peer ? peer->epoch : 0;
+	while (peer && queued < length && peer->node == node && peer->epoch == epoch)
+		{
+			if ((uint16_t) (peer->snd_nxt - peer->snd_una) >= WINDOW)
+				{
+					if (!reliable_wait(peer, start, timeout))
+						break;
+					continue;
+				}
+
+			uint16_t seq = peer->snd_nxt++;
+			outbound_t* out = &peer->out[seq % WINDOW];
+			out->protocol = protocol;
+			out->length = length - queued < SEGMENT ? length - queued : SEGMENT;
+			out->flags = 0;
+			out->tries = 0;
+			out->acked = false;
+			memcpy(out->data, bytes + queued, out->length);
+			queued += out->length;
+			if (peer->syn)
+				{
+					out->flags |= LOWNET_RELIABLE_SYN;
+					peer->syn = false;
+				}
+			if (queued == length)
+				out->flags |= LOWNET_RELIABLE_END;
+
+			int64_t now = esp_timer_get_time();
+			peer->active = now;
+			reliable_send_segment(peer, seq, now);
+		}
+	xSemaphoreGive(reliable.lock);
+	return queued;
+}
+
+int lownet_reliable_flush(uint8_t node, TickType_t timeout)
+{
+	TickType_t start = xTaskGetTickCount();
+	xSemaphoreTake(reliable.lock, portMAX_DELAY);
+	peer_t* peer = reliable_peer(node, false);
+	uint32_t epoch = peer ? peer->epoch : 0;
+	while (peer && peer->node == node && peer->epoch == epoch && peer->snd_una != peer->snd_nxt)
+		if (!reliable_wait(peer, start, timeout))
+			break;
+	int result = peer && (peer->node != node || peer->epoch != epoch || peer->snd_una != peer->snd_nxt);
+	xSemaphoreGive(reliable.lock);
+	return result;
+}
+
+size_t lownet_reliable_peers(lownet_reliable_stats_t* out, size_t max)
+{
+	size_t n = 0;
+	xSemaphoreTake(reliable.lock, portMAX_DELAY);
+	for (int i = 0; i < LOWNET_RELIABLE_PEERS && n < max; ++i)
+		{
+			const peer_t* peer = reliable.peers[i];
+			if (!peer || !peer->node)
+				continue;
+			out[n] = peer->stats;
+			out[n].srtt_us = peer->srtt;
+			out[n].rttvar_us = peer->rttvar;
+			out[n].rto_us = peer->rto;
+			out[n].in_flight = (uint16_t) (peer->snd_nxt - peer->snd_una);
+			++n;
+		}
+	xSemaphoreGive(reliable.lock);
+	return n;
+}
@@ -4,26 +4,48 @@
 #include <stdint.h>
 
 #include "lownet.h"
+#include "lownet_frag.h"
 
 #define LOWNET_PROTOCOL_PING 0x03
 
 void ping_init();
 
-// Usage: ping_command(ID)
-// Pre:   ID is a valid node id.
-// Post:  A ping has been sent to the node identified by ID.
+// Probes in flight at the same time; older unanswered probes count as lost
+#define PING_OUTSTANDING 32
+
+// Time to wait for replies after the last probe, stretched for the
+// measured loss towards the node
+#define PING_LINGER_MS 2000
+
+#define PING_PRIO 5
+
+// Bytes a probe may carry after the ping header; larger probes than fit
+// into a frame are sent in fragments
+#define PING_MAX_PAYLOAD (LOWNET_FRAG_MAX_MESSAGE - sizeof(ping_packet_t))
+
+// Usage: ping_command(ARGS)
+// Pre:   ARGS is "ID [-c COUNT] [-i INTERVAL_MS] [-s SIZE]", ID a valid
+//        node id, SIZE the bytes of the probe after the ping header
+// Post:  COUNT probes (default 1) are being sent to the node identified
+//        by ID, every INTERVAL_MS (default 1000).  Each reply is written
+//        to the serial port with its RTT, and a summary after the last.
 void ping_command(char* args);
 
 // Usage: ping(NODE, PAYLOAD, LENGTH)
 // Pre:   NODE is a node id, PAYLOAD is NULL or a pointer to a buffer of
 //        size LENGTH,
-//        LENGTH <= LOWNET_PAYLOAD_SIZE - sizeof(ping_packet_t)
+//        LENGTH <= PING_MAX_PAYLOAD
 // Post: A ping has been sent to the node identified by NODE
 //       Any data contained in a non-NULL PAYLOAD have been included
 //       in the ping message.
-void ping(uint8_t node, const uint8_t* payload, uint8_t length);
+void ping(uint8_t node, const uint8_t* payload, uint16_t length);
 
-void ping_receive(const lownet_frame_t* frame);
+// Usage: ping_receive(MESSAGE, INFO)
+// Pre:   MESSAGE is a ping message, INFO the reception details of its
+//        last frame
+// Post:  A request has been answered, a reply reported with the RTT up
+//        to the time MESSAGE was complete
+void ping_receive(const lownet_message_t* message, const lownet_rx_info_t* info);
 
 typedef struct __attribute__((__packed__))
 {
@@ -32,4 +54,20 @@ typedef struct __attribute__((__packed__))
 	uint8_t origin;
 } ping_packet_t;
 
+/*
+ * Payload extension of /ping probes, right after ping_packet_t.  Nodes
+ * echo the whole payload, so the RTT is measured on the local esp_timer
+ * and does not depend on network time.
+ */
+#define PING_PROBE_MAGIC 0x5350 // "PS"
+
+typedef struct __attribute__((__packed__))
+{
+	uint16_t magic;
+	uint8_t run;        // tells replies of earlier runs apart
+	uint8_t reserved;
+	uint32_t seq;
+	int64_t sent_us;    // esp_timer time the probe was sent
+} ping_probe_t;
+
 #endif
@@ -0,0 +1,64 @@
+#ifndef GUARD_PKTGEN_H
+#define GUARD_PKTGEN_H
+
+#include <stdint.h>
+
+#include "lownet.h"
+
+/*
+ * Load test protocol.  A sender emits DATA frames of a given size at a
+ * given rate, each carrying a sequence number and the sender's esp_timer
+ * time, followed by END with the number sent.  Every receiver counts
+ * loss, reordering and duplicates, prints its view and returns it to the
+ * sender in a REPORT.
+ *
+ * The two nodes' clocks are not synchronized, so the one-way delay is
+ * reported relative to the fastest frame of the run: it shows queueing
+ * and jitter, not the absolute latency.
+ *
+ *  /pktgen ID [-r RATE] [-s SIZE] [-n COUNT | -t SECONDS]
+ *  /pktgen stop | status
+ *
+ * RATE in frames/s (default 50), SIZE in payload bytes (default 200,
+ * at least sizeof(pktgen_packet_t)), ID may be 0xFF for broadcast.
+ */
+
+#define LOWNET_PROTOCOL_PKTGEN 0x06
+
+#define PKTGEN_DATA   0x01
+#define PKTGEN_END    0x02
+#define PKTGEN_REPORT 0x03
+
+#define PKTGEN_PRIO   5
+
+typedef struct __attribute__((__packed__))
+{
+	uint8_t type;
+	uint8_t run;       // run id, chosen by the sender
+	uint16_t reserved;
+	uint32_t seq;      // DATA: from 0; END: number of DATA frames sent
+	int64_t sent_us;   // sender's esp_timer time
+} pktgen_packet_t;
+
+typedef struct __attribute__((__packed__))
+{
+	pktgen_packet_t header;
+	uint32_t received;
+	uint32_t lost;
+	uint32_t reordered;
+	uint32_t duplicates;
+	uint32_t bytes;       // payload bytes received
+	uint32_t elapsed_us;  // first to last DATA frame
+	uint32_t delay_avg_us;
+	uint32_t delay_max_us;
+} pktgen_report_t;
+
+void pktgen_init();
+
+// Usage: pktgen_command(ARGS)
+// Pre:   ARGS is "ID [options]", "stop" or "status", see above
+// Post:  A run has been started or stopped, or its progress written to
+//        the serial port
+void pktgen_command(char* args);
+
+#endif
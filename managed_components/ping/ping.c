@@ -1,80 +1,327 @@
+#include <math.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
 
 #include "ping.h"
 
 #include <serial_io.h>
 #include <utility.h>
+#include <lownet_neighbor.h>
 #include <lownet_util.h>
 
 #define TAG "PING"
 
+typedef struct
+{
+	bool pending;
+	uint32_t seq;
+	int64_t sent_us;
+} ping_outstanding_t;
+
+// A run of /ping probes and its statistics
+static struct
+{
+	SemaphoreHandle_t lock;
+	TaskHandle_t task;
+
+	uint8_t node;
+	uint8_t run;
+	uint32_t count;
+	uint32_t interval_ms;
+	uint16_t size;
+
+	uint32_t sent;
+	uint32_t received;
+	uint32_t duplicates;
+	uint32_t late;       // replies to probes whose slot was reused, counted lost
+
+	// Probes in flight, by seq % PING_OUTSTANDING
+	ping_outstanding_t outstanding[PING_OUTSTANDING];
+
+	int64_t rtt_min;
+	int64_t rtt_max;
+	double rtt_sum;
+	double rtt_squares;
+} pings;
+
 void ping_init()
 {
-	if (lownet_register_protocol(LOWNET_PROTOCOL_PING, ping_receive) != 0)
+	pings.lock = xSemaphoreCreateMutex();
+	if (!pings.lock || lownet_frag_register(LOWNET_PROTOCOL_PING, ping_receive) != 0)
 		{
 			ESP_LOGE(TAG, "Error registering PING protocol");
 		}
 }
 
+static void ping_usage(void)
+{
+	serial_write_line("Usage: /ping ID [-c COUNT] [-i INTERVAL_MS] [-s SIZE]");
+}
+
+static void ping_summary(void)
+{
+	char buffer[MSG_BUFFER_LENGTH];
+	char id[ID_WIDTH + 1];
+	format_id(id, pings.node);
+
+	snprintf(buffer, sizeof buffer, "--- %s ping statistics ---", id);
+	serial_write_line(buffer);
+
+	uint32_t lost = pings.sent > pings.received ? pings.sent - pings.received : 0;
+	snprintf(buffer, sizeof buffer, "%lu sent, %lu received, %lu duplicate, %lu late, %.1f%% loss",
+	         (unsigned long) pings.sent, (unsigned long) pings.received,
+	         (unsigned long) pings.duplicates, (unsigned long) pings.late,
+	         pings.sent ? 100.0 * lost / pings.sent : 0.0);
+	serial_write_line(buffer);
+
+	if (pings.received)
+		{
+			double avg = pings.rtt_sum / pings.received;
+			double var = pings.rtt_squares / pings.received - avg * avg;
+			snprintf(buffer, sizeof buffer, "rtt min/avg/max/stddev = %.3f/%.3f/%.3f/%.3f ms",
+			         pings.rtt_min / 1e3, avg / 1e3, pings.rtt_max / 1e3,
+			         (var > 0 ? sqrt(var) : 0.0) / 1e3);
+			serial_write_line(buffer);
+		}
+}
+
+// Sends the probes of a run, then waits for stragglers and sums up.
+static void ping_main(void* arg)
+{
+	uint8_t* extension = calloc(1, pings.size);
+	if (!extension)
+		serial_write_line("Not enough memory for probes of that size");
+
+	TickType_t wake = xTaskGetTickCount();
+	for (uint32_t seq = 0; extension && seq < pings.count; ++seq)
+		{
+			if (seq > 0)
+				vTaskDelayUntil(&wake, pdMS_TO_TICKS(pings.interval_ms));
+
+			ping_probe_t probe = {
+				.magic = PING_PROBE_MAGIC,
+				.run = pings.run,
+				.seq = seq,
+			};
+
+			xSemaphoreTake(pings.lock, portMAX_DELAY);
+			probe.sent_us = esp_timer_get_time();
+			pings.outstanding[seq % PING_OUTSTANDING].pending = true;
+			pings.outstanding[seq % PING_OUTSTANDING].seq = seq;
+			pings.outstanding[seq % PING_OUTSTANDING].sent_us = probe.sent_us;
+			pings.sent++;
+			xSemaphoreGive(pings.lock);
+
+			memcpy(extension, &probe, sizeof probe);
+			ping(pings.node, extension, pings.size);
+		}
+
+	// Wait for the replies still out, but no longer than PING_LINGER_MS,
+	// or longer over a lossy link.  Duplicate and late replies answer no
+	// probe still out.
+	uint32_t linger = lownet_neighbor_timeout(pings.node, PING_LINGER_MS);
+	for (uint32_t waited = 0; waited < linger; waited += 10)
+		{
+			if (pings.received >= pings.sent)
+				break;
+			vTaskDelay(pdMS_TO_TICKS(10));
+		}
+
+	free(extension);
+
+	xSemaphoreTake(pings.lock, portMAX_DELAY);
+	ping_summary();
+	pings.task = NULL;
+	xSemaphoreGive(pings.lock);
+	vTaskDelete(NULL);
+}
+
 void ping_command(char* args)
 {
-	if (!args)
+	char* saveptr;
+	char* id = args ? strtok_r(args, " ", &saveptr) : NULL;
+	if (!id)
 		{
 			serial_write_line("A node id must be provided\n");
 			return;
 		}
 
-	uint8_t dest = (uint8_t) hex_to_dec(args + 2);
+	uint8_t dest = (uint8_t) hex_to_dec(id + 2);
 	if (dest == 0)
 		{
 			serial_write_line("Invalid node id\n");
 			return;
 		}
 
-	ping(dest, NULL, 0);
+	uint32_t count = 1;
+	uint32_t interval = 1000;
+	uint32_t size = sizeof(ping_probe_t);
+	char* arg;
+	while ((arg = strtok_r(NULL, " ", &saveptr)))
+		{
+			char* value = strtok_r(NULL, " ", &saveptr);
+			if (!value || arg[0] != '-')
+				{
+					ping_usage();
+					return;
+				}
+			switch (arg[1])
+				{
+				case 'c': count = strtoul(value, NULL, 10); break;
+				case 'i': interval = strtoul(value, NULL, 10); break;
+				case 's': size = strtoul(value, NULL, 10); break;
+				default:
+					ping_usage();
+					return;
+				}
+		}
+	if (count == 0 || interval < 10 || size < sizeof(ping_probe_t) || size > PING_MAX_PAYLOAD)
+		{
+			char buffer[MSG_BUFFER_LENGTH];
+			snprintf(buffer, sizeof buffer,
+			         "COUNT must be positive, INTERVAL at least 10 and SIZE between %u and %u",
+			         (unsigned) sizeof(ping_probe_t), (unsigned) PING_MAX_PAYLOAD);
+			serial_write_line(buffer);
+			return;
+		}
+
+	xSemaphoreTake(pings.lock, portMAX_DELAY);
+	if (pings.task)
+		{
+			xSemaphoreGive(pings.lock);
+			serial_write_line("A ping run is already in progress");
+			return;
+		}
+
+	pings.node = dest;
+	pings.run++;
+	pings.count = count;
+	pings.interval_ms = interval;
+	pings.size = size;
+	pings.sent = 0;
+	pings.received = 0;
+	pings.duplicates = 0;
+	pings.late = 0;
+	pings.rtt_min = INT64_MAX;
+	pings.rtt_max = 0;
+	pings.rtt_sum = 0;
+	pings.rtt_squares = 0;
+	memset(pings.outstanding, 0, sizeof pings.outstanding);
+
+	if (xTaskCreate(ping_main, "ping", 3072, NULL, PING_PRIO, &pings.task) != pdPASS)
+		{
+			pings.task = NULL;
+			serial_write_line("Could not start ping");
+		}
+	xSemaphoreGive(pings.lock);
 }
 
-void ping(uint8_t node, const uint8_t* payload, uint8_t length)
+void ping(uint8_t node, const uint8_t* payload, uint16_t length)
 {
-	lownet_frame_t frame;
-	frame.source = lownet_get_device_id();
-	frame.destination = node;
-	frame.protocol = LOWNET_PROTOCOL_PING;
-	frame.length = sizeof(ping_packet_t);
+	if (!payload)
+		length = 0;
+	if (length > PING_MAX_PAYLOAD)
+		length = PING_MAX_PAYLOAD;
+
+	// Probes which take more than a frame go out in fragments.
+	uint8_t small[LOWNET_PAYLOAD_SIZE];
+	size_t total = sizeof(ping_packet_t) + length;
+	uint8_t* message = total <= sizeof small ? small : malloc(total);
+	if (!message)
+		return;
 
 	ping_packet_t packet;
+	memset(&packet, 0, sizeof packet);
 	packet.timestamp_out = lownet_get_time();
 	packet.origin = lownet_get_device_id();
 
-	memcpy(&frame.payload, &packet, sizeof packet);
+	memcpy(message, &packet, sizeof packet);
+	if (length)
+		memcpy(message + sizeof packet, payload, length);
+
+	lownet_frag_send(node, LOWNET_PROTOCOL_PING, message, total);
+	if (message != small)
+		free(message);
+}
 
+// Matches a reply carrying a probe extension against the outstanding
+// probes.  Value: false if the reply does not belong to the current run.
+static bool ping_reply(const lownet_message_t* message, const ping_probe_t* probe, int64_t now)
+{
+	char buffer[MSG_BUFFER_LENGTH];
+	char id[ID_WIDTH + 1];
+	format_id(id, message->source);
 
-	if (payload)
+	xSemaphoreTake(pings.lock, portMAX_DELAY);
+	if (probe->run != pings.run)
 		{
-			memcpy(frame.payload + frame.length,
-						 payload,
-						 min(LOWNET_PAYLOAD_SIZE - sizeof(ping_packet_t), length));
-			frame.length += min(LOWNET_PAYLOAD_SIZE - sizeof(ping_packet_t), length);
+			xSemaphoreGive(pings.lock);
+			return false;
 		}
 
-	lownet_send(&frame);
+	// A slot holds a later probe once the sequence numbers have come
+	// round; a reply to the earlier one is late, and its probe was lost.
+	ping_outstanding_t* slot = &pings.outstanding[probe->seq % PING_OUTSTANDING];
+	if (!slot->pending || slot->seq != probe->seq)
+		{
+			bool late = slot->seq != probe->seq;
+			if (late)
+				pings.late++;
+			else
+				pings.duplicates++;
+			xSemaphoreGive(pings.lock);
+			snprintf(buffer, sizeof buffer, "Reply from %s: seq=%lu %s",
+			         id, (unsigned long) probe->seq, late ? "late" : "duplicate");
+			serial_write_line(buffer);
+			return true;
+		}
+
+	int64_t rtt = now - slot->sent_us;
+	slot->pending = false;
+	pings.received++;
+	if (rtt < pings.rtt_min)
+		pings.rtt_min = rtt;
+	if (rtt > pings.rtt_max)
+		pings.rtt_max = rtt;
+	pings.rtt_sum += rtt;
+	pings.rtt_squares += (double) rtt * rtt;
+	xSemaphoreGive(pings.lock);
+
+	snprintf(buffer, sizeof buffer, "Reply from %s: seq=%lu size=%u time=%.3f ms",
+	         id, (unsigned long) probe->seq, message->length, rtt / 1e3);
+	serial_write_line(buffer);
+	return true;
 }
 
-void ping_receive(const lownet_frame_t* frame)
+void ping_receive(const lownet_message_t* message, const lownet_rx_info_t* info)
 {
-	if (frame->length < sizeof(ping_packet_t))
-		// Malformed frame.  Discard.
+	if (message->length < sizeof(ping_packet_t))
+		// Malformed message.  Discard.
 		return;
 
 	ping_packet_t packet;
-	memcpy(&packet, &frame->payload, sizeof packet);
+	memcpy(&packet, message->data, sizeof packet);
 
 	if (packet.origin == lownet_get_device_id())
 		{
+			ping_probe_t probe;
+			if (message->length >= sizeof packet + sizeof probe)
+				{
+					memcpy(&probe, message->data + sizeof packet, sizeof probe);
+					if (probe.magic == PING_PROBE_MAGIC && ping_reply(message, &probe, info->timestamp))
+						return;
+				}
+
 			lownet_time_t now = lownet_get_time();
 			lownet_time_t rtt = time_diff(&packet.timestamp_out, &now);
 
@@ -82,24 +329,16 @@ void ping_receive(const lownet_frame_t* frame)
 			char buffer[12 + ID_WIDTH + 6 + TIME_WIDTH + 1];
 			int n = 0;
 			n += sprintf(buffer + n, "Reply from: ");
-			n += format_id(buffer + n, frame->source);
+			n += format_id(buffer + n, message->source);
 			n += sprintf(buffer + n, " RTT: ");
 			n += format_time(buffer + n, &rtt);
 			serial_write_line(buffer);
 		}
 	else
 		{
+			// Echo the whole message, fragmented as it came.
 			packet.timestamp_back = lownet_get_time();
-
-			lownet_frame_t reply;
-			reply.source = lownet_get_device_id();
-			reply.destination = frame->source;
-			reply.protocol = LOWNET_PROTOCOL_PING;
-			reply.length = frame->length;
-
-			memcpy(&reply.payload, &frame->payload, frame->length);
-			memcpy(&reply.payload, &packet, sizeof packet);
-
-			lownet_send(&reply);
+			memcpy(message->data, &packet, sizeof packet);
+			lownet_frag_send(message->source, LOWNET_PROTOCOL_PING, message->data, message->length);
 		}
 }
@@ -0,0 +1,406 @@
+#include "pktgen.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <lownet_util.h>
+#include <serial_io.h>
+#include <utility.h>
+
+#define TAG "pktgen"
+
+#define PKTGEN_RECEIVERS 4
+#define PKTGEN_WINDOW    256 // sequence numbers tracked for duplicates
+#define PKTGEN_ENDS      3   // END is repeated, it may be lost too
+
+// Receive side of one run, per sender
+typedef struct
+{
+	uint8_t source;     // 0 if the slot is free
+	uint8_t run;
+	bool done;
+
+	uint32_t received;
+	uint32_t reordered;
+	uint32_t duplicates;
+	uint32_t bytes;
+	uint32_t highest;   // highest sequence number seen + 1
+	uint8_t seen[PKTGEN_WINDOW / 8]; // bit per seq below highest
+
+	int64_t first_us;
+	int64_t last_us;
+
+	// One-way delay relative to the fastest frame: offsets are the
+	// local time minus the sender's time; the minimum is the baseline.
+	int64_t offset_min;
+	int64_t offset_sum;
+	int64_t offset_max;
+} pktgen_rx_t;
+
+static struct
+{
+	SemaphoreHandle_t lock;
+
+	// Send side
+	TaskHandle_t task;
+	volatile bool stop;
+	uint8_t destination;
+	uint8_t run;
+	uint32_t rate;
+	uint8_t size;
+	uint32_t count;
+	uint32_t sent;
+	int64_t start_us;
+	uint8_t reported[256 / 8]; // receivers whose REPORT has been printed
+
+	pktgen_rx_t rx[PKTGEN_RECEIVERS];
+} pktgen;
+
+static void pktgen_receive(const lownet_frame_t* frame, const lownet_rx_info_t* info);
+
+void pktgen_init()
+{
+	pktgen.lock = xSemaphoreCreateMutex();
+	if (!pktgen.lock || lownet_register_protocol_ex(LOWNET_PROTOCOL_PKTGEN, pktgen_receive) != 0)
+		ESP_LOGE(TAG, "Error registering PKTGEN protocol");
+}
+
+// Pre: PAYLOAD starts with a pktgen_packet_t
+static void pktgen_send(uint8_t destination, const void* payload, uint8_t length)
+{
+	lownet_frame_t frame;
+	frame.source = lownet_get_device_id();
+	frame.destination = destination;
+	frame.protocol = LOWNET_PROTOCOL_PKTGEN;
+	frame.length = length;
+	memcpy(frame.payload, payload, length);
+	lownet_send(&frame);
+}
+
+// Writes frames/s and bytes/s of N frames of SIZE bytes over US.
+static void pktgen_print_rate(const char* what, uint32_t n, uint32_t bytes, int64_t us)
+{
+	char buffer[MSG_BUFFER_LENGTH];
+	double seconds = us > 0 ? us / 1e6 : 0;
+	snprintf(buffer, sizeof buffer, "%s: %lu frames in %.3f s, %.1f frames/s, %.0f bytes/s (key %s)",
+	         what, (unsigned long) n, seconds,
+	         seconds > 0 ? n / seconds : 0.0, seconds > 0 ? bytes / seconds : 0.0,
+	         lownet_get_key() ? "on" : "off");
+	serial_write_line(buffer);
+}
+
+static void pktgen_main(void* arg)
+{
+	pktgen_packet_t header = {
+		.type = PKTGEN_DATA,
+		.run = pktgen.run,
+	};
+	uint8_t body[LOWNET_PAYLOAD_SIZE];
+	for (size_t i = 0; i < sizeof body; ++i)
+		body[i] = (uint8_t) i;
+
+	// Pace on the average: each wake-up sends what is due by now, so rates
+	// above the tick rate go out in small bursts.
+	pktgen.start_us = esp_timer_get_time();
+	while (!pktgen.stop && (!pktgen.count || pktgen.sent < pktgen.count))
+		{
+			int64_t now = esp_timer_get_time();
+			uint64_t due = (uint64_t)(now - pktgen.start_us) * pktgen.rate / 1000000 + 1;
+			if (pktgen.count && due > pktgen.count)
+				due = pktgen.count;
+
+			while (pktgen.sent < due && !pktgen.stop)
+				{
+					header.seq = pktgen.sent;
+					header.sent_us = esp_timer_get_time();
+					memcpy(body, &header, sizeof header);
+					pktgen_send(pktgen.destination, body, pktgen.size);
+					pktgen.sent++;
+				}
+			vTaskDelay(1);
+		}
+	int64_t elapsed = esp_timer_get_time() - pktgen.start_us;
+
+	header.type = PKTGEN_END;
+	header.seq = pktgen.sent;
+	for (int i = 0; i < PKTGEN_ENDS; ++i)
+		{
+			header.sent_us = esp_timer_get_time();
+			pktgen_send(pktgen.destination, &header, sizeof header);
+			vTaskDelay(pdMS_TO_TICKS(50));
+		}
+
+	pktgen_print_rate("Sent", pktgen.sent, pktgen.sent * pktgen.size, elapsed);
+
+	pktgen.task = NULL;
+	vTaskDelete(NULL);
+}
+
+static void pktgen_usage(void)
+{
+	serial_write_line("Usage: /pktgen ID [-r RATE] [-s SIZE] [-n COUNT | -t SECONDS] | stop | status");
+}
+
+void pktgen_command(char* args)
+{
+	char* saveptr;
+	char* arg = args ? strtok_r(args, " ", &saveptr) : NULL;
+	if (!arg)
+		{
+			pktgen_usage();
+			return;
+		}
+
+	if (!strcmp(arg, "stop"))
+		{
+			pktgen.stop = true;
+			return;
+		}
+	if (!strcmp(arg, "status"))
+		{
+			if (!pktgen.task)
+				serial_write_line("No run in progress");
+			else
+				pktgen_print_rate("Sending", pktgen.sent, pktgen.sent * pktgen.size,
+				                  esp_timer_get_time() - pktgen.start_us);
+			return;
+		}
+
+	if (pktgen.task)
+		{
+			serial_write_line("A run is already in progress, /pktgen stop first");
+			return;
+		}
+
+	uint8_t destination = hex_to_dec(arg + 2);
+	if (destination == 0 || destination == lownet_get_device_id())
+		{
+			serial_write_line("Invalid node id");
+			return;
+		}
+
+	uint32_t rate = 50;
+	uint32_t size = LOWNET_PAYLOAD_SIZE;
+	uint32_t count = 0;
+	uint32_t seconds = 10;
+	while ((arg = strtok_r(NULL, " ", &saveptr)))
+		{
+			char* value = strtok_r(NULL, " ", &saveptr);
+			if (!value || arg[0] != '-')
+				{
+					pktgen_usage();
+					return;
+				}
+			switch (arg[1])
+				{
+				case 'r': rate = strtoul(value, NULL, 10); break;
+				case 's': size = strtoul(value, NULL, 10); break;
+				case 'n': count = strtoul(value, NULL, 10); break;
+				case 't': seconds = strtoul(value, NULL, 10); break;
+				default:
+					pktgen_usage();
+					return;
+				}
+		}
+	if (rate == 0 || size < sizeof(pktgen_packet_t) || size > LOWNET_PAYLOAD_SIZE)
+		{
+			serial_write_line("RATE must be positive and SIZE between 16 and 200");
+			return;
+		}
+
+	pktgen.destination = destination;
+	pktgen.rate = rate;
+	pktgen.size = size;
+	pktgen.count = count ? count : rate * seconds;
+	pktgen.sent = 0;
+	pktgen.stop = false;
+	pktgen.run = (uint8_t) esp_random();
+	memset(pktgen.reported, 0, sizeof pktgen.reported);
+
+	if (xTaskCreate(pktgen_main, "pktgen", 3072, NULL, PKTGEN_PRIO, &pktgen.task) != pdPASS)
+		{
+			pktgen.task = NULL;
+			serial_write_line("Could not start the sender");
+		}
+}
+
+// Writes REPORT, prefixed with WHAT and the id of NODE.
+static void pktgen_print_report(const char* what, uint8_t node, const pktgen_report_t* report)
+{
+	char buffer[MSG_BUFFER_LENGTH];
+	char id[32];
+	int n = snprintf(id, sizeof id, "%s ", what);
+	format_id(id + n, node);
+
+	uint32_t total = report->received + report->lost;
+	snprintf(buffer, sizeof buffer,
+	         "%s: %lu received, %lu lost (%.1f%%), %lu reordered, %lu duplicate",
+	         id, (unsigned long) report->received, (unsigned long) report->lost,
+	         total ? 100.0 * report->lost / total : 0.0,
+	         (unsigned long) report->reordered, (unsigned long) report->duplicates);
+	serial_write_line(buffer);
+
+	snprintf(buffer, sizeof buffer, "%s: one-way delay above minimum avg %lu us, max %lu us",
+	         id, (unsigned long) report->delay_avg_us, (unsigned long) report->delay_max_us);
+	serial_write_line(buffer);
+
+	pktgen_print_rate(id, report->received, report->bytes, report->elapsed_us);
+}
+
+// Value: The receive state of run RUN from SOURCE.  With CREATE a new
+//        run replaces an older one from the same sender, or takes a free
+//        or finished slot; NULL if there is none.
+static pktgen_rx_t* pktgen_rx_find(uint8_t source, uint8_t run, bool create)
+{
+	pktgen_rx_t* slot = NULL;
+	for (int i = 0; i < PKTGEN_RECEIVERS && !slot; ++i)
+		if (pktgen.rx[i].source == source)
+			{
+				if (pktgen.rx[i].run == run)
+					return &pktgen.rx[i];
+				slot = &pktgen.rx[i];
+			}
+	for (int i = 0; i < PKTGEN_RECEIVERS && !slot; ++i)
+		if (!pktgen.rx[i].source || pktgen.rx[i].done)
+			slot = &pktgen.rx[i];
+
+	if (!create || !slot)
+		return NULL;
+
+	memset(slot, 0, sizeof *slot);
+	slot->source = source;
+	slot->run = run;
+	return slot;
+}
+
+static void pktgen_rx_data(pktgen_rx_t* rx, const pktgen_packet_t* packet, uint8_t length, int64_t now)
+{
+	uint32_t seq = packet->seq;
+	if (seq + PKTGEN_WINDOW <= rx->highest)
+		{
+			// Too old to tell apart from a duplicate; count it as reordered.
+			rx->reordered++;
+		}
+	else if (seq < rx->highest)
+		{
+			uint8_t* byte = &rx->seen[(seq % PKTGEN_WINDOW) / 8];
+			uint8_t bit = 1 << (seq % 8);
+			if (*byte & bit)
+				{
+					rx->duplicates++;
+					return;
+				}
+			*byte |= bit;
+			rx->reordered++;
+		}
+	else
+		{
+			// Forget the sequence numbers that slide out of the window.
+			for (uint32_t s = rx->highest; s <= seq && s < rx->highest + PKTGEN_WINDOW; ++s)
+				rx->seen[(s % PKTGEN_WINDOW) / 8] &= ~(1 << (s % 8));
+			rx->seen[(seq % PKTGEN_WINDOW) / 8] |= 1 << (seq % 8);
+			rx->highest = seq + 1;
+		}
+
+	int64_t offset = now - packet->sent_us;
+	if (rx->received == 0)
+		{
+			rx->first_us = now;
+			rx->offset_min = offset;
+			rx->offset_max = offset;
+		}
+	if (offset < rx->offset_min)
+		rx->offset_min = offset;
+	if (offset > rx->offset_max)
+		rx->offset_max = offset;
+	rx->offset_sum += offset;
+
+	rx->received++;
+	rx->bytes += length;
+	rx->last_us = now;
+}
+
+static void pktgen_rx_end(pktgen_rx_t* rx, const pktgen_packet_t* packet)
+{
+	pktgen_report_t report;
+	memset(&report, 0, sizeof report);
+	report.header.type = PKTGEN_REPORT;
+	report.header.run = rx->run;
+	report.header.sent_us = esp_timer_get_time();
+
+	report.received = rx->received;
+	report.lost = packet->seq > rx->received ? packet->seq - rx->received : 0;
+	report.reordered = rx->reordered;
+	report.duplicates = rx->duplicates;
+	report.bytes = rx->bytes;
+	report.elapsed_us = rx->last_us - rx->first_us;
+	if (rx->received)
+		{
+			report.delay_avg_us = rx->offset_sum / rx->received - rx->offset_min;
+			report.delay_max_us = rx->offset_max - rx->offset_min;
+		}
+
+	if (!rx->done)
+		{
+			rx->done = true;
+			pktgen_print_report("From", rx->source, &report);
+		}
+	// Answer every END, the sender may have missed an earlier REPORT.
+	pktgen_send(rx->source, &report, sizeof report);
+}
+
+static void pktgen_receive(const lownet_frame_t* frame, const lownet_rx_info_t* info)
+{
+	if (frame->length < sizeof(pktgen_packet_t))
+		return;
+
+	int64_t now = info->timestamp;
+	pktgen_packet_t packet;
+	memcpy(&packet, frame->payload, sizeof packet);
+
+	xSemaphoreTake(pktgen.lock, portMAX_DELAY);
+	switch (packet.type)
+		{
+		case PKTGEN_DATA:
+			{
+				pktgen_rx_t* rx = pktgen_rx_find(frame->source, packet.run, true);
+				if (rx && !rx->done)
+					pktgen_rx_data(rx, &packet, frame->length, now);
+				break;
+			}
+
+		case PKTGEN_END:
+			{
+				pktgen_rx_t* rx = pktgen_rx_find(frame->source, packet.run, true);
+				if (rx)
+					pktgen_rx_end(rx, &packet);
+				break;
+			}
+
+		case PKTGEN_REPORT:
+			{
+				// One report per receiver and run is enough.
+				uint8_t* byte = &pktgen.reported[frame->source / 8];
+				uint8_t bit = 1 << (frame->source % 8);
+				if (frame->length < sizeof(pktgen_report_t) || packet.run != pktgen.run
+				    || (*byte & bit))
+					break;
+				*byte |= bit;
+
+				pktgen_report_t report;
+				memcpy(&report, frame->payload, sizeof report);
+				pktgen_print_report("Report of", frame->source, &report);
+				break;
+			}
+		}
+	xSemaphoreGive(pktgen.lock);
+}
@@ -1,6 +1,11 @@
 #ifndef SERIAL_IO_H
 #define SERIAL_IO_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <freertos/FreeRTOS.h>
+
 #define MSG_BUFFER_LENGTH 128
 
 #define SERIAL_SERVICE_CORE 0
@@ -9,6 +14,46 @@
 void serial_write_line(const char* string);
 int serial_read_line(char* buffer);
 
+// Like serial_write_line, but waits up to TIMEOUT ticks for room in the
+// output buffer instead of dropping the line.  Returns 0 if the line was
+// queued, -1 if it was dropped.
+int serial_write_line_timeout(const char* string, TickType_t timeout);
+
+// Number of output bytes dropped because the output buffer was full.
+uint32_t serial_dropped_bytes(void);
+
+/*
+  Binary mode.  The link carries SLIP (RFC 1055) framed messages instead
+  of text lines; every frame starts with a type byte.  Type
+  SERIAL_FRAME_TEXT carries what would have been a text line, including
+  ESP_LOG output; the other types belong to the owner of the mode.
+ */
+
+#define SERIAL_FRAME_TEXT 0x00
+#define SERIAL_FRAME_MAX  256 // type byte and body, unescaped
+
+typedef void (*serial_frame_fn)(uint8_t type, const uint8_t* body, size_t length);
+
+// Usage: serial_set_binary(HANDLER)
+// Post:  Input frames go to HANDLER, called from the serial RX task.
+//        HANDLER == NULL returns the link to text mode.
+void serial_set_binary(serial_frame_fn handler);
+
+// Usage: serial_write_frame(TYPE, BODY, LENGTH, TIMEOUT)
+// Pre:   BODY points to LENGTH bytes
+// Value: 0 if the frame was queued whole within TIMEOUT ticks, -1 if it
+//        was dropped
+int serial_write_frame(uint8_t type, const void* body, size_t length, TickType_t timeout);
+
+// Usage: serial_set_baudrate(BAUD)
+// Post:  Pending output has been sent and the link runs at BAUD
+// Value: 0 on success, -1 otherwise; the speed is left as it was if
+//        pending output did not go out within a second
+int serial_set_baudrate(uint32_t baudrate);
+
+// Number of input frames discarded for bad framing.
+uint32_t serial_bad_frames(void);
+
 
 // Serial rebuild, to Task-based design.
 void init_serial_service();
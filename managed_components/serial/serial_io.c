@@ -1,4 +1,5 @@
 // CSTDLIB includes.
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -9,7 +10,10 @@
 #include <freertos/semphr.h>
 #include <freertos/task.h>
 
+#include <driver/uart.h>
+#include <driver/uart_vfs.h>
 #include <esp_log.h>
+#include <sdkconfig.h>
 
 // Custom includes.
 #include "serial_io.h"
@@ -18,38 +22,106 @@
 
 
 // Constants and definitions.
-const TickType_t  service_delay = 50 / portTICK_PERIOD_MS;
-const TickType_t  timeout_read = 5000 / portTICK_PERIOD_MS;
 const char* PROMPT_TOKEN = "> ";
 const char* MESSAGE_SYNC = "SYNC // FIRMWARE READY";
 
+#define SERIAL_UART          CONFIG_ESP_CONSOLE_UART_NUM
+#define SERIAL_RX_BUFFER     1024
+#define SERIAL_EVENT_DEPTH   16
+#define SERIAL_TX_RING       4096  // power of two
+#define SERIAL_DRAIN_MS      1000  // wait for pending output before a speed change
+
+// Set by the TX task whenever it has freed space in the output ring.
+#define SERIAL_TX_SPACE      (1 << 0)
+
+// SLIP (RFC 1055) framing of binary mode.
+#define SLIP_END             0xC0
+#define SLIP_ESC             0xDB
+#define SLIP_ESC_END         0xDC
+#define SLIP_ESC_ESC         0xDD
+
 // Internal data structures
 
-void svc_serial(void* pvTaskParams);
+void svc_serial_rx(void* pvTaskParams);
+void svc_serial_tx(void* pvTaskParams);
 
 struct {
-	QueueHandle_t   queue_write;
 	QueueHandle_t   queue_read;
-	TaskHandle_t  service;
+	QueueHandle_t   queue_uart;
+	TaskHandle_t  service_rx;
+	TaskHandle_t  service_tx;
+
+	// Output byte ring; head and tail run freely and are masked on access.
+	// Writers append whole lines under the lock, the TX task drains it.
+	SemaphoreHandle_t  write_lock;
+	EventGroupHandle_t write_events;
+	uint8_t   ring[SERIAL_TX_RING];
+	uint32_t  head;
+	uint32_t  tail;
+	uint32_t  dropped;
+
+	// Binary mode: set while the link carries SLIP frames instead of lines.
+	serial_frame_fn frame_handler;
+	vprintf_like_t  text_vprintf;
+	uint32_t  frames_bad;
 } serial_system;
 
+// Input state of the RX task, one per mode.
+typedef struct {
+	char msg[MSG_BUFFER_LENGTH];
+	int at;
+	char last;
+} serial_rx_text_t;
+
+typedef struct {
+	uint8_t buf[SERIAL_FRAME_MAX];
+	size_t at;
+	int escape;
+	int bad;
+} serial_rx_frame_t;
+
 void init_serial_service() {
 	memset(&serial_system, 0, sizeof(serial_system));
 
-	serial_system.queue_write = xQueueCreate(16, MSG_BUFFER_LENGTH);
 	serial_system.queue_read = xQueueCreate(4, MSG_BUFFER_LENGTH);
-	if (!serial_system.queue_write || !serial_system.queue_read) {
+	serial_system.write_lock = xSemaphoreCreateMutex();
+	serial_system.write_events = xEventGroupCreate();
+	if (!serial_system.queue_read || !serial_system.write_lock || !serial_system.write_events) {
 		ESP_LOGE(TAG, "Failed to create serial message queues");
 		return;
 	}
 
+	// The driver raises an event per RX interrupt (FIFO threshold or
+	// line idle), so the RX task sleeps until there actually is input.
+	// No driver TX buffer: the output ring is the buffer, and while
+	// uart_write_bytes drains one chunk into the FIFO the next one builds
+	// up behind it.
+	esp_err_t err = uart_driver_install(SERIAL_UART, SERIAL_RX_BUFFER, 0,
+		SERIAL_EVENT_DEPTH, &serial_system.queue_uart, 0);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "Failed to install the UART driver: %s", esp_err_to_name(err));
+		return;
+	}
+	// Route stdio (ESP_LOG) through the driver as well, so log output and
+	// serial lines do not fight over the TX FIFO.
+	uart_vfs_dev_use_driver(SERIAL_UART);
+
+	xTaskCreatePinnedToCore(
+		svc_serial_rx,
+		"serial_io_rx",
+		4096,
+		NULL,
+		SERIAL_SERVICE_PRIO,
+		&serial_system.service_rx,
+		SERIAL_SERVICE_CORE
+	);
 	xTaskCreatePinnedToCore(
-		svc_serial,
-		"serial_io_service",
+		svc_serial_tx,
+		"serial_io_tx",
 		4096,
 		NULL,
 		SERIAL_SERVICE_PRIO,
-		&serial_system.service,
+		&serial_system.service_tx,
 		SERIAL_SERVICE_CORE
 	);
 
@@ -57,105 +129,355 @@ void init_serial_service() {
 }
 
 
-void svc_serial(void* pvTaskParams) {
-	char in_msg[MSG_BUFFER_LENGTH];
-	char out_msg[MSG_BUFFER_LENGTH];
+// Adds NEXT to the input line.  Lines end with '\r' or '\n'; the '\n' of
+// a "\r\n" pair does not make an empty line.
+static void serial_rx_text(serial_rx_text_t* rx, char next) {
+	int skip = (next == '\n' && rx->last == '\r');
+	rx->last = next;
+	if (skip) {
+		return;
+	}
+
+	if (next == '\r' || next == '\n') {
+		// Terminating newline character found.
+		rx->msg[rx->at < MSG_BUFFER_LENGTH ? rx->at : MSG_BUFFER_LENGTH - 1] = '\0';
+		xQueueSend(serial_system.queue_read, rx->msg, 0);
+		memset(rx->msg, 0, MSG_BUFFER_LENGTH);
+		rx->at = 0;
+	} else if (rx->at < (MSG_BUFFER_LENGTH - 1)) {
+		rx->msg[rx->at++] = next;
+	} else {
+		// We've overrun the internal buffer.  Additional characters
+		// read until a newline is encountered are dumped.
+		rx->at++;
+	}
+}
+
+// Adds NEXT to the input frame and hands complete frames to HANDLER.
+// Oversized frames and bad escapes spoil the frame up to the next END.
+static void serial_rx_frame(serial_rx_frame_t* rx, uint8_t next, serial_frame_fn handler) {
+	if (next == SLIP_END) {
+		if (rx->bad) {
+			serial_system.frames_bad++;
+		} else if (rx->at > 0) {
+			handler(rx->buf[0], rx->buf + 1, rx->at - 1);
+		}
+		rx->at = 0;
+		rx->escape = 0;
+		rx->bad = 0;
+		return;
+	}
+
+	if (rx->escape) {
+		rx->escape = 0;
+		if (next == SLIP_ESC_END) {
+			next = SLIP_END;
+		} else if (next == SLIP_ESC_ESC) {
+			next = SLIP_ESC;
+		} else {
+			rx->bad = 1;
+		}
+	} else if (next == SLIP_ESC) {
+		rx->escape = 1;
+		return;
+	}
 
-	memset(in_msg, 0, MSG_BUFFER_LENGTH);
-	memset(out_msg, 0, MSG_BUFFER_LENGTH);
+	if (rx->at < SERIAL_FRAME_MAX) {
+		rx->buf[rx->at++] = next;
+	} else {
+		rx->bad = 1;
+	}
+}
 
-	int done = 0;
-	int at = 0;
+// Blocks on the UART event queue and assembles input lines, or frames in
+// binary mode.
+void svc_serial_rx(void* pvTaskParams) {
+	static serial_rx_text_t text;
+	static serial_rx_frame_t frame;
+	uint8_t chunk[64];
+	uart_event_t event;
+	serial_frame_fn handler = NULL;
 
 	while (1) {
-		while (xQueueReceive(serial_system.queue_write, out_msg, 0) == pdTRUE) {
-			// We can only write up to LEN - 2 characters; penultimate char would
-			// be newline character '\n' and ultimate char is null terminator '\0'.
-			char msg_buffer[MSG_BUFFER_LENGTH];
-
-			int end = strlen(out_msg);
-			if (end > MSG_BUFFER_LENGTH - 2) {
-				end = MSG_BUFFER_LENGTH - 2;
-			}
-			strncpy(msg_buffer, out_msg, end);
-
-			// Add a newline and null terminator to the input.
-			if (strncmp(msg_buffer, PROMPT_TOKEN, 2)) {
-				msg_buffer[end] = '\n';
-				msg_buffer[end+1] = '\0';
-			} else {
-				msg_buffer[end] = '\0';
-			}
+		if (xQueueReceive(serial_system.queue_uart, &event, portMAX_DELAY) != pdTRUE) {
+			continue;
+		}
+
+		// A mode switch starts both parsers afresh.
+		if (handler != serial_system.frame_handler) {
+			handler = serial_system.frame_handler;
+			memset(&text, 0, sizeof(text));
+			memset(&frame, 0, sizeof(frame));
+		}
 
-			// Write the contents of the internal buffer to standard out (serial output
-			// in this case).
-			printf(msg_buffer);
-			fflush(stdout);
+		switch (event.type) {
+		case UART_DATA: {
+			size_t remaining = event.size;
+			while (remaining > 0) {
+				size_t want = remaining < sizeof(chunk) ? remaining : sizeof(chunk);
+				int got = uart_read_bytes(SERIAL_UART, chunk, want, 0);
+				if (got <= 0) {
+					break;
+				}
+				remaining -= got;
+
+				for (int i = 0; i < got; ++i) {
+					if (handler) {
+						serial_rx_frame(&frame, chunk[i], handler);
+					} else {
+						serial_rx_text(&text, (char)chunk[i]);
+					}
+				}
+			}
+			break;
+		}
 
-			memset(out_msg, 0, MSG_BUFFER_LENGTH);
+		case UART_FIFO_OVF:
+		case UART_BUFFER_FULL:
+			// Input was lost, so whatever line was being assembled is garbage.
+			ESP_LOGW(TAG, "UART input overflow, discarding input");
+			uart_flush_input(SERIAL_UART);
+			xQueueReset(serial_system.queue_uart);
+			memset(&text, 0, sizeof(text));
+			frame.bad = frame.at > 0;
+			break;
+
+		default:
+			break;
 		}
+	}
+}
 
-		if (!done) {
-			// Grab the next char from the serial input stream.
-			int next = fgetc(stdin);
+// Sleeps until there is output, then hands the ring to the driver in as
+// few uart_write_bytes calls as possible: everything pending, split only
+// where the ring wraps.
+void svc_serial_tx(void* pvTaskParams) {
+	while (1) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
-			// If the result is EOF, then there was nothing there (yet).  In this
-			// circumstance, sleep a while before checking again.
-			if (next == EOF) {
-				vTaskDelay(service_delay);
-				continue;
+		while (1) {
+			xSemaphoreTake(serial_system.write_lock, portMAX_DELAY);
+			uint32_t tail = serial_system.tail;
+			uint32_t pending = serial_system.head - tail;
+			xSemaphoreGive(serial_system.write_lock);
+
+			if (pending == 0) {
+				break;
 			}
 
-			if ((char)next == '\n') {
-				// Terminating newline character found.
-				done = 1;
-			} else if (at < (MSG_BUFFER_LENGTH - 1)) {
-				in_msg[at++] = (char)next;
-			} else {
-				// We've overrun the internal buffer.  Additional characters
-				// read until a newline is encountered are dumped.
-				at++;
+			uint32_t at = tail & (SERIAL_TX_RING - 1);
+			uint32_t span = SERIAL_TX_RING - at;
+			if (span > pending) {
+				span = pending;
 			}
+			// Writers only append beyond head, so this span is stable.
+			uart_write_bytes(SERIAL_UART, serial_system.ring + at, span);
+
+			xSemaphoreTake(serial_system.write_lock, portMAX_DELAY);
+			serial_system.tail = tail + span;
+			xEventGroupSetBits(serial_system.write_events, SERIAL_TX_SPACE);
+			xSemaphoreGive(serial_system.write_lock);
+		}
+	}
+}
+
+// Waits up to TIMEOUT for TOTAL bytes of room in the ring, so that a line
+// or frame always goes out whole.
+// Post: 0 with the write lock held if there is room, otherwise -1 and
+//       the bytes have been counted as dropped.
+static int serial_ring_reserve(size_t total, TickType_t timeout) {
+	if (serial_system.write_lock == NULL) { return -1; }
+
+	TickType_t start = xTaskGetTickCount();
+	while (1) {
+		xSemaphoreTake(serial_system.write_lock, portMAX_DELAY);
+		if (total <= SERIAL_TX_RING - (serial_system.head - serial_system.tail)) {
+			return 0;
 		}
 
-		// We've caught an input terminator, and the input message is done.
-		if (done) {
-			xQueueSend(serial_system.queue_read, in_msg, 0);
-			memset(in_msg, 0, MSG_BUFFER_LENGTH);
+		TickType_t waited = xTaskGetTickCount() - start;
+		if (waited >= timeout) {
+			serial_system.dropped += total;
+			xSemaphoreGive(serial_system.write_lock);
+			return -1;
+		}
+
+		// The TX task sets the bit under the lock, so clearing it here
+		// cannot lose a wake-up.
+		xEventGroupClearBits(serial_system.write_events, SERIAL_TX_SPACE);
+		xSemaphoreGive(serial_system.write_lock);
+		xEventGroupWaitBits(serial_system.write_events, SERIAL_TX_SPACE,
+			pdFALSE, pdFALSE, timeout - waited);
+	}
+}
+
+// Pre: the write lock is held and there is room.
+static void serial_ring_put(uint8_t c) {
+	serial_system.ring[serial_system.head++ & (SERIAL_TX_RING - 1)] = c;
+}
+
+// Releases the write lock and wakes the TX task.
+static void serial_ring_commit(void) {
+	xSemaphoreGive(serial_system.write_lock);
+	if (serial_system.service_tx) {
+		xTaskNotifyGive(serial_system.service_tx);
+	}
+}
+
+static size_t slip_size(const uint8_t* data, size_t length) {
+	size_t n = length;
+	for (size_t i = 0; i < length; ++i) {
+		n += (data[i] == SLIP_END || data[i] == SLIP_ESC);
+	}
+	return n;
+}
 
-			done = 0;
-			at = 0;
+// Pre: the write lock is held and there is room.
+static void slip_put(const uint8_t* data, size_t length) {
+	for (size_t i = 0; i < length; ++i) {
+		if (data[i] == SLIP_END) {
+			serial_ring_put(SLIP_ESC);
+			serial_ring_put(SLIP_ESC_END);
+		} else if (data[i] == SLIP_ESC) {
+			serial_ring_put(SLIP_ESC);
+			serial_ring_put(SLIP_ESC_ESC);
+		} else {
+			serial_ring_put(data[i]);
 		}
 	}
 }
 
+// ESP_LOG output while in binary mode, sent as text frames.
+static int serial_log_vprintf(const char* format, va_list args) {
+	char buffer[MSG_BUFFER_LENGTH * 2];
+	int n = vsnprintf(buffer, sizeof(buffer), format, args);
+	if (n < 0) {
+		return n;
+	}
+	size_t len = strnlen(buffer, sizeof(buffer));
+	while (len > 0 && (buffer[len - 1] == '\n' || buffer[len - 1] == '\r')) {
+		len--;
+	}
+	if (len > 0) {
+		serial_write_frame(SERIAL_FRAME_TEXT, buffer, len, 0);
+	}
+	return n;
+}
+
 
 // Serial IO function implementations.
 
 // Writes a string to the serial output.  Non-blocking.
 void serial_write_line(const char* string) {
+	serial_write_line_timeout(string, 0);
+}
+
+// Writes a string to the serial output, waiting up to TIMEOUT for room.
+// In binary mode the string goes out as a text frame.
+int serial_write_line_timeout(const char* string, TickType_t timeout) {
 	// Pre-condition: Input string may not be NULL.
-	if (string == NULL) { return; }
+	if (string == NULL) { return -1; }
 
-	char msg_buffer[MSG_BUFFER_LENGTH];
-	memset(msg_buffer, 0, MSG_BUFFER_LENGTH);
-	int len = strlen(string);
-	len = (len > (MSG_BUFFER_LENGTH - 2) ? MSG_BUFFER_LENGTH - 2 : len);
-	strncpy(msg_buffer, string, len);
-	msg_buffer[len] = '\0';
+	size_t len = strlen(string);
+	if (serial_system.frame_handler) {
+		return serial_write_frame(SERIAL_FRAME_TEXT, string, len, timeout);
+	}
+
+	// Add a newline unless the line is a prompt.
+	int newline = strncmp(string, PROMPT_TOKEN, 2) != 0;
+	if (serial_ring_reserve(len + (newline ? 2 : 0), timeout) != 0) {
+		return -1;
+	}
+	for (size_t i = 0; i < len; ++i) {
+		serial_ring_put((uint8_t)string[i]);
+	}
+	if (newline) {
+		serial_ring_put('\r');
+		serial_ring_put('\n');
+	}
+	serial_ring_commit();
+	return 0;
+}
+
+// Writes a SLIP frame of TYPE and BODY, waiting up to TIMEOUT for room.
+int serial_write_frame(uint8_t type, const void* body, size_t length, TickType_t timeout) {
+	if (body == NULL && length > 0) { return -1; }
+
+	// A leading END flushes out whatever noise preceded the frame.
+	size_t total = 2 + slip_size(&type, 1) + slip_size(body, length);
+	if (serial_ring_reserve(total, timeout) != 0) {
+		return -1;
+	}
+	serial_ring_put(SLIP_END);
+	slip_put(&type, 1);
+	slip_put(body, length);
+	serial_ring_put(SLIP_END);
+	serial_ring_commit();
+	return 0;
+}
+
+// Switches between text mode (HANDLER == NULL) and binary mode.
+void serial_set_binary(serial_frame_fn handler) {
+	if (handler && !serial_system.frame_handler) {
+		serial_system.text_vprintf = esp_log_set_vprintf(serial_log_vprintf);
+	} else if (!handler && serial_system.frame_handler) {
+		esp_log_set_vprintf(serial_system.text_vprintf);
+	}
+	serial_system.frame_handler = handler;
+}
+
+// Changes the line speed once pending output has gone out: the ring has
+// drained into the driver and the driver has sent it.  Writers wait on
+// the lock meanwhile, so nothing goes out at the wrong speed.
+int serial_set_baudrate(uint32_t baudrate) {
+	if (serial_system.write_lock == NULL) { return -1; }
+
+	TickType_t start = xTaskGetTickCount();
+	TickType_t timeout = pdMS_TO_TICKS(SERIAL_DRAIN_MS);
+	xSemaphoreTake(serial_system.write_lock, portMAX_DELAY);
+	while (serial_system.head != serial_system.tail) {
+		TickType_t waited = xTaskGetTickCount() - start;
+		if (waited >= timeout) {
+			xSemaphoreGive(serial_system.write_lock);
+			return -1;
+		}
+
+		// As in serial_ring_reserve, the TX task sets the bit under the lock.
+		xEventGroupClearBits(serial_system.write_events, SERIAL_TX_SPACE);
+		xSemaphoreGive(serial_system.write_lock);
+		xEventGroupWaitBits(serial_system.write_events, SERIAL_TX_SPACE,
+			pdFALSE, pdFALSE, timeout - waited);
+		xSemaphoreTake(serial_system.write_lock, portMAX_DELAY);
+	}
+
+	int result = -1;
+	if (uart_wait_tx_done(SERIAL_UART, timeout) == ESP_OK
+	    && uart_set_baudrate(SERIAL_UART, baudrate) == ESP_OK) {
+		result = 0;
+	}
+	xSemaphoreGive(serial_system.write_lock);
+	return result;
+}
+
+// Input frames discarded for bad framing since boot.
+uint32_t serial_bad_frames(void) {
+	return serial_system.frames_bad;
+}
 
-	xQueueSend(serial_system.queue_write, msg_buffer, 0);
+// Number of output bytes dropped for lack of room since boot.
+uint32_t serial_dropped_bytes(void) {
+	return serial_system.dropped;
 }
 
-// Blocking method, reads a string from serial input.
+// Blocking method, reads a string from serial input.  Sleeps until a
+// complete line has arrived.
 int serial_read_line(char* buffer) {
 	// Precondition: output buffer may not be NULL.
 	if (buffer == NULL) { return 0; }
 
-	if (xQueueReceive(serial_system.queue_read, buffer, timeout_read) == pdTRUE) {
+	if (xQueueReceive(serial_system.queue_read, buffer, portMAX_DELAY) == pdTRUE) {
 		return 0;
 	}
 
-	// No input, timed out.
 	return -1;
 }
@@ -0,0 +1,174 @@
+#include "dlog.h"
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define TAG "dlog"
+
+/*
+ * One bounded multi-producer ring per core.  A producer claims a
+ * position by CAS on head, fills the slot and then publishes it by
+ * storing position + 1 in the slot's sequence number.  The formatter is
+ * the only consumer; it takes slots in order and stops at one that is
+ * claimed but not yet published.  Tasks on the same core only contend
+ * when one preempts another in the middle of a record.
+ */
+
+typedef struct
+{
+	atomic_uint_least32_t sequence;
+	const dlog_format_t* format;
+	int64_t timestamp;
+	uint8_t n;
+	int32_t args[DLOG_MAX_ARGS];
+} dlog_record_t;
+
+typedef struct
+{
+	atomic_uint_least32_t head;
+	atomic_uint_least32_t tail;
+	atomic_uint_least32_t recorded;
+	atomic_uint_least32_t dropped;
+	dlog_record_t slots[DLOG_RING];
+} dlog_ring_t;
+
+esp_log_level_t dlog_level = ESP_LOG_INFO;
+
+static dlog_ring_t rings[portNUM_PROCESSORS];
+static TaskHandle_t formatter;
+
+static void dlog_main(void* arg);
+
+static void dlog_start(void)
+{
+	static atomic_flag started = ATOMIC_FLAG_INIT;
+	if (atomic_flag_test_and_set(&started))
+		return;
+	xTaskCreate(dlog_main, "dlog", 3072, NULL, DLOG_PRIO, &formatter);
+}
+
+void dlog_write(const dlog_format_t* format, int n, ...)
+{
+	if (!formatter)
+		dlog_start();
+
+	int core = xPortGetCoreID();
+	dlog_ring_t* ring = &rings[core < portNUM_PROCESSORS ? core : 0];
+
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	do
+		{
+			uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+			if (head - tail >= DLOG_RING)
+				{
+					atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+					return;
+				}
+		}
+	while (!atomic_compare_exchange_weak_explicit(&ring->head, &head, head + 1,
+	                                              memory_order_relaxed, memory_order_relaxed));
+
+	dlog_record_t* slot = &ring->slots[head & (DLOG_RING - 1)];
+	slot->format = format;
+	slot->timestamp = esp_timer_get_time();
+	slot->n = n;
+
+	va_list args;
+	va_start(args, n);
+	for (int i = 0; i < n && i < DLOG_MAX_ARGS; ++i)
+		slot->args[i] = va_arg(args, int32_t);
+	va_end(args);
+
+	atomic_store_explicit(&slot->sequence, head + 1, memory_order_release);
+	atomic_fetch_add_explicit(&ring->recorded, 1, memory_order_relaxed);
+
+	// Only the first record of a burst wakes the formatter.
+	if (head == atomic_load_explicit(&ring->tail, memory_order_relaxed) && formatter)
+		xTaskNotifyGive(formatter);
+}
+
+dlog_stats_t dlog_stats(void)
+{
+	dlog_stats_t stats = {0};
+	for (int i = 0; i < portNUM_PROCESSORS; ++i)
+		{
+			stats.recorded += atomic_load(&rings[i].recorded);
+			stats.dropped += atomic_load(&rings[i].dropped);
+		}
+	return stats;
+}
+
+// Value: The next published record of RING, NULL if there is none (yet)
+static dlog_record_t* dlog_peek(dlog_ring_t* ring)
+{
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	if (tail == atomic_load_explicit(&ring->head, memory_order_acquire))
+		return NULL;
+
+	dlog_record_t* slot = &ring->slots[tail & (DLOG_RING - 1)];
+	if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != tail + 1)
+		return NULL;
+	return slot;
+}
+
+static void dlog_emit(const dlog_record_t* record)
+{
+	static const char letters[] = "NEWIDV";
+	const dlog_format_t* format = record->format;
+	int32_t a[DLOG_MAX_ARGS] = {0};
+	memcpy(a, record->args, record->n * sizeof a[0]);
+
+	char message[160];
+	snprintf(message, sizeof message, format->format, a[0], a[1], a[2], a[3]);
+	esp_log_write(format->level, format->tag, "%c (%lu) %s: %s\n",
+	              letters[format->level], (unsigned long)(record->timestamp / 1000),
+	              format->tag, message);
+}
+
+// Drains the rings in time stamp order, then sleeps until the next burst.
+static void dlog_main(void* arg)
+{
+	uint32_t reported = 0;
+	while (true)
+		{
+			bool pending = false;
+			while (true)
+				{
+					dlog_ring_t* next = NULL;
+					dlog_record_t* record = NULL;
+					for (int i = 0; i < portNUM_PROCESSORS; ++i)
+						{
+							dlog_record_t* r = dlog_peek(&rings[i]);
+							if (r && (!record || r->timestamp < record->timestamp))
+								{
+									next = &rings[i];
+									record = r;
+								}
+							// A claimed but unpublished slot, look again shortly.
+							if (!r && atomic_load(&rings[i].head) != atomic_load(&rings[i].tail))
+								pending = true;
+						}
+					if (!record)
+						break;
+
+					dlog_emit(record);
+					atomic_fetch_add_explicit(&next->tail, 1, memory_order_release);
+				}
+
+			uint32_t dropped = dlog_stats().dropped;
+			if (dropped != reported)
+				{
+					ESP_LOGW(TAG, "%lu records dropped", (unsigned long)(dropped - reported));
+					reported = dropped;
+				}
+
+			ulTaskNotifyTake(pdTRUE, pending ? 1 : portMAX_DELAY);
+		}
+}
@@ -0,0 +1,64 @@
+#ifndef GUARD_DLOG_H
+#define GUARD_DLOG_H
+
+#include <stdint.h>
+
+#include <esp_log.h>
+
+/*
+  Deferred logging for hot paths.  DLOGx records a pointer to a static
+  format descriptor, a time stamp and up to DLOG_MAX_ARGS integer
+  arguments into a per-core ring without locks; a low priority task
+  formats the records later and hands them to the ESP_LOG output.
+
+  Arguments are passed as int32_t, so formats may only use int sized
+  conversions (%d %u %x %c), never %s, %l or %f.  Call from tasks only,
+  not from interrupt handlers.
+ */
+
+#define DLOG_MAX_ARGS 4
+#define DLOG_RING     128 // records per core, power of two
+#define DLOG_PRIO     1
+
+typedef struct
+{
+	esp_log_level_t level;
+	const char* tag;
+	const char* format;
+} dlog_format_t;
+
+typedef struct
+{
+	uint32_t recorded; // records taken
+	uint32_t dropped;  // records lost to a full ring
+} dlog_stats_t;
+
+#define DLOG_NARGS(...) \
+	(sizeof((int32_t[]){ 0, ##__VA_ARGS__ }) / sizeof(int32_t) - 1)
+
+#define DLOG(level, tag, format, ...) \
+	do { \
+		static const dlog_format_t dlog_format_ = { (level), (tag), (format) }; \
+		_Static_assert(DLOG_NARGS(__VA_ARGS__) <= DLOG_MAX_ARGS, "too many DLOG arguments"); \
+		if ((level) <= dlog_level) \
+			dlog_write(&dlog_format_, DLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__); \
+	} while (0)
+
+#define DLOGE(tag, format, ...) DLOG(ESP_LOG_ERROR,   tag, format, ##__VA_ARGS__)
+#define DLOGW(tag, format, ...) DLOG(ESP_LOG_WARN,    tag, format, ##__VA_ARGS__)
+#define DLOGI(tag, format, ...) DLOG(ESP_LOG_INFO,    tag, format, ##__VA_ARGS__)
+#define DLOGD(tag, format, ...) DLOG(ESP_LOG_DEBUG,   tag, format, ##__VA_ARGS__)
+
+// Records above this level are not taken at all.
+extern esp_log_level_t dlog_level;
+
+// Usage: dlog_write(FORMAT, N, ...)
+// Pre:   FORMAT has static storage, N <= DLOG_MAX_ARGS int arguments follow
+// Post:  The record is queued for the formatter, or counted as dropped
+void dlog_write(const dlog_format_t* format, int n, ...);
+
+// Usage: dlog_stats()
+// Value: Record and drop counts, summed over all cores
+dlog_stats_t dlog_stats(void);
+
+#endif